@@ -4,6 +4,7 @@
 #include <GL/glew.h>
 #include <glm.hpp>
 #include <gtc/matrix_transform.hpp>
+#include <Frustum.h>
 
 #include <vector>
 
@@ -21,9 +22,15 @@ const float PITCH       =  0.0f;
 const float SPEED       =  2.5f;
 const float SENSITIVITY =  0.1f;
 const float ZOOM        =  45.0f;
+const float ASPECT_RATIO = 4.0f / 3.0f;
+const float NEAR_PLANE  =  0.1f;
+const float FAR_PLANE   =  100.0f;
 
 
-// An abstract camera class that processes input and calculates the corresponding Euler Angles, Vectors and Matrices for use in OpenGL
+// An abstract camera class that processes input and calculates the corresponding Euler Angles, Vectors and Matrices for use in OpenGL.
+// Mouse input only adds up until Update applies it once per frame, and the matrices and frustum planes are kept until the
+// camera changes, the version telling whoever derived something from them whether it is still current. The attributes are
+// changed through the functions below, which keep track of that
 class Camera
 {
 public:
@@ -40,9 +47,13 @@ public:
     float MovementSpeed;
     float MouseSensitivity;
     float Zoom;
+    // perspective, Zoom being the vertical field of view
+    float AspectRatio;
+    float NearPlane;
+    float FarPlane;
 
     // constructor with vectors
-    Camera(glm::vec3 position = glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f), float yaw = YAW, float pitch = PITCH) : Front(glm::vec3(0.0f, 0.0f, -1.0f)), MovementSpeed(SPEED), MouseSensitivity(SENSITIVITY), Zoom(ZOOM)
+    Camera(glm::vec3 position = glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f), float yaw = YAW, float pitch = PITCH) : Front(glm::vec3(0.0f, 0.0f, -1.0f)), MovementSpeed(SPEED), MouseSensitivity(SENSITIVITY), Zoom(ZOOM), AspectRatio(ASPECT_RATIO), NearPlane(NEAR_PLANE), FarPlane(FAR_PLANE)
     {
         Position = position;
         WorldUp = up;
@@ -51,7 +62,7 @@ public:
         updateCameraVectors();
     }
     // constructor with scalar values
-    Camera(float posX, float posY, float posZ, float upX, float upY, float upZ, float yaw, float pitch) : Front(glm::vec3(0.0f, 0.0f, -1.0f)), MovementSpeed(SPEED), MouseSensitivity(SENSITIVITY), Zoom(ZOOM)
+    Camera(float posX, float posY, float posZ, float upX, float upY, float upZ, float yaw, float pitch) : Front(glm::vec3(0.0f, 0.0f, -1.0f)), MovementSpeed(SPEED), MouseSensitivity(SENSITIVITY), Zoom(ZOOM), AspectRatio(ASPECT_RATIO), NearPlane(NEAR_PLANE), FarPlane(FAR_PLANE)
     {
         Position = glm::vec3(posX, posY, posZ);
         WorldUp = glm::vec3(upX, upY, upZ);
@@ -61,9 +72,105 @@ public:
     }
 
     // returns the view matrix calculated using Euler Angles and the LookAt Matrix
-    glm::mat4 GetViewMatrix()
+    const glm::mat4& GetViewMatrix()
     {
-        return glm::lookAt(Position, Position + Front, Up);
+        if (viewDirty)
+        {
+            view = glm::lookAt(Position, Position + Front, Up);
+            viewDirty = false;
+        }
+        return view;
+    }
+
+    const glm::mat4& GetProjectionMatrix()
+    {
+        if (projectionDirty)
+        {
+            projection = glm::perspective(glm::radians(Zoom), AspectRatio, NearPlane, FarPlane);
+            projectionDirty = false;
+        }
+        return projection;
+    }
+
+    const glm::mat4& GetViewProjectionMatrix()
+    {
+        if (viewProjectionDirty)
+        {
+            viewProjection = GetProjectionMatrix() * GetViewMatrix();
+            viewProjectionDirty = false;
+        }
+        return viewProjection;
+    }
+
+    const frustum& GetFrustum()
+    {
+        if (frustumDirty)
+        {
+            viewFrustum = extract_frustum(GetViewProjectionMatrix());
+            frustumDirty = false;
+        }
+        return viewFrustum;
+    }
+
+    // goes up every time the view or the projection changes
+    unsigned int GetVersion() const
+    {
+        return version;
+    }
+
+    void SetPerspective(float aspectRatio, float nearPlane, float farPlane)
+    {
+        if (aspectRatio == AspectRatio && nearPlane == NearPlane && farPlane == FarPlane)
+            return;
+
+        AspectRatio = aspectRatio;
+        NearPlane = nearPlane;
+        FarPlane = farPlane;
+        changed(false, true);
+    }
+
+    // applies the mouse and scroll-wheel input received since the last call, the trigonometry of the new orientation done
+    // once however many events there were. Call once per frame before the camera is used
+    void Update()
+    {
+        if (pendingYaw != 0.0f || pendingPitch != 0.0f)
+        {
+            const float yaw = Yaw;
+            const float pitch = Pitch;
+            Yaw   += pendingYaw;
+            Pitch += pendingPitch;
+            pendingYaw = 0.0f;
+            pendingPitch = 0.0f;
+
+            // make sure that when pitch is out of bounds, screen doesn't get flipped
+            if (constrainPitch)
+            {
+                if (Pitch > 89.0f)
+                    Pitch = 89.0f;
+                if (Pitch < -89.0f)
+                    Pitch = -89.0f;
+            }
+
+            // update Front, Right and Up Vectors using the updated Euler angles
+            if (Yaw != yaw || Pitch != pitch)
+            {
+                updateCameraVectors();
+                changed(true, false);
+            }
+        }
+
+        if (pendingZoom != 0.0f)
+        {
+            const float zoom = Zoom;
+            Zoom -= pendingZoom;
+            pendingZoom = 0.0f;
+            if (Zoom < 1.0f)
+                Zoom = 1.0f;
+            if (Zoom > 45.0f)
+                Zoom = 45.0f;
+            if (Zoom != zoom)
+                changed(false, true);
+        }
     }
 
     // processes input received from any keyboard-like input system. Accepts input parameter in the form of camera defined ENUM (to abstract it from windowing systems)
@@ -78,41 +185,52 @@ public:
             Position -= Right * velocity;
         if (direction == RIGHT)
             Position += Right * velocity;
+        if (velocity != 0.0f)
+            changed(true, false);
     }
 
     // processes input received from a mouse input system. Expects the offset value in both the x and y direction.
+    // The offsets are added up for Update
     void ProcessMouseMovement(float xoffset, float yoffset, GLboolean constrainPitch = true)
     {
-        xoffset *= MouseSensitivity;
-        yoffset *= MouseSensitivity;
-
-        Yaw   += xoffset;
-        Pitch += yoffset;
-
-        // make sure that when pitch is out of bounds, screen doesn't get flipped
-        if (constrainPitch)
-        {
-            if (Pitch > 89.0f)
-                Pitch = 89.0f;
-            if (Pitch < -89.0f)
-                Pitch = -89.0f;
-        }
-
-        // update Front, Right and Up Vectors using the updated Euler angles
-        updateCameraVectors();
+        pendingYaw   += xoffset * MouseSensitivity;
+        pendingPitch += yoffset * MouseSensitivity;
+        this->constrainPitch = constrainPitch != GL_FALSE;
     }
 
     // processes input received from a mouse scroll-wheel event. Only requires input on the vertical wheel-axis
     void ProcessMouseScroll(float yoffset)
     {
-        Zoom -= (float)yoffset;
-        if (Zoom < 1.0f)
-            Zoom = 1.0f;
-        if (Zoom > 45.0f)
-            Zoom = 45.0f;
+        pendingZoom += yoffset;
     }
 
 private:
+    // input waiting for Update
+    float pendingYaw = 0.0f;
+    float pendingPitch = 0.0f;
+    float pendingZoom = 0.0f;
+    bool constrainPitch = true;
+
+    // what was computed from the attributes, and whether they changed since
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::mat4 viewProjection;
+    frustum viewFrustum;
+    bool viewDirty = true;
+    bool projectionDirty = true;
+    bool viewProjectionDirty = true;
+    bool frustumDirty = true;
+    unsigned int version = 1;
+
+    void changed(bool viewChanged, bool projectionChanged)
+    {
+        viewDirty = viewDirty || viewChanged;
+        projectionDirty = projectionDirty || projectionChanged;
+        viewProjectionDirty = true;
+        frustumDirty = true;
+        version++;
+    }
+
     // calculates the front vector from the Camera's (updated) Euler Angles
     void updateCameraVectors()
     {
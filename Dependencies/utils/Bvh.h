@@ -0,0 +1,345 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <glm.hpp>
+#include <Frustum.h>
+#include <Culling.h>
+
+#include <cfloat>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// a node covers the primitives indices[first, first + count). Primitives of a subtree are always
+// contiguous, so a subtree that is fully inside the frustum is accepted by copying its range
+typedef struct
+{
+	glm::vec3 min;
+	glm::vec3 max;
+	int left; // -1 for leaves, the right child is always left + 1
+	int parent;
+	uint32_t first;
+	uint32_t count;
+} bvh_node;
+
+typedef struct
+{
+	std::vector<bvh_node> nodes;
+	std::vector<uint32_t> indices; // primitive index for every slot, grouped by subtree
+	std::vector<int> leaf_of; // leaf node holding each primitive, used by refit
+} bvh;
+
+const int bvh_bins = 16;
+const uint32_t bvh_leaf_size = 4;
+
+inline glm::vec3 bvh_primitive_min(const cull_set& set, const uint32_t i)
+{
+	return glm::vec3(set.center_x[i] - set.extent_x[i], set.center_y[i] - set.extent_y[i], set.center_z[i] - set.extent_z[i]);
+}
+
+inline glm::vec3 bvh_primitive_max(const cull_set& set, const uint32_t i)
+{
+	return glm::vec3(set.center_x[i] + set.extent_x[i], set.center_y[i] + set.extent_y[i], set.center_z[i] + set.extent_z[i]);
+}
+
+inline float bvh_area(const glm::vec3& min, const glm::vec3& max)
+{
+	const auto size = glm::max(max - min, glm::vec3(0.0f));
+	return size.x * size.y + size.y * size.z + size.z * size.x;
+}
+
+inline void bvh_fit_node(bvh& tree, const cull_set& set, bvh_node& node)
+{
+	node.min = glm::vec3(FLT_MAX);
+	node.max = glm::vec3(-FLT_MAX);
+	for (auto i = node.first; i < node.first + node.count; i++)
+	{
+		node.min = glm::min(node.min, bvh_primitive_min(set, tree.indices[i]));
+		node.max = glm::max(node.max, bvh_primitive_max(set, tree.indices[i]));
+	}
+}
+
+// top-down build splitting every node at the cheapest of bvh_bins centroid planes per axis (binned SAH)
+inline void build_bvh(bvh& tree, const cull_set& set)
+{
+	const auto count = static_cast<uint32_t>(set.center_x.size());
+	tree.nodes.clear();
+	tree.indices.resize(count);
+	tree.leaf_of.assign(count, -1);
+	for (uint32_t i = 0; i < count; i++)
+		tree.indices[i] = i;
+
+	if (count == 0)
+		return;
+
+	// primitive boxes and centroids are read many times per level, so they are unpacked once per slot
+	// and swapped together with the indices, keeping every pass over a node a linear walk
+	std::vector<glm::vec3> primitive_min(count), primitive_max(count), centroids(count);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		primitive_min[i] = bvh_primitive_min(set, i);
+		primitive_max[i] = bvh_primitive_max(set, i);
+		centroids[i] = glm::vec3(set.center_x[i], set.center_y[i], set.center_z[i]);
+	}
+
+	tree.nodes.reserve(count / bvh_leaf_size * 2 + 1);
+	tree.nodes.push_back(bvh_node{ glm::vec3(0.0f), glm::vec3(0.0f), -1, -1, 0, count });
+	bvh_fit_node(tree, set, tree.nodes[0]);
+
+	std::vector<int> stack = { 0 };
+	while (!stack.empty())
+	{
+		const auto node_index = stack.back();
+		stack.pop_back();
+		const auto node = tree.nodes[node_index];
+
+		auto make_leaf = node.count <= bvh_leaf_size;
+
+		// bin the centroids along every axis and keep the split with the lowest surface area cost
+		auto best_axis = -1, best_split = 0;
+		auto best_cost = bvh_area(node.min, node.max) * node.count;
+		glm::vec3 best_left_min, best_left_max, best_right_min, best_right_max;
+		glm::vec3 centroid_min(FLT_MAX), centroid_max(-FLT_MAX);
+		for (auto i = node.first; i < node.first + node.count && !make_leaf; i++)
+		{
+			centroid_min = glm::min(centroid_min, centroids[i]);
+			centroid_max = glm::max(centroid_max, centroids[i]);
+		}
+
+		for (auto axis = 0; axis < 3 && !make_leaf; axis++)
+		{
+			const auto extent = centroid_max[axis] - centroid_min[axis];
+			if (extent <= 0.0f)
+				continue;
+
+			glm::vec3 bin_min[bvh_bins], bin_max[bvh_bins];
+			uint32_t bin_count[bvh_bins] = {};
+			for (auto b = 0; b < bvh_bins; b++)
+			{
+				bin_min[b] = glm::vec3(FLT_MAX);
+				bin_max[b] = glm::vec3(-FLT_MAX);
+			}
+
+			const auto scale = bvh_bins / extent;
+			for (auto i = node.first; i < node.first + node.count; i++)
+			{
+				const auto bin = glm::min(bvh_bins - 1, static_cast<int>((centroids[i][axis] - centroid_min[axis]) * scale));
+				bin_count[bin]++;
+				bin_min[bin] = glm::min(bin_min[bin], primitive_min[i]);
+				bin_max[bin] = glm::max(bin_max[bin], primitive_max[i]);
+			}
+
+			// sweep from the right to get the cost of everything past each split plane
+			glm::vec3 right_min[bvh_bins], right_max[bvh_bins];
+			uint32_t right_count[bvh_bins];
+			glm::vec3 sweep_min(FLT_MAX), sweep_max(-FLT_MAX);
+			uint32_t sweep_count = 0;
+			for (auto b = bvh_bins - 1; b > 0; b--)
+			{
+				sweep_min = glm::min(sweep_min, bin_min[b]);
+				sweep_max = glm::max(sweep_max, bin_max[b]);
+				sweep_count += bin_count[b];
+				right_min[b] = sweep_min;
+				right_max[b] = sweep_max;
+				right_count[b] = sweep_count;
+			}
+
+			sweep_min = glm::vec3(FLT_MAX);
+			sweep_max = glm::vec3(-FLT_MAX);
+			sweep_count = 0;
+			for (auto b = 0; b < bvh_bins - 1; b++)
+			{
+				sweep_min = glm::min(sweep_min, bin_min[b]);
+				sweep_max = glm::max(sweep_max, bin_max[b]);
+				sweep_count += bin_count[b];
+				if (sweep_count == 0 || right_count[b + 1] == 0)
+					continue;
+
+				const auto cost = bvh_area(sweep_min, sweep_max) * sweep_count + bvh_area(right_min[b + 1], right_max[b + 1]) * right_count[b + 1];
+				if (cost < best_cost)
+				{
+					best_cost = cost;
+					best_axis = axis;
+					best_split = b + 1;
+					best_left_min = sweep_min;
+					best_left_max = sweep_max;
+					best_right_min = right_min[b + 1];
+					best_right_max = right_max[b + 1];
+				}
+			}
+		}
+
+		if (make_leaf || best_axis < 0)
+		{
+			for (auto i = node.first; i < node.first + node.count; i++)
+				tree.leaf_of[tree.indices[i]] = node_index;
+			continue;
+		}
+
+		// partition the slots so the left child's primitives come first
+		const auto scale = bvh_bins / (centroid_max[best_axis] - centroid_min[best_axis]);
+		auto middle = node.first;
+		for (auto i = node.first; i < node.first + node.count; i++)
+		{
+			const auto bin = glm::min(bvh_bins - 1, static_cast<int>((centroids[i][best_axis] - centroid_min[best_axis]) * scale));
+			if (bin < best_split)
+			{
+				std::swap(tree.indices[i], tree.indices[middle]);
+				std::swap(primitive_min[i], primitive_min[middle]);
+				std::swap(primitive_max[i], primitive_max[middle]);
+				std::swap(centroids[i], centroids[middle]);
+				middle++;
+			}
+		}
+
+		const auto left = static_cast<int>(tree.nodes.size());
+		tree.nodes.push_back(bvh_node{ best_left_min, best_left_max, -1, node_index, node.first, middle - node.first });
+		tree.nodes.push_back(bvh_node{ best_right_min, best_right_max, -1, node_index, middle, node.first + node.count - middle });
+		tree.nodes[node_index].left = left;
+
+		stack.push_back(left);
+		stack.push_back(left + 1);
+	}
+}
+
+// refits the nodes above a primitive whose bounds changed, stopping as soon as a node no longer changes
+inline void refit_bvh(bvh& tree, const cull_set& set, const uint32_t primitive)
+{
+	auto node_index = tree.leaf_of[primitive];
+	while (node_index >= 0)
+	{
+		auto& node = tree.nodes[node_index];
+		const auto old_min = node.min;
+		const auto old_max = node.max;
+
+		if (node.left < 0)
+		{
+			bvh_fit_node(tree, set, node);
+		}
+		else
+		{
+			node.min = glm::min(tree.nodes[node.left].min, tree.nodes[node.left + 1].min);
+			node.max = glm::max(tree.nodes[node.left].max, tree.nodes[node.left + 1].max);
+		}
+
+		if (node.min == old_min && node.max == old_max)
+			break;
+		node_index = node.parent;
+	}
+}
+
+// nodes at most depth levels below the root, each one an independent culling task
+inline std::vector<int> bvh_subtrees(const bvh& tree, const int depth)
+{
+	std::vector<int> subtrees;
+	if (tree.nodes.empty())
+		return subtrees;
+
+	subtrees.push_back(0);
+	for (auto level = 0; level < depth; level++)
+	{
+		std::vector<int> next;
+		for (const auto node : subtrees)
+		{
+			if (tree.nodes[node].left < 0)
+			{
+				next.push_back(node);
+			}
+			else
+			{
+				next.push_back(tree.nodes[node].left);
+				next.push_back(tree.nodes[node].left + 1);
+			}
+		}
+		subtrees.swap(next);
+	}
+
+	return subtrees;
+}
+
+// culls the subtree below root. Planes a node is fully inside of are dropped for its children, and a node
+// inside all of them accepts its whole primitive range untested. Visible primitives are written to visible
+// starting at the subtree's first slot, so subtrees can be culled in parallel into the same array
+inline uint32_t cull_bvh(const bvh& tree, const cull_set& set, const frustum& frustum, const int root, uint32_t* visible)
+{
+	if (tree.nodes.empty())
+		return 0;
+
+	auto* output = visible + tree.nodes[root].first;
+	uint32_t count = 0;
+
+	typedef struct
+	{
+		int node;
+		int planes; // bit per plane that still has to be tested
+	} bvh_visit;
+
+	bvh_visit stack[64];
+	auto top = 0;
+	stack[top++] = bvh_visit{ root, 0x3f };
+
+	while (top > 0)
+	{
+		const auto visit = stack[--top];
+		const auto& node = tree.nodes[visit.node];
+
+		const auto center = (node.min + node.max) * 0.5f;
+		const auto extent = (node.max - node.min) * 0.5f;
+		auto planes = visit.planes;
+		auto outside = false;
+		for (auto p = 0; p < 6 && !outside; p++)
+		{
+			if ((planes & (1 << p)) == 0)
+				continue;
+
+			const auto& plane = frustum.planes[p];
+			const auto distance = glm::dot(glm::vec3(plane), center) + plane.w;
+			const auto radius = glm::dot(glm::abs(glm::vec3(plane)), extent);
+			if (distance + radius < 0.0f)
+				outside = true;
+			else if (distance - radius >= 0.0f)
+				planes &= ~(1 << p);
+		}
+
+		if (outside)
+			continue;
+
+		if (planes == 0)
+		{
+			for (auto i = node.first; i < node.first + node.count; i++)
+				output[count++] = tree.indices[i];
+		}
+		else if (node.left < 0)
+		{
+			for (auto i = node.first; i < node.first + node.count; i++)
+			{
+				const auto p = tree.indices[i];
+				const glm::vec3 primitive_center(set.center_x[p], set.center_y[p], set.center_z[p]);
+				const glm::vec3 primitive_extent(set.extent_x[p], set.extent_y[p], set.extent_z[p]);
+				output[count] = p;
+				count += box_in_frustum(frustum, primitive_center, primitive_extent) ? 1 : 0;
+			}
+		}
+		else if (top + 2 <= 64)
+		{
+			stack[top++] = bvh_visit{ node.left + 1, planes };
+			stack[top++] = bvh_visit{ node.left, planes };
+		}
+		else
+		{
+			// deeper than the stack allows, fall back to testing the primitives one by one
+			for (auto i = node.first; i < node.first + node.count; i++)
+			{
+				const auto p = tree.indices[i];
+				const glm::vec3 primitive_center(set.center_x[p], set.center_y[p], set.center_z[p]);
+				const glm::vec3 primitive_extent(set.extent_x[p], set.extent_y[p], set.extent_z[p]);
+				output[count] = p;
+				count += box_in_frustum(frustum, primitive_center, primitive_extent) ? 1 : 0;
+			}
+		}
+	}
+
+	return count;
+}
+
+#endif
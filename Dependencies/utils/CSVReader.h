@@ -1,50 +1,178 @@
+#ifndef CSV_READER_H
+#define CSV_READER_H
+
+#include <CpuFeatures.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
 #include <fstream>
+#include <stdexcept>
 #include <string>
-#include <sstream>
 #include <vector>
 
-static std::vector<float> read_csv_file(std::string fileName)
+// the files are numbers separated by ';', spaces and tabs. The separators of a whole file are found
+// first, one bit for every byte, 64 bytes to a word with a variant of the kernel for each SIMD level, so
+// the tokenizer jumps from number to number instead of looking at every byte
+inline bool is_csv_separator(const char c)
 {
-	std::vector<float> vector;
-
-	// Create an input filestream
-	std::ifstream fileStream(fileName);
+	return c == ';' || c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
 
-	// Make sure the file is open
-	if (!fileStream.is_open()) throw std::runtime_error("Could not open file");
+// fills bits for size bytes of data, starting on a word of its own
+inline void csv_separators_scalar(const char* data, const size_t size, uint64_t* bits)
+{
+	for (size_t word = 0; word * 64 < size; word++)
+	{
+		uint64_t mask = 0;
+		for (size_t i = word * 64; i < size && i < word * 64 + 64; i++)
+			mask |= static_cast<uint64_t>(is_csv_separator(data[i])) << (i - word * 64);
+		bits[word] = mask;
+	}
+}
 
-	std::string line, colName;
-	float val;
+#ifdef SIMD_X86
+SIMD_TARGET("ssse3,sse4.1") inline void csv_separators_sse4(const char* data, const size_t size, uint64_t* bits)
+{
+	const auto semicolon = _mm_set1_epi8(';'), space = _mm_set1_epi8(' '), tab = _mm_set1_epi8('\t');
+	const auto newline = _mm_set1_epi8('\n'), carriage_return = _mm_set1_epi8('\r');
+	size_t word = 0;
+	for (; word * 64 + 64 <= size; word++)
+	{
+		uint64_t mask = 0;
+		for (auto part = 0; part < 4; part++)
+		{
+			const auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + word * 64 + part * 16));
+			auto separators = _mm_or_si128(_mm_cmpeq_epi8(bytes, semicolon), _mm_cmpeq_epi8(bytes, space));
+			separators = _mm_or_si128(separators, _mm_or_si128(_mm_cmpeq_epi8(bytes, tab), _mm_cmpeq_epi8(bytes, newline)));
+			separators = _mm_or_si128(separators, _mm_cmpeq_epi8(bytes, carriage_return));
+			mask |= static_cast<uint64_t>(static_cast<uint32_t>(_mm_movemask_epi8(separators))) << (part * 16);
+		}
+		bits[word] = mask;
+	}
+	csv_separators_scalar(data + word * 64, size - word * 64, bits + word);
+}
 
-	if (fileStream.good())
+SIMD_TARGET("avx2") inline void csv_separators_avx2(const char* data, const size_t size, uint64_t* bits)
+{
+	const auto semicolon = _mm256_set1_epi8(';'), space = _mm256_set1_epi8(' '), tab = _mm256_set1_epi8('\t');
+	const auto newline = _mm256_set1_epi8('\n'), carriage_return = _mm256_set1_epi8('\r');
+	size_t word = 0;
+	for (; word * 64 + 64 <= size; word++)
 	{
-		std::stringstream ss(line);
+		uint64_t mask = 0;
+		for (auto part = 0; part < 2; part++)
+		{
+			const auto bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + word * 64 + part * 32));
+			auto separators = _mm256_or_si256(_mm256_cmpeq_epi8(bytes, semicolon), _mm256_cmpeq_epi8(bytes, space));
+			separators = _mm256_or_si256(separators, _mm256_or_si256(_mm256_cmpeq_epi8(bytes, tab), _mm256_cmpeq_epi8(bytes, newline)));
+			separators = _mm256_or_si256(separators, _mm256_cmpeq_epi8(bytes, carriage_return));
+			mask |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(separators))) << (part * 32);
+		}
+		bits[word] = mask;
 	}
+	_mm256_zeroupper();
+	csv_separators_scalar(data + word * 64, size - word * 64, bits + word);
+}
 
-	// Read data, line by line
-	while (std::getline(fileStream, line))
+// the compares give masks of their own, a whole word for every load
+SIMD_TARGET("avx512f,avx512bw,avx512dq,avx512vl") inline void csv_separators_avx512(const char* data, const size_t size, uint64_t* bits)
+{
+	const auto semicolon = _mm512_set1_epi8(';'), space = _mm512_set1_epi8(' '), tab = _mm512_set1_epi8('\t');
+	const auto newline = _mm512_set1_epi8('\n'), carriage_return = _mm512_set1_epi8('\r');
+	size_t word = 0;
+	for (; word * 64 + 64 <= size; word++)
 	{
-		// Create a stringstream of the current line
-		std::stringstream ss(line);
+		const auto bytes = _mm512_loadu_si512(data + word * 64);
+		bits[word] = _mm512_cmpeq_epi8_mask(bytes, semicolon) | _mm512_cmpeq_epi8_mask(bytes, space) | _mm512_cmpeq_epi8_mask(bytes, tab)
+			| _mm512_cmpeq_epi8_mask(bytes, newline) | _mm512_cmpeq_epi8_mask(bytes, carriage_return);
+	}
+	_mm256_zeroupper();
+	csv_separators_scalar(data + word * 64, size - word * 64, bits + word);
+}
+#endif
 
-		// Keep track of the current column index
-		int columnIndex = 0;
+// the separator bits of size bytes of data, (size + 63) / 64 words, with the variant for the active SIMD level
+inline void csv_separators(const char* data, const size_t size, uint64_t* bits)
+{
+#ifdef SIMD_X86
+	typedef void (*kernel)(const char*, size_t, uint64_t*);
+	static const kernel variants[simd_level_count] = { csv_separators_scalar, csv_separators_sse4, csv_separators_avx2, csv_separators_avx512 };
+	dispatch_kernel(kernel_csv_separators, variants)(data, size, bits);
+#else
+	csv_separators_scalar(data, size, bits);
+#endif
+}
 
-		// Extract each integer
-		while (ss >> val) 
+// the first position from position on whose bit is separator, size when there is none
+inline size_t next_csv_position(const std::vector<uint64_t>& bits, const size_t size, size_t position, const bool separator)
+{
+	while (position < size)
+	{
+		const auto word = separator ? bits[position / 64] : ~bits[position / 64];
+		const auto rest = word >> (position % 64);
+		if (rest != 0)
 		{
-			// Add the current integer to the 'colIdx' column's values vector
-			vector.push_back(val);
-
-			// If the next token is a comma, ignore it and move on
-			if (ss.peek() == ';') ss.ignore();
-
-			// Increment the column index
-			columnIndex++;
+#ifdef _MSC_VER
+			unsigned long bit;
+			_BitScanForward64(&bit, rest);
+#else
+			const auto bit = __builtin_ctzll(rest);
+#endif
+			return std::min(position + bit, size);
 		}
+		position = (position / 64 + 1) * 64;
 	}
+	return size;
+}
+
+// the numbers of a file in order. A token that is no number ends its line, like a stream read fails on it
+static std::vector<float> read_csv_file(std::string fileName)
+{
+	std::ifstream fileStream(fileName, std::ios::binary);
 
+	// Make sure the file is open
+	if (!fileStream.is_open()) throw std::runtime_error("Could not open file");
+
+	// the whole file at once, null terminated so the last number ends
+	fileStream.seekg(0, std::ios::end);
+	std::string data(static_cast<size_t>(fileStream.tellg()), '\0');
+	fileStream.seekg(0, std::ios::beg);
+	fileStream.read(&data[0], static_cast<std::streamsize>(data.size()));
 	fileStream.close();
 
+	const auto size = data.size();
+	std::vector<uint64_t> bits((size + 63) / 64);
+	csv_separators(data.c_str(), size, bits.data());
+
+	std::vector<float> vector;
+	vector.reserve(size / 4);
+
+	auto position = next_csv_position(bits, size, 0, false);
+	while (position < size)
+	{
+		const auto token_end = next_csv_position(bits, size, position, true);
+		char* number_end;
+		const auto value = std::strtof(data.c_str() + position, &number_end);
+		const auto parsed = static_cast<size_t>(number_end - data.c_str());
+
+		if (parsed > position)
+			vector.push_back(value);
+
+		if (parsed != token_end)
+		{
+			const auto line_end = data.find('\n', position);
+			if (line_end == std::string::npos)
+				break;
+			position = line_end;
+		}
+		else
+			position = token_end;
+
+		position = next_csv_position(bits, size, position, false);
+	}
+
 	return vector;
-}
\ No newline at end of file
+}
+
+#endif
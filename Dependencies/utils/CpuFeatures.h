@@ -0,0 +1,261 @@
+#ifndef CPU_FEATURES_H
+#define CPU_FEATURES_H
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+// GCC and Clang only compile the intrinsics of an instruction set into functions marked for it, MSVC
+// compiles them anywhere. Neither of the first two clears the upper halves of the wide registers when
+// such a function returns, which stalls every SSE instruction after it, so the AVX2 and AVX-512
+// variants end with _mm256_zeroupper themselves
+#if defined(__GNUC__) || defined(__clang__)
+#define SIMD_TARGET(isa) __attribute__((target(isa)))
+#else
+#define SIMD_TARGET(isa)
+#endif
+
+// GCC fuses a multiply and the add after it into one FMA, intrinsics included, in every function whose
+// target has FMA, which the AVX-512 ones do; Clang does so within an expression. Both round once instead
+// of twice, so kernels that have to match their scalar variant bit for bit sit between SIMD_EXACT_BEGIN
+// and SIMD_EXACT_END, which keep every multiply and add as written. MSVC only fuses with /arch:AVX2 and
+// up, which the project does not build with
+#if defined(__clang__)
+#define SIMD_EXACT_BEGIN _Pragma("clang fp contract(off)")
+#define SIMD_EXACT_END _Pragma("clang fp contract(on)")
+#elif defined(__GNUC__)
+#define SIMD_EXACT_BEGIN _Pragma("GCC push_options") _Pragma("GCC optimize(\"fp-contract=off\")")
+#define SIMD_EXACT_END _Pragma("GCC pop_options")
+#else
+#define SIMD_EXACT_BEGIN
+#define SIMD_EXACT_END
+#endif
+
+// the instruction sets the hot kernels are compiled for, each level with everything of the ones before
+// it: sse4 is SSSE3 and SSE4.1, avx2 comes with FMA, and avx512 is the F, BW, DQ and VL parts every
+// AVX-512 CPU has. A kernel is compiled for any of them and the best one the CPU runs is picked when the
+// program starts, so one build serves old and new machines alike
+enum simd_level
+{
+	simd_scalar,
+	simd_sse4,
+	simd_avx2,
+	simd_avx512,
+	simd_level_count
+};
+
+inline const char* simd_level_name(const simd_level level)
+{
+	const char* const names[] = { "scalar", "sse4", "avx2", "avx512" };
+	return names[level];
+}
+
+// false when the name is no level
+inline bool parse_simd_level(const char* name, simd_level& level)
+{
+	for (auto i = 0; i < simd_level_count; i++)
+	{
+		if (std::strcmp(name, simd_level_name(static_cast<simd_level>(i))) == 0)
+		{
+			level = static_cast<simd_level>(i);
+			return true;
+		}
+	}
+	return false;
+}
+
+// what the CPU supports and the OS running it saves the registers of
+typedef struct
+{
+	bool ssse3;
+	bool sse41;
+	bool avx;
+	bool fma;
+	bool avx2;
+	bool avx512f;
+	bool avx512bw;
+	bool avx512dq;
+	bool avx512vl;
+} cpu_features;
+
+inline cpu_features probe_cpu_features()
+{
+	cpu_features features;
+	std::memset(&features, 0, sizeof(features));
+#ifdef SIMD_X86
+	unsigned int leaf1[4] = { 0, 0, 0, 0 }, leaf7[4] = { 0, 0, 0, 0 };
+#ifdef _MSC_VER
+	int registers[4];
+	__cpuid(registers, 0);
+	const auto max_leaf = registers[0];
+	__cpuidex(registers, 1, 0);
+	for (auto i = 0; i < 4; i++)
+		leaf1[i] = static_cast<unsigned int>(registers[i]);
+	if (max_leaf >= 7)
+	{
+		__cpuidex(registers, 7, 0);
+		for (auto i = 0; i < 4; i++)
+			leaf7[i] = static_cast<unsigned int>(registers[i]);
+	}
+#else
+	const auto max_leaf = __get_cpuid_max(0, nullptr);
+	__cpuid_count(1, 0, leaf1[0], leaf1[1], leaf1[2], leaf1[3]);
+	if (max_leaf >= 7)
+		__cpuid_count(7, 0, leaf7[0], leaf7[1], leaf7[2], leaf7[3]);
+#endif
+
+	features.ssse3 = (leaf1[2] & (1u << 9)) != 0;
+	features.sse41 = (leaf1[2] & (1u << 19)) != 0;
+
+	// the wider registers only count when the OS saves them on a switch: XCR0 has the SSE and AVX
+	// state, then the AVX-512 mask and upper registers
+	if ((leaf1[2] & (1u << 27)) == 0)
+		return features;
+#ifdef _MSC_VER
+	const auto xcr0 = _xgetbv(0);
+#else
+	unsigned int xcr0_low, xcr0_high;
+	__asm__("xgetbv" : "=a"(xcr0_low), "=d"(xcr0_high) : "c"(0));
+	const unsigned long long xcr0 = (static_cast<unsigned long long>(xcr0_high) << 32) | xcr0_low;
+#endif
+	const auto avx_state = (xcr0 & 0x6) == 0x6;
+	const auto avx512_state = avx_state && (xcr0 & 0xe0) == 0xe0;
+
+	features.avx = avx_state && (leaf1[2] & (1u << 28)) != 0;
+	features.fma = features.avx && (leaf1[2] & (1u << 12)) != 0;
+	features.avx2 = features.avx && (leaf7[1] & (1u << 5)) != 0;
+	features.avx512f = avx512_state && (leaf7[1] & (1u << 16)) != 0;
+	features.avx512dq = avx512_state && (leaf7[1] & (1u << 17)) != 0;
+	features.avx512bw = avx512_state && (leaf7[1] & (1u << 30)) != 0;
+	features.avx512vl = avx512_state && (leaf7[1] & (1u << 31)) != 0;
+#endif
+	return features;
+}
+
+// the highest level all of whose instruction sets are there
+inline simd_level cpu_simd_level(const cpu_features& features)
+{
+	if (!features.ssse3 || !features.sse41)
+		return simd_scalar;
+	if (!features.avx2 || !features.fma)
+		return simd_sse4;
+	if (!features.avx512f || !features.avx512bw || !features.avx512dq || !features.avx512vl)
+		return simd_avx2;
+	return simd_avx512;
+}
+
+// the level of this CPU, probed once
+inline simd_level cpu_simd_level()
+{
+	static const auto level = cpu_simd_level(probe_cpu_features());
+	return level;
+}
+
+// the level the SIMD_LEVEL environment variable asks for, scalar, sse4, avx2 or avx512, at most the
+// CPU's. The CPU's own when it is not set
+inline simd_level environment_simd_level()
+{
+	auto level = cpu_simd_level();
+#ifdef _MSC_VER
+	char* value = nullptr;
+	size_t length = 0;
+	if (_dupenv_s(&value, &length, "SIMD_LEVEL") == 0 && value != nullptr)
+	{
+		parse_simd_level(value, level);
+		free(value);
+	}
+#else
+	if (const auto* const value = std::getenv("SIMD_LEVEL"))
+		parse_simd_level(value, level);
+#endif
+	return level < cpu_simd_level() ? level : cpu_simd_level();
+}
+
+inline simd_level& simd_level_setting()
+{
+	static auto level = environment_simd_level();
+	return level;
+}
+
+// the level every dispatched kernel runs at
+inline simd_level active_simd_level()
+{
+	return simd_level_setting();
+}
+
+// the dispatched kernels, each with a slot in the kernel table
+enum simd_kernel
+{
+	kernel_cull_boxes,
+	kernel_rasterize_row,
+	kernel_tile_row_farthest,
+	kernel_expand_rgb_to_rgba,
+	kernel_csv_separators,
+	kernel_multiply_matrices,
+	kernel_transform_points,
+	kernel_inverse_transpose,
+	kernel_transform_boxes,
+	kernel_mip_horizontal,
+	kernel_mip_vertical,
+	simd_kernel_count
+};
+
+// the variant every kernel runs at the active level, null until the kernel is first called. Zeroed
+// before the program starts, so reading a slot is a plain load
+inline std::atomic<void (*)()>* simd_kernel_table()
+{
+	static std::atomic<void (*)()> table[simd_kernel_count];
+	return table;
+}
+
+// runs the kernels at another level from now on, at most the CPU's, which is returned. Clears the kernel
+// table, so every kernel is resolved again on its next call. For checking every variant of the kernels
+// in turn; not while kernels are running on other threads
+inline simd_level force_simd_level(const simd_level level)
+{
+	simd_level_setting() = level < cpu_simd_level() ? level : cpu_simd_level();
+	for (auto i = 0; i < simd_kernel_count; i++)
+		simd_kernel_table()[i].store(nullptr, std::memory_order_relaxed);
+	return simd_level_setting();
+}
+
+// the variant of a kernel for a level, one function for each level with null where the kernel has
+// nothing of its own and the variant below is used
+template <typename F>
+inline F resolve_kernel(const F (&variants)[simd_level_count], const simd_level level)
+{
+	for (auto i = static_cast<int>(level); i > simd_scalar; i--)
+	{
+		if (variants[i] != nullptr)
+			return variants[i];
+	}
+	return variants[simd_scalar];
+}
+
+// the variant of a kernel for the active level from the kernel table, resolved and kept there on the
+// first call, so later ones cost a load and an indirect call. Threads that resolve the same kernel at
+// once store the same variant
+template <typename F>
+inline F dispatch_kernel(const simd_kernel kernel, const F (&variants)[simd_level_count])
+{
+	auto& slot = simd_kernel_table()[kernel];
+	auto resolved = slot.load(std::memory_order_relaxed);
+	if (resolved == nullptr)
+	{
+		resolved = reinterpret_cast<void (*)()>(resolve_kernel(variants, active_simd_level()));
+		slot.store(resolved, std::memory_order_relaxed);
+	}
+	return reinterpret_cast<F>(resolved);
+}
+
+#endif
@@ -0,0 +1,301 @@
+#ifndef CULLING_H
+#define CULLING_H
+
+#include <glm.hpp>
+#include <Frustum.h>
+#include <CpuFeatures.h>
+
+#include <cfloat>
+#include <cstdint>
+#include <vector>
+
+// bounding volumes of an object: axis aligned box plus a sphere around it
+typedef struct
+{
+	glm::vec3 min;
+	glm::vec3 max;
+	glm::vec3 center;
+	float radius;
+} object_bounds;
+
+// bounds of the positions in an interleaved vertex array, the position being the first three floats of every vertex
+inline object_bounds compute_bounds(const float* vertices, const size_t vertex_count, const size_t stride)
+{
+	object_bounds result;
+	result.min = glm::vec3(FLT_MAX);
+	result.max = glm::vec3(-FLT_MAX);
+	for (size_t i = 0; i < vertex_count; i++)
+	{
+		const glm::vec3 position(vertices[i * stride], vertices[i * stride + 1], vertices[i * stride + 2]);
+		result.min = glm::min(result.min, position);
+		result.max = glm::max(result.max, position);
+	}
+
+	// the sphere is centered on the box but only as large as the farthest vertex needs
+	result.center = (result.min + result.max) * 0.5f;
+	auto radius_squared = 0.0f;
+	for (size_t i = 0; i < vertex_count; i++)
+	{
+		const glm::vec3 position(vertices[i * stride], vertices[i * stride + 1], vertices[i * stride + 2]);
+		radius_squared = glm::max(radius_squared, glm::dot(position - result.center, position - result.center));
+	}
+	result.radius = glm::sqrt(radius_squared);
+
+	return result;
+}
+
+// box transformed by an affine matrix, still axis aligned so it grows to enclose the rotated box
+inline object_bounds transform_bounds(const object_bounds& local, const glm::mat4& transform)
+{
+	const auto center = (local.min + local.max) * 0.5f;
+	const auto extent = (local.max - local.min) * 0.5f;
+
+	const auto world_center = glm::vec3(transform * glm::vec4(center, 1.0f));
+	const auto world_extent = glm::abs(glm::vec3(transform[0])) * extent.x + glm::abs(glm::vec3(transform[1])) * extent.y + glm::abs(glm::vec3(transform[2])) * extent.z;
+
+	const auto scale = glm::max(glm::length(glm::vec3(transform[0])), glm::max(glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2]))));
+
+	object_bounds result;
+	result.min = world_center - world_extent;
+	result.max = world_center + world_extent;
+	result.center = glm::vec3(transform * glm::vec4(local.center, 1.0f));
+	result.radius = local.radius * scale;
+	return result;
+}
+
+// world space boxes stored as structure of arrays (center and half extent per axis) so a batch of
+// boxes can be tested against a frustum plane with a handful of SIMD instructions
+typedef struct
+{
+	std::vector<float> center_x, center_y, center_z;
+	std::vector<float> extent_x, extent_y, extent_z;
+} cull_set;
+
+inline void add_cull_bounds(cull_set& set, const object_bounds& bounds)
+{
+	const auto center = (bounds.min + bounds.max) * 0.5f;
+	const auto extent = (bounds.max - bounds.min) * 0.5f;
+	set.center_x.push_back(center.x);
+	set.center_y.push_back(center.y);
+	set.center_z.push_back(center.z);
+	set.extent_x.push_back(extent.x);
+	set.extent_y.push_back(extent.y);
+	set.extent_z.push_back(extent.z);
+}
+
+inline void set_cull_bounds(cull_set& set, const size_t index, const object_bounds& bounds)
+{
+	const auto center = (bounds.min + bounds.max) * 0.5f;
+	const auto extent = (bounds.max - bounds.min) * 0.5f;
+	set.center_x[index] = center.x;
+	set.center_y[index] = center.y;
+	set.center_z[index] = center.z;
+	set.extent_x[index] = extent.x;
+	set.extent_y[index] = extent.y;
+	set.extent_z[index] = extent.z;
+}
+
+SIMD_EXACT_BEGIN
+
+// a box is outside when it lies entirely behind any plane: dot(n, c) + w + dot(|n|, e) < 0. The products
+// are added one at a time in the order the SIMD variants add them, none of them fused, so every variant
+// culls the same boxes
+inline bool box_in_frustum(const frustum& frustum, const glm::vec3& center, const glm::vec3& extent)
+{
+	for (const auto& plane : frustum.planes)
+	{
+		auto distance = plane.x * center.x + plane.w;
+		distance = plane.y * center.y + distance;
+		distance = plane.z * center.z + distance;
+		distance = glm::abs(plane.x) * extent.x + distance;
+		distance = glm::abs(plane.y) * extent.y + distance;
+		distance = glm::abs(plane.z) * extent.z + distance;
+		if (distance < 0.0f)
+			return false;
+	}
+
+	return true;
+}
+
+inline uint32_t cull_boxes_scalar(const frustum& frustum, const cull_set& set, const uint32_t first, const uint32_t last, uint32_t* visible)
+{
+	uint32_t count = 0;
+	for (auto i = first; i < last; i++)
+	{
+		const glm::vec3 center(set.center_x[i], set.center_y[i], set.center_z[i]);
+		const glm::vec3 extent(set.extent_x[i], set.extent_y[i], set.extent_z[i]);
+		visible[count] = i;
+		count += box_in_frustum(frustum, center, extent) ? 1 : 0;
+	}
+
+	return count;
+}
+
+#ifdef SIMD_X86
+// four boxes at a time, the last ones left to the scalar variant
+SIMD_TARGET("ssse3,sse4.1") inline uint32_t cull_boxes_sse4(const frustum& frustum, const cull_set& set, const uint32_t first, const uint32_t last, uint32_t* visible)
+{
+	__m128 plane_x[6], plane_y[6], plane_z[6], plane_w[6], abs_x[6], abs_y[6], abs_z[6];
+	for (auto p = 0; p < 6; p++)
+	{
+		const auto& plane = frustum.planes[p];
+		plane_x[p] = _mm_set1_ps(plane.x);
+		plane_y[p] = _mm_set1_ps(plane.y);
+		plane_z[p] = _mm_set1_ps(plane.z);
+		plane_w[p] = _mm_set1_ps(plane.w);
+		abs_x[p] = _mm_set1_ps(glm::abs(plane.x));
+		abs_y[p] = _mm_set1_ps(glm::abs(plane.y));
+		abs_z[p] = _mm_set1_ps(glm::abs(plane.z));
+	}
+
+	uint32_t count = 0;
+	auto i = first;
+	for (; i + 4 <= last; i += 4)
+	{
+		const auto cx = _mm_loadu_ps(&set.center_x[i]);
+		const auto cy = _mm_loadu_ps(&set.center_y[i]);
+		const auto cz = _mm_loadu_ps(&set.center_z[i]);
+		const auto ex = _mm_loadu_ps(&set.extent_x[i]);
+		const auto ey = _mm_loadu_ps(&set.extent_y[i]);
+		const auto ez = _mm_loadu_ps(&set.extent_z[i]);
+
+		auto outside = _mm_setzero_ps();
+		for (auto p = 0; p < 6; p++)
+		{
+			auto distance = _mm_add_ps(_mm_mul_ps(plane_x[p], cx), plane_w[p]);
+			distance = _mm_add_ps(_mm_mul_ps(plane_y[p], cy), distance);
+			distance = _mm_add_ps(_mm_mul_ps(plane_z[p], cz), distance);
+			distance = _mm_add_ps(_mm_mul_ps(abs_x[p], ex), distance);
+			distance = _mm_add_ps(_mm_mul_ps(abs_y[p], ey), distance);
+			distance = _mm_add_ps(_mm_mul_ps(abs_z[p], ez), distance);
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(distance, _mm_setzero_ps()));
+		}
+
+		const auto mask = ~_mm_movemask_ps(outside) & 0xf;
+		for (uint32_t lane = 0; lane < 4; lane++)
+		{
+			visible[count] = i + lane;
+			count += (mask >> lane) & 1;
+		}
+	}
+
+	return count + cull_boxes_scalar(frustum, set, i, last, visible + count);
+}
+
+// eight boxes at a time
+SIMD_TARGET("avx2") inline uint32_t cull_boxes_avx2(const frustum& frustum, const cull_set& set, const uint32_t first, const uint32_t last, uint32_t* visible)
+{
+	__m256 plane_x[6], plane_y[6], plane_z[6], plane_w[6], abs_x[6], abs_y[6], abs_z[6];
+	for (auto p = 0; p < 6; p++)
+	{
+		const auto& plane = frustum.planes[p];
+		plane_x[p] = _mm256_set1_ps(plane.x);
+		plane_y[p] = _mm256_set1_ps(plane.y);
+		plane_z[p] = _mm256_set1_ps(plane.z);
+		plane_w[p] = _mm256_set1_ps(plane.w);
+		abs_x[p] = _mm256_set1_ps(glm::abs(plane.x));
+		abs_y[p] = _mm256_set1_ps(glm::abs(plane.y));
+		abs_z[p] = _mm256_set1_ps(glm::abs(plane.z));
+	}
+
+	uint32_t count = 0;
+	auto i = first;
+	for (; i + 8 <= last; i += 8)
+	{
+		const auto cx = _mm256_loadu_ps(&set.center_x[i]);
+		const auto cy = _mm256_loadu_ps(&set.center_y[i]);
+		const auto cz = _mm256_loadu_ps(&set.center_z[i]);
+		const auto ex = _mm256_loadu_ps(&set.extent_x[i]);
+		const auto ey = _mm256_loadu_ps(&set.extent_y[i]);
+		const auto ez = _mm256_loadu_ps(&set.extent_z[i]);
+
+		auto outside = _mm256_setzero_ps();
+		for (auto p = 0; p < 6; p++)
+		{
+			auto distance = _mm256_add_ps(_mm256_mul_ps(plane_x[p], cx), plane_w[p]);
+			distance = _mm256_add_ps(_mm256_mul_ps(plane_y[p], cy), distance);
+			distance = _mm256_add_ps(_mm256_mul_ps(plane_z[p], cz), distance);
+			distance = _mm256_add_ps(_mm256_mul_ps(abs_x[p], ex), distance);
+			distance = _mm256_add_ps(_mm256_mul_ps(abs_y[p], ey), distance);
+			distance = _mm256_add_ps(_mm256_mul_ps(abs_z[p], ez), distance);
+			outside = _mm256_or_ps(outside, _mm256_cmp_ps(distance, _mm256_setzero_ps(), _CMP_LT_OQ));
+		}
+
+		const auto mask = ~_mm256_movemask_ps(outside) & 0xff;
+		for (uint32_t lane = 0; lane < 8; lane++)
+		{
+			visible[count] = i + lane;
+			count += (mask >> lane) & 1;
+		}
+	}
+
+	_mm256_zeroupper();
+	return count + cull_boxes_scalar(frustum, set, i, last, visible + count);
+}
+
+// sixteen boxes at a time, the indices of the visible ones compressed straight into visible
+SIMD_TARGET("avx512f,avx512bw,avx512dq,avx512vl,popcnt") inline uint32_t cull_boxes_avx512(const frustum& frustum, const cull_set& set, const uint32_t first, const uint32_t last, uint32_t* visible)
+{
+	__m512 plane_x[6], plane_y[6], plane_z[6], plane_w[6], abs_x[6], abs_y[6], abs_z[6];
+	for (auto p = 0; p < 6; p++)
+	{
+		const auto& plane = frustum.planes[p];
+		plane_x[p] = _mm512_set1_ps(plane.x);
+		plane_y[p] = _mm512_set1_ps(plane.y);
+		plane_z[p] = _mm512_set1_ps(plane.z);
+		plane_w[p] = _mm512_set1_ps(plane.w);
+		abs_x[p] = _mm512_set1_ps(glm::abs(plane.x));
+		abs_y[p] = _mm512_set1_ps(glm::abs(plane.y));
+		abs_z[p] = _mm512_set1_ps(glm::abs(plane.z));
+	}
+
+	const auto lanes = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+	uint32_t count = 0;
+	auto i = first;
+	for (; i + 16 <= last; i += 16)
+	{
+		const auto cx = _mm512_loadu_ps(&set.center_x[i]);
+		const auto cy = _mm512_loadu_ps(&set.center_y[i]);
+		const auto cz = _mm512_loadu_ps(&set.center_z[i]);
+		const auto ex = _mm512_loadu_ps(&set.extent_x[i]);
+		const auto ey = _mm512_loadu_ps(&set.extent_y[i]);
+		const auto ez = _mm512_loadu_ps(&set.extent_z[i]);
+
+		__mmask16 outside = 0;
+		for (auto p = 0; p < 6; p++)
+		{
+			auto distance = _mm512_add_ps(_mm512_mul_ps(plane_x[p], cx), plane_w[p]);
+			distance = _mm512_add_ps(_mm512_mul_ps(plane_y[p], cy), distance);
+			distance = _mm512_add_ps(_mm512_mul_ps(plane_z[p], cz), distance);
+			distance = _mm512_add_ps(_mm512_mul_ps(abs_x[p], ex), distance);
+			distance = _mm512_add_ps(_mm512_mul_ps(abs_y[p], ey), distance);
+			distance = _mm512_add_ps(_mm512_mul_ps(abs_z[p], ez), distance);
+			outside |= _mm512_cmp_ps_mask(distance, _mm512_setzero_ps(), _CMP_LT_OQ);
+		}
+
+		const auto mask = static_cast<__mmask16>(~outside);
+		_mm512_mask_compressstoreu_epi32(visible + count, mask, _mm512_add_epi32(_mm512_set1_epi32(static_cast<int>(i)), lanes));
+		count += static_cast<uint32_t>(_mm_popcnt_u32(mask));
+	}
+
+	_mm256_zeroupper();
+	return count + cull_boxes_scalar(frustum, set, i, last, visible + count);
+}
+#endif
+
+SIMD_EXACT_END
+
+// writes the indices of the boxes in [first, last) that touch the frustum to visible, returns how many.
+// visible needs room for (last - first) entries. Runs the variant for the active SIMD level
+inline uint32_t cull_boxes(const frustum& frustum, const cull_set& set, const uint32_t first, const uint32_t last, uint32_t* visible)
+{
+#ifdef SIMD_X86
+	typedef uint32_t (*kernel)(const ::frustum&, const cull_set&, uint32_t, uint32_t, uint32_t*);
+	static const kernel variants[simd_level_count] = { cull_boxes_scalar, cull_boxes_sse4, cull_boxes_avx2, cull_boxes_avx512 };
+	return dispatch_kernel(kernel_cull_boxes, variants)(frustum, set, first, last, visible);
+#else
+	return cull_boxes_scalar(frustum, set, first, last, visible);
+#endif
+}
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef FRAME_PIPELINE_H
+#define FRAME_PIPELINE_H
+
+#include <condition_variable>
+#include <mutex>
+
+// hands frame packets from the thread that builds them to the thread that renders them. There are two
+// packets, so the builder fills the next one while the renderer works on the previous: the builder is
+// at most one frame ahead and waits when it gets further than that
+template <typename packet>
+class frame_pipeline
+{
+public:
+	// blocks until the renderer is done with the packet about to be filled
+	packet& begin_write()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		changed.wait(lock, [this] { return !full[write_index]; });
+		return packets[write_index];
+	}
+
+	void submit()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			full[write_index] = true;
+			write_index ^= 1;
+		}
+		changed.notify_all();
+	}
+
+	// blocks until a packet is ready, null once the pipeline is closed and every packet has been read
+	packet* begin_read()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		changed.wait(lock, [this] { return full[read_index] || closed; });
+		return full[read_index] ? &packets[read_index] : nullptr;
+	}
+
+	// gives the packet back to the builder, nothing may read it afterwards
+	void end_read()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			full[read_index] = false;
+			read_index ^= 1;
+		}
+		changed.notify_all();
+	}
+
+	void close()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			closed = true;
+		}
+		changed.notify_all();
+	}
+
+private:
+	packet packets[2];
+	bool full[2] = { false, false };
+	int write_index = 0;
+	int read_index = 0;
+	bool closed = false;
+	std::mutex mutex;
+	std::condition_variable changed;
+};
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <glm.hpp>
+
+// the six planes of a view frustum as (normal, distance), normals pointing inside
+typedef struct
+{
+	glm::vec4 planes[6];
+} frustum;
+
+// Gribb/Hartmann plane extraction from a projection * view matrix
+inline frustum extract_frustum(const glm::mat4& view_projection)
+{
+	frustum result;
+
+	// glm is column major, so row i of the matrix is (m[0][i], m[1][i], m[2][i], m[3][i])
+	const glm::vec4 row_x(view_projection[0][0], view_projection[1][0], view_projection[2][0], view_projection[3][0]);
+	const glm::vec4 row_y(view_projection[0][1], view_projection[1][1], view_projection[2][1], view_projection[3][1]);
+	const glm::vec4 row_z(view_projection[0][2], view_projection[1][2], view_projection[2][2], view_projection[3][2]);
+	const glm::vec4 row_w(view_projection[0][3], view_projection[1][3], view_projection[2][3], view_projection[3][3]);
+
+	result.planes[0] = row_w + row_x; // left
+	result.planes[1] = row_w - row_x; // right
+	result.planes[2] = row_w + row_y; // bottom
+	result.planes[3] = row_w - row_y; // top
+	result.planes[4] = row_w + row_z; // near
+	result.planes[5] = row_w - row_z; // far
+
+	for (auto& plane : result.planes)
+		plane /= glm::length(glm::vec3(plane));
+
+	return result;
+}
+
+inline bool sphere_in_frustum(const frustum& frustum, const glm::vec3& center, const float radius)
+{
+	for (const auto& plane : frustum.planes)
+	{
+		if (glm::dot(glm::vec3(plane), center) + plane.w < -radius)
+			return false;
+	}
+
+	return true;
+}
+
+#endif
@@ -0,0 +1,328 @@
+#ifndef IMAGE_DECODER_H
+#define IMAGE_DECODER_H
+
+#include <TextureFormats.h>
+
+// not again where the implementation was included already, it would be compiled twice
+#ifndef STBI_INCLUDE_STB_IMAGE_H
+#include <stb_image.h>
+#endif
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <vector>
+
+#ifdef USE_LIBJPEG_TURBO
+#include <csetjmp>
+#include <cstdio>
+#include <jpeglib.h>
+#endif
+
+// what an image file holds, read from its header without decoding it
+typedef struct
+{
+	int width;
+	int height;
+	int channels;
+} image_info;
+
+// an image decoding backend. decode gives the texels with wanted channels, 0 for the file's own, rows
+// bottom to top like the GL textures, at 1 / 2^scale of the image's size each way, rounded up. Backends
+// that can shrink the image while decoding it do, the others decode it whole and box filter it down. Every
+// backend allocates the texels with malloc, as stb_image does, so whichever decoded them they go back with
+// stbi_image_free. Null when the file cannot be decoded
+typedef struct
+{
+	const char* name;
+	bool (*accepts)(const unsigned char* data, size_t size);
+	bool (*info)(const unsigned char* data, size_t size, image_info& info);
+	unsigned char* (*decode)(const unsigned char* data, size_t size, int scale, int wanted, image_info& info);
+} image_decoder;
+
+// a side of size texels at 1 / 2^scale
+inline int scaled_image_size(const int size, const int scale)
+{
+	return (size + (1 << scale) - 1) >> scale;
+}
+
+// shrinks malloc'd texels to 1 / 2^scale of their size, every texel the average of the block it covers,
+// the blocks on the far edges cut short. The texels given are freed
+inline unsigned char* shrink_image(unsigned char* pixels, image_info& info, const int scale)
+{
+	if (scale <= 0)
+		return pixels;
+
+	const auto width = scaled_image_size(info.width, scale);
+	const auto height = scaled_image_size(info.height, scale);
+	auto* const shrunk = static_cast<unsigned char*>(malloc(static_cast<size_t>(width) * height * info.channels));
+	const auto block = 1 << scale;
+	const auto channels = info.channels;
+
+	// the rows of a block are summed into a row of sums, one for every texel of the shrunk row
+	std::vector<unsigned int> sums(static_cast<size_t>(width) * channels);
+	for (auto y = 0; y < height; y++)
+	{
+		std::fill(sums.begin(), sums.end(), 0u);
+		const auto y1 = std::min(info.height, (y + 1) * block);
+		for (auto source_y = y * block; source_y < y1; source_y++)
+		{
+			const auto* const row = pixels + static_cast<size_t>(source_y) * info.width * channels;
+			for (auto x = 0; x < info.width; x++)
+			{
+				for (auto c = 0; c < channels; c++)
+					sums[(x >> scale) * channels + c] += row[x * channels + c];
+			}
+		}
+
+		auto* const row = shrunk + static_cast<size_t>(y) * width * channels;
+		for (auto x = 0; x < width; x++)
+		{
+			const auto count = static_cast<unsigned int>((y1 - y * block) * (std::min(info.width, (x + 1) * block) - x * block));
+			for (auto c = 0; c < channels; c++)
+				row[x * channels + c] = static_cast<unsigned char>((sums[x * channels + c] + count / 2) / count);
+		}
+	}
+
+	free(pixels);
+	info.width = width;
+	info.height = height;
+	return shrunk;
+}
+
+// stb_image reads about any file, so it takes whatever no other backend does
+inline bool stb_image_accepts(const unsigned char*, size_t)
+{
+	return true;
+}
+
+inline bool stb_image_info(const unsigned char* data, const size_t size, image_info& info)
+{
+	return stbi_info_from_memory(data, static_cast<int>(size), &info.width, &info.height, &info.channels) != 0;
+}
+
+// RGB asked for as RGBA is expanded with expand_rgb_to_rgba, faster than stb_image's own conversion,
+// after the image is shrunk; other conversions are left to stb_image
+inline unsigned char* stb_image_decode(const unsigned char* data, const size_t size, const int scale, const int wanted, image_info& info)
+{
+	stbi_set_flip_vertically_on_load_thread(1);
+	auto* pixels = stbi_load_from_memory(data, static_cast<int>(size), &info.width, &info.height, &info.channels, 0);
+	if (pixels != nullptr && wanted != 0 && info.channels != wanted && (info.channels != 3 || wanted != 4))
+	{
+		stbi_image_free(pixels);
+		pixels = stbi_load_from_memory(data, static_cast<int>(size), &info.width, &info.height, &info.channels, wanted);
+		info.channels = wanted;
+	}
+	if (pixels == nullptr)
+		return nullptr;
+
+	pixels = shrink_image(pixels, info, scale);
+	if (wanted != 0 && info.channels != wanted)
+	{
+		auto* const rgba = static_cast<unsigned char*>(malloc(static_cast<size_t>(info.width) * info.height * 4));
+		expand_rgb_to_rgba(pixels, rgba, static_cast<size_t>(info.width) * info.height);
+		stbi_image_free(pixels);
+		pixels = rgba;
+		info.channels = 4;
+	}
+	return pixels;
+}
+
+inline const image_decoder& stb_image_decoder()
+{
+	static const image_decoder decoder = { "stb_image", stb_image_accepts, stb_image_info, stb_image_decode };
+	return decoder;
+}
+
+#ifdef USE_LIBJPEG_TURBO
+// libjpeg-turbo's SIMD decoder for JPEGs, which also scales the inverse DCT down to 1/2, 1/4 and 1/8 of
+// the image so smaller decodes skip most of the work; scales past 1/8 are box filtered after it. Errors
+// jump back out of the library instead of exiting, and its warnings are not printed
+typedef struct
+{
+	jpeg_error_mgr manager;
+	jmp_buf jump;
+} libjpeg_error;
+
+inline void libjpeg_error_exit(const j_common_ptr common)
+{
+	longjmp(reinterpret_cast<libjpeg_error*>(common->err)->jump, 1);
+}
+
+inline void libjpeg_output_message(j_common_ptr)
+{
+}
+
+inline bool libjpeg_accepts(const unsigned char* data, const size_t size)
+{
+	return size > 3 && data[0] == 0xff && data[1] == 0xd8 && data[2] == 0xff;
+}
+
+inline bool libjpeg_info(const unsigned char* data, const size_t size, image_info& info)
+{
+	jpeg_decompress_struct decompress;
+	libjpeg_error error;
+	decompress.err = jpeg_std_error(&error.manager);
+	error.manager.error_exit = libjpeg_error_exit;
+	error.manager.output_message = libjpeg_output_message;
+	if (setjmp(error.jump))
+	{
+		jpeg_destroy_decompress(&decompress);
+		return false;
+	}
+
+	jpeg_create_decompress(&decompress);
+	jpeg_mem_src(&decompress, const_cast<unsigned char*>(data), static_cast<unsigned long>(size));
+	jpeg_read_header(&decompress, TRUE);
+	info.width = static_cast<int>(decompress.image_width);
+	info.height = static_cast<int>(decompress.image_height);
+	info.channels = decompress.num_components;
+	jpeg_destroy_decompress(&decompress);
+	return true;
+}
+
+// gray, RGB and RGBA come straight out of the decoder; gray with alpha and CMYK files fail, for stb_image
+// to take over
+inline unsigned char* libjpeg_decode(const unsigned char* data, const size_t size, const int scale, const int wanted, image_info& info)
+{
+	jpeg_decompress_struct decompress;
+	libjpeg_error error;
+	unsigned char* volatile pixels = nullptr;
+	decompress.err = jpeg_std_error(&error.manager);
+	error.manager.error_exit = libjpeg_error_exit;
+	error.manager.output_message = libjpeg_output_message;
+	if (setjmp(error.jump))
+	{
+		jpeg_destroy_decompress(&decompress);
+		free(pixels);
+		return nullptr;
+	}
+
+	jpeg_create_decompress(&decompress);
+	jpeg_mem_src(&decompress, const_cast<unsigned char*>(data), static_cast<unsigned long>(size));
+	jpeg_read_header(&decompress, TRUE);
+
+	const auto channels = wanted != 0 ? wanted : decompress.num_components;
+	if (channels == 2 || (decompress.jpeg_color_space != JCS_GRAYSCALE && decompress.jpeg_color_space != JCS_YCbCr && decompress.jpeg_color_space != JCS_RGB))
+	{
+		jpeg_destroy_decompress(&decompress);
+		return nullptr;
+	}
+
+	decompress.out_color_space = channels == 1 ? JCS_GRAYSCALE : channels == 3 ? JCS_RGB : JCS_EXT_RGBA;
+	decompress.scale_num = 1;
+	decompress.scale_denom = 1u << std::min(scale, 3);
+	jpeg_start_decompress(&decompress);
+
+	info.width = static_cast<int>(decompress.output_width);
+	info.height = static_cast<int>(decompress.output_height);
+	info.channels = channels;
+	const auto row_bytes = static_cast<size_t>(info.width) * channels;
+	pixels = static_cast<unsigned char*>(malloc(row_bytes * info.height));
+
+	// the file's rows come top to bottom and are stored from the last one up
+	while (decompress.output_scanline < decompress.output_height)
+	{
+		JSAMPROW row = pixels + (info.height - 1 - decompress.output_scanline) * row_bytes;
+		jpeg_read_scanlines(&decompress, &row, 1);
+	}
+
+	jpeg_finish_decompress(&decompress);
+	jpeg_destroy_decompress(&decompress);
+	return shrink_image(pixels, info, scale - std::min(scale, 3));
+}
+
+inline const image_decoder& libjpeg_decoder()
+{
+	static const image_decoder decoder = { "libjpeg-turbo", libjpeg_accepts, libjpeg_info, libjpeg_decode };
+	return decoder;
+}
+
+// texels of width x height with channels 1, 3 or 4, rows bottom to top, to a JPEG of that quality.
+// Empty when they cannot be encoded
+inline std::vector<unsigned char> encode_jpeg(const unsigned char* pixels, const int width, const int height, const int channels, const int quality)
+{
+	jpeg_compress_struct compress;
+	libjpeg_error error;
+	unsigned char* output = nullptr;
+	unsigned long output_size = 0;
+	compress.err = jpeg_std_error(&error.manager);
+	error.manager.error_exit = libjpeg_error_exit;
+	error.manager.output_message = libjpeg_output_message;
+	if (setjmp(error.jump))
+	{
+		jpeg_destroy_compress(&compress);
+		free(output);
+		return std::vector<unsigned char>();
+	}
+
+	jpeg_create_compress(&compress);
+	jpeg_mem_dest(&compress, &output, &output_size);
+	compress.image_width = width;
+	compress.image_height = height;
+	compress.input_components = channels;
+	compress.in_color_space = channels == 1 ? JCS_GRAYSCALE : channels == 3 ? JCS_RGB : JCS_EXT_RGBA;
+	jpeg_set_defaults(&compress);
+	jpeg_set_quality(&compress, quality, TRUE);
+	jpeg_start_compress(&compress, TRUE);
+
+	const auto row_bytes = static_cast<size_t>(width) * channels;
+	while (compress.next_scanline < compress.image_height)
+	{
+		JSAMPROW row = const_cast<unsigned char*>(pixels) + (height - 1 - compress.next_scanline) * row_bytes;
+		jpeg_write_scanlines(&compress, &row, 1);
+	}
+
+	jpeg_finish_compress(&compress);
+	std::vector<unsigned char> file(output, output + output_size);
+	jpeg_destroy_compress(&compress);
+	free(output);
+	return file;
+}
+#endif
+
+// every backend built in, the one each file goes to first
+inline const std::vector<const image_decoder*>& image_decoders()
+{
+#ifdef USE_LIBJPEG_TURBO
+	static const std::vector<const image_decoder*> decoders = { &libjpeg_decoder(), &stb_image_decoder() };
+#else
+	static const std::vector<const image_decoder*> decoders = { &stb_image_decoder() };
+#endif
+	return decoders;
+}
+
+// the first backend that takes the file
+inline const image_decoder& find_image_decoder(const unsigned char* data, const size_t size)
+{
+	for (const auto* decoder : image_decoders())
+	{
+		if (decoder->accepts(data, size))
+			return *decoder;
+	}
+	return stb_image_decoder();
+}
+
+// the size of the file's image at 1 / 2^scale and its own channels, false when it is no image
+inline bool read_image_info(const unsigned char* data, const size_t size, const int scale, image_info& info)
+{
+	if (!find_image_decoder(data, size).info(data, size, info) && !stb_image_info(data, size, info))
+		return false;
+
+	info.width = scaled_image_size(info.width, scale);
+	info.height = scaled_image_size(info.height, scale);
+	return true;
+}
+
+// decodes the file with the backend that takes it, stb_image trying again when that one fails
+inline unsigned char* decode_image(const unsigned char* data, const size_t size, const int scale, const int wanted, image_info& info)
+{
+	const auto& decoder = find_image_decoder(data, size);
+	auto* const pixels = decoder.decode(data, size, scale, wanted, info);
+	if (pixels != nullptr || &decoder == &stb_image_decoder())
+		return pixels;
+
+	return stb_image_decode(data, size, scale, wanted, info);
+}
+
+#endif
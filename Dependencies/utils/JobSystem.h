@@ -0,0 +1,261 @@
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class job_counter;
+
+typedef struct
+{
+	std::function<void()> function;
+	job_counter* counter;
+} job;
+
+// number of jobs still to finish, plus the jobs waiting for it to reach zero
+class job_counter
+{
+public:
+	std::atomic<int> pending{ 0 };
+
+private:
+	friend class job_system;
+	std::mutex mutex;
+	std::vector<job> continuations;
+};
+
+// fixed pool of worker threads, each with its own deque: a thread pushes and pops its own jobs at the
+// back and steals the oldest ones from the front of the others when it runs dry. Threads that are not
+// its workers, including the workers of another system, share the first deque. Waiting on a counter
+// runs pending jobs instead of blocking
+class job_system
+{
+public:
+	// 0 workers is valid, every job then runs inside wait on the calling thread
+	void start(const unsigned int worker_count)
+	{
+		queues.clear();
+		for (unsigned int i = 0; i <= worker_count; i++)
+			queues.emplace_back(new job_queue());
+
+		quit = false;
+		for (unsigned int i = 0; i < worker_count; i++)
+			workers.emplace_back([this, i] { run_worker(i + 1); });
+	}
+
+	// every job still queued runs before stop returns, the continuations they release included, so no
+	// counter is left short of zero. The workers drain the queues, whatever is left without any runs on
+	// the calling thread
+	void stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(sleep_mutex);
+			quit = true;
+		}
+		wake.notify_all();
+		for (auto& worker : workers)
+			worker.join();
+		workers.clear();
+
+		job next;
+		while (take(own_queue(), next))
+			execute(next);
+	}
+
+	unsigned int worker_count() const
+	{
+		return static_cast<unsigned int>(workers.size());
+	}
+
+	// queues a job, counter drops back once it has run
+	void run(job_counter& counter, std::function<void()> function)
+	{
+		counter.pending++;
+		push(job{ std::move(function), &counter });
+	}
+
+	// queues a job that only starts once dependency reaches zero
+	void run_after(job_counter& dependency, job_counter& counter, std::function<void()> function)
+	{
+		counter.pending++;
+		{
+			std::lock_guard<std::mutex> lock(dependency.mutex);
+			if (dependency.pending != 0)
+			{
+				dependency.continuations.push_back(job{ std::move(function), &counter });
+				return;
+			}
+		}
+		push(job{ std::move(function), &counter });
+	}
+
+	// runs pending jobs on the calling thread until the counter reaches zero
+	void wait(job_counter& counter)
+	{
+		while (counter.pending != 0)
+		{
+			job next;
+			if (take(own_queue(), next))
+				execute(next);
+			else
+				std::this_thread::yield();
+		}
+
+		// the job that brought the counter to zero may still be releasing its continuations
+		std::lock_guard<std::mutex> lock(counter.mutex);
+	}
+
+	// splits [0, count) into chunks of at least min_chunk items, a few per thread so idle ones can steal,
+	// and calls body(begin, end) for each of them. Returns once every chunk is done
+	template <typename function>
+	void parallel_for(const size_t count, const size_t min_chunk, const function& body)
+	{
+		if (count == 0)
+			return;
+
+		const size_t target_chunks = (workers.size() + 1) * 4;
+		const auto chunk = std::max(std::max<size_t>(min_chunk, 1), (count + target_chunks - 1) / target_chunks);
+		if (chunk >= count)
+		{
+			body(size_t(0), count);
+			return;
+		}
+
+		job_counter counter;
+		for (size_t begin = 0; begin < count; begin += chunk)
+		{
+			const auto end = std::min(count, begin + chunk);
+			run(counter, [&body, begin, end] { body(begin, end); });
+		}
+		wait(counter);
+	}
+
+private:
+	typedef struct
+	{
+		std::mutex mutex;
+		std::deque<job> jobs;
+	} job_queue;
+
+	std::vector<std::unique_ptr<job_queue>> queues;
+	std::vector<std::thread> workers;
+	std::atomic<int> queued{ 0 };
+	std::mutex sleep_mutex;
+	std::condition_variable wake;
+	bool quit = false;
+
+	// the system the calling thread is a worker of, and its deque there
+	typedef struct
+	{
+		const job_system* owner;
+		size_t index;
+	} worker_slot;
+
+	static worker_slot& current_worker()
+	{
+		static thread_local worker_slot slot{ nullptr, 0 };
+		return slot;
+	}
+
+	size_t own_queue() const
+	{
+		const auto& slot = current_worker();
+		return slot.owner == this && slot.index < queues.size() ? slot.index : 0;
+	}
+
+	void push(job&& item)
+	{
+		{
+			auto& queue = *queues[own_queue()];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			queue.jobs.push_back(std::move(item));
+		}
+		queued++;
+
+		// taking the lock orders the push before a worker that is about to sleep checks queued
+		{
+			std::lock_guard<std::mutex> lock(sleep_mutex);
+		}
+		wake.notify_one();
+	}
+
+	// newest job of the thread's own queue first, then the oldest one of any other queue
+	bool take(const size_t own, job& result)
+	{
+		if (queued == 0)
+			return false;
+
+		{
+			auto& queue = *queues[own];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			if (!queue.jobs.empty())
+			{
+				result = std::move(queue.jobs.back());
+				queue.jobs.pop_back();
+				queued--;
+				return true;
+			}
+		}
+
+		for (size_t i = 1; i < queues.size(); i++)
+		{
+			auto& queue = *queues[(own + i) % queues.size()];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			if (!queue.jobs.empty())
+			{
+				result = std::move(queue.jobs.front());
+				queue.jobs.pop_front();
+				queued--;
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	void execute(job& current)
+	{
+		current.function();
+
+		auto& counter = *current.counter;
+		std::vector<job> ready;
+		{
+			// the lock keeps run_after from adding a continuation after they have been collected
+			std::lock_guard<std::mutex> lock(counter.mutex);
+			if (--counter.pending == 0)
+				ready.swap(counter.continuations);
+		}
+
+		for (auto& continuation : ready)
+			push(std::move(continuation));
+	}
+
+	void run_worker(const size_t index)
+	{
+		current_worker() = worker_slot{ this, index };
+		for (;;)
+		{
+			job next;
+			if (take(index, next))
+			{
+				execute(next);
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock(sleep_mutex);
+			wake.wait(lock, [this] { return queued != 0 || quit; });
+			if (quit && queued == 0)
+				return;
+		}
+	}
+};
+
+#endif
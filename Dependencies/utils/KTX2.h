@@ -0,0 +1,221 @@
+#ifndef KTX2_H
+#define KTX2_H
+
+#include <TextureArray.h>
+#include <TextureCompression.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// the subset of Khronos KTX2 the texture cooker writes: one 2D image, no layers or faces, no
+// supercompression, with every level of its mip chain. The image is in one of the codecs' block formats
+// or plain GL_RGB8 or GL_RGBA8. Multi byte fields are little endian
+
+const unsigned char ktx2_identifier[12] = { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+
+const GLenum ktx2_formats[] =
+{
+	GL_COMPRESSED_RGB_S3TC_DXT1_EXT, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, GL_COMPRESSED_RGBA_BPTC_UNORM, GL_COMPRESSED_RGB8_ETC2, GL_RGB8, GL_RGBA8
+};
+
+// Vulkan format number of a GL format, 0 for the ones not listed above
+inline uint32_t ktx2_vk_format(const GLenum format)
+{
+	switch (format)
+	{
+	case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: return 131; // VK_FORMAT_BC1_RGB_UNORM_BLOCK
+	case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: return 137; // VK_FORMAT_BC3_UNORM_BLOCK
+	case GL_COMPRESSED_RGBA_BPTC_UNORM: return 145; // VK_FORMAT_BC7_UNORM_BLOCK
+	case GL_COMPRESSED_RGB8_ETC2: return 147; // VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK
+	case GL_RGB8: return 23; // VK_FORMAT_R8G8B8_UNORM
+	case GL_RGBA8: return 37; // VK_FORMAT_R8G8B8A8_UNORM
+	default: return 0;
+	}
+}
+
+inline bool ktx2_compressed(const GLenum format)
+{
+	return format != GL_RGB8 && format != GL_RGBA8;
+}
+
+inline int ktx2_channels(const GLenum format)
+{
+	return format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT || format == GL_COMPRESSED_RGB8_ETC2 || format == GL_RGB8 ? 3 : 4;
+}
+
+inline size_t ktx2_level_size(const GLenum format, const int width, const int height)
+{
+	return ktx2_compressed(format) ? compressed_level_size(format, width, height) : static_cast<size_t>(width) * height * ktx2_channels(format);
+}
+
+inline void ktx2_put32(std::vector<unsigned char>& out, const uint32_t value)
+{
+	for (auto i = 0; i < 4; i++)
+		out.push_back(static_cast<unsigned char>(value >> (i * 8)));
+}
+
+inline void ktx2_put64(std::vector<unsigned char>& out, const uint64_t value)
+{
+	ktx2_put32(out, static_cast<uint32_t>(value));
+	ktx2_put32(out, static_cast<uint32_t>(value >> 32));
+}
+
+inline uint32_t ktx2_get32(const unsigned char* in)
+{
+	return in[0] | in[1] << 8 | in[2] << 16 | static_cast<uint32_t>(in[3]) << 24;
+}
+
+inline uint64_t ktx2_get64(const unsigned char* in)
+{
+	return ktx2_get32(in) | static_cast<uint64_t>(ktx2_get32(in + 4)) << 32;
+}
+
+// the basic data format descriptor: color model, texel block size and where the channels sit in a block
+inline std::vector<unsigned char> ktx2_descriptor(const GLenum format)
+{
+	// each sample is bit offset, bit length - 1 and channel
+	std::vector<uint32_t> samples;
+	unsigned char model;
+	switch (format)
+	{
+	case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: model = 128; samples = { 0, 63, 0 }; break;
+	case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: model = 130; samples = { 0, 63, 15, 64, 63, 0 }; break;
+	case GL_COMPRESSED_RGBA_BPTC_UNORM: model = 134; samples = { 0, 127, 0 }; break;
+	case GL_COMPRESSED_RGB8_ETC2: model = 161; samples = { 0, 63, 2 }; break;
+	case GL_RGB8: model = 1; samples = { 0, 7, 0, 8, 7, 1, 16, 7, 2 }; break;
+	default: model = 1; samples = { 0, 7, 0, 8, 7, 1, 16, 7, 2, 24, 7, 15 }; break;
+	}
+	const auto compressed = ktx2_compressed(format);
+
+	std::vector<unsigned char> block;
+	const auto sample_count = static_cast<uint32_t>(samples.size() / 3);
+	ktx2_put32(block, 24 + 24 + 16 * sample_count); // dfdTotalSize
+	ktx2_put32(block, 0); // Khronos vendor, basic descriptor type
+	ktx2_put32(block, 2 | (24 + 16 * sample_count) << 16); // version 1.3, block size
+	block.push_back(model);
+	block.push_back(1); // BT.709 primaries
+	block.push_back(1); // linear transfer, the GL formats are UNORM
+	block.push_back(0); // straight alpha
+	if (compressed)
+		block.insert(block.end(), { 3, 3, 0, 0 }); // 4x4x1x1 texel blocks
+	else
+		block.insert(block.end(), { 0, 0, 0, 0 });
+	block.push_back(static_cast<unsigned char>(compressed ? gl_block_bytes(format) : ktx2_channels(format)));
+	block.insert(block.end(), 7, 0);
+
+	for (uint32_t s = 0; s < sample_count; s++)
+	{
+		ktx2_put32(block, samples[s * 3] | samples[s * 3 + 1] << 16 | samples[s * 3 + 2] << 24);
+		ktx2_put32(block, 0); // sample position
+		ktx2_put32(block, 0); // lower
+		ktx2_put32(block, compressed ? 0xFFFFFFFF : 255); // upper
+	}
+
+	return block;
+}
+
+// levels holds the compressed mip chain, level 0 first
+inline bool write_ktx2(const std::string& file_name, const GLenum format, const int width, const int height, const std::vector<std::vector<unsigned char>>& levels)
+{
+	const auto level_count = static_cast<uint32_t>(levels.size());
+	const auto descriptor = ktx2_descriptor(format);
+	const size_t alignment = ktx2_compressed(format) ? gl_block_bytes(format) : format == GL_RGB8 ? 12 : 4;
+
+	// level data goes after the header, the level index and the descriptor, smallest level first
+	const size_t descriptor_offset = 80 + 24 * level_count;
+	std::vector<uint64_t> offsets(level_count);
+	auto offset = descriptor_offset + descriptor.size();
+	for (auto level = level_count; level-- > 0;)
+	{
+		offset = (offset + alignment - 1) / alignment * alignment;
+		offsets[level] = offset;
+		offset += levels[level].size();
+	}
+
+	std::vector<unsigned char> out(ktx2_identifier, ktx2_identifier + 12);
+	ktx2_put32(out, ktx2_vk_format(format));
+	ktx2_put32(out, 1); // typeSize
+	ktx2_put32(out, width);
+	ktx2_put32(out, height);
+	ktx2_put32(out, 0); // depth
+	ktx2_put32(out, 0); // layers
+	ktx2_put32(out, 1); // faces
+	ktx2_put32(out, level_count);
+	ktx2_put32(out, 0); // supercompression
+	ktx2_put32(out, static_cast<uint32_t>(descriptor_offset));
+	ktx2_put32(out, static_cast<uint32_t>(descriptor.size()));
+	ktx2_put32(out, 0); // key/value data
+	ktx2_put32(out, 0);
+	ktx2_put64(out, 0); // supercompression global data
+	ktx2_put64(out, 0);
+
+	for (uint32_t level = 0; level < level_count; level++)
+	{
+		ktx2_put64(out, offsets[level]);
+		ktx2_put64(out, levels[level].size());
+		ktx2_put64(out, levels[level].size());
+	}
+
+	out.insert(out.end(), descriptor.begin(), descriptor.end());
+	for (auto level = level_count; level-- > 0;)
+	{
+		out.resize(static_cast<size_t>(offsets[level]), 0);
+		out.insert(out.end(), levels[level].begin(), levels[level].end());
+	}
+
+	std::ofstream file(file_name, std::ios::binary);
+	file.write(reinterpret_cast<const char*>(out.data()), out.size());
+	return static_cast<bool>(file);
+}
+
+// fills width, height, channels, compressed and levels of image, leaving pixels null. false when data is
+// not a file write_ktx2 could have written
+inline bool read_ktx2(const std::vector<unsigned char>& data, decoded_image& image)
+{
+	if (data.size() < 80 || std::memcmp(data.data(), ktx2_identifier, 12) != 0)
+		return false;
+
+	const auto* const header = data.data() + 12;
+	GLenum format = 0;
+	for (const auto candidate : ktx2_formats)
+	{
+		if (ktx2_vk_format(candidate) == ktx2_get32(header))
+			format = candidate;
+	}
+	if (format == 0)
+		return false;
+
+	const auto width = static_cast<int>(ktx2_get32(header + 8));
+	const auto height = static_cast<int>(ktx2_get32(header + 12));
+	const auto level_count = ktx2_get32(header + 28);
+	if (width <= 0 || height <= 0 || ktx2_get32(header + 16) > 1 || ktx2_get32(header + 20) > 1 || ktx2_get32(header + 24) != 1
+		|| ktx2_get32(header + 32) != 0 || level_count == 0 || level_count > 32 || data.size() < 80 + 24 * static_cast<size_t>(level_count))
+		return false;
+
+	std::vector<std::vector<unsigned char>> levels(level_count);
+	for (uint32_t level = 0; level < level_count; level++)
+	{
+		const auto* const entry = data.data() + 80 + 24 * level;
+		const auto offset = ktx2_get64(entry);
+		const auto length = ktx2_get64(entry + 8);
+		const auto expected = ktx2_level_size(format, std::max(1, width >> level), std::max(1, height >> level));
+		if (length != expected || offset > data.size() || length > data.size() - offset)
+			return false;
+
+		levels[level].assign(data.begin() + static_cast<size_t>(offset), data.begin() + static_cast<size_t>(offset + length));
+	}
+
+	image.pixels = nullptr;
+	image.width = width;
+	image.height = height;
+	image.channels = ktx2_channels(format);
+	image.compressed = ktx2_compressed(format) ? format : 0;
+	image.levels = std::move(levels);
+	return true;
+}
+
+#endif
@@ -0,0 +1,407 @@
+#ifndef MIPMAPS_H
+#define MIPMAPS_H
+
+#include <JobSystem.h>
+#include <CpuFeatures.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+// how the texels of a level are averaged into the next one
+enum mip_filter
+{
+	mip_box, // the average of what each texel covers, fractions of texels included on odd sizes
+	mip_kaiser // Kaiser windowed sinc over two texels of the smaller level each way, keeps more detail
+};
+
+// levels down to 1x1, each max(1, size / 2) of the one before as GL sizes them
+inline int mip_level_count(const int width, const int height)
+{
+	auto levels = 1;
+	for (auto size = std::max(width, height); size > 1; size /= 2)
+		levels++;
+	return levels;
+}
+
+inline float srgb_to_linear(const float value)
+{
+	return value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+}
+
+inline float linear_to_srgb(const float value)
+{
+	return value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+}
+
+// decoding looks up the 256 byte values, encoding rounds linear values to 1 / 16383 first
+class srgb_tables
+{
+public:
+	static const int encode_steps = 16383;
+	float decode[256];
+	unsigned char encode[encode_steps + 1];
+
+	srgb_tables()
+	{
+		for (auto i = 0; i < 256; i++)
+			decode[i] = srgb_to_linear(i / 255.0f);
+		for (auto i = 0; i <= encode_steps; i++)
+			encode[i] = static_cast<unsigned char>(linear_to_srgb(static_cast<float>(i) / encode_steps) * 255.0f + 0.5f);
+	}
+};
+
+inline const srgb_tables& get_srgb_tables()
+{
+	static const srgb_tables tables;
+	return tables;
+}
+
+// the texels of one axis of a level that make up each texel of that axis in the next level, count of
+// them per texel. Taps past the edge are clamped to it
+typedef struct
+{
+	int count;
+	std::vector<int> source;
+	std::vector<float> weight;
+} mip_taps;
+
+// modified Bessel function of the first kind, order 0
+inline float bessel_i0(const float x)
+{
+	auto sum = 1.0f, term = 1.0f;
+	for (auto k = 1; k < 20; k++)
+	{
+		const auto half = x / (2.0f * k);
+		term *= half * half;
+		sum += term;
+	}
+	return sum;
+}
+
+// t in texels of the smaller level
+inline float kaiser_weight(const float t)
+{
+	const auto radius = 2.0f, alpha = 4.0f;
+	if (std::fabs(t) >= radius)
+		return 0.0f;
+
+	const auto x = t / radius;
+	const auto sinc = std::fabs(t) < 1e-5f ? 1.0f : std::sin(3.14159265f * t) / (3.14159265f * t);
+	return sinc * bessel_i0(alpha * std::sqrt(1.0f - x * x)) / bessel_i0(alpha);
+}
+
+inline mip_taps make_mip_taps(const int source_size, const int size, const mip_filter filter)
+{
+	const auto scale = static_cast<float>(source_size) / size;
+	const auto radius = filter == mip_box ? 0.5f * scale : 2.0f * scale; // in texels of the larger level
+
+	// the texels each texel reaches, box weights being how much of a texel it covers
+	std::vector<int> first(size), last(size);
+	auto count = 1;
+	for (auto i = 0; i < size; i++)
+	{
+		const auto center = (i + 0.5f) * scale;
+		if (filter == mip_box)
+		{
+			first[i] = static_cast<int>(std::floor(center - radius + 1e-4f));
+			last[i] = static_cast<int>(std::ceil(center + radius - 1e-4f)) - 1;
+		}
+		else
+		{
+			first[i] = static_cast<int>(std::ceil(center - radius - 0.5f));
+			last[i] = static_cast<int>(std::floor(center + radius - 0.5f));
+		}
+		count = std::max(count, last[i] - first[i] + 1);
+	}
+
+	mip_taps taps;
+	taps.count = count;
+	taps.source.assign(static_cast<size_t>(size) * count, 0);
+	taps.weight.assign(static_cast<size_t>(size) * count, 0.0f);
+	for (auto i = 0; i < size; i++)
+	{
+		const auto center = (i + 0.5f) * scale;
+		auto total = 0.0f;
+		for (auto k = 0; k < count; k++)
+		{
+			const auto texel = std::min(first[i] + k, last[i]);
+			auto weight = 0.0f;
+			if (first[i] + k <= last[i])
+			{
+				if (filter == mip_box)
+					weight = std::max(0.0f, std::min(texel + 1.0f, center + radius) - std::max(static_cast<float>(texel), center - radius));
+				else
+					weight = kaiser_weight((texel + 0.5f - center) / scale);
+			}
+
+			taps.source[i * count + k] = std::min(source_size - 1, std::max(0, texel));
+			taps.weight[i * count + k] = weight;
+			total += weight;
+		}
+
+		for (auto k = 0; k < count; k++)
+			taps.weight[i * count + k] /= total;
+	}
+
+	return taps;
+}
+
+SIMD_EXACT_BEGIN
+
+// rows [first_row, end_row) of a level narrowed to width, texels being four floats. Every variant sums
+// the taps in the same order without fused multiplies, so all of them give the same floats
+inline void mip_horizontal_scalar(const float* source, const int source_width, const mip_taps& taps, const int width, const int first_row, const int end_row, float* out)
+{
+	for (auto y = first_row; y < end_row; y++)
+	{
+		const auto* const row = source + static_cast<size_t>(y) * source_width * 4;
+		auto* const target = out + static_cast<size_t>(y) * width * 4;
+		for (auto x = 0; x < width; x++)
+		{
+			const auto* const source_taps = &taps.source[x * taps.count];
+			const auto* const weights = &taps.weight[x * taps.count];
+			float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+			for (auto k = 0; k < taps.count; k++)
+			{
+				for (auto c = 0; c < 4; c++)
+					sum[c] += weights[k] * row[source_taps[k] * 4 + c];
+			}
+			std::copy(sum, sum + 4, target + x * 4);
+		}
+	}
+}
+
+// rows [first_row, end_row) of the next level from the rows mip_horizontal narrowed, floats holding
+// the width of a row
+inline void mip_vertical_scalar(const float* source, const size_t floats, const mip_taps& taps, const int first_row, const int end_row, float* out)
+{
+	for (auto y = first_row; y < end_row; y++)
+	{
+		const auto* const source_taps = &taps.source[y * taps.count];
+		const auto* const weights = &taps.weight[y * taps.count];
+		auto* const target = out + y * floats;
+		for (size_t i = 0; i < floats; i++)
+		{
+			auto sum = 0.0f;
+			for (auto k = 0; k < taps.count; k++)
+				sum += weights[k] * source[source_taps[k] * floats + i];
+			target[i] = sum;
+		}
+	}
+}
+
+#ifdef SIMD_X86
+// a texel is one SSE register
+SIMD_TARGET("sse4.1") inline void mip_horizontal_sse4(const float* source, const int source_width, const mip_taps& taps, const int width, const int first_row, const int end_row, float* out)
+{
+	for (auto y = first_row; y < end_row; y++)
+	{
+		const auto* const row = source + static_cast<size_t>(y) * source_width * 4;
+		auto* const target = out + static_cast<size_t>(y) * width * 4;
+		for (auto x = 0; x < width; x++)
+		{
+			const auto* const source_taps = &taps.source[x * taps.count];
+			const auto* const weights = &taps.weight[x * taps.count];
+			auto sum = _mm_setzero_ps();
+			for (auto k = 0; k < taps.count; k++)
+				sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[k]), _mm_loadu_ps(row + source_taps[k] * 4)));
+			_mm_storeu_ps(target + x * 4, sum);
+		}
+	}
+}
+
+SIMD_TARGET("sse4.1") inline void mip_vertical_sse4(const float* source, const size_t floats, const mip_taps& taps, const int first_row, const int end_row, float* out)
+{
+	for (auto y = first_row; y < end_row; y++)
+	{
+		const auto* const source_taps = &taps.source[y * taps.count];
+		const auto* const weights = &taps.weight[y * taps.count];
+		auto* const target = out + y * floats;
+
+		size_t i = 0;
+		for (; i + 4 <= floats; i += 4)
+		{
+			auto sum = _mm_setzero_ps();
+			for (auto k = 0; k < taps.count; k++)
+				sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[k]), _mm_loadu_ps(source + source_taps[k] * floats + i)));
+			_mm_storeu_ps(target + i, sum);
+		}
+		for (; i < floats; i++)
+		{
+			auto sum = 0.0f;
+			for (auto k = 0; k < taps.count; k++)
+				sum += weights[k] * source[source_taps[k] * floats + i];
+			target[i] = sum;
+		}
+	}
+}
+
+// two texels of the narrowed row at once, one in each half of the register
+SIMD_TARGET("avx2") inline void mip_horizontal_avx2(const float* source, const int source_width, const mip_taps& taps, const int width, const int first_row, const int end_row, float* out)
+{
+	for (auto y = first_row; y < end_row; y++)
+	{
+		const auto* const row = source + static_cast<size_t>(y) * source_width * 4;
+		auto* const target = out + static_cast<size_t>(y) * width * 4;
+		auto x = 0;
+		for (; x + 2 <= width; x += 2)
+		{
+			const auto* const source_taps = &taps.source[x * taps.count];
+			const auto* const weights = &taps.weight[x * taps.count];
+			auto sum = _mm256_setzero_ps();
+			for (auto k = 0; k < taps.count; k++)
+			{
+				const auto texels = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(row + source_taps[k] * 4)), _mm_loadu_ps(row + source_taps[taps.count + k] * 4), 1);
+				const auto weight = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_set1_ps(weights[k])), _mm_set1_ps(weights[taps.count + k]), 1);
+				sum = _mm256_add_ps(sum, _mm256_mul_ps(weight, texels));
+			}
+			_mm256_storeu_ps(target + x * 4, sum);
+		}
+		if (x < width)
+		{
+			const auto* const source_taps = &taps.source[x * taps.count];
+			const auto* const weights = &taps.weight[x * taps.count];
+			auto sum = _mm_setzero_ps();
+			for (auto k = 0; k < taps.count; k++)
+				sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[k]), _mm_loadu_ps(row + source_taps[k] * 4)));
+			_mm_storeu_ps(target + x * 4, sum);
+		}
+	}
+	_mm256_zeroupper();
+}
+
+SIMD_TARGET("avx2") inline void mip_vertical_avx2(const float* source, const size_t floats, const mip_taps& taps, const int first_row, const int end_row, float* out)
+{
+	for (auto y = first_row; y < end_row; y++)
+	{
+		const auto* const source_taps = &taps.source[y * taps.count];
+		const auto* const weights = &taps.weight[y * taps.count];
+		auto* const target = out + y * floats;
+
+		size_t i = 0;
+		for (; i + 8 <= floats; i += 8)
+		{
+			auto sum = _mm256_setzero_ps();
+			for (auto k = 0; k < taps.count; k++)
+				sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(weights[k]), _mm256_loadu_ps(source + source_taps[k] * floats + i)));
+			_mm256_storeu_ps(target + i, sum);
+		}
+		for (; i + 4 <= floats; i += 4)
+		{
+			auto sum = _mm_setzero_ps();
+			for (auto k = 0; k < taps.count; k++)
+				sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[k]), _mm_loadu_ps(source + source_taps[k] * floats + i)));
+			_mm_storeu_ps(target + i, sum);
+		}
+		for (; i < floats; i++)
+		{
+			auto sum = 0.0f;
+			for (auto k = 0; k < taps.count; k++)
+				sum += weights[k] * source[source_taps[k] * floats + i];
+			target[i] = sum;
+		}
+	}
+	_mm256_zeroupper();
+}
+#endif
+
+SIMD_EXACT_END
+
+inline void mip_horizontal(const float* source, const int source_width, const mip_taps& taps, const int width, const int first_row, const int end_row, float* out)
+{
+#ifdef SIMD_X86
+	typedef void (*kernel)(const float*, int, const mip_taps&, int, int, int, float*);
+	static const kernel variants[simd_level_count] = { mip_horizontal_scalar, mip_horizontal_sse4, mip_horizontal_avx2, nullptr };
+	dispatch_kernel(kernel_mip_horizontal, variants)(source, source_width, taps, width, first_row, end_row, out);
+#else
+	mip_horizontal_scalar(source, source_width, taps, width, first_row, end_row, out);
+#endif
+}
+
+inline void mip_vertical(const float* source, const size_t floats, const mip_taps& taps, const int first_row, const int end_row, float* out)
+{
+#ifdef SIMD_X86
+	typedef void (*kernel)(const float*, size_t, const mip_taps&, int, int, float*);
+	static const kernel variants[simd_level_count] = { mip_vertical_scalar, mip_vertical_sse4, mip_vertical_avx2, nullptr };
+	dispatch_kernel(kernel_mip_vertical, variants)(source, floats, taps, first_row, end_row, out);
+#else
+	mip_vertical_scalar(source, floats, taps, first_row, end_row, out);
+#endif
+}
+
+// the whole mip chain of an image, level 0 first. pixels has channels channels of 8 bits; with srgb set
+// the colors are sRGB encoded and are averaged as linear light, alpha, the last of two or four channels,
+// always being linear. Every level is filtered from the one before it in bands of rows, which jobs run
+// in parallel
+inline std::vector<std::vector<unsigned char>> build_mip_chain(job_system& jobs, const unsigned char* pixels, const int width, const int height, const int channels, const bool srgb, const mip_filter filter)
+{
+	const auto& tables = get_srgb_tables();
+	const size_t band = 16;
+	const auto colors = channels == 2 ? 1 : std::min(channels, 3);
+
+	std::vector<std::vector<unsigned char>> levels(mip_level_count(width, height));
+	levels[0].assign(pixels, pixels + static_cast<size_t>(width) * height * channels);
+
+	std::vector<float> level(static_cast<size_t>(width) * height * 4);
+	jobs.parallel_for(height, band, [&](const size_t begin, const size_t end)
+	{
+		for (auto texel = begin * width; texel < end * width; texel++)
+		{
+			for (auto c = 0; c < 4; c++)
+			{
+				const auto value = c < channels ? pixels[texel * channels + c] : 255;
+				level[texel * 4 + c] = srgb && c < colors ? tables.decode[value] : value / 255.0f;
+			}
+		}
+	});
+
+	auto level_width = width, level_height = height;
+	std::vector<float> narrowed, next;
+	for (size_t l = 1; l < levels.size(); l++)
+	{
+		const auto next_width = std::max(1, level_width / 2);
+		const auto next_height = std::max(1, level_height / 2);
+		const auto horizontal = make_mip_taps(level_width, next_width, filter);
+		const auto vertical = make_mip_taps(level_height, next_height, filter);
+
+		narrowed.resize(static_cast<size_t>(next_width) * level_height * 4);
+		jobs.parallel_for(level_height, band, [&](const size_t begin, const size_t end)
+		{
+			mip_horizontal(level.data(), level_width, horizontal, next_width, static_cast<int>(begin), static_cast<int>(end), narrowed.data());
+		});
+
+		next.resize(static_cast<size_t>(next_width) * next_height * 4);
+		auto& out = levels[l];
+		out.resize(static_cast<size_t>(next_width) * next_height * channels);
+		jobs.parallel_for(next_height, band, [&](const size_t begin, const size_t end)
+		{
+			mip_vertical(narrowed.data(), static_cast<size_t>(next_width) * 4, vertical, static_cast<int>(begin), static_cast<int>(end), next.data());
+
+			// the kaiser lobes can overshoot, values are clamped before they are encoded or filtered again
+			for (auto texel = begin * next_width; texel < end * next_width; texel++)
+			{
+				for (auto c = 0; c < 4; c++)
+				{
+					const auto value = std::min(1.0f, std::max(0.0f, next[texel * 4 + c]));
+					next[texel * 4 + c] = value;
+					if (c < channels)
+					{
+						out[texel * channels + c] = srgb && c < colors
+							? tables.encode[static_cast<int>(value * srgb_tables::encode_steps + 0.5f)]
+							: static_cast<unsigned char>(value * 255.0f + 0.5f);
+					}
+				}
+			}
+		});
+
+		level.swap(next);
+		level_width = next_width;
+		level_height = next_height;
+	}
+
+	return levels;
+}
+
+#endif
@@ -0,0 +1,484 @@
+#ifndef OCCLUSION_CULLING_H
+#define OCCLUSION_CULLING_H
+
+#include <glm.hpp>
+#include <Culling.h>
+#include <SimdMath.h>
+#include <CpuFeatures.h>
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+SIMD_EXACT_BEGIN
+
+// the kernels the occlusion buffer spends its time in, with a variant for each SIMD level.
+// rasterize_row keeps the nearest depth for the pixel centers of a row inside a triangle, between
+// columns x0 and x1. Edge e of a pixel is step_x[e] * x + edge[e] and its depth depth_x * x + depth,
+// with the y terms of the row already in edge and depth. Columns are gone through in whole groups of
+// lanes, which a row of whole tiles always has room for, the ones outside x0 to x1 left alone
+inline void rasterize_row_scalar(float* row, const int x0, const int x1, const glm::vec3& step_x, const glm::vec3& edge, const float depth_x, const float depth)
+{
+	for (auto x = x0; x <= x1; x++)
+	{
+		const auto pixel_x = x + 0.5f;
+		if (step_x.x * pixel_x + edge.x >= 0.0f && step_x.y * pixel_x + edge.y >= 0.0f && step_x.z * pixel_x + edge.z >= 0.0f)
+			row[x] = std::min(row[x], depth_x * pixel_x + depth);
+	}
+}
+
+// tile_row_farthest writes the farthest depth of every tile in a row of tiles_x 8x8 tiles, the rows of
+// the tiles width floats apart
+inline void tile_row_farthest_scalar(const float* rows, const int width, const int tiles_x, float* farthest)
+{
+	for (auto tile_x = 0; tile_x < tiles_x; tile_x++)
+	{
+		auto tile_farthest = 0.0f;
+		for (auto y = 0; y < 8; y++)
+			for (auto x = 0; x < 8; x++)
+				tile_farthest = std::max(tile_farthest, rows[y * width + tile_x * 8 + x]);
+		farthest[tile_x] = tile_farthest;
+	}
+}
+
+#ifdef SIMD_X86
+SIMD_TARGET("ssse3,sse4.1") inline void rasterize_row_sse4(float* row, const int x0, const int x1, const glm::vec3& step_x, const glm::vec3& edge, const float depth_x, const float depth)
+{
+	const auto lane_offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+	const auto first = _mm_set1_ps(x0 + 0.5f), last = _mm_set1_ps(x1 + 0.5f);
+	for (auto x = x0 / 4 * 4; x <= x1; x += 4)
+	{
+		const auto pixel_x = _mm_add_ps(_mm_set1_ps(static_cast<float>(x)), lane_offsets);
+		const auto edge0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(step_x.x), pixel_x), _mm_set1_ps(edge.x));
+		const auto edge1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(step_x.y), pixel_x), _mm_set1_ps(edge.y));
+		const auto edge2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(step_x.z), pixel_x), _mm_set1_ps(edge.z));
+		auto inside = _mm_and_ps(_mm_cmpge_ps(pixel_x, first), _mm_cmple_ps(pixel_x, last));
+		inside = _mm_and_ps(inside, _mm_and_ps(_mm_cmpge_ps(edge0, _mm_setzero_ps()), _mm_cmpge_ps(edge1, _mm_setzero_ps())));
+		inside = _mm_and_ps(inside, _mm_cmpge_ps(edge2, _mm_setzero_ps()));
+		if (_mm_movemask_ps(inside) == 0)
+			continue;
+
+		const auto z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(depth_x), pixel_x), _mm_set1_ps(depth));
+		const auto current = _mm_loadu_ps(row + x);
+		_mm_storeu_ps(row + x, _mm_blendv_ps(current, _mm_min_ps(current, z), inside));
+	}
+}
+
+SIMD_TARGET("ssse3,sse4.1") inline void tile_row_farthest_sse4(const float* rows, const int width, const int tiles_x, float* farthest)
+{
+	for (auto tile_x = 0; tile_x < tiles_x; tile_x++)
+	{
+		const auto* row = rows + tile_x * 8;
+		auto tile_farthest = _mm_setzero_ps();
+		for (auto y = 0; y < 8; y++)
+			tile_farthest = _mm_max_ps(tile_farthest, _mm_max_ps(_mm_loadu_ps(row + y * width), _mm_loadu_ps(row + y * width + 4)));
+		auto quad = _mm_max_ps(tile_farthest, _mm_movehl_ps(tile_farthest, tile_farthest));
+		quad = _mm_max_ss(quad, _mm_shuffle_ps(quad, quad, 1));
+		farthest[tile_x] = _mm_cvtss_f32(quad);
+	}
+}
+
+SIMD_TARGET("avx2") inline void rasterize_row_avx2(float* row, const int x0, const int x1, const glm::vec3& step_x, const glm::vec3& edge, const float depth_x, const float depth)
+{
+	const auto lane_offsets = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+	const auto first = _mm256_set1_ps(x0 + 0.5f), last = _mm256_set1_ps(x1 + 0.5f);
+	for (auto x = x0 / 8 * 8; x <= x1; x += 8)
+	{
+		const auto pixel_x = _mm256_add_ps(_mm256_set1_ps(static_cast<float>(x)), lane_offsets);
+		const auto edge0 = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(step_x.x), pixel_x), _mm256_set1_ps(edge.x));
+		const auto edge1 = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(step_x.y), pixel_x), _mm256_set1_ps(edge.y));
+		const auto edge2 = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(step_x.z), pixel_x), _mm256_set1_ps(edge.z));
+		auto inside = _mm256_and_ps(_mm256_cmp_ps(pixel_x, first, _CMP_GE_OQ), _mm256_cmp_ps(pixel_x, last, _CMP_LE_OQ));
+		inside = _mm256_and_ps(inside, _mm256_and_ps(_mm256_cmp_ps(edge0, _mm256_setzero_ps(), _CMP_GE_OQ), _mm256_cmp_ps(edge1, _mm256_setzero_ps(), _CMP_GE_OQ)));
+		inside = _mm256_and_ps(inside, _mm256_cmp_ps(edge2, _mm256_setzero_ps(), _CMP_GE_OQ));
+		if (_mm256_movemask_ps(inside) == 0)
+			continue;
+
+		const auto z = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(depth_x), pixel_x), _mm256_set1_ps(depth));
+		const auto current = _mm256_loadu_ps(row + x);
+		_mm256_storeu_ps(row + x, _mm256_blendv_ps(current, _mm256_min_ps(current, z), inside));
+	}
+	_mm256_zeroupper();
+}
+
+// a whole tile row at once, one 8 float load per row of a tile
+SIMD_TARGET("avx2") inline void tile_row_farthest_avx2(const float* rows, const int width, const int tiles_x, float* farthest)
+{
+	for (auto tile_x = 0; tile_x < tiles_x; tile_x++)
+	{
+		const auto* row = rows + tile_x * 8;
+		auto tile_farthest = _mm256_setzero_ps();
+		for (auto y = 0; y < 8; y++)
+			tile_farthest = _mm256_max_ps(tile_farthest, _mm256_loadu_ps(row + y * width));
+		const auto half = _mm_max_ps(_mm256_castps256_ps128(tile_farthest), _mm256_extractf128_ps(tile_farthest, 1));
+		auto quad = _mm_max_ps(half, _mm_movehl_ps(half, half));
+		quad = _mm_max_ss(quad, _mm_shuffle_ps(quad, quad, 1));
+		farthest[tile_x] = _mm_cvtss_f32(quad);
+	}
+	_mm256_zeroupper();
+}
+
+// sixteen pixels at a time from x0 itself, the columns past x1 masked off instead of rounded to
+SIMD_TARGET("avx512f,avx512bw,avx512dq,avx512vl") inline void rasterize_row_avx512(float* row, const int x0, const int x1, const glm::vec3& step_x, const glm::vec3& edge, const float depth_x, const float depth)
+{
+	const auto lane_offsets = _mm512_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f, 8.5f, 9.5f, 10.5f, 11.5f, 12.5f, 13.5f, 14.5f, 15.5f);
+	for (auto x = x0; x <= x1; x += 16)
+	{
+		const auto columns = x1 - x + 1;
+		const auto in_row = static_cast<__mmask16>(columns >= 16 ? 0xffff : (1u << columns) - 1);
+		const auto pixel_x = _mm512_add_ps(_mm512_set1_ps(static_cast<float>(x)), lane_offsets);
+		const auto edge0 = _mm512_add_ps(_mm512_mul_ps(_mm512_set1_ps(step_x.x), pixel_x), _mm512_set1_ps(edge.x));
+		const auto edge1 = _mm512_add_ps(_mm512_mul_ps(_mm512_set1_ps(step_x.y), pixel_x), _mm512_set1_ps(edge.y));
+		const auto edge2 = _mm512_add_ps(_mm512_mul_ps(_mm512_set1_ps(step_x.z), pixel_x), _mm512_set1_ps(edge.z));
+		auto inside = _mm512_mask_cmp_ps_mask(in_row, edge0, _mm512_setzero_ps(), _CMP_GE_OQ);
+		inside = _mm512_mask_cmp_ps_mask(inside, edge1, _mm512_setzero_ps(), _CMP_GE_OQ);
+		inside = _mm512_mask_cmp_ps_mask(inside, edge2, _mm512_setzero_ps(), _CMP_GE_OQ);
+		if (inside == 0)
+			continue;
+
+		const auto z = _mm512_add_ps(_mm512_mul_ps(_mm512_set1_ps(depth_x), pixel_x), _mm512_set1_ps(depth));
+		const auto current = _mm512_maskz_loadu_ps(inside, row + x);
+		_mm512_mask_storeu_ps(row + x, inside, _mm512_min_ps(current, z));
+	}
+	_mm256_zeroupper();
+}
+#endif
+
+SIMD_EXACT_END
+
+inline void rasterize_row(float* row, const int x0, const int x1, const glm::vec3& step_x, const glm::vec3& edge, const float depth_x, const float depth)
+{
+#ifdef SIMD_X86
+	typedef void (*kernel)(float*, int, int, const glm::vec3&, const glm::vec3&, float, float);
+	static const kernel variants[simd_level_count] = { rasterize_row_scalar, rasterize_row_sse4, rasterize_row_avx2, rasterize_row_avx512 };
+	dispatch_kernel(kernel_rasterize_row, variants)(row, x0, x1, step_x, edge, depth_x, depth);
+#else
+	rasterize_row_scalar(row, x0, x1, step_x, edge, depth_x, depth);
+#endif
+}
+
+inline void tile_row_farthest(const float* rows, const int width, const int tiles_x, float* farthest)
+{
+#ifdef SIMD_X86
+	typedef void (*kernel)(const float*, int, int, float*);
+	static const kernel variants[simd_level_count] = { tile_row_farthest_scalar, tile_row_farthest_sse4, tile_row_farthest_avx2, nullptr };
+	dispatch_kernel(kernel_tile_row_farthest, variants)(rows, width, tiles_x, farthest);
+#else
+	tile_row_farthest_scalar(rows, width, tiles_x, farthest);
+#endif
+}
+
+// low resolution depth buffer the occluders are rasterized into on the CPU. Depth is the window depth
+// in [0, 1] (1 is the far plane), rows go bottom to top like the GL framebuffer. Every 8x8 tile also
+// keeps the farthest depth it contains, so most box tests are answered without touching pixels
+class occlusion_buffer
+{
+public:
+	static const int tile_size = 8;
+
+	int width = 0;
+	int height = 0;
+	std::vector<float> depth;
+	std::vector<float> tile_max;
+
+	// width and height are rounded up to whole tiles
+	void resize(const int width, const int height)
+	{
+		this->width = (width + tile_size - 1) / tile_size * tile_size;
+		this->height = (height + tile_size - 1) / tile_size * tile_size;
+		depth.assign(static_cast<size_t>(this->width) * this->height, 1.0f);
+		tile_max.assign(static_cast<size_t>(this->width / tile_size) * (this->height / tile_size), 1.0f);
+	}
+
+	void clear()
+	{
+		std::fill(depth.begin(), depth.end(), 1.0f);
+		std::fill(tile_max.begin(), tile_max.end(), 1.0f);
+	}
+
+	// rasterizes a triangle given in clip space, clipping it against the near plane first
+	void rasterize_triangle(const glm::vec4& a, const glm::vec4& b, const glm::vec4& c)
+	{
+		const glm::vec4 input[3] = { a, b, c };
+		glm::vec4 clipped[4];
+		auto count = 0;
+
+		// Sutherland-Hodgman against z >= -w, the only plane that matters before the divide
+		for (auto i = 0; i < 3; i++)
+		{
+			const auto& current = input[i];
+			const auto& next = input[(i + 1) % 3];
+			const auto current_distance = current.z + current.w;
+			const auto next_distance = next.z + next.w;
+
+			if (current_distance >= 0.0f)
+				clipped[count++] = current;
+			if ((current_distance >= 0.0f) != (next_distance >= 0.0f))
+				clipped[count++] = glm::mix(current, next, current_distance / (current_distance - next_distance));
+		}
+
+		if (count < 3)
+			return;
+
+		glm::vec3 screen[4];
+		for (auto i = 0; i < count; i++)
+			screen[i] = to_screen(clipped[i]);
+
+		draw_triangle(screen[0], screen[1], screen[2]);
+		if (count == 4)
+			draw_triangle(screen[0], screen[2], screen[3]);
+	}
+
+	// refreshes the per tile farthest depth, call once every occluder has been rasterized
+	void update_hierarchy()
+	{
+		const auto tiles_x = width / tile_size;
+		for (auto tile_y = 0; tile_y < height / tile_size; tile_y++)
+			tile_row_farthest(&depth[static_cast<size_t>(tile_y) * tile_size * width], width, tiles_x, &tile_max[tile_y * tiles_x]);
+	}
+
+	// false only when every pixel the box covers already holds something nearer than the box
+	bool is_box_visible(const glm::mat4& view_projection, const glm::vec3& center, const glm::vec3& extent) const
+	{
+		glm::vec2 screen_min(FLT_MAX), screen_max(-FLT_MAX);
+		auto nearest = FLT_MAX;
+		for (auto corner = 0; corner < 8; corner++)
+		{
+			const glm::vec3 offset(corner & 1 ? extent.x : -extent.x, corner & 2 ? extent.y : -extent.y, corner & 4 ? extent.z : -extent.z);
+			const auto clip = view_projection * glm::vec4(center + offset, 1.0f);
+
+			// boxes crossing the near plane are too close to judge from their projection
+			if (clip.z < -clip.w || clip.w <= 0.0f)
+				return true;
+
+			const auto screen = to_screen(clip);
+			screen_min = glm::min(screen_min, glm::vec2(screen));
+			screen_max = glm::max(screen_max, glm::vec2(screen));
+			nearest = std::min(nearest, screen.z);
+		}
+
+		const auto x0 = std::max(0, static_cast<int>(std::floor(screen_min.x)));
+		const auto y0 = std::max(0, static_cast<int>(std::floor(screen_min.y)));
+		const auto x1 = std::min(width - 1, static_cast<int>(std::ceil(screen_max.x)));
+		const auto y1 = std::min(height - 1, static_cast<int>(std::ceil(screen_max.y)));
+		if (x0 > x1 || y0 > y1)
+			return true;
+
+		const auto tiles_x = width / tile_size;
+		for (auto tile_y = y0 / tile_size; tile_y <= y1 / tile_size; tile_y++)
+		{
+			for (auto tile_x = x0 / tile_size; tile_x <= x1 / tile_size; tile_x++)
+			{
+				// the whole tile is nearer than the box, nothing to see there
+				if (tile_max[tile_y * tiles_x + tile_x] < nearest)
+					continue;
+
+				const auto row_begin = std::max(y0, tile_y * tile_size);
+				const auto row_end = std::min(y1, tile_y * tile_size + tile_size - 1);
+				const auto column_begin = std::max(x0, tile_x * tile_size);
+				const auto column_end = std::min(x1, tile_x * tile_size + tile_size - 1);
+				for (auto y = row_begin; y <= row_end; y++)
+				{
+					for (auto x = column_begin; x <= column_end; x++)
+					{
+						if (depth[static_cast<size_t>(y) * width + x] >= nearest)
+							return true;
+					}
+				}
+			}
+		}
+
+		return false;
+	}
+
+private:
+	glm::vec3 to_screen(const glm::vec4& clip) const
+	{
+		const auto ndc = glm::vec3(clip) / clip.w;
+		return glm::vec3((ndc.x * 0.5f + 0.5f) * width, (ndc.y * 0.5f + 0.5f) * height, ndc.z * 0.5f + 0.5f);
+	}
+
+	// keeps the nearest depth for every pixel center inside the triangle, several pixels of a row at once
+	void draw_triangle(glm::vec3 a, glm::vec3 b, glm::vec3 c)
+	{
+		auto area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+		if (std::abs(area) < 1e-8f)
+			return;
+
+		// occluders are drawn from both sides, so just make the winding counter clockwise
+		if (area < 0.0f)
+		{
+			std::swap(b, c);
+			area = -area;
+		}
+
+		const auto x0 = std::max(0, static_cast<int>(std::floor(std::min(a.x, std::min(b.x, c.x)))));
+		const auto y0 = std::max(0, static_cast<int>(std::floor(std::min(a.y, std::min(b.y, c.y)))));
+		const auto x1 = std::min(width - 1, static_cast<int>(std::ceil(std::max(a.x, std::max(b.x, c.x)))));
+		const auto y1 = std::min(height - 1, static_cast<int>(std::ceil(std::max(a.y, std::max(b.y, c.y)))));
+		if (x0 > x1 || y0 > y1)
+			return;
+
+		// edge functions e = step_x * x + step_y * y + offset, positive inside, one per edge
+		const glm::vec3 step_x(b.y - c.y, c.y - a.y, a.y - b.y);
+		const glm::vec3 step_y(c.x - b.x, a.x - c.x, b.x - a.x);
+		const glm::vec3 offset(b.x * c.y - c.x * b.y, c.x * a.y - a.x * c.y, a.x * b.y - b.x * a.y);
+
+		// depth is affine in screen space after the perspective divide
+		const auto depth_x = ((b.z - a.z) * (c.y - a.y) - (c.z - a.z) * (b.y - a.y)) / area;
+		const auto depth_y = ((c.z - a.z) * (b.x - a.x) - (b.z - a.z) * (c.x - a.x)) / area;
+		const auto depth_offset = a.z - depth_x * a.x - depth_y * a.y;
+
+		for (auto y = y0; y <= y1; y++)
+		{
+			const auto pixel_y = y + 0.5f;
+			const auto edge = step_y * pixel_y + offset;
+			rasterize_row(&depth[static_cast<size_t>(y) * width], x0, x1, step_x, edge, depth_x, depth_y * pixel_y + depth_offset);
+		}
+	}
+};
+
+// rasterizes the occluders of a frame on its own thread while the main thread does frustum culling.
+// An occluder is a triangle list in local space placed by any number of transforms
+class occlusion_culler
+{
+public:
+	occlusion_buffer buffer;
+	float raster_milliseconds = 0.0f;
+
+	void start(const int width, const int height)
+	{
+		buffer.resize(width, height);
+		worker = std::thread([this] { run(); });
+	}
+
+	void stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			quit = true;
+		}
+		wake.notify_all();
+		if (worker.joinable())
+			worker.join();
+	}
+
+	// hands the occluders of this frame to the worker, the placements are copied
+	void begin_frame(const glm::mat4& view_projection, const std::vector<glm::vec3>* triangles, const std::vector<glm::mat4>& placements)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			this->view_projection = view_projection;
+			this->triangles = triangles;
+			this->placements = placements;
+			pending = true;
+			done = false;
+		}
+		wake.notify_all();
+	}
+
+	// blocks until the occluders handed over by begin_frame are in the buffer
+	void wait()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		finished.wait(lock, [this] { return done || !pending; });
+	}
+
+	// removes the occluded entries from indices, returns how many are left
+	uint32_t filter_visible(const cull_set& set, uint32_t* indices, const uint32_t count) const
+	{
+		uint32_t visible = 0;
+		for (uint32_t i = 0; i < count; i++)
+		{
+			const auto index = indices[i];
+			const glm::vec3 center(set.center_x[index], set.center_y[index], set.center_z[index]);
+			const glm::vec3 extent(set.extent_x[index], set.extent_y[index], set.extent_z[index]);
+			indices[visible] = index;
+			visible += buffer.is_box_visible(view_projection, center, extent) ? 1 : 0;
+		}
+
+		return visible;
+	}
+
+private:
+	std::thread worker;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable finished;
+	bool pending = false;
+	bool done = false;
+	bool quit = false;
+
+	glm::mat4 view_projection = glm::mat4(1.0f);
+	const std::vector<glm::vec3>* triangles = nullptr;
+	std::vector<glm::mat4> placements;
+
+	// the worker's own: the vertices of the triangles it last saw, the placements times view_projection
+	// and the vertices of one placement in clip space
+	const std::vector<glm::vec3>* local_triangles = nullptr;
+	point_set local_points;
+	std::vector<glm::mat4> transforms;
+	point_set clip_points;
+
+	glm::vec4 clip_vertex(const size_t i) const
+	{
+		return glm::vec4(clip_points.x[i], clip_points.y[i], clip_points.z[i], clip_points.w[i]);
+	}
+
+	void run()
+	{
+		for (;;)
+		{
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [this] { return (pending && !done) || quit; });
+				if (quit)
+					return;
+			}
+
+			const auto start = std::chrono::steady_clock::now();
+
+			buffer.clear();
+			if (triangles != nullptr)
+			{
+				if (triangles != local_triangles)
+				{
+					local_triangles = triangles;
+					resize_point_set(local_points, triangles->size());
+					for (size_t i = 0; i < triangles->size(); i++)
+					{
+						local_points.x[i] = (*triangles)[i].x;
+						local_points.y[i] = (*triangles)[i].y;
+						local_points.z[i] = (*triangles)[i].z;
+					}
+				}
+
+				// every placement's vertices go to clip space in one batch before its triangles are drawn
+				transforms.resize(placements.size());
+				multiply_matrices(view_projection, placements.data(), transforms.data(), placements.size());
+				for (const auto& transform : transforms)
+				{
+					transform_points(transform, local_points, clip_points);
+					for (size_t i = 0; i + 2 < clip_points.x.size(); i += 3)
+						buffer.rasterize_triangle(clip_vertex(i), clip_vertex(i + 1), clip_vertex(i + 2));
+				}
+			}
+			buffer.update_hierarchy();
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				raster_milliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+				done = true;
+			}
+			finished.notify_all();
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,150 @@
+#ifndef OCCLUSION_QUERIES_H
+#define OCCLUSION_QUERIES_H
+
+#include <GL/glew.h>
+
+#include <cstdint>
+#include <vector>
+
+// what to do with an object this frame given the queries issued on its box in earlier frames
+enum query_decision
+{
+	query_draw, // visible last frame or never tested, draw it normally
+	query_conditional, // the query is still in flight, let the GPU decide with conditional rendering
+	query_skip // its box was fully hidden last frame
+};
+
+// GPU occlusion queries on object bounding boxes with one frame of latency. Results are only read once
+// the GPU reports them available, so the CPU never waits; an object whose result is still in flight is
+// drawn under glBeginConditionalRender with GL_QUERY_NO_WAIT, which never stalls either. Query objects
+// come from a pool and go back to it as soon as their result has been read
+class occlusion_queries
+{
+public:
+	GLenum target = GL_ANY_SAMPLES_PASSED;
+
+	// counters of the latest frame
+	uint32_t issued = 0;
+	uint32_t skipped = 0;
+	uint32_t conditional = 0;
+
+	void create(const size_t object_count)
+	{
+		// the conservative target lets the GPU answer from coarse depth, it only exists from 4.3 or ES3 compatibility
+		target = GLEW_VERSION_4_3 || GLEW_ARB_ES3_compatibility ? GL_ANY_SAMPLES_PASSED_CONSERVATIVE : GL_ANY_SAMPLES_PASSED;
+		states.assign(object_count, query_state{ 0, 0, 0, false });
+		frame = 1;
+	}
+
+	void destroy()
+	{
+		if (!queries.empty())
+			glDeleteQueries(static_cast<GLsizei>(queries.size()), queries.data());
+		queries.clear();
+		free_queries.clear();
+		waiting.clear();
+		states.clear();
+	}
+
+	// picks up every result the GPU has finished since the last frame
+	void begin_frame()
+	{
+		frame++;
+		issued = skipped = conditional = 0;
+
+		size_t still_waiting = 0;
+		for (const auto object : waiting)
+		{
+			auto& state = states[object];
+			GLuint available = 0;
+			glGetQueryObjectuiv(state.query, GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available)
+			{
+				waiting[still_waiting++] = object;
+				continue;
+			}
+
+			GLuint passed = 0;
+			glGetQueryObjectuiv(state.query, GL_QUERY_RESULT, &passed);
+			state.visible = passed != 0;
+			state.result_frame = state.issued_frame;
+			free_queries.push_back(state.query);
+			state.query = 0;
+		}
+		waiting.resize(still_waiting);
+	}
+
+	// results older than last frame say nothing about now, so those objects are simply drawn
+	query_decision decide(const uint32_t object)
+	{
+		const auto& state = states[object];
+		if (state.query != 0)
+		{
+			conditional++;
+			return query_conditional;
+		}
+		if (state.result_frame + 1 == frame && !state.visible)
+		{
+			skipped++;
+			return query_skip;
+		}
+		return query_draw;
+	}
+
+	// query still in flight for the object, 0 when there is none
+	GLuint pending_query(const uint32_t object) const
+	{
+		return states[object].query;
+	}
+
+	// a new query is only issued once the previous one has been read back
+	bool needs_query(const uint32_t object) const
+	{
+		return states[object].query == 0;
+	}
+
+	// wrap the draw of the object's bounding box between begin_query and end_query
+	void begin_query(const uint32_t object)
+	{
+		if (free_queries.empty())
+		{
+			const auto first = queries.size();
+			queries.resize(first + pool_growth);
+			glGenQueries(pool_growth, &queries[first]);
+			free_queries.insert(free_queries.end(), queries.begin() + first, queries.end());
+		}
+
+		auto& state = states[object];
+		state.query = free_queries.back();
+		state.issued_frame = frame;
+		free_queries.pop_back();
+		waiting.push_back(object);
+		issued++;
+
+		glBeginQuery(target, state.query);
+	}
+
+	void end_query() const
+	{
+		glEndQuery(target);
+	}
+
+private:
+	static const int pool_growth = 64;
+
+	typedef struct
+	{
+		GLuint query;
+		uint32_t issued_frame;
+		uint32_t result_frame;
+		bool visible;
+	} query_state;
+
+	uint32_t frame = 1;
+	std::vector<query_state> states;
+	std::vector<GLuint> queries;
+	std::vector<GLuint> free_queries;
+	std::vector<uint32_t> waiting;
+};
+
+#endif
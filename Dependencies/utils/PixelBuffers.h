@@ -0,0 +1,220 @@
+#ifndef PIXEL_BUFFERS_H
+#define PIXEL_BUFFERS_H
+
+#include <GL/glew.h>
+
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+// a ring of pixel unpack buffers that texture bands are staged through. A band is copied into a mapped
+// buffer and the texture reads it from there, so the call returns right away and the driver moves the
+// band to the GPU on its own time instead of copying it out of client memory first. Every buffer is
+// fenced after its upload and only written again once the GPU has read it, a band that finds the next
+// buffer still being read is read from memory instead of waiting for it. Belongs to the thread whose
+// context made it
+class pixel_buffer_pool
+{
+public:
+	size_t staged = 0; // bands that went through the buffers
+	size_t staged_bytes = 0;
+	size_t direct = 0; // bands larger than a buffer or finding it busy, read from memory as before
+	size_t busy = 0; // times the next buffer was still being read
+	size_t written = 0; // bands a job had already written into a staging_buffer, nothing copied here
+
+	void create(const int count, const GLsizeiptr buffer_size)
+	{
+		this->buffer_size = buffer_size;
+		buffers.assign(count, 0);
+		fences.assign(count, nullptr);
+		next = 0;
+
+		glGenBuffers(count, buffers.data());
+		for (const auto buffer : buffers)
+		{
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, buffer_size, nullptr, GL_STREAM_DRAW);
+		}
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	}
+
+	void destroy()
+	{
+		for (auto& fence : fences)
+		{
+			if (fence != nullptr)
+				glDeleteSync(fence);
+			fence = nullptr;
+		}
+
+		if (!buffers.empty())
+			glDeleteBuffers(static_cast<GLsizei>(buffers.size()), buffers.data());
+		buffers.clear();
+	}
+
+	// calls upload with where the GL call should read the bytes of data from: the start of the bound
+	// unpack buffer they were copied into, or data itself when they do not fit in one
+	template <typename F>
+	void upload(const void* data, const size_t bytes, F upload)
+	{
+		if (buffers.empty() || bytes > static_cast<size_t>(buffer_size))
+		{
+			direct++;
+			upload(data);
+			return;
+		}
+
+		// the upload thread never stalls on the GPU, the driver copies the band out of memory right away
+		auto& fence = fences[next];
+		if (fence != nullptr)
+		{
+			if (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0) == GL_TIMEOUT_EXPIRED)
+			{
+				busy++;
+				direct++;
+				upload(data);
+				return;
+			}
+			glDeleteSync(fence);
+			fence = nullptr;
+		}
+
+		// the fence says the GPU is done with the buffer, so it is written without waiting on the driver
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffers[next]);
+		auto* const mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, static_cast<GLsizeiptr>(bytes), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+		if (mapped == nullptr)
+		{
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			direct++;
+			upload(data);
+			return;
+		}
+
+		std::memcpy(mapped, data, bytes);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		upload(static_cast<const void*>(nullptr));
+		fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+		next = (next + 1) % buffers.size();
+		staged++;
+		staged_bytes += bytes;
+	}
+
+private:
+	GLsizeiptr buffer_size = 0;
+	std::vector<unsigned int> buffers;
+	std::vector<GLsync> fences;
+	size_t next = 0;
+};
+
+// one buffer that all the levels of a texture are staged through at once. The upload thread maps it
+// when it makes the texture's storage, a job writes the texels into it and the bands read them from
+// there, so the upload thread copies nothing. Persistently mapped with GL_ARB_buffer_storage, otherwise
+// mapped until the first band binds it. memory is null when it could not be mapped, the bands are then
+// read from memory through the pool. Made and bound on the upload thread, memory written by one job
+class staging_buffer
+{
+public:
+	unsigned char* memory = nullptr;
+
+	void create(const size_t bytes)
+	{
+		persistent = GLEW_ARB_buffer_storage != 0;
+
+		glGenBuffers(1, &buffer);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+		if (persistent)
+		{
+			const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			glBufferStorage(GL_PIXEL_UNPACK_BUFFER, static_cast<GLsizeiptr>(bytes), nullptr, flags);
+			memory = static_cast<unsigned char*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, static_cast<GLsizeiptr>(bytes), flags));
+		}
+		else
+		{
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, static_cast<GLsizeiptr>(bytes), nullptr, GL_STREAM_DRAW);
+			memory = static_cast<unsigned char*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, static_cast<GLsizeiptr>(bytes), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+		}
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+		mapped = memory != nullptr;
+		if (!mapped)
+			destroy();
+	}
+
+	// the GPU may still be reading it, the driver keeps the storage until it is done
+	void destroy()
+	{
+		if (buffer == 0)
+			return;
+
+		if (mapped)
+		{
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		}
+		glDeleteBuffers(1, &buffer);
+		buffer = 0;
+		memory = nullptr;
+		mapped = false;
+	}
+
+	// whether the bands read from it, with their offsets in it as pointers
+	bool staged() const
+	{
+		return buffer != 0;
+	}
+
+	// as the unpack buffer, unmapped first when the mapping is not persistent
+	void bind()
+	{
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+		if (mapped && !persistent)
+		{
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+			mapped = false;
+		}
+	}
+
+private:
+	unsigned int buffer = 0;
+	bool persistent = false;
+	bool mapped = false;
+};
+
+// the pool of the calling thread, null on threads that upload straight from memory
+inline pixel_buffer_pool*& thread_pixel_buffers()
+{
+	static thread_local pixel_buffer_pool* pool = nullptr;
+	return pool;
+}
+
+// an offset in the bound unpack buffer, which GL takes in place of a pointer
+inline const unsigned char* buffer_offset(const size_t offset)
+{
+	return reinterpret_cast<const unsigned char*>(offset);
+}
+
+// upload is a GL call reading bytes of pixels from the pointer it is given, staged through the calling
+// thread's pixel buffers when it has them. When staging has been staged data is the offset in it that a
+// job already wrote the bytes at, and the call reads them from there
+template <typename F>
+inline void upload_pixels(const void* data, const size_t bytes, F upload, staging_buffer* staging = nullptr)
+{
+	auto* const pool = thread_pixel_buffers();
+	if (staging != nullptr && staging->staged())
+	{
+		staging->bind();
+		upload(data);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		if (pool != nullptr)
+			pool->written++;
+	}
+	else if (pool != nullptr)
+		pool->upload(data, bytes, upload);
+	else
+		upload(data);
+}
+
+#endif
@@ -0,0 +1,216 @@
+#ifndef PORTALS_H
+#define PORTALS_H
+
+#include <glm.hpp>
+#include <CSVReader.h>
+#include <Frustum.h>
+#include <Culling.h>
+#include <Prefab.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// cell index of everything that is not inside a cell
+const int outside_cell = -1;
+
+// deepest chain of portals followed from the camera's cell
+const int max_portal_depth = 8;
+
+// a room, as a box in prefab space
+typedef struct
+{
+	glm::vec3 min;
+	glm::vec3 max;
+} portal_cell;
+
+// an opening between two cells (or a cell and the outside), a convex quad in prefab space
+typedef struct
+{
+	int cells[2];
+	glm::vec3 corners[4];
+} portal;
+
+typedef struct
+{
+	std::vector<portal_cell> cells;
+	std::vector<portal> portals;
+} cell_graph;
+
+// cells file: min and max per cell. Portals file: the two cells then the four corners per portal
+inline cell_graph load_cell_graph(const std::string& cells_file_name, const std::string& portals_file_name)
+{
+	cell_graph graph;
+
+	const auto cells = read_csv_file(cells_file_name);
+	for (size_t i = 0; i + 6 <= cells.size(); i += 6)
+		graph.cells.push_back({ glm::vec3(cells[i], cells[i + 1], cells[i + 2]), glm::vec3(cells[i + 3], cells[i + 4], cells[i + 5]) });
+
+	const auto portals = read_csv_file(portals_file_name);
+	for (size_t i = 0; i + 14 <= portals.size(); i += 14)
+	{
+		portal portal;
+		portal.cells[0] = static_cast<int>(portals[i]);
+		portal.cells[1] = static_cast<int>(portals[i + 1]);
+		for (auto corner = 0; corner < 4; corner++)
+			portal.corners[corner] = glm::vec3(portals[i + 2 + corner * 3], portals[i + 3 + corner * 3], portals[i + 4 + corner * 3]);
+		graph.portals.push_back(portal);
+	}
+
+	return graph;
+}
+
+inline int find_cell(const cell_graph& graph, const glm::vec3& point)
+{
+	for (size_t i = 0; i < graph.cells.size(); i++)
+	{
+		if (glm::all(glm::greaterThanEqual(point, graph.cells[i].min)) && glm::all(glm::lessThanEqual(point, graph.cells[i].max)))
+			return static_cast<int>(i);
+	}
+
+	return outside_cell;
+}
+
+// frustum seeing only through a rectangle of the screen (in normalized device coordinates) and only
+// beyond the given plane, the far plane is kept from base
+inline frustum frustum_from_rect(const glm::mat4& view_projection, const frustum& base, const glm::vec2& rect_min, const glm::vec2& rect_max, const glm::vec4& near_plane)
+{
+	const glm::vec4 row_x(view_projection[0][0], view_projection[1][0], view_projection[2][0], view_projection[3][0]);
+	const glm::vec4 row_y(view_projection[0][1], view_projection[1][1], view_projection[2][1], view_projection[3][1]);
+	const glm::vec4 row_w(view_projection[0][3], view_projection[1][3], view_projection[2][3], view_projection[3][3]);
+
+	frustum result;
+	result.planes[0] = row_x - rect_min.x * row_w;
+	result.planes[1] = rect_max.x * row_w - row_x;
+	result.planes[2] = row_y - rect_min.y * row_w;
+	result.planes[3] = rect_max.y * row_w - row_y;
+	for (auto i = 0; i < 4; i++)
+		result.planes[i] /= glm::length(glm::vec3(result.planes[i]));
+	result.planes[4] = near_plane;
+	result.planes[5] = base.planes[5];
+
+	return result;
+}
+
+// follows the portals out of a cell, narrowing the visible screen rectangle at every one of them, and
+// collects a frustum for every path that reaches the outside
+inline void collect_portal_frusta(const cell_graph& graph, const glm::mat4& transform, const glm::mat4& view_projection, const frustum& base,
+	const glm::vec3& eye, const int cell, const glm::vec2& rect_min, const glm::vec2& rect_max, std::vector<int>& path, std::vector<frustum>& result)
+{
+	for (const auto& portal : graph.portals)
+	{
+		if (portal.cells[0] != cell && portal.cells[1] != cell)
+			continue;
+
+		const auto neighbour = portal.cells[0] == cell ? portal.cells[1] : portal.cells[0];
+		if (std::find(path.begin(), path.end(), neighbour) != path.end())
+			continue;
+
+		glm::vec3 corners[4];
+		for (auto i = 0; i < 4; i++)
+			corners[i] = glm::vec3(transform * glm::vec4(portal.corners[i], 1.0f));
+
+		// the portal plane, facing away from the eye so only what lies past the opening stays inside
+		auto normal = glm::normalize(glm::cross(corners[1] - corners[0], corners[2] - corners[0]));
+		auto plane = glm::vec4(normal, -glm::dot(normal, corners[0]));
+		if (glm::dot(normal, eye) + plane.w > 0.0f)
+			plane = -plane;
+
+		// screen rectangle of the opening, clipped against the near plane first so the part in front of
+		// the eye still narrows the view when the portal passes right by it
+		glm::vec4 clip[4];
+		for (auto i = 0; i < 4; i++)
+			clip[i] = view_projection * glm::vec4(corners[i], 1.0f);
+
+		glm::vec2 portal_min(FLT_MAX), portal_max(-FLT_MAX);
+		for (auto i = 0; i < 4; i++)
+		{
+			const auto& current = clip[i];
+			const auto& next = clip[(i + 1) % 4];
+			const auto current_distance = current.z + current.w;
+			const auto next_distance = next.z + next.w;
+
+			if (current_distance >= 0.0f)
+			{
+				portal_min = glm::min(portal_min, glm::vec2(current) / current.w);
+				portal_max = glm::max(portal_max, glm::vec2(current) / current.w);
+			}
+			if ((current_distance >= 0.0f) != (next_distance >= 0.0f))
+			{
+				const auto crossing = glm::mix(current, next, current_distance / (current_distance - next_distance));
+				portal_min = glm::min(portal_min, glm::vec2(crossing) / crossing.w);
+				portal_max = glm::max(portal_max, glm::vec2(crossing) / crossing.w);
+			}
+		}
+		portal_min = glm::max(portal_min, rect_min);
+		portal_max = glm::min(portal_max, rect_max);
+		if (portal_min.x >= portal_max.x || portal_min.y >= portal_max.y)
+			continue;
+
+		if (neighbour == outside_cell)
+		{
+			result.push_back(frustum_from_rect(view_projection, base, portal_min, portal_max, plane));
+		}
+		else if (static_cast<int>(path.size()) < max_portal_depth)
+		{
+			path.push_back(neighbour);
+			collect_portal_frusta(graph, transform, view_projection, base, eye, neighbour, portal_min, portal_max, path, result);
+			path.pop_back();
+		}
+	}
+}
+
+// narrows the first visible entries of prefab.visible (already frustum culled) to what the eye can see.
+// With the eye inside a cell of an instance, that instance stays and the others only when seen through
+// its portals; from the outside nothing changes. Cells of other instances are not entered, their
+// contents are the instance itself which is already judged by its box
+inline uint32_t cull_prefab_portals(const cell_graph& graph, prefab& prefab, const uint32_t visible, const glm::mat4& view_projection,
+	const frustum& view_frustum, const glm::vec3& eye, std::vector<frustum>& portal_frusta)
+{
+	portal_frusta.clear();
+	if (graph.cells.empty())
+		return visible;
+
+	// the instance holding the eye is among the visible ones, as the near plane is inside its box
+	auto eye_instance = UINT32_MAX;
+	auto eye_cell = outside_cell;
+	for (uint32_t i = 0; i < visible && eye_cell == outside_cell; i++)
+	{
+		const auto index = prefab.visible[i];
+		const glm::vec3 center(prefab.instance_bounds.center_x[index], prefab.instance_bounds.center_y[index], prefab.instance_bounds.center_z[index]);
+		const glm::vec3 extent(prefab.instance_bounds.extent_x[index], prefab.instance_bounds.extent_y[index], prefab.instance_bounds.extent_z[index]);
+		if (glm::any(glm::greaterThan(glm::abs(eye - center), extent)))
+			continue;
+
+		eye_cell = find_cell(graph, glm::vec3(glm::inverse(prefab.instances[index]) * glm::vec4(eye, 1.0f)));
+		eye_instance = index;
+	}
+
+	if (eye_cell == outside_cell)
+		return visible;
+
+	std::vector<int> path(1, eye_cell);
+	collect_portal_frusta(graph, prefab.instances[eye_instance], view_projection, view_frustum, eye, eye_cell, glm::vec2(-1.0f), glm::vec2(1.0f), path, portal_frusta);
+
+	uint32_t count = 0;
+	for (uint32_t i = 0; i < visible; i++)
+	{
+		const auto index = prefab.visible[i];
+		auto seen = index == eye_instance;
+		if (!seen)
+		{
+			const glm::vec3 center(prefab.instance_bounds.center_x[index], prefab.instance_bounds.center_y[index], prefab.instance_bounds.center_z[index]);
+			const glm::vec3 extent(prefab.instance_bounds.extent_x[index], prefab.instance_bounds.extent_y[index], prefab.instance_bounds.extent_z[index]);
+			for (size_t f = 0; f < portal_frusta.size() && !seen; f++)
+				seen = box_in_frustum(portal_frusta[f], center, extent);
+		}
+
+		prefab.visible[count] = index;
+		count += seen ? 1 : 0;
+	}
+
+	return count;
+}
+
+#endif
@@ -0,0 +1,179 @@
+#ifndef PREFAB_H
+#define PREFAB_H
+
+#include <GL/glew.h>
+#include <glm.hpp>
+#include <Frustum.h>
+#include <Culling.h>
+#include <SimdMath.h>
+#include <Bvh.h>
+#include <JobSystem.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// first vertex attribute used by the per-instance model matrix, a mat4 takes four consecutive locations
+const unsigned int instance_attribute_location = 4;
+
+// below this many instances culling stays on the calling thread, above it runs as jobs of this many
+const uint32_t parallel_cull_threshold = 4096;
+const uint32_t parallel_cull_chunk = 4096;
+
+// one mesh of a prefab, placed relative to its parent part (or to the prefab origin when parent is -1)
+typedef struct
+{
+	int object;
+	int parent;
+	glm::mat4 local;
+	glm::mat4 world;
+} prefab_part;
+
+// a set of meshes with a shared local hierarchy that is drawn once per instance
+typedef struct
+{
+	std::vector<prefab_part> parts;
+	object_bounds bounds; // around every part, in prefab space
+	std::vector<glm::mat4> instances;
+	cull_set instance_bounds; // world bounds of every instance, in the same order as instances
+	bvh instance_bvh; // hierarchy over instance_bounds, empty when culling the flat list
+	std::vector<int> cull_roots; // subtrees of instance_bvh culled as separate jobs
+	std::vector<uint32_t> cull_counts; // scratch count of visible instances per job
+	std::vector<uint32_t> visible; // scratch list of the instances that passed culling
+} prefab;
+
+// parts must be listed after their parents
+inline void resolve_prefab_hierarchy(prefab& prefab)
+{
+	for (auto& part : prefab.parts)
+		part.world = part.parent < 0 ? part.local : prefab.parts[part.parent].world * part.local;
+}
+
+// bounds enclosing every part once placed by the hierarchy
+inline void compute_prefab_bounds(prefab& prefab, const std::vector<object_bounds>& part_bounds)
+{
+	prefab.bounds.min = glm::vec3(FLT_MAX);
+	prefab.bounds.max = glm::vec3(-FLT_MAX);
+	for (size_t i = 0; i < prefab.parts.size(); i++)
+	{
+		const auto placed = transform_bounds(part_bounds[i], prefab.parts[i].world);
+		prefab.bounds.min = glm::min(prefab.bounds.min, placed.min);
+		prefab.bounds.max = glm::max(prefab.bounds.max, placed.max);
+	}
+
+	prefab.bounds.center = (prefab.bounds.min + prefab.bounds.max) * 0.5f;
+	prefab.bounds.radius = 0.0f;
+	for (size_t i = 0; i < prefab.parts.size(); i++)
+	{
+		const auto placed = transform_bounds(part_bounds[i], prefab.parts[i].world);
+		prefab.bounds.radius = glm::max(prefab.bounds.radius, glm::length(placed.center - prefab.bounds.center) + placed.radius);
+	}
+}
+
+inline void add_prefab_instance(prefab& prefab, const glm::mat4& transform)
+{
+	prefab.instances.push_back(transform);
+	add_cull_bounds(prefab.instance_bounds, transform_bounds(prefab.bounds, transform));
+	prefab.visible.push_back(0);
+}
+
+// makes room for count instances, to be placed with move_prefab_instance
+inline void resize_prefab_instances(prefab& prefab, const size_t count)
+{
+	prefab.instances.resize(count);
+	auto& set = prefab.instance_bounds;
+	for (auto* axis : { &set.center_x, &set.center_y, &set.center_z, &set.extent_x, &set.extent_y, &set.extent_z })
+		axis->resize(count);
+	prefab.visible.resize(count);
+}
+
+// moves an already placed instance, refitting the hierarchy above it when there is one
+inline void move_prefab_instance(prefab& prefab, const uint32_t index, const glm::mat4& transform)
+{
+	prefab.instances[index] = transform;
+	set_cull_bounds(prefab.instance_bounds, index, transform_bounds(prefab.bounds, transform));
+	if (!prefab.instance_bvh.nodes.empty())
+		refit_bvh(prefab.instance_bvh, prefab.instance_bounds, index);
+}
+
+// the bounds of the instances in [first, last) from their transforms, written to prefab.instances
+// beforehand, a SIMD batch at a time. Leaves the hierarchy as it is, for placing many instances before
+// it is built
+inline void place_prefab_instances(prefab& prefab, const size_t first, const size_t last)
+{
+	transform_boxes(prefab.bounds, prefab.instances.data() + first, last - first, prefab.instance_bounds, first);
+}
+
+// points the instance attribute locations of a mesh's VAO at packed model matrices starting at offset, advancing once per instance
+inline void attach_instance_buffer(const unsigned int vao, const unsigned int instance_buffer, const GLintptr offset)
+{
+	glBindVertexArray(vao);
+	glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+	for (unsigned int column = 0; column < 4; column++)
+	{
+		const auto location = instance_attribute_location + column;
+		glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), reinterpret_cast<void*>(offset + column * sizeof(glm::vec4)));
+		glEnableVertexAttribArray(location);
+		glVertexAttribDivisor(location, 1);
+	}
+	glBindVertexArray(0);
+}
+
+// fills prefab.visible with the instances whose bounds touch the frustum, returns how many
+inline uint32_t cull_prefab_instances(prefab& prefab, const frustum& frustum)
+{
+	const auto count = static_cast<uint32_t>(prefab.instances.size());
+	return prefab.instance_bvh.nodes.empty()
+		? cull_boxes(frustum, prefab.instance_bounds, 0, count, prefab.visible.data())
+		: cull_bvh(prefab.instance_bvh, prefab.instance_bounds, frustum, 0, prefab.visible.data());
+}
+
+// same as above with the culling split in jobs: BVH subtrees, or fixed ranges of the flat list. Each job
+// writes at the start of its own slots, the results are packed together afterwards
+inline uint32_t cull_prefab_instances(prefab& prefab, const frustum& frustum, job_system& jobs)
+{
+	const auto count = static_cast<uint32_t>(prefab.instances.size());
+	const auto use_bvh = !prefab.instance_bvh.nodes.empty();
+	if (count < parallel_cull_threshold || jobs.worker_count() == 0 || (use_bvh && prefab.cull_roots.size() < 2))
+		return cull_prefab_instances(prefab, frustum);
+
+	auto* visible = prefab.visible.data();
+	const auto pieces = use_bvh ? prefab.cull_roots.size() : (count + parallel_cull_chunk - 1) / parallel_cull_chunk;
+	prefab.cull_counts.resize(pieces);
+	jobs.parallel_for(pieces, 1, [&](const size_t begin, const size_t end)
+	{
+		for (auto piece = begin; piece < end; piece++)
+		{
+			if (use_bvh)
+			{
+				prefab.cull_counts[piece] = cull_bvh(prefab.instance_bvh, prefab.instance_bounds, frustum, prefab.cull_roots[piece], visible);
+			}
+			else
+			{
+				const auto first = static_cast<uint32_t>(piece) * parallel_cull_chunk;
+				prefab.cull_counts[piece] = cull_boxes(frustum, prefab.instance_bounds, first, std::min(count, first + parallel_cull_chunk), visible + first);
+			}
+		}
+	});
+
+	// pieces are in slot order, so every result only ever moves towards the front
+	uint32_t packed = 0;
+	for (size_t piece = 0; piece < pieces; piece++)
+	{
+		const auto first = use_bvh ? prefab.instance_bvh.nodes[prefab.cull_roots[piece]].first : static_cast<uint32_t>(piece) * parallel_cull_chunk;
+		if (first != packed)
+			std::copy(visible + first, visible + first + prefab.cull_counts[piece], visible + packed);
+		packed += prefab.cull_counts[piece];
+	}
+
+	return packed;
+}
+
+// packs the model matrices of the first visible entries of prefab.visible into destination
+inline void write_prefab_instances(const prefab& prefab, const uint32_t visible, glm::mat4* destination)
+{
+	for (uint32_t i = 0; i < visible; i++)
+		destination[i] = prefab.instances[prefab.visible[i]];
+}
+
+#endif
@@ -0,0 +1,151 @@
+#ifndef RESOURCE_CACHE_H
+#define RESOURCE_CACHE_H
+
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// 64-bit FNV-1a, continued from hash when the data comes in pieces
+inline uint64_t fnv1a_hash(const void* data, const size_t size, uint64_t hash = 14695981039346656037ull)
+{
+	const auto* const bytes = static_cast<const unsigned char*>(data);
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+// the hash of a file's bytes, or of its name when it cannot be read, so missing files do not all look alike
+inline uint64_t file_content_hash(const std::string& file_name)
+{
+	std::ifstream file(file_name, std::ios::binary);
+	const std::vector<char> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	if (bytes.empty())
+		return fnv1a_hash(file_name.data(), file_name.size());
+	return fnv1a_hash(bytes.data(), bytes.size());
+}
+
+// resources shared by everyone asking for the same content: each is kept once under the hash of its
+// content, whatever the paths it was asked for under, and counts its references. The first acquire makes
+// it with load, the last release hands it to the release function, which frees its GL objects, so that
+// has to run on a thread owning the context. Resources stay where they are until released
+template <typename T>
+class resource_cache
+{
+public:
+	typedef std::function<void(T&)> load_function;
+	typedef std::function<void(T&)> release_function;
+
+	size_t loads = 0; // acquires that made their resource
+	size_t hits = 0; // acquires that found it made already
+	size_t released = 0;
+
+	explicit resource_cache(release_function release) : release_resource(std::move(release))
+	{
+	}
+
+	// the content hash a path was acquired under, false when it has not been yet
+	bool find_hash(const std::string& path, uint64_t& hash) const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		const auto found = paths.find(path);
+		if (found == paths.end())
+			return false;
+
+		hash = found->second;
+		return true;
+	}
+
+	// one more reference to the resource of that content. load runs under the cache's lock, so it only
+	// starts the work: a resource still loading is shared as it is, whatever load left in it to wait on
+	T& acquire(const std::string& path, const uint64_t hash, const load_function& load)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		paths[path] = hash;
+
+		auto found = entries.find(hash);
+		if (found != entries.end())
+		{
+			found->second.references++;
+			hits++;
+			return found->second.value;
+		}
+
+		auto& entry = entries[hash];
+		entry.references = 1;
+		load(entry.value);
+		loads++;
+		return entry.value;
+	}
+
+	// one reference less, the last one releases the resource and true is returned
+	bool release(const uint64_t hash)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		const auto found = entries.find(hash);
+		if (found == entries.end() || --found->second.references > 0)
+			return false;
+
+		release_resource(found->second.value);
+		entries.erase(found);
+		forget_paths(hash);
+		released++;
+		return true;
+	}
+
+	int references(const uint64_t hash) const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		const auto found = entries.find(hash);
+		return found == entries.end() ? 0 : found->second.references;
+	}
+
+	size_t size() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return entries.size();
+	}
+
+	// releases whatever is left, references or not
+	void clear()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (auto& entry : entries)
+			release_resource(entry.second.value);
+		released += entries.size();
+		entries.clear();
+		paths.clear();
+	}
+
+private:
+	typedef struct
+	{
+		T value;
+		int references;
+	} entry;
+
+	mutable std::mutex mutex;
+	release_function release_resource;
+	std::unordered_map<uint64_t, entry> entries;
+	std::unordered_map<std::string, uint64_t> paths;
+
+	void forget_paths(const uint64_t hash)
+	{
+		for (auto i = paths.begin(); i != paths.end();)
+		{
+			if (i->second == hash)
+				i = paths.erase(i);
+			else
+				++i;
+		}
+	}
+};
+
+#endif
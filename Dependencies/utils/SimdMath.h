@@ -0,0 +1,440 @@
+#ifndef SIMD_MATH_H
+#define SIMD_MATH_H
+
+#include <glm.hpp>
+#include <Culling.h>
+#include <CpuFeatures.h>
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+// allocates on cache lines, so no SIMD load of the elements straddles two and every glm::mat4 sits on
+// a line of its own
+template <typename T>
+class aligned_allocator
+{
+public:
+	typedef T value_type;
+	enum { alignment = 64 };
+
+	aligned_allocator() = default;
+
+	template <typename U>
+	aligned_allocator(const aligned_allocator<U>&)
+	{
+	}
+
+	T* allocate(const size_t count)
+	{
+#ifdef _MSC_VER
+		auto* const memory = _aligned_malloc(count * sizeof(T), alignment);
+#else
+		void* memory = nullptr;
+		if (posix_memalign(&memory, alignment, count * sizeof(T)) != 0)
+			memory = nullptr;
+#endif
+		if (memory == nullptr)
+			throw std::bad_alloc();
+		return static_cast<T*>(memory);
+	}
+
+	void deallocate(T* memory, size_t)
+	{
+#ifdef _MSC_VER
+		_aligned_free(memory);
+#else
+		free(memory);
+#endif
+	}
+
+	template <typename U>
+	bool operator==(const aligned_allocator<U>&) const
+	{
+		return true;
+	}
+
+	template <typename U>
+	bool operator!=(const aligned_allocator<U>&) const
+	{
+		return false;
+	}
+};
+
+template <typename T>
+using aligned_vector = std::vector<T, aligned_allocator<T>>;
+
+// points as structure of arrays, so a kernel handles as many points as a register holds floats. w is
+// only filled in by transforms, points to transform are taken to be at w = 1
+typedef struct
+{
+	aligned_vector<float> x, y, z, w;
+} point_set;
+
+inline void resize_point_set(point_set& points, const size_t count)
+{
+	points.x.resize(count);
+	points.y.resize(count);
+	points.z.resize(count);
+	points.w.resize(count);
+}
+
+// batched math over many matrices, points or boxes at once, with a variant of every kernel for each SIMD
+// level; the scalar kernels are glm itself and the reference the others are checked against
+inline void multiply_matrices_scalar(const glm::mat4& left, const glm::mat4* right, glm::mat4* result, const size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+		result[i] = left * right[i];
+}
+
+inline void transform_points_scalar(const glm::mat4& transform, const float* x, const float* y, const float* z, const size_t count, float* result_x, float* result_y, float* result_z, float* result_w)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		const auto point = transform * glm::vec4(x[i], y[i], z[i], 1.0f);
+		result_x[i] = point.x;
+		result_y[i] = point.y;
+		result_z[i] = point.z;
+		result_w[i] = point.w;
+	}
+}
+
+inline void inverse_transpose_scalar(const glm::mat4* matrices, glm::mat4* result, const size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+		result[i] = glm::mat4(glm::transpose(glm::inverse(glm::mat3(matrices[i]))));
+}
+
+inline void transform_boxes_scalar(const object_bounds& local, const glm::mat4* transforms, const size_t count, cull_set& set, const size_t first)
+{
+	const auto center = (local.min + local.max) * 0.5f;
+	const auto extent = (local.max - local.min) * 0.5f;
+	for (size_t i = 0; i < count; i++)
+	{
+		const auto& transform = transforms[i];
+		const auto world_center = glm::vec3(transform * glm::vec4(center, 1.0f));
+		const auto world_extent = glm::abs(glm::vec3(transform[0])) * extent.x + glm::abs(glm::vec3(transform[1])) * extent.y + glm::abs(glm::vec3(transform[2])) * extent.z;
+		set.center_x[first + i] = world_center.x;
+		set.center_y[first + i] = world_center.y;
+		set.center_z[first + i] = world_center.z;
+		set.extent_x[first + i] = world_extent.x;
+		set.extent_y[first + i] = world_extent.y;
+		set.extent_z[first + i] = world_extent.z;
+	}
+}
+
+#ifdef SIMD_X86
+// SSE4: four points or a matrix column a register. The last few items of every kernel go to the scalar
+// one. Multiplying matrices a column at a time gains nothing over glm, so that is left to the scalar kernel
+SIMD_TARGET("sse4.1")
+inline void transform_points_sse4(const glm::mat4& transform, const float* x, const float* y, const float* z, const size_t count, float* result_x, float* result_y, float* result_z, float* result_w)
+{
+	float* const results[4] = { result_x, result_y, result_z, result_w };
+	__m128 elements[4][4];
+	for (auto column = 0; column < 4; column++)
+	{
+		for (auto row = 0; row < 4; row++)
+			elements[column][row] = _mm_set1_ps(transform[column][row]);
+	}
+
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		const auto px = _mm_loadu_ps(x + i);
+		const auto py = _mm_loadu_ps(y + i);
+		const auto pz = _mm_loadu_ps(z + i);
+		for (auto row = 0; row < 4; row++)
+		{
+			const auto xy = _mm_add_ps(_mm_mul_ps(elements[0][row], px), _mm_mul_ps(elements[1][row], py));
+			const auto zw = _mm_add_ps(_mm_mul_ps(elements[2][row], pz), elements[3][row]);
+			_mm_storeu_ps(results[row] + i, _mm_add_ps(xy, zw));
+		}
+	}
+	transform_points_scalar(transform, x + i, y + i, z + i, count - i, result_x + i, result_y + i, result_z + i, result_w + i);
+}
+
+// the columns of the inverse transpose of [c0 c1 c2] are c1 x c2, c2 x c0 and c0 x c1 over the determinant.
+// The w lanes of the cross products cancel to zero
+SIMD_TARGET("sse4.1")
+inline void inverse_transpose_sse4(const glm::mat4* matrices, glm::mat4* result, const size_t count)
+{
+	const auto last_column = _mm_setr_ps(0.0f, 0.0f, 0.0f, 1.0f);
+	for (size_t i = 0; i < count; i++)
+	{
+		const auto c0 = _mm_loadu_ps(&matrices[i][0][0]);
+		const auto c1 = _mm_loadu_ps(&matrices[i][1][0]);
+		const auto c2 = _mm_loadu_ps(&matrices[i][2][0]);
+		const auto c0_yzx = _mm_shuffle_ps(c0, c0, _MM_SHUFFLE(3, 0, 2, 1)), c0_zxy = _mm_shuffle_ps(c0, c0, _MM_SHUFFLE(3, 1, 0, 2));
+		const auto c1_yzx = _mm_shuffle_ps(c1, c1, _MM_SHUFFLE(3, 0, 2, 1)), c1_zxy = _mm_shuffle_ps(c1, c1, _MM_SHUFFLE(3, 1, 0, 2));
+		const auto c2_yzx = _mm_shuffle_ps(c2, c2, _MM_SHUFFLE(3, 0, 2, 1)), c2_zxy = _mm_shuffle_ps(c2, c2, _MM_SHUFFLE(3, 1, 0, 2));
+		const auto r0 = _mm_sub_ps(_mm_mul_ps(c1_yzx, c2_zxy), _mm_mul_ps(c1_zxy, c2_yzx));
+		const auto r1 = _mm_sub_ps(_mm_mul_ps(c2_yzx, c0_zxy), _mm_mul_ps(c2_zxy, c0_yzx));
+		const auto r2 = _mm_sub_ps(_mm_mul_ps(c0_yzx, c1_zxy), _mm_mul_ps(c0_zxy, c1_yzx));
+		const auto determinant = _mm_dp_ps(c0, r0, 0x7f);
+		_mm_storeu_ps(&result[i][0][0], _mm_div_ps(r0, determinant));
+		_mm_storeu_ps(&result[i][1][0], _mm_div_ps(r1, determinant));
+		_mm_storeu_ps(&result[i][2][0], _mm_div_ps(r2, determinant));
+		_mm_storeu_ps(&result[i][3][0], last_column);
+	}
+}
+
+// four boxes a pass, each computed a column at a time and transposed into the arrays of the set
+SIMD_TARGET("sse4.1")
+inline void transform_boxes_sse4(const object_bounds& local, const glm::mat4* transforms, const size_t count, cull_set& set, const size_t first)
+{
+	const auto center = (local.min + local.max) * 0.5f;
+	const auto extent = (local.max - local.min) * 0.5f;
+	const auto cx = _mm_set1_ps(center.x), cy = _mm_set1_ps(center.y), cz = _mm_set1_ps(center.z);
+	const auto ex = _mm_set1_ps(extent.x), ey = _mm_set1_ps(extent.y), ez = _mm_set1_ps(extent.z);
+	const auto sign = _mm_set1_ps(-0.0f);
+
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 centers[4], extents[4];
+		for (auto j = 0; j < 4; j++)
+		{
+			const auto& transform = transforms[i + j];
+			const auto m0 = _mm_loadu_ps(&transform[0][0]);
+			const auto m1 = _mm_loadu_ps(&transform[1][0]);
+			const auto m2 = _mm_loadu_ps(&transform[2][0]);
+			const auto m3 = _mm_loadu_ps(&transform[3][0]);
+			centers[j] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m0, cx), _mm_mul_ps(m1, cy)), _mm_add_ps(_mm_mul_ps(m2, cz), m3));
+			extents[j] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_andnot_ps(sign, m0), ex), _mm_mul_ps(_mm_andnot_ps(sign, m1), ey)), _mm_mul_ps(_mm_andnot_ps(sign, m2), ez));
+		}
+		_MM_TRANSPOSE4_PS(centers[0], centers[1], centers[2], centers[3]);
+		_MM_TRANSPOSE4_PS(extents[0], extents[1], extents[2], extents[3]);
+
+		const auto slot = first + i;
+		_mm_storeu_ps(&set.center_x[slot], centers[0]);
+		_mm_storeu_ps(&set.center_y[slot], centers[1]);
+		_mm_storeu_ps(&set.center_z[slot], centers[2]);
+		_mm_storeu_ps(&set.extent_x[slot], extents[0]);
+		_mm_storeu_ps(&set.extent_y[slot], extents[1]);
+		_mm_storeu_ps(&set.extent_z[slot], extents[2]);
+	}
+	transform_boxes_scalar(local, transforms + i, count - i, set, first + i);
+}
+
+// AVX2: two matrix columns or eight points or boxes a register, with fused multiply-adds. Two inverse
+// transposes side by side are no faster than one at a time, so the level keeps the SSE4 kernel for those
+SIMD_TARGET("avx2,fma")
+inline void multiply_matrices_avx2(const glm::mat4& left, const glm::mat4* right, glm::mat4* result, const size_t count)
+{
+	const auto l0 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(&left[0][0]));
+	const auto l1 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(&left[1][0]));
+	const auto l2 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(&left[2][0]));
+	const auto l3 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(&left[3][0]));
+	for (size_t i = 0; i < count; i++)
+	{
+		for (auto column = 0; column < 4; column += 2)
+		{
+			const auto r = _mm256_loadu_ps(&right[i][column][0]);
+			auto product = _mm256_mul_ps(l0, _mm256_permute_ps(r, 0x00));
+			product = _mm256_fmadd_ps(l1, _mm256_permute_ps(r, 0x55), product);
+			product = _mm256_fmadd_ps(l2, _mm256_permute_ps(r, 0xaa), product);
+			product = _mm256_fmadd_ps(l3, _mm256_permute_ps(r, 0xff), product);
+			_mm256_storeu_ps(&result[i][column][0], product);
+		}
+	}
+	_mm256_zeroupper();
+}
+
+SIMD_TARGET("avx2,fma")
+inline void transform_points_avx2(const glm::mat4& transform, const float* x, const float* y, const float* z, const size_t count, float* result_x, float* result_y, float* result_z, float* result_w)
+{
+	float* const results[4] = { result_x, result_y, result_z, result_w };
+	__m256 elements[4][4];
+	for (auto column = 0; column < 4; column++)
+	{
+		for (auto row = 0; row < 4; row++)
+			elements[column][row] = _mm256_set1_ps(transform[column][row]);
+	}
+
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		const auto px = _mm256_loadu_ps(x + i);
+		const auto py = _mm256_loadu_ps(y + i);
+		const auto pz = _mm256_loadu_ps(z + i);
+		for (auto row = 0; row < 4; row++)
+		{
+			auto point = _mm256_fmadd_ps(elements[2][row], pz, elements[3][row]);
+			point = _mm256_fmadd_ps(elements[1][row], py, point);
+			point = _mm256_fmadd_ps(elements[0][row], px, point);
+			_mm256_storeu_ps(results[row] + i, point);
+		}
+	}
+	_mm256_zeroupper();
+	transform_points_scalar(transform, x + i, y + i, z + i, count - i, result_x + i, result_y + i, result_z + i, result_w + i);
+}
+
+// eight boxes a pass, every matrix element gathered across the eight transforms so the boxes come out
+// as rows of the set
+SIMD_TARGET("avx2,fma")
+inline void transform_boxes_avx2(const object_bounds& local, const glm::mat4* transforms, const size_t count, cull_set& set, const size_t first)
+{
+	const auto center = (local.min + local.max) * 0.5f;
+	const auto extent = (local.max - local.min) * 0.5f;
+	const auto cx = _mm256_set1_ps(center.x), cy = _mm256_set1_ps(center.y), cz = _mm256_set1_ps(center.z);
+	const auto ex = _mm256_set1_ps(extent.x), ey = _mm256_set1_ps(extent.y), ez = _mm256_set1_ps(extent.z);
+	const auto sign = _mm256_set1_ps(-0.0f);
+	const auto stride = _mm256_setr_epi32(0, 16, 32, 48, 64, 80, 96, 112);
+	std::vector<float>* const centers[3] = { &set.center_x, &set.center_y, &set.center_z };
+	std::vector<float>* const extents[3] = { &set.extent_x, &set.extent_y, &set.extent_z };
+
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		const auto* const elements = &transforms[i][0][0];
+		for (auto row = 0; row < 3; row++)
+		{
+			const auto m0 = _mm256_i32gather_ps(elements + row, stride, 4);
+			const auto m1 = _mm256_i32gather_ps(elements + 4 + row, stride, 4);
+			const auto m2 = _mm256_i32gather_ps(elements + 8 + row, stride, 4);
+			const auto m3 = _mm256_i32gather_ps(elements + 12 + row, stride, 4);
+			const auto world_center = _mm256_fmadd_ps(m0, cx, _mm256_fmadd_ps(m1, cy, _mm256_fmadd_ps(m2, cz, m3)));
+			const auto world_extent = _mm256_fmadd_ps(_mm256_andnot_ps(sign, m0), ex, _mm256_fmadd_ps(_mm256_andnot_ps(sign, m1), ey, _mm256_mul_ps(_mm256_andnot_ps(sign, m2), ez)));
+			_mm256_storeu_ps(centers[row]->data() + first + i, world_center);
+			_mm256_storeu_ps(extents[row]->data() + first + i, world_extent);
+		}
+	}
+	_mm256_zeroupper();
+	transform_boxes_scalar(local, transforms + i, count - i, set, first + i);
+}
+
+// AVX-512: a whole matrix, or sixteen points or boxes, a register. The inverse transposes are left to
+// the SSE4 kernel here too
+SIMD_TARGET("avx512f")
+inline void multiply_matrices_avx512(const glm::mat4& left, const glm::mat4* right, glm::mat4* result, const size_t count)
+{
+	const auto l0 = _mm512_broadcast_f32x4(_mm_loadu_ps(&left[0][0]));
+	const auto l1 = _mm512_broadcast_f32x4(_mm_loadu_ps(&left[1][0]));
+	const auto l2 = _mm512_broadcast_f32x4(_mm_loadu_ps(&left[2][0]));
+	const auto l3 = _mm512_broadcast_f32x4(_mm_loadu_ps(&left[3][0]));
+	for (size_t i = 0; i < count; i++)
+	{
+		const auto r = _mm512_loadu_ps(&right[i][0][0]);
+		auto product = _mm512_mul_ps(l0, _mm512_permute_ps(r, 0x00));
+		product = _mm512_fmadd_ps(l1, _mm512_permute_ps(r, 0x55), product);
+		product = _mm512_fmadd_ps(l2, _mm512_permute_ps(r, 0xaa), product);
+		product = _mm512_fmadd_ps(l3, _mm512_permute_ps(r, 0xff), product);
+		_mm512_storeu_ps(&result[i][0][0], product);
+	}
+	_mm256_zeroupper();
+}
+
+SIMD_TARGET("avx512f")
+inline void transform_points_avx512(const glm::mat4& transform, const float* x, const float* y, const float* z, const size_t count, float* result_x, float* result_y, float* result_z, float* result_w)
+{
+	float* const results[4] = { result_x, result_y, result_z, result_w };
+	__m512 elements[4][4];
+	for (auto column = 0; column < 4; column++)
+	{
+		for (auto row = 0; row < 4; row++)
+			elements[column][row] = _mm512_set1_ps(transform[column][row]);
+	}
+
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		const auto px = _mm512_loadu_ps(x + i);
+		const auto py = _mm512_loadu_ps(y + i);
+		const auto pz = _mm512_loadu_ps(z + i);
+		for (auto row = 0; row < 4; row++)
+		{
+			auto point = _mm512_fmadd_ps(elements[2][row], pz, elements[3][row]);
+			point = _mm512_fmadd_ps(elements[1][row], py, point);
+			point = _mm512_fmadd_ps(elements[0][row], px, point);
+			_mm512_storeu_ps(results[row] + i, point);
+		}
+	}
+	_mm256_zeroupper();
+	transform_points_scalar(transform, x + i, y + i, z + i, count - i, result_x + i, result_y + i, result_z + i, result_w + i);
+}
+
+SIMD_TARGET("avx512f")
+inline void transform_boxes_avx512(const object_bounds& local, const glm::mat4* transforms, const size_t count, cull_set& set, const size_t first)
+{
+	const auto center = (local.min + local.max) * 0.5f;
+	const auto extent = (local.max - local.min) * 0.5f;
+	const auto cx = _mm512_set1_ps(center.x), cy = _mm512_set1_ps(center.y), cz = _mm512_set1_ps(center.z);
+	const auto ex = _mm512_set1_ps(extent.x), ey = _mm512_set1_ps(extent.y), ez = _mm512_set1_ps(extent.z);
+	const auto stride = _mm512_setr_epi32(0, 16, 32, 48, 64, 80, 96, 112, 128, 144, 160, 176, 192, 208, 224, 240);
+	std::vector<float>* const centers[3] = { &set.center_x, &set.center_y, &set.center_z };
+	std::vector<float>* const extents[3] = { &set.extent_x, &set.extent_y, &set.extent_z };
+
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		const auto* const elements = &transforms[i][0][0];
+		for (auto row = 0; row < 3; row++)
+		{
+			const auto m0 = _mm512_i32gather_ps(stride, elements + row, 4);
+			const auto m1 = _mm512_i32gather_ps(stride, elements + 4 + row, 4);
+			const auto m2 = _mm512_i32gather_ps(stride, elements + 8 + row, 4);
+			const auto m3 = _mm512_i32gather_ps(stride, elements + 12 + row, 4);
+			const auto world_center = _mm512_fmadd_ps(m0, cx, _mm512_fmadd_ps(m1, cy, _mm512_fmadd_ps(m2, cz, m3)));
+			const auto world_extent = _mm512_fmadd_ps(_mm512_abs_ps(m0), ex, _mm512_fmadd_ps(_mm512_abs_ps(m1), ey, _mm512_mul_ps(_mm512_abs_ps(m2), ez)));
+			_mm512_storeu_ps(centers[row]->data() + first + i, world_center);
+			_mm512_storeu_ps(extents[row]->data() + first + i, world_extent);
+		}
+	}
+	_mm256_zeroupper();
+	transform_boxes_scalar(local, transforms + i, count - i, set, first + i);
+}
+#endif
+
+// result[i] = left * right[i], right and result may be the same array
+inline void multiply_matrices(const glm::mat4& left, const glm::mat4* right, glm::mat4* result, const size_t count)
+{
+#ifdef SIMD_X86
+	typedef void (*kernel)(const glm::mat4&, const glm::mat4*, glm::mat4*, size_t);
+	static const kernel variants[simd_level_count] = { multiply_matrices_scalar, nullptr, multiply_matrices_avx2, multiply_matrices_avx512 };
+	dispatch_kernel(kernel_multiply_matrices, variants)(left, right, result, count);
+#else
+	multiply_matrices_scalar(left, right, result, count);
+#endif
+}
+
+// the points through a matrix, w included. result is resized to the points
+inline void transform_points(const glm::mat4& transform, const point_set& points, point_set& result)
+{
+	const auto count = points.x.size();
+	resize_point_set(result, count);
+#ifdef SIMD_X86
+	typedef void (*kernel)(const glm::mat4&, const float*, const float*, const float*, size_t, float*, float*, float*, float*);
+	static const kernel variants[simd_level_count] = { transform_points_scalar, transform_points_sse4, transform_points_avx2, transform_points_avx512 };
+	dispatch_kernel(kernel_transform_points, variants)(transform, points.x.data(), points.y.data(), points.z.data(), count, result.x.data(), result.y.data(), result.z.data(), result.w.data());
+#else
+	transform_points_scalar(transform, points.x.data(), points.y.data(), points.z.data(), count, result.x.data(), result.y.data(), result.z.data(), result.w.data());
+#endif
+}
+
+// the normal matrices, inverse transpose of the upper 3x3 kept in a mat4
+inline void inverse_transpose_matrices(const glm::mat4* matrices, glm::mat4* result, const size_t count)
+{
+#ifdef SIMD_X86
+	typedef void (*kernel)(const glm::mat4*, glm::mat4*, size_t);
+	static const kernel variants[simd_level_count] = { inverse_transpose_scalar, inverse_transpose_sse4, nullptr, nullptr };
+	dispatch_kernel(kernel_inverse_transpose, variants)(matrices, result, count);
+#else
+	inverse_transpose_scalar(matrices, result, count);
+#endif
+}
+
+// a local box placed by every transform, as transform_bounds does, written to set from slot first on.
+// The set needs slots up to first + count already
+inline void transform_boxes(const object_bounds& local, const glm::mat4* transforms, const size_t count, cull_set& set, const size_t first)
+{
+#ifdef SIMD_X86
+	typedef void (*kernel)(const object_bounds&, const glm::mat4*, size_t, cull_set&, size_t);
+	static const kernel variants[simd_level_count] = { transform_boxes_scalar, transform_boxes_sse4, transform_boxes_avx2, transform_boxes_avx512 };
+	dispatch_kernel(kernel_transform_boxes, variants)(local, transforms, count, set, first);
+#else
+	transform_boxes_scalar(local, transforms, count, set, first);
+#endif
+}
+
+#endif
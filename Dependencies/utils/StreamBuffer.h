@@ -0,0 +1,147 @@
+#ifndef STREAM_BUFFER_H
+#define STREAM_BUFFER_H
+
+#include <GL/glew.h>
+
+#include <cstdint>
+
+// a piece of the stream buffer handed out for this frame: write through cpu, bind with offset
+typedef struct
+{
+	void* cpu;
+	GLintptr offset;
+	GLsizeiptr size;
+} stream_allocation;
+
+// ring buffer for per-frame dynamic data. The buffer is split into frame regions, each protected by a
+// fence, so the CPU only writes into a region once the GPU has finished the frame that last used it.
+// With GL_ARB_buffer_storage the whole buffer stays persistently and coherently mapped; without it the
+// current region is mapped unsynchronized at begin_frame and unmapped by flush before drawing
+class stream_buffer
+{
+public:
+	static const int regions = 3;
+
+	unsigned int buffer = 0;
+
+	void create(const GLsizeiptr region_size)
+	{
+		this->region_size = region_size;
+		persistent = GLEW_ARB_buffer_storage != 0;
+
+		glGenBuffers(1, &buffer);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+		if (persistent)
+		{
+			const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			glBufferStorage(GL_COPY_WRITE_BUFFER, region_size * regions, nullptr, flags);
+			mapped = static_cast<uint8_t*>(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, region_size * regions, flags));
+		}
+		else
+		{
+			glBufferData(GL_COPY_WRITE_BUFFER, region_size * regions, nullptr, GL_STREAM_DRAW);
+		}
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+		for (auto& fence : fences)
+			fence = nullptr;
+	}
+
+	void destroy()
+	{
+		for (auto& fence : fences)
+		{
+			if (fence != nullptr)
+				glDeleteSync(fence);
+			fence = nullptr;
+		}
+
+		if (persistent && mapped != nullptr)
+		{
+			glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+			glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		}
+		mapped = nullptr;
+
+		glDeleteBuffers(1, &buffer);
+		buffer = 0;
+	}
+
+	// moves to the next region, waiting only if the GPU is still reading the frame that used it last
+	void begin_frame()
+	{
+		region = (region + 1) % regions;
+		head = 0;
+
+		auto& fence = fences[region];
+		if (fence != nullptr)
+		{
+			auto flags = GLbitfield(0);
+			while (glClientWaitSync(fence, flags, 1000000) == GL_TIMEOUT_EXPIRED)
+				flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+			glDeleteSync(fence);
+			fence = nullptr;
+		}
+
+		if (!persistent)
+		{
+			glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+			const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT;
+			region_memory = static_cast<uint8_t*>(glMapBufferRange(GL_COPY_WRITE_BUFFER, region * region_size, region_size, flags));
+			glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		}
+		else
+		{
+			region_memory = mapped + region * region_size;
+		}
+	}
+
+	// bump allocation inside the current region, cpu is null when the region is full
+	stream_allocation allocate(const GLsizeiptr size, const GLsizeiptr alignment)
+	{
+		const auto start = (head + alignment - 1) / alignment * alignment;
+		if (region_memory == nullptr || start + size > region_size)
+			return stream_allocation{ nullptr, 0, 0 };
+
+		head = start + size;
+		return stream_allocation{ region_memory + start, region * region_size + start, size };
+	}
+
+	// gives back the unused end of the latest allocation
+	void trim(stream_allocation& allocation, const GLsizeiptr used)
+	{
+		if (allocation.cpu != nullptr && allocation.offset + allocation.size == region * region_size + head)
+			head -= allocation.size - used;
+		allocation.size = used;
+	}
+
+	// makes this frame's writes visible to the GPU, must run before the draws that read them
+	void flush()
+	{
+		if (!persistent)
+		{
+			glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+			glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		}
+		region_memory = nullptr;
+	}
+
+	// fences the region once every draw reading it has been submitted
+	void end_frame()
+	{
+		fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+
+private:
+	GLsizeiptr region_size = 0;
+	GLsizeiptr head = 0;
+	int region = 0;
+	bool persistent = false;
+	uint8_t* mapped = nullptr;
+	uint8_t* region_memory = nullptr;
+	GLsync fences[regions];
+};
+
+#endif
@@ -0,0 +1,256 @@
+#ifndef TEXTURE_ARRAY_H
+#define TEXTURE_ARRAY_H
+
+#include <GL/glew.h>
+
+#include <PixelBuffers.h>
+#include <TextureCompression.h>
+#include <TextureFormats.h>
+
+#include <algorithm>
+#include <vector>
+
+// pixels decoded from an image file, owned by whoever decoded them. An image can also come with its
+// whole mip chain, built on the CPU or cooked offline, in which case pixels may be null; a compressed
+// one only has the chain, as blocks of its format
+typedef struct
+{
+	unsigned char* pixels;
+	int width;
+	int height;
+	int channels;
+	GLenum compressed = 0;
+	std::vector<std::vector<unsigned char>> levels; // level 0 first
+} decoded_image;
+
+// a GL_TEXTURE_2D_ARRAY holding every texture that shares the same size and format
+typedef struct
+{
+	unsigned int texture;
+	int width;
+	int height;
+	int channels;
+	int layers;
+	GLenum compressed = 0; // the layers' block format
+	int levels = 1; // uploaded by the caller, with a single level glGenerateMipmap makes the others
+	bool srgb = false; // the colors are sampled as sRGB
+} texture_pool;
+
+// where a texture ended up: the pool it belongs to and its layer inside that pool
+typedef struct
+{
+	int pool;
+	int layer;
+} texture_slot;
+
+// bilinear resize, used to bring textures of different sizes into the same pool
+inline std::vector<unsigned char> resize_image(const decoded_image& image, const int width, const int height)
+{
+	std::vector<unsigned char> resized(static_cast<size_t>(width) * height * image.channels);
+
+	const float scale_x = static_cast<float>(image.width) / width;
+	const float scale_y = static_cast<float>(image.height) / height;
+
+	for (int y = 0; y < height; y++)
+	{
+		float src_y = (y + 0.5f) * scale_y - 0.5f;
+		if (src_y < 0.0f)
+			src_y = 0.0f;
+		const int y0 = static_cast<int>(src_y);
+		const int y1 = y0 + 1 < image.height ? y0 + 1 : y0;
+		const float fy = src_y - y0;
+
+		for (int x = 0; x < width; x++)
+		{
+			float src_x = (x + 0.5f) * scale_x - 0.5f;
+			if (src_x < 0.0f)
+				src_x = 0.0f;
+			const int x0 = static_cast<int>(src_x);
+			const int x1 = x0 + 1 < image.width ? x0 + 1 : x0;
+			const float fx = src_x - x0;
+
+			for (int c = 0; c < image.channels; c++)
+			{
+				const float p00 = image.pixels[(static_cast<size_t>(y0) * image.width + x0) * image.channels + c];
+				const float p10 = image.pixels[(static_cast<size_t>(y0) * image.width + x1) * image.channels + c];
+				const float p01 = image.pixels[(static_cast<size_t>(y1) * image.width + x0) * image.channels + c];
+				const float p11 = image.pixels[(static_cast<size_t>(y1) * image.width + x1) * image.channels + c];
+
+				const float top = p00 + (p10 - p00) * fx;
+				const float bottom = p01 + (p11 - p01) * fx;
+				resized[(static_cast<size_t>(y) * width + x) * image.channels + c] = static_cast<unsigned char>(top + (bottom - top) * fy + 0.5f);
+			}
+		}
+	}
+
+	return resized;
+}
+
+// groups the images into texture array pools by size and format, only their sizes, channel counts,
+// formats and mip chains are looked at. With resize enabled every image without a chain is scaled to
+// pool_size x pool_size first, so all of them with the same channel count share a single pool; images
+// with a chain keep their size. Images without a size are left out. Channel counts are the uploaded ones
+inline std::vector<texture_pool> plan_texture_pools(const std::vector<decoded_image>& images, const bool resize, const int pool_size, const bool srgb, std::vector<texture_slot>& slots)
+{
+	std::vector<texture_pool> pools;
+	slots.assign(images.size(), texture_slot{ -1, -1 });
+
+	for (size_t i = 0; i < images.size(); i++)
+	{
+		const auto& image = images[i];
+		if (image.width <= 0 || image.height <= 0 || image.channels <= 0)
+			continue;
+
+		const int width = resize && image.levels.empty() ? pool_size : image.width;
+		const int height = resize && image.levels.empty() ? pool_size : image.height;
+		const int levels = image.levels.empty() ? 1 : static_cast<int>(image.levels.size());
+
+		int pool = -1;
+		for (size_t p = 0; p < pools.size(); p++)
+		{
+			if (pools[p].width == width && pools[p].height == height && pools[p].channels == image.channels
+				&& pools[p].compressed == image.compressed && pools[p].levels == levels)
+			{
+				pool = static_cast<int>(p);
+				break;
+			}
+		}
+
+		if (pool < 0)
+		{
+			pools.push_back(texture_pool{ 0, width, height, image.channels, 0, image.compressed, levels, srgb });
+			pool = static_cast<int>(pools.size()) - 1;
+		}
+
+		slots[i].pool = pool;
+		slots[i].layer = pools[pool].layers++;
+	}
+
+	return pools;
+}
+
+inline texture_format texture_pool_format(const texture_pool& pool)
+{
+	return choose_texture_format(pool.channels, pool.srgb);
+}
+
+// the array storage, every layer still empty. Levels finer than first_level are left out, for the mip
+// streaming to bring in later
+inline void create_texture_pool(texture_pool& pool, const int first_level = 0)
+{
+	const auto format = texture_pool_format(pool);
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glGenTextures(1, &pool.texture);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, pool.texture);
+
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	set_texture_swizzle(GL_TEXTURE_2D_ARRAY, format.channels);
+
+	for (auto level = first_level; level < pool.levels; level++)
+	{
+		const auto width = std::max(1, pool.width >> level);
+		const auto height = std::max(1, pool.height >> level);
+		if (pool.compressed == 0)
+		{
+			glTexImage3D(GL_TEXTURE_2D_ARRAY, level, format.internal_format, width, height, pool.layers, 0, format.format, GL_UNSIGNED_BYTE, nullptr);
+			continue;
+		}
+
+		const auto size = static_cast<GLsizei>(compressed_level_size(pool.compressed, width, height) * pool.layers);
+		glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, pool.compressed, width, height, pool.layers, 0, size, nullptr);
+	}
+
+	if (pool.levels > 1)
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, pool.levels - 1);
+	if (first_level > 0)
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, first_level);
+}
+
+// rows [first_row, first_row + rows) of one level of a layer, pixels points at the level's first row, in
+// staging when it has been staged as upload_pixels takes it
+inline void upload_texture_pool_rows(const texture_pool& pool, const int layer, const int level, const int first_row, const int rows, const unsigned char* pixels, staging_buffer* staging = nullptr)
+{
+	const auto width = std::max(1, pool.width >> level);
+	const auto row_bytes = static_cast<size_t>(width) * pool.channels;
+
+	glBindTexture(GL_TEXTURE_2D_ARRAY, pool.texture);
+	upload_pixels(pixels + first_row * row_bytes, rows * row_bytes, [&](const void* data)
+	{
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, first_row, layer, width, rows, 1, texture_pool_format(pool).format, GL_UNSIGNED_BYTE, data);
+	}, staging);
+}
+
+// block rows [first_row, first_row + rows) of one level of a layer of a compressed pool, blocks points at
+// the level's first block row, staged as above
+inline void upload_texture_pool_blocks(const texture_pool& pool, const int layer, const int level, const int first_row, const int rows, const unsigned char* blocks, staging_buffer* staging = nullptr)
+{
+	const auto width = std::max(1, pool.width >> level);
+	const auto height = std::max(1, pool.height >> level);
+	const auto row_bytes = compressed_level_size(pool.compressed, width, 1);
+	const auto band_height = std::min(rows * 4, height - first_row * 4);
+
+	glBindTexture(GL_TEXTURE_2D_ARRAY, pool.texture);
+	upload_pixels(blocks + first_row * row_bytes, rows * row_bytes, [&](const void* data)
+	{
+		glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, first_row * 4, layer, width, band_height, 1, pool.compressed, static_cast<GLsizei>(rows * row_bytes), data);
+	}, staging);
+}
+
+// once every layer is in
+inline void finish_texture_pool(const texture_pool& pool)
+{
+	glBindTexture(GL_TEXTURE_2D_ARRAY, pool.texture);
+	if (pool.levels == 1 && pool.compressed == 0)
+		glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+// plans the pools and uploads every image into them in one go
+inline std::vector<texture_pool> build_texture_pools(const std::vector<decoded_image>& images, const bool resize, const int pool_size, const bool srgb, std::vector<texture_slot>& slots)
+{
+	auto pools = plan_texture_pools(images, resize, pool_size, srgb, slots);
+
+	for (size_t p = 0; p < pools.size(); p++)
+	{
+		auto& pool = pools[p];
+		create_texture_pool(pool);
+
+		for (size_t i = 0; i < images.size(); i++)
+		{
+			if (slots[i].pool != static_cast<int>(p) || (images[i].pixels == nullptr && images[i].levels.empty()))
+				continue;
+
+			const auto& image = images[i];
+			if (!image.levels.empty())
+			{
+				for (auto level = 0; level < pool.levels; level++)
+				{
+					const auto height = std::max(1, pool.height >> level);
+					if (pool.compressed != 0)
+						upload_texture_pool_blocks(pool, slots[i].layer, level, 0, (height + 3) / 4, image.levels[level].data());
+					else
+						upload_texture_pool_rows(pool, slots[i].layer, level, 0, height, image.levels[level].data());
+				}
+			}
+			else if (image.width == pool.width && image.height == pool.height)
+			{
+				upload_texture_pool_rows(pool, slots[i].layer, 0, 0, pool.height, image.pixels);
+			}
+			else
+			{
+				const auto resized = resize_image(image, pool.width, pool.height);
+				upload_texture_pool_rows(pool, slots[i].layer, 0, 0, pool.height, resized.data());
+			}
+		}
+
+		finish_texture_pool(pool);
+	}
+
+	return pools;
+}
+
+#endif
@@ -0,0 +1,192 @@
+#ifndef TEXTURE_ATLAS_H
+#define TEXTURE_ATLAS_H
+
+#include <algorithm>
+#include <climits>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// a rectangle of an atlas in texels, rows counted bottom to top like the GL textures
+typedef struct
+{
+	int x;
+	int y;
+	int width;
+	int height;
+} atlas_rect;
+
+// skyline bottom-left packing: the top edge of everything placed so far is kept as a list of horizontal
+// segments, and each rectangle goes where its bottom ends up lowest, the leftmost such place on ties.
+// Rectangles packed tallest first waste little room
+class skyline_packer
+{
+public:
+	int width = 0;
+	int height = 0;
+
+	void reset(const int width, const int height)
+	{
+		this->width = width;
+		this->height = height;
+		skyline.assign(1, segment{ 0, 0, width });
+	}
+
+	// false when the rectangle fits nowhere
+	bool insert(const int rect_width, const int rect_height, atlas_rect& rect)
+	{
+		auto best = -1, best_y = INT_MAX;
+		for (size_t i = 0; i < skyline.size(); i++)
+		{
+			const auto y = fit(i, rect_width, rect_height);
+			if (y >= 0 && y < best_y)
+			{
+				best = static_cast<int>(i);
+				best_y = y;
+			}
+		}
+		if (best < 0)
+			return false;
+
+		rect = atlas_rect{ skyline[best].x, best_y, rect_width, rect_height };
+		add(best, rect);
+		return true;
+	}
+
+private:
+	typedef struct
+	{
+		int x;
+		int y;
+		int width;
+	} segment;
+
+	std::vector<segment> skyline; // left to right, covering the whole width
+
+	// the lowest a rectangle whose left edge is at segment i can sit, -1 when it does not fit there
+	int fit(const size_t i, const int rect_width, const int rect_height) const
+	{
+		if (skyline[i].x + rect_width > width)
+			return -1;
+
+		auto y = 0;
+		auto left = rect_width;
+		for (auto j = i; left > 0; j++)
+		{
+			y = std::max(y, skyline[j].y);
+			left -= skyline[j].width;
+		}
+		return y + rect_height <= height ? y : -1;
+	}
+
+	// raises the skyline over rect, the segments under it shrink or go
+	void add(const int i, const atlas_rect& rect)
+	{
+		skyline.insert(skyline.begin() + i, segment{ rect.x, rect.y + rect.height, rect.width });
+
+		const auto end = rect.x + rect.width;
+		for (size_t j = i + 1; j < skyline.size() && skyline[j].x < end;)
+		{
+			auto& covered = skyline[j];
+			const auto overlap = end - covered.x;
+			if (covered.width <= overlap)
+			{
+				skyline.erase(skyline.begin() + j);
+				continue;
+			}
+
+			covered.x += overlap;
+			covered.width -= overlap;
+			break;
+		}
+
+		// neighbours at the same height become one segment
+		for (size_t j = 0; j + 1 < skyline.size();)
+		{
+			if (skyline[j].y == skyline[j + 1].y)
+			{
+				skyline[j].width += skyline[j + 1].width;
+				skyline.erase(skyline.begin() + j + 1);
+			}
+			else
+				j++;
+		}
+	}
+};
+
+// the levels an atlas keeps with gutter texels around every texture: while the gutter is at least two
+// texels wide, as far as the mip filter reaches, no level mixes neighbouring textures
+inline int atlas_mip_levels(const int gutter)
+{
+	auto levels = 1;
+	while ((gutter >> levels) >= 2)
+		levels++;
+	return levels;
+}
+
+// copies a texture of width x height into rect of the atlas, its edge texels repeated over gutter texels
+// all around it. Both have channels channels
+inline void copy_into_atlas(unsigned char* atlas, const int atlas_size, const int channels, const atlas_rect& rect, const unsigned char* pixels, const int width, const int height, const int gutter)
+{
+	for (auto y = -gutter; y < height + gutter; y++)
+	{
+		const auto source_y = std::min(height - 1, std::max(0, y));
+		auto* const row = atlas + (static_cast<size_t>(rect.y + y) * atlas_size + rect.x) * channels;
+		for (auto x = -gutter; x < width + gutter; x++)
+		{
+			const auto source_x = std::min(width - 1, std::max(0, x));
+			std::copy_n(pixels + (static_cast<size_t>(source_y) * width + source_x) * channels, channels, row + x * channels);
+		}
+	}
+}
+
+// where a texture went: the atlas and the texture coordinates of the rectangle it fills in it
+typedef struct
+{
+	std::string texture_file_name;
+	std::string atlas_file_name;
+	float u0;
+	float v0;
+	float u1;
+	float v1;
+} atlas_entry;
+
+// one texture a line: its file name, its atlas' and the rectangle, separated by spaces
+inline bool write_atlas_layout(const std::string& file_name, const std::vector<atlas_entry>& entries)
+{
+	std::ofstream file(file_name);
+	file.precision(9);
+	for (const auto& entry : entries)
+		file << entry.texture_file_name << " " << entry.atlas_file_name << " " << entry.u0 << " " << entry.v0 << " " << entry.u1 << " " << entry.v1 << "\n";
+	return static_cast<bool>(file);
+}
+
+// empty when there is no layout
+inline std::vector<atlas_entry> read_atlas_layout(const std::string& file_name)
+{
+	std::vector<atlas_entry> entries;
+	std::ifstream file(file_name);
+	std::string line;
+	while (std::getline(file, line))
+	{
+		std::istringstream fields(line);
+		atlas_entry entry;
+		if (fields >> entry.texture_file_name >> entry.atlas_file_name >> entry.u0 >> entry.v0 >> entry.u1 >> entry.v1)
+			entries.push_back(entry);
+	}
+	return entries;
+}
+
+// moves texture coordinates in [0, 1] to the entry's rectangle, uv_offset floats into each vertex
+inline void remap_texture_coordinates(float* vertices, const int count, const int stride, const int uv_offset, const atlas_entry& entry)
+{
+	for (auto i = 0; i < count; i++)
+	{
+		auto* const uv = vertices + static_cast<size_t>(i) * stride + uv_offset;
+		uv[0] = entry.u0 + uv[0] * (entry.u1 - entry.u0);
+		uv[1] = entry.v0 + uv[1] * (entry.v1 - entry.v0);
+	}
+}
+
+#endif
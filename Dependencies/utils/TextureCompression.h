@@ -0,0 +1,849 @@
+#ifndef TEXTURE_COMPRESSION_H
+#define TEXTURE_COMPRESSION_H
+
+#include <GL/glew.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// block formats the texture cooker writes, every block covers 4x4 texels
+enum texture_codec
+{
+	codec_bc1, // RGB, two 565 endpoints and 2 bit indices, 8 bytes
+	codec_bc3, // RGBA, BC1 color after 8 bytes of interpolated alpha, 16 bytes
+	codec_bc7, // RGBA, mode 6 only: one subset, 7 bit endpoints with a p-bit each and 4 bit indices, 16 bytes
+	codec_etc2 // RGB, the ETC1 compatible individual and differential modes, 8 bytes
+};
+
+const texture_codec texture_codecs[] = { codec_bc1, codec_bc3, codec_bc7, codec_etc2 };
+
+inline const char* codec_name(const texture_codec codec)
+{
+	switch (codec)
+	{
+	case codec_bc1: return "bc1";
+	case codec_bc3: return "bc3";
+	case codec_bc7: return "bc7";
+	default: return "etc2";
+	}
+}
+
+inline GLenum codec_gl_format(const texture_codec codec)
+{
+	switch (codec)
+	{
+	case codec_bc1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	case codec_bc3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	case codec_bc7: return GL_COMPRESSED_RGBA_BPTC_UNORM;
+	default: return GL_COMPRESSED_RGB8_ETC2;
+	}
+}
+
+inline bool codec_has_alpha(const texture_codec codec)
+{
+	return codec == codec_bc3 || codec == codec_bc7;
+}
+
+// whether the context can sample the codec, needs a current context with glew initialized
+inline bool codec_supported(const texture_codec codec)
+{
+	switch (codec)
+	{
+	case codec_bc1:
+	case codec_bc3: return GLEW_EXT_texture_compression_s3tc != 0;
+	case codec_bc7: return GLEW_VERSION_4_2 || GLEW_ARB_texture_compression_bptc;
+	default: return GLEW_VERSION_4_3 || GLEW_ARB_ES3_compatibility;
+	}
+}
+
+// bytes per 4x4 block of a compressed GL format
+inline int gl_block_bytes(const GLenum format)
+{
+	return format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT || format == GL_COMPRESSED_SRGB_S3TC_DXT1_EXT || format == GL_COMPRESSED_RGB8_ETC2 || format == GL_COMPRESSED_SRGB8_ETC2 ? 8 : 16;
+}
+
+inline size_t compressed_level_size(const GLenum format, const int width, const int height)
+{
+	return static_cast<size_t>((width + 3) / 4) * ((height + 3) / 4) * gl_block_bytes(format);
+}
+
+// least squares endpoints for the given weights of e0 (e1 gets 1 - weight), over channels channels.
+// Leaves the endpoints alone when every weight is the same
+inline void refine_endpoints(const float* pixels, const float* weights, const int count, const int channels, float* e0, float* e1)
+{
+	float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+	float ax[4] = { 0.0f, 0.0f, 0.0f, 0.0f }, bx[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	for (auto i = 0; i < count; i++)
+	{
+		const auto a = weights[i];
+		const auto b = 1.0f - a;
+		aa += a * a;
+		ab += a * b;
+		bb += b * b;
+		for (auto c = 0; c < channels; c++)
+		{
+			ax[c] += a * pixels[i * channels + c];
+			bx[c] += b * pixels[i * channels + c];
+		}
+	}
+
+	const auto determinant = aa * bb - ab * ab;
+	if (std::fabs(determinant) < 1e-6f)
+		return;
+
+	for (auto c = 0; c < channels; c++)
+	{
+		e0[c] = std::min(255.0f, std::max(0.0f, (ax[c] * bb - bx[c] * ab) / determinant));
+		e1[c] = std::min(255.0f, std::max(0.0f, (bx[c] * aa - ax[c] * ab) / determinant));
+	}
+}
+
+// ends of the block's principal axis, found by power iteration on the covariance
+inline void principal_endpoints(const float* pixels, const int count, const int channels, float* e0, float* e1)
+{
+	float mean[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	for (auto i = 0; i < count; i++)
+	{
+		for (auto c = 0; c < channels; c++)
+			mean[c] += pixels[i * channels + c] / count;
+	}
+
+	float covariance[4][4] = {};
+	for (auto i = 0; i < count; i++)
+	{
+		for (auto r = 0; r < channels; r++)
+		{
+			for (auto c = 0; c < channels; c++)
+				covariance[r][c] += (pixels[i * channels + r] - mean[r]) * (pixels[i * channels + c] - mean[c]);
+		}
+	}
+
+	float axis[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+	for (auto iteration = 0; iteration < 8; iteration++)
+	{
+		float next[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		auto length = 0.0f;
+		for (auto r = 0; r < channels; r++)
+		{
+			for (auto c = 0; c < channels; c++)
+				next[r] += covariance[r][c] * axis[c];
+			length = std::max(length, std::fabs(next[r]));
+		}
+		if (length < 1e-6f)
+			break;
+		for (auto c = 0; c < channels; c++)
+			axis[c] = next[c] / length;
+	}
+
+	auto low = 0.0f, high = 0.0f;
+	for (auto i = 0; i < count; i++)
+	{
+		auto t = 0.0f;
+		for (auto c = 0; c < channels; c++)
+			t += (pixels[i * channels + c] - mean[c]) * axis[c];
+		low = std::min(low, t);
+		high = std::max(high, t);
+	}
+
+	for (auto c = 0; c < channels; c++)
+	{
+		e0[c] = std::min(255.0f, std::max(0.0f, mean[c] + axis[c] * high));
+		e1[c] = std::min(255.0f, std::max(0.0f, mean[c] + axis[c] * low));
+	}
+}
+
+// bc1 color endpoints
+inline uint16_t pack_565(const float* color)
+{
+	const auto r = static_cast<int>(std::lround(color[0] * 31.0f / 255.0f));
+	const auto g = static_cast<int>(std::lround(color[1] * 63.0f / 255.0f));
+	const auto b = static_cast<int>(std::lround(color[2] * 31.0f / 255.0f));
+	return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+}
+
+inline void unpack_565(const uint16_t value, int* color)
+{
+	const auto r = value >> 11;
+	const auto g = (value >> 5) & 63;
+	const auto b = value & 31;
+	color[0] = (r << 3) | (r >> 2);
+	color[1] = (g << 2) | (g >> 4);
+	color[2] = (b << 3) | (b >> 2);
+}
+
+// the four colors of a bc1 block in four color mode
+inline void bc1_palette(const uint16_t c0, const uint16_t c1, int palette[4][3])
+{
+	unpack_565(c0, palette[0]);
+	unpack_565(c1, palette[1]);
+	for (auto c = 0; c < 3; c++)
+	{
+		palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+		palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+	}
+}
+
+// nearest palette entries, returns the squared error
+inline int bc1_indices(const float* pixels, const uint16_t c0, const uint16_t c1, uint32_t& indices)
+{
+	int palette[4][3];
+	bc1_palette(c0, c1, palette);
+
+	indices = 0;
+	auto total = 0;
+	for (auto i = 0; i < 16; i++)
+	{
+		auto best = 0, best_error = INT32_MAX;
+		for (auto p = 0; p < 4; p++)
+		{
+			auto error = 0;
+			for (auto c = 0; c < 3; c++)
+			{
+				const auto d = static_cast<int>(pixels[i * 3 + c]) - palette[p][c];
+				error += d * d;
+			}
+			if (error < best_error)
+			{
+				best_error = error;
+				best = p;
+			}
+		}
+		indices |= static_cast<uint32_t>(best) << (i * 2);
+		total += best_error;
+	}
+
+	return total;
+}
+
+// rgba is one 4x4 block, 16 texels of 4 bytes
+inline void encode_bc1_block(const unsigned char* rgba, unsigned char* out)
+{
+	float pixels[16 * 3];
+	for (auto i = 0; i < 16; i++)
+	{
+		for (auto c = 0; c < 3; c++)
+			pixels[i * 3 + c] = rgba[i * 4 + c];
+	}
+
+	float e0[3], e1[3];
+	principal_endpoints(pixels, 16, 3, e0, e1);
+
+	auto c0 = pack_565(e0);
+	auto c1 = pack_565(e1);
+	uint32_t indices;
+	auto error = bc1_indices(pixels, c0, c1, indices);
+
+	// one least squares pass on the chosen indices
+	static const float weights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+	float texel_weights[16];
+	for (auto i = 0; i < 16; i++)
+		texel_weights[i] = weights[(indices >> (i * 2)) & 3];
+	refine_endpoints(pixels, texel_weights, 16, 3, e0, e1);
+
+	const auto refined_c0 = pack_565(e0);
+	const auto refined_c1 = pack_565(e1);
+	uint32_t refined_indices;
+	if (bc1_indices(pixels, refined_c0, refined_c1, refined_indices) < error)
+	{
+		c0 = refined_c0;
+		c1 = refined_c1;
+		indices = refined_indices;
+	}
+
+	// c0 > c1 selects four color mode, swapping the endpoints swaps indices 0-1 and 2-3
+	if (c0 < c1)
+	{
+		std::swap(c0, c1);
+		indices ^= 0x55555555;
+	}
+	else if (c0 == c1)
+	{
+		indices = 0;
+	}
+
+	out[0] = c0 & 0xFF;
+	out[1] = c0 >> 8;
+	out[2] = c1 & 0xFF;
+	out[3] = c1 >> 8;
+	for (auto i = 0; i < 4; i++)
+		out[4 + i] = (indices >> (i * 8)) & 0xFF;
+}
+
+inline void decode_bc1_block(const unsigned char* in, unsigned char* rgba)
+{
+	const auto c0 = static_cast<uint16_t>(in[0] | (in[1] << 8));
+	const auto c1 = static_cast<uint16_t>(in[2] | (in[3] << 8));
+	const auto indices = static_cast<uint32_t>(in[4] | (in[5] << 8) | (in[6] << 16) | (static_cast<uint32_t>(in[7]) << 24));
+
+	int palette[4][3];
+	bc1_palette(c0, c1, palette);
+	auto transparent = false;
+	if (c0 <= c1)
+	{
+		// three color mode, only ever read from files written elsewhere
+		for (auto c = 0; c < 3; c++)
+		{
+			palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+			palette[3][c] = 0;
+		}
+		transparent = true;
+	}
+
+	for (auto i = 0; i < 16; i++)
+	{
+		const auto index = (indices >> (i * 2)) & 3;
+		for (auto c = 0; c < 3; c++)
+			rgba[i * 4 + c] = static_cast<unsigned char>(palette[index][c]);
+		rgba[i * 4 + 3] = transparent && index == 3 ? 0 : 255;
+	}
+}
+
+// bc3: alpha block first, then a bc1 color block that always uses four color mode
+inline void encode_bc3_block(const unsigned char* rgba, unsigned char* out)
+{
+	auto a0 = 0, a1 = 255;
+	for (auto i = 0; i < 16; i++)
+	{
+		a0 = std::max(a0, static_cast<int>(rgba[i * 4 + 3]));
+		a1 = std::min(a1, static_cast<int>(rgba[i * 4 + 3]));
+	}
+
+	int palette[8] = { a0, a1 };
+	for (auto i = 2; i < 8; i++)
+		palette[i] = ((8 - i) * a0 + (i - 1) * a1) / 7;
+
+	uint64_t indices = 0;
+	if (a0 != a1)
+	{
+		for (auto i = 0; i < 16; i++)
+		{
+			auto best = 0, best_error = INT32_MAX;
+			for (auto p = 0; p < 8; p++)
+			{
+				const auto error = std::abs(rgba[i * 4 + 3] - palette[p]);
+				if (error < best_error)
+				{
+					best_error = error;
+					best = p;
+				}
+			}
+			indices |= static_cast<uint64_t>(best) << (i * 3);
+		}
+	}
+
+	out[0] = static_cast<unsigned char>(a0);
+	out[1] = static_cast<unsigned char>(a1);
+	for (auto i = 0; i < 6; i++)
+		out[2 + i] = (indices >> (i * 8)) & 0xFF;
+
+	encode_bc1_block(rgba, out + 8);
+}
+
+inline void decode_bc3_block(const unsigned char* in, unsigned char* rgba)
+{
+	const int a0 = in[0], a1 = in[1];
+	int palette[8] = { a0, a1 };
+	for (auto i = 2; i < 8; i++)
+		palette[i] = a0 > a1 ? ((8 - i) * a0 + (i - 1) * a1) / 7 : 0;
+	if (a0 <= a1)
+	{
+		for (auto i = 2; i < 6; i++)
+			palette[i] = ((6 - i) * a0 + (i - 1) * a1) / 5;
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+
+	uint64_t indices = 0;
+	for (auto i = 0; i < 6; i++)
+		indices |= static_cast<uint64_t>(in[2 + i]) << (i * 8);
+
+	// the color block of bc3 never has the three color mode
+	const auto c0 = static_cast<uint16_t>(in[8] | (in[9] << 8));
+	const auto c1 = static_cast<uint16_t>(in[10] | (in[11] << 8));
+	const auto color_indices = static_cast<uint32_t>(in[12] | (in[13] << 8) | (in[14] << 16) | (static_cast<uint32_t>(in[15]) << 24));
+	int colors[4][3];
+	bc1_palette(c0, c1, colors);
+
+	for (auto i = 0; i < 16; i++)
+	{
+		const auto index = (color_indices >> (i * 2)) & 3;
+		for (auto c = 0; c < 3; c++)
+			rgba[i * 4 + c] = static_cast<unsigned char>(colors[index][c]);
+		rgba[i * 4 + 3] = static_cast<unsigned char>(palette[(indices >> (i * 3)) & 7]);
+	}
+}
+
+// little endian bit stream of a 128 bit block
+class block_bits
+{
+public:
+	unsigned char* bytes;
+	int position = 0;
+
+	explicit block_bits(unsigned char* block) : bytes(block) {}
+
+	void write(const uint32_t value, const int count)
+	{
+		for (auto i = 0; i < count; i++, position++)
+		{
+			if ((value >> i) & 1)
+				bytes[position / 8] |= static_cast<unsigned char>(1 << (position % 8));
+			else
+				bytes[position / 8] &= static_cast<unsigned char>(~(1 << (position % 8)));
+		}
+	}
+
+	uint32_t read(const int count)
+	{
+		uint32_t value = 0;
+		for (auto i = 0; i < count; i++, position++)
+			value |= static_cast<uint32_t>((bytes[position / 8] >> (position % 8)) & 1) << i;
+		return value;
+	}
+};
+
+const int bc7_weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+// nearest of the 16 interpolated colors of a mode 6 block with 8 bit endpoints, returns the squared error
+inline int bc7_indices(const float* pixels, const int* e0, const int* e1, int* indices)
+{
+	int palette[16][4];
+	for (auto w = 0; w < 16; w++)
+	{
+		for (auto c = 0; c < 4; c++)
+			palette[w][c] = ((64 - bc7_weights[w]) * e0[c] + bc7_weights[w] * e1[c] + 32) >> 6;
+	}
+
+	auto total = 0;
+	for (auto i = 0; i < 16; i++)
+	{
+		auto best = 0, best_error = INT32_MAX;
+		for (auto p = 0; p < 16; p++)
+		{
+			auto error = 0;
+			for (auto c = 0; c < 4; c++)
+			{
+				const auto d = static_cast<int>(pixels[i * 4 + c]) - palette[p][c];
+				error += d * d;
+			}
+			if (error < best_error)
+			{
+				best_error = error;
+				best = p;
+			}
+		}
+		indices[i] = best;
+		total += best_error;
+	}
+
+	return total;
+}
+
+// 7 bit endpoints for every combination of p-bits, keeps the one with the least error
+inline int bc7_quantize(const float* pixels, const float* e0, const float* e1, int* q0, int* q1, int* p, int* indices)
+{
+	auto best_error = INT32_MAX;
+	for (auto combination = 0; combination < 4; combination++)
+	{
+		const int pbits[2] = { combination & 1, combination >> 1 };
+		int candidate0[4], candidate1[4], full0[4], full1[4], candidate_indices[16];
+		for (auto c = 0; c < 4; c++)
+		{
+			candidate0[c] = std::min(127, std::max(0, static_cast<int>(std::lround((e0[c] - pbits[0]) / 2.0f))));
+			candidate1[c] = std::min(127, std::max(0, static_cast<int>(std::lround((e1[c] - pbits[1]) / 2.0f))));
+			full0[c] = (candidate0[c] << 1) | pbits[0];
+			full1[c] = (candidate1[c] << 1) | pbits[1];
+		}
+
+		const auto error = bc7_indices(pixels, full0, full1, candidate_indices);
+		if (error < best_error)
+		{
+			best_error = error;
+			std::copy(candidate0, candidate0 + 4, q0);
+			std::copy(candidate1, candidate1 + 4, q1);
+			p[0] = pbits[0];
+			p[1] = pbits[1];
+			std::copy(candidate_indices, candidate_indices + 16, indices);
+		}
+	}
+
+	return best_error;
+}
+
+inline void encode_bc7_block(const unsigned char* rgba, unsigned char* out)
+{
+	float pixels[16 * 4];
+	for (auto i = 0; i < 64; i++)
+		pixels[i] = rgba[i];
+
+	float e0[4], e1[4];
+	principal_endpoints(pixels, 16, 4, e0, e1);
+
+	int q0[4], q1[4], p[2], indices[16];
+	const auto error = bc7_quantize(pixels, e0, e1, q0, q1, p, indices);
+
+	// one least squares pass on the chosen indices
+	float weights[16];
+	for (auto i = 0; i < 16; i++)
+		weights[i] = 1.0f - bc7_weights[indices[i]] / 64.0f;
+	refine_endpoints(pixels, weights, 16, 4, e0, e1);
+
+	int refined_q0[4], refined_q1[4], refined_p[2], refined_indices[16];
+	if (bc7_quantize(pixels, e0, e1, refined_q0, refined_q1, refined_p, refined_indices) < error)
+	{
+		std::copy(refined_q0, refined_q0 + 4, q0);
+		std::copy(refined_q1, refined_q1 + 4, q1);
+		std::copy(refined_p, refined_p + 2, p);
+		std::copy(refined_indices, refined_indices + 16, indices);
+	}
+
+	// the first index is stored without its top bit, so it has to be below 8
+	if (indices[0] >= 8)
+	{
+		std::swap_ranges(q0, q0 + 4, q1);
+		std::swap(p[0], p[1]);
+		for (auto i = 0; i < 16; i++)
+			indices[i] = 15 - indices[i];
+	}
+
+	block_bits bits(out);
+	bits.write(1 << 6, 7);
+	for (auto c = 0; c < 4; c++)
+	{
+		bits.write(q0[c], 7);
+		bits.write(q1[c], 7);
+	}
+	bits.write(p[0], 1);
+	bits.write(p[1], 1);
+	for (auto i = 0; i < 16; i++)
+		bits.write(indices[i], i == 0 ? 3 : 4);
+}
+
+// only mode 6, the one encode_bc7_block writes; other modes decode as black
+inline void decode_bc7_block(const unsigned char* in, unsigned char* rgba)
+{
+	if ((in[0] & 0x7f) != 1 << 6)
+	{
+		std::fill(rgba, rgba + 64, static_cast<unsigned char>(0));
+		return;
+	}
+
+	block_bits bits(const_cast<unsigned char*>(in));
+	bits.read(7);
+	int e0[4], e1[4];
+	for (auto c = 0; c < 4; c++)
+	{
+		e0[c] = bits.read(7) << 1;
+		e1[c] = bits.read(7) << 1;
+	}
+	const auto p0 = bits.read(1);
+	const auto p1 = bits.read(1);
+	for (auto c = 0; c < 4; c++)
+	{
+		e0[c] |= p0;
+		e1[c] |= p1;
+	}
+
+	for (auto i = 0; i < 16; i++)
+	{
+		const auto weight = bc7_weights[bits.read(i == 0 ? 3 : 4)];
+		for (auto c = 0; c < 4; c++)
+			rgba[i * 4 + c] = static_cast<unsigned char>(((64 - weight) * e0[c] + weight * e1[c] + 32) >> 6);
+	}
+}
+
+const int etc_modifiers[8][4] =
+{
+	{ 2, 8, -2, -8 }, { 5, 17, -5, -17 }, { 9, 29, -9, -29 }, { 13, 42, -13, -42 },
+	{ 18, 60, -18, -60 }, { 24, 80, -24, -80 }, { 33, 106, -33, -106 }, { 47, 183, -47, -183 }
+};
+
+// an etc block is split in two halves: left and right columns, or with flip set top and bottom rows
+inline int etc_half(const int x, const int y, const int flip)
+{
+	return flip ? (y >= 2 ? 1 : 0) : (x >= 2 ? 1 : 0);
+}
+
+// texels are numbered down the columns
+inline int etc_texel_bit(const int x, const int y)
+{
+	return x * 4 + y;
+}
+
+// best modifier table for one half around its base color, msb and lsb get the half's bits of the two
+// index planes. Returns the squared error
+inline int etc_fit_half(const unsigned char* rgba, const int flip, const int half, const int* base, int& table, uint32_t& msb, uint32_t& lsb)
+{
+	auto best_error = INT32_MAX;
+	for (auto t = 0; t < 8; t++)
+	{
+		auto error = 0;
+		uint32_t table_msb = 0, table_lsb = 0;
+		for (auto y = 0; y < 4; y++)
+		{
+			for (auto x = 0; x < 4; x++)
+			{
+				if (etc_half(x, y, flip) != half)
+					continue;
+
+				auto best = 0, best_texel = INT32_MAX;
+				for (auto m = 0; m < 4; m++)
+				{
+					auto texel_error = 0;
+					for (auto c = 0; c < 3; c++)
+					{
+						const auto d = rgba[(y * 4 + x) * 4 + c] - std::min(255, std::max(0, base[c] + etc_modifiers[t][m]));
+						texel_error += d * d;
+					}
+					if (texel_error < best_texel)
+					{
+						best_texel = texel_error;
+						best = m;
+					}
+				}
+
+				table_msb |= static_cast<uint32_t>(best >> 1) << etc_texel_bit(x, y);
+				table_lsb |= static_cast<uint32_t>(best & 1) << etc_texel_bit(x, y);
+				error += best_texel;
+			}
+		}
+
+		if (error < best_error)
+		{
+			best_error = error;
+			table = t;
+			msb = table_msb;
+			lsb = table_lsb;
+		}
+	}
+
+	return best_error;
+}
+
+inline void etc_write(const uint64_t block, unsigned char* out)
+{
+	for (auto i = 0; i < 8; i++)
+		out[i] = static_cast<unsigned char>(block >> (56 - i * 8));
+}
+
+// tries both splits, each in differential mode when the two average colors are close enough and in
+// individual mode otherwise. Never produces the T, H or planar modes, which ETC2 decoders only see on a
+// differential overflow
+inline void encode_etc2_block(const unsigned char* rgba, unsigned char* out)
+{
+	auto best_error = INT32_MAX;
+	uint64_t best_block = 0;
+
+	for (auto flip = 0; flip < 2; flip++)
+	{
+		float average[2][3] = {};
+		for (auto y = 0; y < 4; y++)
+		{
+			for (auto x = 0; x < 4; x++)
+			{
+				for (auto c = 0; c < 3; c++)
+					average[etc_half(x, y, flip)][c] += rgba[(y * 4 + x) * 4 + c] / 8.0f;
+			}
+		}
+
+		int q5[2][3], q4[2][3];
+		auto differential = true;
+		for (auto c = 0; c < 3; c++)
+		{
+			for (auto h = 0; h < 2; h++)
+			{
+				q5[h][c] = static_cast<int>(std::lround(average[h][c] * 31.0f / 255.0f));
+				q4[h][c] = static_cast<int>(std::lround(average[h][c] * 15.0f / 255.0f));
+			}
+			const auto delta = q5[1][c] - q5[0][c];
+			differential = differential && delta >= -4 && delta <= 3;
+		}
+
+		int base[2][3];
+		for (auto h = 0; h < 2; h++)
+		{
+			for (auto c = 0; c < 3; c++)
+				base[h][c] = differential ? (q5[h][c] << 3) | (q5[h][c] >> 2) : (q4[h][c] << 4) | q4[h][c];
+		}
+
+		int tables[2];
+		uint32_t msb = 0, lsb = 0;
+		uint32_t half_msb[2] = { 0, 0 }, half_lsb[2] = { 0, 0 };
+		auto error = 0;
+		for (auto h = 0; h < 2; h++)
+		{
+			error += etc_fit_half(rgba, flip, h, base[h], tables[h], half_msb[h], half_lsb[h]);
+			msb |= half_msb[h];
+			lsb |= half_lsb[h];
+		}
+
+		if (error >= best_error)
+			continue;
+
+		uint64_t block = 0;
+		for (auto c = 0; c < 3; c++)
+		{
+			const auto shift = 56 - c * 8;
+			if (differential)
+				block |= (static_cast<uint64_t>(q5[0][c]) << (shift + 3)) | (static_cast<uint64_t>((q5[1][c] - q5[0][c]) & 7) << shift);
+			else
+				block |= (static_cast<uint64_t>(q4[0][c]) << (shift + 4)) | (static_cast<uint64_t>(q4[1][c]) << shift);
+		}
+		block |= static_cast<uint64_t>(tables[0]) << 37;
+		block |= static_cast<uint64_t>(tables[1]) << 34;
+		block |= static_cast<uint64_t>(differential ? 1 : 0) << 33;
+		block |= static_cast<uint64_t>(flip) << 32;
+		block |= static_cast<uint64_t>(msb) << 16 | lsb;
+
+		best_error = error;
+		best_block = block;
+	}
+
+	etc_write(best_block, out);
+}
+
+// individual and differential modes only, the ones encode_etc2_block writes; blocks using the other
+// modes decode as black
+inline void decode_etc2_block(const unsigned char* in, unsigned char* rgba)
+{
+	uint64_t block = 0;
+	for (auto i = 0; i < 8; i++)
+		block = block << 8 | in[i];
+
+	const auto differential = (block >> 33) & 1;
+	const auto flip = static_cast<int>((block >> 32) & 1);
+	int base[2][3];
+	for (auto c = 0; c < 3; c++)
+	{
+		const auto shift = 56 - c * 8;
+		if (differential)
+		{
+			const auto first = static_cast<int>((block >> (shift + 3)) & 31);
+			auto delta = static_cast<int>((block >> shift) & 7);
+			delta = delta >= 4 ? delta - 8 : delta;
+			const auto second = first + delta;
+			if (second < 0 || second > 31)
+			{
+				std::fill(rgba, rgba + 64, static_cast<unsigned char>(0));
+				return;
+			}
+			base[0][c] = (first << 3) | (first >> 2);
+			base[1][c] = (second << 3) | (second >> 2);
+		}
+		else
+		{
+			const auto first = static_cast<int>((block >> (shift + 4)) & 15);
+			const auto second = static_cast<int>((block >> shift) & 15);
+			base[0][c] = (first << 4) | first;
+			base[1][c] = (second << 4) | second;
+		}
+	}
+
+	const int tables[2] = { static_cast<int>((block >> 37) & 7), static_cast<int>((block >> 34) & 7) };
+	for (auto y = 0; y < 4; y++)
+	{
+		for (auto x = 0; x < 4; x++)
+		{
+			const auto bit = etc_texel_bit(x, y);
+			const auto index = static_cast<int>(((block >> (16 + bit)) & 1) << 1 | ((block >> bit) & 1));
+			const auto half = etc_half(x, y, flip);
+			for (auto c = 0; c < 3; c++)
+				rgba[(y * 4 + x) * 4 + c] = static_cast<unsigned char>(std::min(255, std::max(0, base[half][c] + etc_modifiers[tables[half]][index])));
+			rgba[(y * 4 + x) * 4 + 3] = 255;
+		}
+	}
+}
+
+inline void encode_block(const texture_codec codec, const unsigned char* rgba, unsigned char* out)
+{
+	switch (codec)
+	{
+	case codec_bc1: encode_bc1_block(rgba, out); break;
+	case codec_bc3: encode_bc3_block(rgba, out); break;
+	case codec_bc7: encode_bc7_block(rgba, out); break;
+	default: encode_etc2_block(rgba, out); break;
+	}
+}
+
+inline void decode_block(const texture_codec codec, const unsigned char* in, unsigned char* rgba)
+{
+	switch (codec)
+	{
+	case codec_bc1: decode_bc1_block(in, rgba); break;
+	case codec_bc3: decode_bc3_block(in, rgba); break;
+	case codec_bc7: decode_bc7_block(in, rgba); break;
+	default: decode_etc2_block(in, rgba); break;
+	}
+}
+
+// block rows [first_row, end_row) of an RGBA level into out, which holds the whole level. Blocks past the
+// edge of the level repeat its last row and column
+inline void compress_block_rows(const texture_codec codec, const unsigned char* rgba, const int width, const int height, const int first_row, const int end_row, unsigned char* out)
+{
+	const auto block_bytes = gl_block_bytes(codec_gl_format(codec));
+	const auto blocks_x = (width + 3) / 4;
+
+	unsigned char block[64];
+	for (auto by = first_row; by < end_row; by++)
+	{
+		for (auto bx = 0; bx < blocks_x; bx++)
+		{
+			for (auto y = 0; y < 4; y++)
+			{
+				for (auto x = 0; x < 4; x++)
+				{
+					const auto source_x = std::min(bx * 4 + x, width - 1);
+					const auto source_y = std::min(by * 4 + y, height - 1);
+					std::copy_n(rgba + (static_cast<size_t>(source_y) * width + source_x) * 4, 4, block + (y * 4 + x) * 4);
+				}
+			}
+			encode_block(codec, block, out + (static_cast<size_t>(by) * blocks_x + bx) * block_bytes);
+		}
+	}
+}
+
+inline std::vector<unsigned char> decompress_level(const texture_codec codec, const unsigned char* data, const int width, const int height)
+{
+	const auto block_bytes = gl_block_bytes(codec_gl_format(codec));
+	const auto blocks_x = (width + 3) / 4;
+	const auto blocks_y = (height + 3) / 4;
+
+	std::vector<unsigned char> rgba(static_cast<size_t>(width) * height * 4);
+	unsigned char block[64];
+	for (auto by = 0; by < blocks_y; by++)
+	{
+		for (auto bx = 0; bx < blocks_x; bx++)
+		{
+			decode_block(codec, data + (static_cast<size_t>(by) * blocks_x + bx) * block_bytes, block);
+			for (auto y = 0; y < 4 && by * 4 + y < height; y++)
+			{
+				for (auto x = 0; x < 4 && bx * 4 + x < width; x++)
+					std::copy_n(block + (y * 4 + x) * 4, 4, &rgba[(static_cast<size_t>(by * 4 + y) * width + bx * 4 + x) * 4]);
+			}
+		}
+	}
+
+	return rgba;
+}
+
+// peak signal to noise ratio in dB over the first channels channels of two RGBA images
+inline double rgba_psnr(const unsigned char* a, const unsigned char* b, const size_t texels, const int channels)
+{
+	double squared = 0.0;
+	for (size_t i = 0; i < texels; i++)
+	{
+		for (auto c = 0; c < channels; c++)
+		{
+			const double d = static_cast<int>(a[i * 4 + c]) - static_cast<int>(b[i * 4 + c]);
+			squared += d * d;
+		}
+	}
+
+	const auto mean = squared / (static_cast<double>(texels) * channels);
+	return mean > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / mean) : 99.0;
+}
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef TEXTURE_FORMATS_H
+#define TEXTURE_FORMATS_H
+
+#include <GL/glew.h>
+#include <CpuFeatures.h>
+
+#include <cstddef>
+
+// how the texels of an image go to GL, decided by its channel count. Tightly packed RGB rows send most
+// drivers down a path that converts them on the CPU during the call, so three channels are expanded to
+// RGBA before they get there. One and two channels stay red and red-green textures, a quarter and a half
+// of the memory, swizzled to read as gray and gray with alpha
+typedef struct
+{
+	GLenum internal_format;
+	GLenum format;
+	int channels; // of every uploaded texel
+} texture_format;
+
+// the channels an image with channels channels is uploaded with
+inline int upload_channels(const int channels)
+{
+	return channels == 3 ? 4 : channels;
+}
+
+// with srgb the colors are decoded to linear light by the texture units. Gray has no sRGB format in core
+// GL and stays linear
+inline texture_format choose_texture_format(const int channels, const bool srgb)
+{
+	switch (upload_channels(channels))
+	{
+	case 1:
+		return texture_format{ GL_R8, GL_RED, 1 };
+	case 2:
+		return texture_format{ GL_RG8, GL_RG, 2 };
+	default:
+		return texture_format{ static_cast<GLenum>(srgb ? GL_SRGB8_ALPHA8 : GL_RGBA8), GL_RGBA, 4 };
+	}
+}
+
+// the sRGB twin of a block format, the format itself when it has none
+inline GLenum srgb_compressed_format(const GLenum format)
+{
+	switch (format)
+	{
+	case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: return GL_COMPRESSED_SRGB_S3TC_DXT1_EXT;
+	case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: return GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT;
+	case GL_COMPRESSED_RGBA_BPTC_UNORM: return GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM;
+	case GL_COMPRESSED_RGB8_ETC2: return GL_COMPRESSED_SRGB8_ETC2;
+	default: return format;
+	}
+}
+
+// gray textures read their red channel as every color, and their green one as alpha when they have it.
+// Applies to the texture bound to target
+inline void set_texture_swizzle(const GLenum target, const int channels)
+{
+	if (channels > 2)
+		return;
+
+	const GLint gray[] = { GL_RED, GL_RED, GL_RED, GL_ONE };
+	const GLint gray_alpha[] = { GL_RED, GL_RED, GL_RED, GL_GREEN };
+	glTexParameteriv(target, GL_TEXTURE_SWIZZLE_RGBA, channels == 1 ? gray : gray_alpha);
+}
+
+inline void expand_rgb_to_rgba_scalar(const unsigned char* rgb, unsigned char* rgba, const size_t texels)
+{
+	for (size_t i = 0; i < texels; i++)
+	{
+		rgba[i * 4] = rgb[i * 3];
+		rgba[i * 4 + 1] = rgb[i * 3 + 1];
+		rgba[i * 4 + 2] = rgb[i * 3 + 2];
+		rgba[i * 4 + 3] = 255;
+	}
+}
+
+#ifdef SIMD_X86
+// four texels at a time, shuffled into place out of a 16 byte load. A load reads four bytes past the
+// texels it uses, so the last texels are left to the scalar variant
+SIMD_TARGET("ssse3,sse4.1") inline void expand_rgb_to_rgba_sse4(const unsigned char* rgb, unsigned char* rgba, const size_t texels)
+{
+	const auto shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+	const auto alpha = _mm_set1_epi32(static_cast<int>(0xff000000u));
+	size_t i = 0;
+	for (; (i + 4) * 3 + 4 <= texels * 3; i += 4)
+	{
+		const auto source = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rgb + i * 3));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(rgba + i * 4), _mm_or_si128(_mm_shuffle_epi8(source, shuffle), alpha));
+	}
+	expand_rgb_to_rgba_scalar(rgb + i * 3, rgba + i * 4, texels - i);
+}
+
+// eight texels at a time, the two halves of a 32 byte store shuffled out of their own 16 byte loads
+SIMD_TARGET("avx2") inline void expand_rgb_to_rgba_avx2(const unsigned char* rgb, unsigned char* rgba, const size_t texels)
+{
+	const auto shuffle = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+		0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+	const auto alpha = _mm256_set1_epi32(static_cast<int>(0xff000000u));
+	size_t i = 0;
+	for (; (i + 8) * 3 + 4 <= texels * 3; i += 8)
+	{
+		const auto low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rgb + i * 3));
+		const auto high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rgb + i * 3 + 12));
+		const auto source = _mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(rgba + i * 4), _mm256_or_si256(_mm256_shuffle_epi8(source, shuffle), alpha));
+	}
+	_mm256_zeroupper();
+	expand_rgb_to_rgba_scalar(rgb + i * 3, rgba + i * 4, texels - i);
+}
+#endif
+
+// RGB texels to RGBA with opaque alpha, with the variant for the active SIMD level
+inline void expand_rgb_to_rgba(const unsigned char* rgb, unsigned char* rgba, const size_t texels)
+{
+#ifdef SIMD_X86
+	typedef void (*kernel)(const unsigned char*, unsigned char*, size_t);
+	static const kernel variants[simd_level_count] = { expand_rgb_to_rgba_scalar, expand_rgb_to_rgba_sse4, expand_rgb_to_rgba_avx2, nullptr };
+	dispatch_kernel(kernel_expand_rgb_to_rgba, variants)(rgb, rgba, texels);
+#else
+	expand_rgb_to_rgba_scalar(rgb, rgba, texels);
+#endif
+}
+
+#endif
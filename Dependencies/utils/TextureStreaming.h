@@ -0,0 +1,368 @@
+#ifndef TEXTURE_STREAMING_H
+#define TEXTURE_STREAMING_H
+
+#include <GL/glew.h>
+
+#include <JobSystem.h>
+#include <PixelBuffers.h>
+#include <TextureCompression.h>
+#include <TextureFormats.h>
+#include <UploadScheduler.h>
+#include <UploadThread.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <vector>
+
+// texture coordinates per world unit of a triangle list: the square root of the area its triangles
+// cover in the texture over the area they cover in the world. Positions are the first three floats of a
+// vertex, the texture coordinates the two at uv_offset
+inline float texture_coordinate_density(const float* vertices, const int count, const int stride, const int uv_offset)
+{
+	double uv_area = 0.0, world_area = 0.0;
+	for (auto i = 0; i + 2 < count; i += 3)
+	{
+		const auto* const a = vertices + static_cast<size_t>(i) * stride;
+		const auto* const b = a + stride;
+		const auto* const c = b + stride;
+
+		const double e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+		const double e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+		const double cross[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+		world_area += std::sqrt(cross[0] * cross[0] + cross[1] * cross[1] + cross[2] * cross[2]);
+
+		const auto* const ta = a + uv_offset;
+		const auto* const tb = b + uv_offset;
+		const auto* const tc = c + uv_offset;
+		uv_area += std::fabs((tb[0] - ta[0]) * (tc[1] - ta[1]) - (tc[0] - ta[0]) * (tb[1] - ta[1]));
+	}
+
+	return world_area > 0.0 ? static_cast<float>(std::sqrt(uv_area / world_area)) : 0.0f;
+}
+
+// the finest level worth having for a surface distance away, the first whose texels are no smaller than
+// the pixels they land on. size is the larger side of level 0, pixel_scale the pixels a world unit
+// covers one unit away: projection[1][1] times half the viewport height
+inline int required_mip_level(const int size, const int levels, const float uv_density, const float distance, const float pixel_scale)
+{
+	const auto texels = size * uv_density; // per world unit at level 0
+	const auto pixels = pixel_scale / std::max(distance, 1e-3f);
+	const auto level = static_cast<int>(std::floor(std::log2(std::max(1.0f, texels / pixels))));
+	return std::min(levels - 1, std::max(0, level));
+}
+
+// a texture whose finer levels come and go. Its whole chain stays in system memory, the GPU only has
+// the levels from resident_level down to 1x1. The fields up to chains are set once by add
+typedef struct
+{
+	unsigned int* texture; // written by whoever creates it
+	GLenum target; // GL_TEXTURE_2D or GL_TEXTURE_2D_ARRAY
+	int width;
+	int height;
+	int channels;
+	int layers;
+	int levels;
+	GLenum compressed;
+	bool srgb; // the colors are sampled as sRGB
+	int first_level; // the coarse levels loaded up front, never evicted
+	std::vector<std::shared_ptr<std::vector<std::vector<unsigned char>>>> chains; // one per layer, level 0 first
+
+	std::atomic<bool> ready{ false }; // set by the upload thread once the coarse levels are in and the chains filled
+	std::atomic<int> base_level{ 0 }; // GL_TEXTURE_BASE_LEVEL as the drawing thread last set it
+
+	// the rest belongs to the thread that runs the streamer
+	int resident_level; // finest level given memory, ahead of base_level while a change is on its way
+	int wanted_level; // this frame, levels when the texture is not drawn
+	size_t last_wanted; // frame the texture was last drawn
+} streamed_texture;
+
+// storage for one level of every layer, without data. empty gives the level no texels at all, which is
+// how the memory of an evicted level goes back
+inline void define_streamed_level(const streamed_texture& texture, const int level, const bool empty)
+{
+	const auto width = empty ? 0 : std::max(1, texture.width >> level);
+	const auto height = empty ? 0 : std::max(1, texture.height >> level);
+	const auto format = choose_texture_format(texture.channels, texture.srgb);
+	const auto size = texture.compressed != 0 ? static_cast<GLsizei>(compressed_level_size(texture.compressed, width, height) * texture.layers) : 0;
+
+	if (texture.target == GL_TEXTURE_2D_ARRAY)
+	{
+		if (texture.compressed != 0)
+			glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, texture.compressed, width, height, texture.layers, 0, size, nullptr);
+		else
+			glTexImage3D(GL_TEXTURE_2D_ARRAY, level, format.internal_format, width, height, texture.layers, 0, format.format, GL_UNSIGNED_BYTE, nullptr);
+	}
+	else
+	{
+		if (texture.compressed != 0)
+			glCompressedTexImage2D(GL_TEXTURE_2D, level, texture.compressed, width, height, 0, size, nullptr);
+		else
+			glTexImage2D(GL_TEXTURE_2D, level, format.internal_format, width, height, 0, format.format, GL_UNSIGNED_BYTE, nullptr);
+	}
+}
+
+// rows [first_row, first_row + rows) of one level of a layer from its chain, rows of blocks when compressed,
+// or from where the level of the layer was written in staging at offset once it has been staged. A layer
+// that failed to load has an empty chain and is left as it is
+inline void upload_streamed_rows(const streamed_texture& texture, const int layer, const int level, const int first_row, const int rows, staging_buffer* staging, const size_t offset)
+{
+	if (texture.chains[layer]->empty())
+		return;
+
+	const auto width = std::max(1, texture.width >> level);
+	const auto height = std::max(1, texture.height >> level);
+	const auto format = choose_texture_format(texture.channels, texture.srgb).format;
+	const auto row_bytes = texture.compressed != 0 ? compressed_level_size(texture.compressed, width, 1) : static_cast<size_t>(width) * texture.channels;
+	const auto* const data = (staging->staged() ? buffer_offset(offset) : (*texture.chains[layer])[level].data()) + first_row * row_bytes;
+
+	glBindTexture(texture.target, *texture.texture);
+	upload_pixels(data, rows * row_bytes, [&](const void* pixels)
+	{
+		if (texture.compressed != 0)
+		{
+			const auto band_height = std::min(rows * 4, height - first_row * 4);
+			if (texture.target == GL_TEXTURE_2D_ARRAY)
+				glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, first_row * 4, layer, width, band_height, 1, texture.compressed, static_cast<GLsizei>(rows * row_bytes), pixels);
+			else
+				glCompressedTexSubImage2D(GL_TEXTURE_2D, level, 0, first_row * 4, width, band_height, texture.compressed, static_cast<GLsizei>(rows * row_bytes), pixels);
+		}
+		else
+		{
+			if (texture.target == GL_TEXTURE_2D_ARRAY)
+				glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, first_row, layer, width, rows, 1, format, GL_UNSIGNED_BYTE, pixels);
+			else
+				glTexSubImage2D(GL_TEXTURE_2D, level, 0, first_row, width, rows, format, GL_UNSIGNED_BYTE, pixels);
+		}
+	}, staging);
+}
+
+// a move of GL_TEXTURE_BASE_LEVEL left to the thread that draws: down to a finer level once its upload is
+// fenced, or up right away, the levels left out losing their memory
+typedef struct
+{
+	streamed_texture* texture;
+	int level;
+	std::shared_ptr<upload_ticket> ticket; // null when evicting
+} texture_level_change;
+
+// false while the upload is still on its way. Leaves no texture bound to the active unit
+inline bool apply_texture_level_change(const texture_level_change& change)
+{
+	if (!upload_finished(change.ticket.get()))
+		return false;
+
+	auto& texture = *change.texture;
+	glBindTexture(texture.target, *texture.texture);
+	glTexParameteri(texture.target, GL_TEXTURE_BASE_LEVEL, change.level);
+	for (auto level = texture.base_level.load(); level < change.level; level++)
+		define_streamed_level(texture, level, true);
+	glBindTexture(texture.target, 0);
+
+	texture.base_level = change.level;
+	return true;
+}
+
+// decides which levels of the streamed textures are on the GPU. Every frame the textures drawn say
+// which level they need; the finer levels missing are uploaded through the scheduler one at a time,
+// those furthest from what they need first, as long as they fit the budget. When one does not, levels
+// no longer needed are evicted, from the textures drawn least recently. The coarse levels loaded up
+// front are always kept, so they may go over the budget on their own. Belongs to one thread, the one
+// that issues the scheduler's uploads
+class texture_streamer
+{
+public:
+	size_t budget = 64 * 1024 * 1024;
+
+	// bytes given to levels, those still on their way included, and levels wanted but left out this frame
+	size_t resident_bytes = 0;
+	size_t deferred_levels = 0;
+
+	// returns the handle. The texture must be created with levels first_level and coarser only, those whose
+	// larger side is at most start_size, and GL_TEXTURE_BASE_LEVEL at first_level
+	int add(unsigned int* texture, const GLenum target, const int width, const int height, const int channels, const int layers, const int levels, const GLenum compressed, const bool srgb, const int start_size)
+	{
+		textures.emplace_back();
+		auto& added = textures.back();
+		added.texture = texture;
+		added.target = target;
+		added.width = width;
+		added.height = height;
+		added.channels = channels;
+		added.layers = layers;
+		added.levels = levels;
+		added.compressed = compressed;
+		added.srgb = srgb;
+		added.first_level = 0;
+		while (added.first_level < levels - 1 && std::max(width, height) >> added.first_level > start_size)
+			added.first_level++;
+		added.chains.resize(layers);
+		added.base_level = added.first_level;
+		added.resident_level = added.first_level;
+		added.wanted_level = levels;
+		added.last_wanted = 0;
+
+		for (auto level = added.first_level; level < levels; level++)
+			resident_bytes += level_bytes(added, level);
+
+		return static_cast<int>(textures.size()) - 1;
+	}
+
+	streamed_texture& get(const int handle)
+	{
+		return textures[handle];
+	}
+
+	// nothing is wanted until want is called again
+	void begin_frame()
+	{
+		frame++;
+		for (auto& texture : textures)
+			texture.wanted_level = texture.levels;
+	}
+
+	// a texture drawn by several objects keeps the finest level any of them wants
+	void want(const int handle, const int level)
+	{
+		auto& texture = textures[handle];
+		texture.wanted_level = std::min(texture.wanted_level, level);
+		texture.last_wanted = frame;
+	}
+
+	// queues this frame's uploads, with items of at most chunk_size bytes whose levels a job of jobs stages,
+	// and adds the level changes the drawing thread has to make
+	void update(upload_scheduler& scheduler, job_system& jobs, const size_t chunk_size, std::vector<texture_level_change>& changes)
+	{
+		order.clear();
+		for (auto& texture : textures)
+		{
+			if (texture.ready && texture.base_level == texture.resident_level && texture.wanted_level < texture.resident_level)
+				order.push_back(&texture);
+		}
+		std::stable_sort(order.begin(), order.end(), [](const streamed_texture* a, const streamed_texture* b)
+		{
+			return a->resident_level - a->wanted_level > b->resident_level - b->wanted_level;
+		});
+
+		deferred_levels = 0;
+		for (auto* const texture : order)
+		{
+			const auto level = texture->resident_level - 1;
+			const auto bytes = level_bytes(*texture, level);
+			if (resident_bytes + bytes > budget && !make_room(bytes, texture, changes))
+			{
+				deferred_levels += texture->resident_level - texture->wanted_level;
+				continue;
+			}
+
+			const auto ticket = std::make_shared<upload_ticket>();
+			upload_staging staging;
+			auto items = level_items(texture, level, chunk_size, staging);
+			add_staged_resource(scheduler, jobs, std::move(items), std::move(staging), ticket, nullptr);
+			texture->resident_level = level;
+			resident_bytes += bytes;
+			changes.push_back(texture_level_change{ texture, level, ticket });
+		}
+	}
+
+private:
+	std::deque<streamed_texture> textures; // a deque, so the textures never move
+	std::vector<streamed_texture*> order;
+	size_t frame = 0;
+
+	static size_t level_bytes(const streamed_texture& texture, const int level)
+	{
+		const auto width = std::max(1, texture.width >> level);
+		const auto height = std::max(1, texture.height >> level);
+		const auto bytes = texture.compressed != 0 ? compressed_level_size(texture.compressed, width, height) : static_cast<size_t>(width) * height * texture.channels;
+		return bytes * texture.layers;
+	}
+
+	// evicts levels finer than their textures want until bytes more fit, the least recently drawn textures
+	// first and their finest levels first. Nothing is evicted when even all of them would not make room.
+	// Textures with a change on its way are left alone
+	bool make_room(const size_t bytes, const streamed_texture* keep, std::vector<texture_level_change>& changes)
+	{
+		std::vector<streamed_texture*> victims;
+		size_t evictable = 0;
+		for (auto& texture : textures)
+		{
+			if (&texture == keep || texture.base_level != texture.resident_level)
+				continue;
+
+			for (auto level = texture.resident_level; level < std::min(texture.wanted_level, texture.first_level); level++)
+				evictable += level_bytes(texture, level);
+			if (texture.resident_level < std::min(texture.wanted_level, texture.first_level))
+				victims.push_back(&texture);
+		}
+		if (resident_bytes - evictable + bytes > budget)
+			return false;
+
+		std::stable_sort(victims.begin(), victims.end(), [](const streamed_texture* a, const streamed_texture* b) { return a->last_wanted < b->last_wanted; });
+
+		for (auto* const texture : victims)
+		{
+			if (resident_bytes + bytes <= budget)
+				break;
+
+			auto level = texture->resident_level;
+			while (level < std::min(texture->wanted_level, texture->first_level) && resident_bytes + bytes > budget)
+				resident_bytes -= level_bytes(*texture, level++);
+
+			texture->resident_level = level;
+			changes.push_back(texture_level_change{ texture, level, nullptr });
+		}
+
+		return resident_bytes + bytes <= budget;
+	}
+
+	// the storage of the level first, then every layer in bands of rows, read from staging where write puts
+	// the level of each layer one after another
+	static std::vector<upload_item> level_items(streamed_texture* texture, const int level, const size_t chunk_size, upload_staging& staging)
+	{
+		std::vector<upload_item> items;
+		items.push_back({ [texture, level]
+		{
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+			glBindTexture(texture->target, *texture->texture);
+			define_streamed_level(*texture, level, false);
+		}, 0 });
+
+		const auto width = std::max(1, texture->width >> level);
+		const auto height = std::max(1, texture->height >> level);
+		const auto row_bytes = texture->compressed != 0 ? compressed_level_size(texture->compressed, width, 1) : static_cast<size_t>(width) * texture->channels;
+		const auto rows = texture->compressed != 0 ? (height + 3) / 4 : height;
+		const auto band = static_cast<int>(std::max<size_t>(1, chunk_size / row_bytes));
+		const auto layer_bytes = rows * row_bytes;
+		staging = upload_staging{ std::make_shared<staging_buffer>(), layer_bytes * texture->layers, nullptr };
+		staging.write = [texture, level, layer_bytes](unsigned char* memory)
+		{
+			for (auto layer = 0; layer < texture->layers; layer++)
+			{
+				const auto& chain = *texture->chains[layer];
+				if (!chain.empty())
+					std::copy(chain[level].begin(), chain[level].end(), memory + layer * layer_bytes);
+			}
+		};
+
+		for (auto layer = 0; layer < texture->layers; layer++)
+		{
+			for (auto first_row = 0; first_row < rows; first_row += band)
+			{
+				const auto count = std::min(band, rows - first_row);
+				items.push_back({ [texture, layer, level, first_row, count, buffer = staging.buffer, layer_bytes]
+				{
+					upload_streamed_rows(*texture, layer, level, first_row, count, buffer.get(), layer * layer_bytes);
+				}, count * row_bytes });
+			}
+		}
+		items.push_back({ [buffer = staging.buffer] { buffer->destroy(); }, 0 });
+
+		return items;
+	}
+};
+
+#endif
@@ -0,0 +1,273 @@
+#ifndef UPLOAD_SCHEDULER_H
+#define UPLOAD_SCHEDULER_H
+
+#include <JobSystem.h>
+#include <UploadThread.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// one step of an upload, such as a range of a buffer or a band of rows of a texture level. Steps that
+// only allocate storage count as 0 bytes. Every step only makes GL calls on data that is ready, CPU work
+// such as decoding is done before its resource is queued
+typedef struct
+{
+	std::function<void()> upload;
+	size_t bytes;
+} upload_item;
+
+// visible objects first, then the bigger they are on screen the sooner. focal_length is projection[1][1]
+inline float screen_importance(const float radius, const float distance, const float focal_length, const bool visible)
+{
+	const auto size = std::min(1.0f, radius * focal_length / std::max(distance, radius)); // of half the screen height
+	return (visible ? 2.0f : 0.0f) + size * size;
+}
+
+// holds uploads back and hands them to the upload thread a frame's worth of bytes at a time, the most
+// important resource first. The items of a resource run in order and its ticket is fenced after the
+// last of them. Everything but residency_milliseconds and supply belongs to the thread that calls issue.
+// The slot of a resource is used again once its last item has been handed over, the handle holds the
+// slot's generation so one kept after that is told apart from the resource that took the slot over
+class upload_scheduler
+{
+public:
+	size_t frame_budget = 1024 * 1024;
+
+	// items still held back, bytes handed over in the latest frame and the most in a frame since reset_peak
+	size_t queue_depth = 0;
+	size_t issued_bytes = 0;
+	size_t peak_bytes = 0;
+
+	// from the first item queued to the last one run by the upload thread, negative while streaming
+	std::atomic<float> residency_milliseconds{ -1.0f };
+
+	// returns the resource for raise_priority
+	int add(std::vector<upload_item> items, std::shared_ptr<upload_ticket> ticket)
+	{
+		if (queued_resources == 0)
+		{
+			started = std::chrono::steady_clock::now();
+			residency_milliseconds = -1.0f;
+		}
+
+		queue_depth += items.size();
+		queued_resources++;
+
+		size_t index;
+		if (!free_slots.empty())
+		{
+			index = free_slots.back();
+			free_slots.pop_back();
+		}
+		else
+		{
+			index = resources.size();
+			resources.push_back(resource{ std::deque<upload_item>(), nullptr, 0.0f, true, 0 });
+		}
+
+		auto& slot = resources[index];
+		slot.items.assign(items.begin(), items.end());
+		slot.ticket = std::move(ticket);
+		slot.priority = 0.0f;
+		slot.supplied = true;
+		return static_cast<int>(slot.generation << index_bits | index);
+	}
+
+	// a resource whose items are not known yet, such as the uploads of an image still being decoded. They
+	// come through supply, and while none are there the resource is passed over without holding back the
+	// others
+	int add_pending(std::shared_ptr<upload_ticket> ticket)
+	{
+		const auto handle = add(std::vector<upload_item>(), std::move(ticket));
+		resources[handle & index_mask].supplied = false;
+		return handle;
+	}
+
+	// the items of a resource made by add_pending, from any thread. They are queued by the next issue, more
+	// of them may follow until last is set
+	void supply(const int resource, std::vector<upload_item> items, const bool last = true)
+	{
+		std::lock_guard<std::mutex> lock(supplied_mutex);
+		supplied_items.push_back(supplied_batch{ resource, std::move(items), last });
+	}
+
+	bool idle() const
+	{
+		return queued_resources == 0;
+	}
+
+	// priorities last one frame, a resource wanted by several objects keeps the highest. Resources already
+	// handed over are left alone
+	void raise_priority(const int resource, const float priority)
+	{
+		const auto index = static_cast<size_t>(resource & index_mask);
+		if (index >= resources.size() || resources[index].generation != static_cast<unsigned>(resource) >> index_bits || !resources[index].ticket)
+			return;
+
+		resources[index].priority = std::max(resources[index].priority, priority);
+	}
+
+	// slots made so far, the most resources ever queued at once
+	size_t capacity() const
+	{
+		return resources.size();
+	}
+
+	void reset_peak()
+	{
+		peak_bytes = 0;
+	}
+
+	// one batch a frame, stopping at the first item that would go over the budget. The first item always
+	// goes, so one larger than the whole budget still gets through
+	void issue(upload_thread& uploads)
+	{
+		issued_bytes = 0;
+		if (queued_resources == 0)
+			return;
+
+		{
+			std::lock_guard<std::mutex> lock(supplied_mutex);
+			for (auto& supplied : supplied_items)
+			{
+				auto& resource = resources[supplied.resource & index_mask];
+				resource.items.insert(resource.items.end(), std::make_move_iterator(supplied.items.begin()), std::make_move_iterator(supplied.items.end()));
+				resource.supplied = supplied.last;
+				queue_depth += supplied.items.size();
+			}
+			supplied_items.clear();
+		}
+
+		order.clear();
+		for (size_t i = 0; i < resources.size(); i++)
+		{
+			if (resources[i].ticket && (resources[i].supplied || !resources[i].items.empty()))
+				order.push_back(i);
+		}
+		std::stable_sort(order.begin(), order.end(), [this](const size_t a, const size_t b) { return resources[a].priority > resources[b].priority; });
+
+		std::vector<upload_item> batch;
+		std::vector<std::shared_ptr<upload_ticket>> tickets;
+		for (const auto index : order)
+		{
+			auto& resource = resources[index];
+			while (!resource.items.empty() && (batch.empty() || issued_bytes + resource.items.front().bytes <= frame_budget))
+			{
+				issued_bytes += resource.items.front().bytes;
+				batch.push_back(std::move(resource.items.front()));
+				resource.items.pop_front();
+				queue_depth--;
+			}
+
+			if (!resource.items.empty())
+				break;
+			if (!resource.supplied)
+				continue;
+
+			tickets.push_back(std::move(resource.ticket));
+			resource.generation = (resource.generation + 1) & generation_mask;
+			free_slots.push_back(index);
+			queued_resources--;
+		}
+
+		for (auto& resource : resources)
+			resource.priority = 0.0f;
+		peak_bytes = std::max(peak_bytes, issued_bytes);
+
+		const auto drained = queued_resources == 0;
+		const auto start = started;
+		uploads.submit([this, batch = std::move(batch), drained, start]
+		{
+			for (const auto& item : batch)
+				item.upload();
+
+			if (drained)
+				residency_milliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+		}, std::move(tickets));
+	}
+
+private:
+	// a handle is the slot in its low bits and the slot's generation above them
+	static const int index_bits = 20;
+	static const int index_mask = (1 << index_bits) - 1;
+	static const unsigned generation_mask = (1u << (31 - index_bits)) - 1;
+
+	typedef struct
+	{
+		std::deque<upload_item> items;
+		std::shared_ptr<upload_ticket> ticket; // null once handed over with the last item, the slot is free then
+		float priority;
+		bool supplied; // false until the last items of a pending resource have come
+		unsigned generation; // bumped every time the slot is freed
+	} resource;
+
+	typedef struct
+	{
+		int resource;
+		std::vector<upload_item> items;
+		bool last;
+	} supplied_batch;
+
+	std::vector<resource> resources;
+	std::vector<size_t> free_slots;
+	std::vector<size_t> order;
+	std::mutex supplied_mutex;
+	std::vector<supplied_batch> supplied_items;
+	size_t queued_resources = 0;
+	std::chrono::steady_clock::time_point started;
+};
+
+// the staging buffer the data of a resource go through, the bytes they take in it and write, which puts
+// them there from a job
+typedef struct
+{
+	std::shared_ptr<staging_buffer> buffer;
+	size_t bytes;
+	std::function<void(unsigned char*)> write;
+} upload_staging;
+
+// adds a resource whose first item makes its storage. Along with it the upload thread makes the staging
+// buffer, then a job writes the data into it once ready, when there is one, has reached zero. Only then
+// are the other items queued, so the upload thread neither waits for the data, makes it nor copies it.
+// Without staging bytes the job only queues them. Returns the resource as add does
+inline int add_staged_resource(upload_scheduler& scheduler, job_system& jobs, std::vector<upload_item> items, upload_staging staging, std::shared_ptr<upload_ticket> ticket, std::shared_ptr<job_counter> ready)
+{
+	if (items.empty())
+		return scheduler.add(std::move(items), std::move(ticket));
+
+	// the jobs keep the counters alive until they have run
+	const auto resource = scheduler.add_pending(std::move(ticket));
+	const auto staged = std::make_shared<job_counter>();
+	const auto rest = std::make_shared<std::vector<upload_item>>(std::make_move_iterator(items.begin() + 1), std::make_move_iterator(items.end()));
+	auto storage = std::move(items.front());
+	storage.upload = [make_storage = std::move(storage.upload), staging, rest, resource, ready, staged, &scheduler, &jobs]
+	{
+		make_storage();
+		if (staging.buffer && staging.bytes > 0)
+			staging.buffer->create(staging.bytes);
+
+		const auto stage = [staging, rest, resource, ready, staged, &scheduler]
+		{
+			if (staging.buffer && staging.buffer->memory != nullptr)
+				staging.write(staging.buffer->memory);
+			scheduler.supply(resource, std::move(*rest));
+		};
+		if (ready)
+			jobs.run_after(*ready, *staged, stage);
+		else
+			jobs.run(*staged, stage);
+	};
+	scheduler.supply(resource, { std::move(storage) }, false);
+	return resource;
+}
+
+#endif
@@ -0,0 +1,162 @@
+#ifndef UPLOAD_THREAD_H
+#define UPLOAD_THREAD_H
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#include <PixelBuffers.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// end of one upload: the fence appears once the upload thread has issued the GL calls and signals once
+// the GPU has executed them
+class upload_ticket
+{
+public:
+	std::atomic<GLsync> fence{ nullptr };
+	bool finished = false; // only touched by the thread that draws
+};
+
+// runs uploads in order on a hidden window whose context is shared with the one that draws. Buffers,
+// textures and fences are shared between the two contexts, vertex arrays are not, so the drawing thread
+// makes those itself once an upload has finished
+class upload_thread
+{
+public:
+	// texture bands go through pixel_buffer_count buffers of pixel_buffer_size bytes, none reads them from
+	// memory. Set before start, the counters of the pool are read after stop
+	int pixel_buffer_count = 0;
+	GLsizeiptr pixel_buffer_size = 0;
+	pixel_buffer_pool pixel_buffers;
+
+	// like every glfw window, the hidden one has to be created on the main thread
+	bool start(GLFWwindow* shared_window)
+	{
+		glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+		context = glfwCreateWindow(1, 1, "uploads", nullptr, shared_window);
+		glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+		if (context == nullptr)
+			return false;
+
+		quit = false;
+		worker = std::thread([this] { run(); });
+		return true;
+	}
+
+	// uploads already queued are done first
+	void stop()
+	{
+		if (context == nullptr)
+			return;
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			quit = true;
+		}
+		wake.notify_all();
+		worker.join();
+
+		glfwDestroyWindow(context);
+		context = nullptr;
+	}
+
+	// upload runs on the upload thread with its context current
+	std::shared_ptr<upload_ticket> submit(std::function<void()> upload)
+	{
+		auto ticket = std::make_shared<upload_ticket>();
+		submit(std::move(upload), { ticket });
+		return ticket;
+	}
+
+	// same as above, every ticket given is fenced once upload has run
+	void submit(std::function<void()> upload, std::vector<std::shared_ptr<upload_ticket>> tickets)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			pending.push_back(request{ std::move(upload), std::move(tickets) });
+		}
+		wake.notify_one();
+	}
+
+private:
+	typedef struct
+	{
+		std::function<void()> upload;
+		std::vector<std::shared_ptr<upload_ticket>> tickets;
+	} request;
+
+	GLFWwindow* context = nullptr;
+	std::thread worker;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::deque<request> pending;
+	bool quit = false;
+
+	void run()
+	{
+		glfwMakeContextCurrent(context);
+		if (pixel_buffer_count > 0)
+		{
+			pixel_buffers.create(pixel_buffer_count, pixel_buffer_size);
+			thread_pixel_buffers() = &pixel_buffers;
+		}
+
+		for (;;)
+		{
+			request next;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [this] { return !pending.empty() || quit; });
+				if (pending.empty())
+					break;
+
+				next = std::move(pending.front());
+				pending.pop_front();
+			}
+
+			next.upload();
+
+			// the flush sends the fences on their way, a fence still sitting in this context would never signal
+			std::vector<GLsync> fences;
+			for (size_t i = 0; i < next.tickets.size(); i++)
+				fences.push_back(glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
+			glFlush();
+			for (size_t i = 0; i < next.tickets.size(); i++)
+				next.tickets[i]->fence.store(fences[i]);
+		}
+
+		thread_pixel_buffers() = nullptr;
+		pixel_buffers.destroy();
+		glfwMakeContextCurrent(nullptr);
+	}
+};
+
+// true once what the ticket stands for can be used, checked without waiting. No ticket means the
+// upload was done in place. Objects must be bound again after this, which makes their new contents
+// visible to the calling context
+inline bool upload_finished(upload_ticket* ticket)
+{
+	if (ticket == nullptr || ticket->finished)
+		return true;
+
+	const auto fence = ticket->fence.load();
+	if (fence == nullptr)
+		return false;
+
+	const auto status = glClientWaitSync(fence, 0, 0);
+	if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+		return false;
+
+	glDeleteSync(fence);
+	ticket->finished = true;
+	return true;
+}
+
+#endif
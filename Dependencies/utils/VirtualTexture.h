@@ -0,0 +1,576 @@
+#ifndef VIRTUAL_TEXTURE_H
+#define VIRTUAL_TEXTURE_H
+
+#include <GL/glew.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// page files: a square RGBA8 texture cut into square pages at every mip level, down to the level that
+// fits in a single page. Each page is stored with border texels of its neighbours around it, so that
+// bilinear filtering inside the page cache never reaches a different page. Rows go bottom to top like
+// the GL textures. The header is eight little endian 32 bit words, the pages follow level 0 first, each
+// level row by row
+
+const uint32_t page_file_magic = 0x46505456; // "VTPF"
+const size_t page_file_header_size = 32;
+
+typedef struct
+{
+	int size; // texels a side at level 0
+	int page_size; // texels a side of a page, borders left out
+	int border;
+	int levels;
+} page_file_header;
+
+// levels until a single page covers the whole texture
+inline int page_file_levels(const int size, const int page_size)
+{
+	auto levels = 1;
+	for (auto pages = size / page_size; pages > 1; pages /= 2)
+		levels++;
+	return levels;
+}
+
+// pages a side of a level
+inline int page_file_pages(const page_file_header& header, const int level)
+{
+	return std::max(1, (header.size >> level) / header.page_size);
+}
+
+inline int page_file_stored_size(const page_file_header& header)
+{
+	return header.page_size + 2 * header.border;
+}
+
+inline size_t page_file_page_bytes(const page_file_header& header)
+{
+	const auto stored = static_cast<size_t>(page_file_stored_size(header));
+	return stored * stored * 4;
+}
+
+inline uint64_t page_file_offset(const page_file_header& header, const int level, const int x, const int y)
+{
+	uint64_t index = 0;
+	for (auto l = 0; l < level; l++)
+		index += static_cast<uint64_t>(page_file_pages(header, l)) * page_file_pages(header, l);
+	index += static_cast<uint64_t>(y) * page_file_pages(header, level) + x;
+	return page_file_header_size + index * page_file_page_bytes(header);
+}
+
+inline void write_page_file_header(std::ostream& out, const page_file_header& header)
+{
+	const uint32_t words[8] = { page_file_magic, 1, static_cast<uint32_t>(header.size), static_cast<uint32_t>(header.page_size),
+		static_cast<uint32_t>(header.border), static_cast<uint32_t>(header.levels), 4, 0 };
+	for (const auto word : words)
+	{
+		const char bytes[4] = { static_cast<char>(word), static_cast<char>(word >> 8), static_cast<char>(word >> 16), static_cast<char>(word >> 24) };
+		out.write(bytes, 4);
+	}
+}
+
+// false when the stream does not start with a header write_page_file_header could have written
+inline bool read_page_file_header(std::istream& in, page_file_header& header)
+{
+	unsigned char bytes[page_file_header_size];
+	if (!in.read(reinterpret_cast<char*>(bytes), page_file_header_size))
+		return false;
+
+	uint32_t words[8];
+	for (auto i = 0; i < 8; i++)
+		words[i] = bytes[i * 4] | bytes[i * 4 + 1] << 8 | bytes[i * 4 + 2] << 16 | static_cast<uint32_t>(bytes[i * 4 + 3]) << 24;
+	if (words[0] != page_file_magic || words[1] != 1 || words[6] != 4)
+		return false;
+
+	header.size = static_cast<int>(words[2]);
+	header.page_size = static_cast<int>(words[3]);
+	header.border = static_cast<int>(words[4]);
+	header.levels = static_cast<int>(words[5]);
+	return header.page_size > 0 && header.border >= 0 && header.size >= header.page_size && header.size / header.page_size <= 256
+		&& header.levels == page_file_levels(header.size, header.page_size);
+}
+
+// a page of the virtual texture, its level and place in that level's grid packed into one key
+inline uint32_t virtual_page_key(const int level, const int x, const int y)
+{
+	return static_cast<uint32_t>(level) << 24 | static_cast<uint32_t>(y) << 12 | static_cast<uint32_t>(x);
+}
+
+// sparse virtual texturing. Only the pages the camera sees are kept, in a fixed size cache texture of
+// cache_pages x cache_pages slots, and a page table texture with a mip level per page level tells the
+// shader which slot holds each page. Pages that are not in yet point at the slot of their nearest
+// coarser page that is, the single page of the coarsest level never leaving the cache.
+//
+// Which pages the camera sees comes from a feedback pass drawn at a fraction of the window size, whose
+// pixels hold the page each of them samples. It is read back through pixel buffers with fences a few
+// frames later, so the GPU is never waited on. Missing pages are read from the page file by a loader
+// thread, coarse levels first, and go into the cache a few per frame in place of the pages seen the
+// longest time ago. Everything but the loader runs on the thread that draws
+class virtual_texture
+{
+public:
+	page_file_header header = page_file_header{ 0, 0, 0, 0 };
+	int cache_pages = 0;
+	int feedback_width = 0;
+	int feedback_height = 0;
+	GLuint pages_texture = 0;
+	GLuint table_texture = 0;
+
+	// counters, requested of the latest frame, the others since reset_counters
+	uint32_t requested = 0; // distinct pages the feedback saw
+	uint32_t loaded = 0; // pages that went into the cache
+	uint32_t evicted = 0; // pages that made room for them
+
+	// opens the page file and makes the textures and the feedback target. pages_per_frame caps the
+	// pages that go into the cache each frame. false, with nothing made, when the page file is missing
+	// or not one
+	bool create(const std::string& file_name, const int cache_pages, const int feedback_width, const int feedback_height, const int pages_per_frame)
+	{
+		std::ifstream file(file_name, std::ios::binary);
+		if (!file || !read_page_file_header(file, header))
+			return false;
+
+		// the coarsest page must be there from the start, everything falls back to it
+		std::vector<unsigned char> root(page_file_page_bytes(header));
+		file.seekg(static_cast<std::streamoff>(page_file_offset(header, header.levels - 1, 0, 0)));
+		if (!file.read(reinterpret_cast<char*>(root.data()), root.size()))
+			return false;
+
+		this->file_name = file_name;
+		this->cache_pages = cache_pages;
+		this->feedback_width = feedback_width;
+		this->feedback_height = feedback_height;
+		this->pages_per_frame = pages_per_frame;
+
+		const auto cache_size = cache_pages * page_file_stored_size(header);
+		glGenTextures(1, &pages_texture);
+		glBindTexture(GL_TEXTURE_2D, pages_texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, cache_size, cache_size, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+		glGenTextures(1, &table_texture);
+		glBindTexture(GL_TEXTURE_2D, table_texture);
+		page_slots.resize(header.levels);
+		table.resize(header.levels);
+		for (auto level = 0; level < header.levels; level++)
+		{
+			const auto pages = page_file_pages(header, level);
+			page_slots[level].assign(static_cast<size_t>(pages) * pages, slot_empty);
+			table[level].assign(static_cast<size_t>(pages) * pages * 4, 0);
+			glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, pages, pages, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+		}
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, header.levels - 1);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+		slots.assign(static_cast<size_t>(cache_pages) * cache_pages, cache_slot{ -1, 0, 0, 0 });
+		glBindTexture(GL_TEXTURE_2D, pages_texture);
+		place_page(virtual_page_key(header.levels - 1, 0, 0), root.data());
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		glGenTextures(1, &feedback_color);
+		glBindTexture(GL_TEXTURE_2D, feedback_color);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, feedback_width, feedback_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		glGenRenderbuffers(1, &feedback_depth);
+		glBindRenderbuffer(GL_RENDERBUFFER, feedback_depth);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, feedback_width, feedback_height);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+		glGenFramebuffers(1, &feedback_framebuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER, feedback_framebuffer);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, feedback_color, 0);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, feedback_depth);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+		glGenBuffers(readback_count, readback_buffers);
+		for (auto i = 0; i < readback_count; i++)
+		{
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, readback_buffers[i]);
+			glBufferData(GL_PIXEL_PACK_BUFFER, static_cast<GLsizeiptr>(feedback_width) * feedback_height * 4, nullptr, GL_STREAM_READ);
+			readback_fences[i] = nullptr;
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		quit = false;
+		loader = std::thread([this] { run(); });
+		return true;
+	}
+
+	void destroy()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			quit = true;
+		}
+		wake.notify_all();
+		if (loader.joinable())
+			loader.join();
+
+		for (auto i = 0; i < readback_count; i++)
+		{
+			if (readback_fences[i] != nullptr)
+				glDeleteSync(readback_fences[i]);
+			readback_fences[i] = nullptr;
+		}
+		if (pages_texture != 0)
+		{
+			glDeleteBuffers(readback_count, readback_buffers);
+			glDeleteFramebuffers(1, &feedback_framebuffer);
+			glDeleteRenderbuffers(1, &feedback_depth);
+			glDeleteTextures(1, &feedback_color);
+			glDeleteTextures(1, &table_texture);
+			glDeleteTextures(1, &pages_texture);
+		}
+		pages_texture = table_texture = 0;
+	}
+
+	// texels a side of the page cache
+	int cache_size() const
+	{
+		return cache_pages * page_file_stored_size(header);
+	}
+
+	// pages resident in the cache, the coarsest one included
+	uint32_t resident() const
+	{
+		return static_cast<uint32_t>(std::count_if(slots.begin(), slots.end(), [](const cache_slot& slot) { return slot.level >= 0; }));
+	}
+
+	void reset_counters()
+	{
+		loaded = evicted = 0;
+	}
+
+	// reads back the feedback that is ready, asks the loader for the pages it is missing and moves the
+	// pages the loader has read into the cache. Once a frame, before anything samples the virtual texture
+	void begin_frame()
+	{
+		frame++;
+		read_feedback();
+		fill_cache();
+
+		if (table_dirty)
+			upload_table();
+	}
+
+	// binds the cache and the page table, they stay bound for the whole frame
+	void bind(const GLenum pages_unit, const GLenum table_unit) const
+	{
+		glActiveTexture(pages_unit);
+		glBindTexture(GL_TEXTURE_2D, pages_texture);
+		glActiveTexture(table_unit);
+		glBindTexture(GL_TEXTURE_2D, table_texture);
+	}
+
+	// the objects drawn between begin_feedback and end_feedback go to the feedback target
+	void begin_feedback()
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, feedback_framebuffer);
+		glViewport(0, 0, feedback_width, feedback_height);
+		glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	}
+
+	// starts copying the feedback into the next free pixel buffer, a frame whose buffers are all still in
+	// flight drops its feedback. Leaves the default framebuffer bound with the given viewport
+	void end_feedback(const int viewport_width, const int viewport_height)
+	{
+		const auto buffer = next_readback;
+		if (readback_fences[buffer] == nullptr)
+		{
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, readback_buffers[buffer]);
+			glReadPixels(0, 0, feedback_width, feedback_height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+			readback_fences[buffer] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			next_readback = (next_readback + 1) % readback_count;
+		}
+
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glViewport(0, 0, viewport_width, viewport_height);
+	}
+
+private:
+	static const int readback_count = 3;
+	enum { slot_empty = -1, slot_loading = -2 }; // page_slots entries of pages not in the cache
+
+	typedef struct
+	{
+		int level; // -1 when the slot is free
+		int x;
+		int y;
+		uint32_t last_used; // frame the feedback last saw the page
+	} cache_slot;
+
+	std::string file_name;
+	int pages_per_frame = 0;
+	uint32_t frame = 0;
+
+	std::vector<cache_slot> slots;
+	std::vector<std::vector<int>> page_slots; // per level, the slot of each page
+	std::vector<std::vector<unsigned char>> table; // per level, slot x, slot y and level of each page's entry
+	bool table_dirty = true;
+
+	GLuint feedback_framebuffer = 0;
+	GLuint feedback_color = 0;
+	GLuint feedback_depth = 0;
+	GLuint readback_buffers[readback_count] = {};
+	GLsync readback_fences[readback_count] = {};
+	int next_readback = 0; // the buffer the next feedback goes to, the oldest in flight
+	std::vector<uint32_t> seen;
+	size_t in_flight = 0; // pages asked of the loader and not back in fill_cache yet
+
+	// loader side, guarded by mutex
+	std::thread loader;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::deque<uint32_t> requests;
+	std::deque<std::pair<uint32_t, std::vector<unsigned char>>> loaded_pages;
+	bool quit = false;
+
+	int& page_slot(const uint32_t key)
+	{
+		const auto level = static_cast<int>(key >> 24);
+		return page_slots[level][(key >> 12 & 0xFFF) * page_file_pages(header, level) + (key & 0xFFF)];
+	}
+
+	// the feedback of every frame whose copy has finished, oldest first
+	void read_feedback()
+	{
+		seen.clear();
+		for (auto i = 0; i < readback_count; i++)
+		{
+			const auto buffer = (next_readback + i) % readback_count;
+			if (readback_fences[buffer] == nullptr)
+				continue;
+
+			const auto status = glClientWaitSync(readback_fences[buffer], 0, 0);
+			if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+				break;
+			glDeleteSync(readback_fences[buffer]);
+			readback_fences[buffer] = nullptr;
+
+			const auto bytes = static_cast<size_t>(feedback_width) * feedback_height * 4;
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, readback_buffers[buffer]);
+			const auto* const pixels = static_cast<const unsigned char*>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, static_cast<GLsizeiptr>(bytes), GL_MAP_READ_BIT));
+			if (pixels != nullptr)
+			{
+				// the last pixel's page is remembered, neighbouring pixels mostly see the same one
+				uint32_t last = 0xFFFFFFFF;
+				for (size_t p = 0; p < bytes; p += 4)
+				{
+					if (pixels[p + 3] == 0)
+						continue;
+
+					const auto level = static_cast<int>(pixels[p + 2]);
+					if (level >= header.levels || pixels[p] >= page_file_pages(header, level) || pixels[p + 1] >= page_file_pages(header, level))
+						continue;
+
+					const auto key = virtual_page_key(level, pixels[p], pixels[p + 1]);
+					if (key != last)
+						seen.push_back(key);
+					last = key;
+				}
+				glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+			}
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		}
+
+		if (seen.empty())
+			return;
+
+		// every page brings the coarser pages above it along, they stand in for it until it is in and
+		// for its neighbours when the cache runs short
+		std::sort(seen.begin(), seen.end());
+		seen.erase(std::unique(seen.begin(), seen.end()), seen.end());
+		const auto pages_seen = seen.size();
+		for (size_t i = 0; i < pages_seen; i++)
+		{
+			auto x = static_cast<int>(seen[i] & 0xFFF), y = static_cast<int>(seen[i] >> 12 & 0xFFF);
+			for (auto level = static_cast<int>(seen[i] >> 24) + 1; level < header.levels; level++)
+			{
+				x /= 2;
+				y /= 2;
+				seen.push_back(virtual_page_key(level, x, y));
+			}
+		}
+
+		// coarse levels first, they are few and cover the most
+		std::sort(seen.begin(), seen.end(), [](const uint32_t a, const uint32_t b) { return a > b; });
+		seen.erase(std::unique(seen.begin(), seen.end()), seen.end());
+		requested = static_cast<uint32_t>(seen.size());
+
+		std::vector<uint32_t> missing;
+		for (const auto key : seen)
+		{
+			const auto slot = page_slot(key);
+			if (slot >= 0)
+				slots[slot].last_used = frame;
+			else if (slot == slot_empty)
+				missing.push_back(key);
+		}
+
+		// pages beyond what the slots not seen this frame can take would only be dropped once read
+		const auto room = static_cast<size_t>(std::count_if(slots.begin(), slots.end(), [this](const cache_slot& slot) { return slot.last_used != frame; }));
+		missing.resize(std::min(missing.size(), room > in_flight ? room - in_flight : 0));
+		if (missing.empty())
+			return;
+
+		in_flight += missing.size();
+		for (const auto key : missing)
+			page_slot(key) = slot_loading;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			requests.insert(requests.end(), missing.begin(), missing.end());
+		}
+		wake.notify_all();
+	}
+
+	// the pages the loader has read, a few per frame. A page that finds no slot free of this frame's
+	// pages is dropped, the feedback asks for it again once the view has moved
+	void fill_cache()
+	{
+		std::vector<std::pair<uint32_t, std::vector<unsigned char>>> ready;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			while (!loaded_pages.empty() && static_cast<int>(ready.size()) < pages_per_frame)
+			{
+				ready.push_back(std::move(loaded_pages.front()));
+				loaded_pages.pop_front();
+			}
+			in_flight -= ready.size();
+		}
+
+		if (ready.empty())
+			return;
+
+		glBindTexture(GL_TEXTURE_2D, pages_texture);
+		for (auto& page : ready)
+		{
+			if (page.second.empty() || !place_page(page.first, page.second.data()))
+				page_slot(page.first) = slot_empty;
+		}
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+
+	// puts a page into a free slot or the one seen the longest time ago, pages_texture being bound
+	bool place_page(const uint32_t key, const unsigned char* pixels)
+	{
+		const auto root = virtual_page_key(header.levels - 1, 0, 0);
+		auto best = -1;
+		for (size_t s = 0; s < slots.size(); s++)
+		{
+			const auto& slot = slots[s];
+			if (slot.level < 0)
+			{
+				best = static_cast<int>(s);
+				break;
+			}
+			if (slot.last_used == frame || virtual_page_key(slot.level, slot.x, slot.y) == root)
+				continue;
+			if (best < 0 || slot.last_used < slots[best].last_used)
+				best = static_cast<int>(s);
+		}
+		if (best < 0)
+			return false;
+
+		auto& slot = slots[best];
+		if (slot.level >= 0)
+		{
+			page_slot(virtual_page_key(slot.level, slot.x, slot.y)) = slot_empty;
+			evicted++;
+		}
+
+		slot = cache_slot{ static_cast<int>(key >> 24), static_cast<int>(key & 0xFFF), static_cast<int>(key >> 12 & 0xFFF), frame };
+		page_slot(key) = best;
+		loaded++;
+		table_dirty = true;
+
+		const auto stored = page_file_stored_size(header);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, best % cache_pages * stored, best / cache_pages * stored, stored, stored, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+		return true;
+	}
+
+	// every entry names the slot of its page, or of the nearest coarser page in the cache, the coarsest
+	// level being filled first so the finer ones can copy from it
+	void upload_table()
+	{
+		glBindTexture(GL_TEXTURE_2D, table_texture);
+		for (auto level = header.levels - 1; level >= 0; level--)
+		{
+			const auto pages = page_file_pages(header, level);
+			for (auto y = 0; y < pages; y++)
+			{
+				for (auto x = 0; x < pages; x++)
+				{
+					auto* const entry = &table[level][(static_cast<size_t>(y) * pages + x) * 4];
+					const auto slot = page_slots[level][static_cast<size_t>(y) * pages + x];
+					if (slot >= 0)
+					{
+						entry[0] = static_cast<unsigned char>(slot % cache_pages);
+						entry[1] = static_cast<unsigned char>(slot / cache_pages);
+						entry[2] = static_cast<unsigned char>(level);
+						entry[3] = 255;
+					}
+					else
+					{
+						const auto parent_pages = page_file_pages(header, level + 1);
+						std::copy_n(&table[level + 1][(static_cast<size_t>(y / 2) * parent_pages + x / 2) * 4], 4, entry);
+					}
+				}
+			}
+			glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, pages, pages, GL_RGBA, GL_UNSIGNED_BYTE, table[level].data());
+		}
+		glBindTexture(GL_TEXTURE_2D, 0);
+		table_dirty = false;
+	}
+
+	// reads the requested pages, in the order they were asked for, from its own handle on the page file
+	void run()
+	{
+		std::ifstream file(file_name, std::ios::binary);
+		const auto page_bytes = page_file_page_bytes(header);
+
+		for (;;)
+		{
+			uint32_t key;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [this] { return !requests.empty() || quit; });
+				if (quit)
+					return;
+				key = requests.front();
+				requests.pop_front();
+			}
+
+			// a page that cannot be read comes back empty and goes back to missing
+			std::vector<unsigned char> pixels(page_bytes);
+			file.clear();
+			file.seekg(static_cast<std::streamoff>(page_file_offset(header, static_cast<int>(key >> 24), key & 0xFFF, key >> 12 & 0xFFF)));
+			if (!file.read(reinterpret_cast<char*>(pixels.data()), page_bytes))
+				pixels.clear();
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				loaded_pages.emplace_back(key, std::move(pixels));
+			}
+		}
+	}
+};
+
+#endif
@@ -6,8 +6,35 @@
 #include <gtc/matrix_transform.hpp>
 #include <gtc/type_ptr.hpp>
 #include <CSVReader.h>
+#include <TextureArray.h>
+#include <TextureAtlas.h>
+#include <TextureFormats.h>
+#include <ImageDecoder.h>
+#include <KTX2.h>
+#include <Mipmaps.h>
+#include <Frustum.h>
+#include <Culling.h>
+#include <Prefab.h>
+#include <Portals.h>
+#include <JobSystem.h>
+#include <FramePipeline.h>
+#include <StreamBuffer.h>
+#include <UploadThread.h>
+#include <UploadScheduler.h>
+#include <TextureStreaming.h>
+#include <VirtualTexture.h>
+#include <OcclusionCulling.h>
+#include <OcclusionQueries.h>
+#include <ResourceCache.h>
 #include <Shader.h>
+#include "Bench.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <string>
+#include <thread>
 #include <vector>
 #include <camera.h>
 
@@ -16,31 +43,285 @@ typedef struct
 	unsigned int vao;
 	unsigned int vbo;
 	unsigned int texture;
+	int texture_pool;
+	int texture_layer;
 	int points;
 	bool draw_texture;
+	object_bounds bounds;
+	std::shared_ptr<upload_ticket> buffer_upload; // null when uploaded in place
+	std::shared_ptr<upload_ticket> texture_upload;
+	int buffer_resource; // upload scheduler resources, -1 when there is none
+	int texture_resource;
+	int texture_stream; // mip streaming handle, -1 when the texture is not streamed
+	float uv_density; // texture coordinates per world unit
+	uint64_t mesh_hash; // resource cache keys of the buffer and the texture
+	uint64_t texture_hash;
+	const unsigned int* shared_buffer; // the cached buffer and texture, read again once their uploads have finished; null when not cached
+	const unsigned int* shared_texture;
+	bool resident; // every upload finished and the vertex array made
 } custom_object;
 
+// a vertex buffer or a texture kept by a resource cache: the GL object, the ticket of its upload, null when
+// it was made in place, and its upload scheduler resource, -1 when there is none
+typedef struct
+{
+	unsigned int object;
+	std::shared_ptr<upload_ticket> upload;
+	int resource;
+	int stream; // mip streaming handle of a texture, -1 when it is not streamed
+} cached_resource;
+
+// how one level of a texture is split into upload bands of at most upload_chunk_size bytes, rows
+// being rows of blocks when it is compressed
+typedef struct
+{
+	int width;
+	int height;
+	size_t row_bytes;
+	int rows;
+	int band;
+} level_bands;
+
+// a level of a layer of a texture pool and where it goes in the pool's staging buffer
+typedef struct
+{
+	std::shared_ptr<std::vector<std::vector<unsigned char>>> levels;
+	int level;
+	size_t offset;
+} staged_level;
+
+// std140 mirrors of the FrameData and ObjectData uniform blocks
+typedef struct
+{
+	glm::mat4 projection;
+	glm::mat4 view;
+	glm::vec4 light_pos;
+	glm::vec4 view_pos;
+	glm::vec4 light_color;
+	float specular_strength;
+	float padding[3];
+} frame_uniforms;
+
+typedef struct
+{
+	glm::mat4 model;
+	int draw_texture;
+	int use_texture_array;
+	int texture_layer;
+	int instanced;
+	int virtual_texture;
+	int padding[3];
+} object_uniforms;
+
+// everything the render thread needs to draw a frame, built by the main thread
+typedef struct
+{
+	glm::mat4 projection;
+	glm::mat4 view;
+	glm::vec3 view_pos;
+	glm::vec3 light_pos;
+	float specular_strength;
+	std::vector<uint32_t> house_indices; // visible house instances
+	std::vector<glm::mat4> house_instances; // and their model matrices, in the same order
+	bool draw_sun;
+	glm::mat4 sun_model;
+	int framebuffer_width;
+	int framebuffer_height;
+	bool report;
+	std::vector<texture_level_change> texture_changes; // base level moves of the streamed textures
+} frame_packet;
+
+// GL objects the frames are drawn with and the scratch space of the drawing thread
+typedef struct
+{
+	Shader* lighting_shader;
+	Shader* light_cube_shader;
+	Shader* feedback_shader;
+	custom_object* objects;
+	custom_object* sun;
+	const std::vector<texture_pool>* texture_pools;
+	const prefab* house;
+	stream_buffer* stream;
+	GLint uniform_alignment;
+	occlusion_queries* queries;
+	virtual_texture* virtual_pages;
+	int virtual_object; // the object sampling the virtual texture, -1 when there is none
+	int viewport_width;
+	int viewport_height;
+	std::vector<size_t> part_order; // the house parts in drawing order, the ones sharing a texture one after another
+	std::vector<uint32_t> drawn_houses; // positions in the packet
+	std::vector<uint32_t> conditional_houses;
+	std::vector<uint32_t> queried_houses;
+	std::vector<stream_allocation> part_data;
+	std::vector<stream_allocation> conditional_data;
+	std::vector<stream_allocation> query_data;
+	std::vector<texture_level_change> texture_changes; // waiting for their uploads
+} render_state;
+
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
 void process_input(GLFWwindow* window);
-custom_object load_custom_object(const std::pair<std::string, std::string>& file_name_and_texture);
+void bind_uniform_blocks(const Shader& shader);
+custom_object load_custom_object(const std::pair<std::string, std::string>& file_name_and_texture, resource_cache<cached_resource>& meshes, resource_cache<cached_resource>& textures);
+custom_object load_custom_object(const std::string& mesh_file_name, const std::vector<float>& vector, const std::string& texture_file_name, resource_cache<cached_resource>& meshes, resource_cache<cached_resource>& textures);
+void queue_custom_object(custom_object& object, const std::string& mesh_file_name, std::vector<float> vertices, const std::string& texture_file_name, resource_cache<cached_resource>& meshes, resource_cache<cached_resource>& textures, upload_scheduler& scheduler, job_system& decoders, texture_streamer* streamer);
+void acquire_object_texture(custom_object& object, resource_cache<cached_resource>& textures, const std::string& texture_file_name, const resource_cache<cached_resource>::load_function& load);
+uint64_t texture_content_hash(const resource_cache<cached_resource>& textures, const std::string& texture_file_name);
+void release_object_resources(custom_object& object, resource_cache<cached_resource>& meshes, resource_cache<cached_resource>& textures);
+std::vector<upload_item> object_texture_items(unsigned int* texture, const std::string& texture_file_name, job_system& decoders, texture_streamer* streamer, int& stream, std::shared_ptr<job_counter>& decoded, upload_staging& staging);
+void queue_texture_pools(custom_object* objects, const std::pair<std::string, std::string>* file_names_and_textures, int count, upload_scheduler& scheduler, job_system& decoders, texture_streamer* streamer, std::vector<texture_pool>& pools);
+void prioritize_uploads(upload_scheduler& scheduler, const custom_object& object, float priority);
+void create_object_vao(custom_object& object);
+bool make_resident(custom_object& object);
 unsigned int load_object_texture(const std::string& texture_file_name);
+unsigned int create_object_texture(const decoded_image& image);
+std::string cooked_file_name(const std::string& texture_file_name, const std::string& format_name);
+std::string texture_file_stem(const std::string& texture_file_name);
+std::string virtual_page_file_name(const std::string& texture_file_name);
+bool load_cooked_texture(const std::string& texture_file_name, decoded_image& image);
+std::vector<upload_item> cooked_texture_items(unsigned int* texture, std::shared_ptr<decoded_image> image, texture_streamer* streamer, int& stream, upload_staging& staging);
+level_bands plan_level_bands(GLenum compressed, int width, int height, int channels, int level);
+void build_image_mip_chain(job_system& jobs, decoded_image& image, int width, int height);
+void cook_textures(job_system& jobs, const std::pair<std::string, std::string>* file_names_and_textures, int count, int virtual_repeat);
+void cook_virtual_texture(job_system& jobs, const std::string& texture_file_name, int repeat);
+void cook_mip_chain(job_system& jobs, const std::string& texture_file_name, const std::vector<std::vector<unsigned char>>& mips, int width, int height, bool has_alpha, double mips_milliseconds);
+void cook_texture_atlases(job_system& jobs, const std::pair<std::string, std::string>* file_names_and_textures, int count);
+void apply_texture_atlases(const std::vector<atlas_entry>& entries, std::pair<std::string, std::string>* file_names_and_textures, int count, std::vector<std::vector<float>>& vertices);
+bool texture_file_info(const std::vector<unsigned char>& file, int& width, int& height, int& channels);
+unsigned char* decode_texture(const std::vector<unsigned char>& file, int& width, int& height, int& channels, int wanted);
+void expand_image_channels(decoded_image& image);
+std::vector<texture_pool> load_texture_pools(custom_object* objects, const std::pair<std::string, std::string>* file_names_and_textures, int count, job_system& jobs);
+std::vector<unsigned char> read_file(const std::string& file_name);
+std::vector<decoded_image> decode_images(job_system& jobs, const std::vector<std::string>& file_names, const std::vector<int>& channels);
+std::vector<glm::vec3> load_occluder_triangles(const std::string& file_name);
+void select_occluders(const prefab& prefab, uint32_t drawn, const glm::vec3& eye, std::vector<glm::mat4>& occluders);
+void render_frame(render_state& state, const frame_packet& packet);
+void render_loop(GLFWwindow* window, render_state& state, frame_pipeline<frame_packet>& pipeline);
+void bind_object_texture(const custom_object& object, const std::vector<texture_pool>& texture_pools, unsigned int& bound_texture);
 
 // settings
+const unsigned int job_workers = 0; // 0 runs one worker per core besides the main thread
 const unsigned int scr_width = 800;
 const unsigned int scr_height = 600;
 const unsigned int vertice_definition = 11; //3 Positions + 3 Colors + 3 Normal Vector + 2 Texture Coordinates
 
+// texture arrays: textures of matching size and format share one GL_TEXTURE_2D_ARRAY, so drawing
+// an object only changes the layer uniform instead of binding a new texture
+const bool use_texture_arrays = true;
+const bool texture_array_resize = true; // scale every texture to texture_array_size so they all fit a single pool
+const int texture_array_size = 1024;
+
+// textures cooked by --cook-textures are loaded instead of the images: the compressed ones when the
+// context can sample them, else their plain mip chain
+const bool use_cooked_textures = true;
+
+// mipmaps: chains are built on the CPU, filtered as linear light, instead of by glGenerateMipmap
+const bool use_cpu_mipmaps = true;
+const mip_filter mipmap_filter = mip_kaiser;
+const bool mipmap_srgb = true; // the images hold sRGB colors
+
+// texture formats: with srgb_textures the texture units decode the colors to linear light as they are
+// sampled. The lighting writes its results out as they are, so it is off until the framebuffer is sRGB too
+const bool srgb_textures = false;
+
+// image decoding: JPEGs go through libjpeg-turbo when it is built in with USE_LIBJPEG_TURBO, everything
+// else through stb_image. texture_skip_levels leaves out the finest levels of the decoded textures, for
+// machines that only ever sample the coarser mips: JPEGs are then decoded straight at 1 / 2^n of their size
+const int texture_skip_levels = 0;
+
+// prefabs: the house is placed house_grid_size x house_grid_size times and drawn with instancing
+const int house_grid_size = 1;
+const float house_spacing = 5.0f;
+const bool use_bvh_culling = true; // cull instances through a bounding volume hierarchy instead of the flat list
+const int cull_subtree_depth = 4; // the hierarchy is culled as 2^depth jobs
+
+// portals: with the eye inside a house only what shows through its door and window is drawn
+const bool use_portals = true;
+
+// occlusion culling: the walls of the houses nearest the camera are rasterized into a small depth buffer
+// on a worker thread, and instances whose boxes end up entirely behind them are not drawn
+const bool use_occlusion_culling = true;
+const int occlusion_width = 256;
+const int occlusion_height = 192;
+const int occluder_part = 1; // the walls
+const size_t occluder_count = 8;
+
+// occlusion queries: the GPU tests the box of every house in view and the result decides next frame's
+// draw, trading a frame of latency for no CPU work. Meant for machines where the CPU is the bottleneck
+const bool use_occlusion_queries = false;
+const float query_eye_margin = 0.1f; // near plane distance, a box this close to the eye is always drawn
+
+// render thread: GL submission and buffer swaps run on their own thread, fed one frame packet at a time
+const bool use_render_thread = true;
+
+// upload thread: buffers and textures are uploaded on a hidden context shared with the window's, and an
+// object is drawn from the first frame after its uploads have finished. The uploads are split into items
+// of at most upload_chunk_size bytes and handed over upload_frame_budget bytes a frame, visible and
+// larger objects first
+const bool use_upload_thread = true;
+const size_t upload_frame_budget = 1024 * 1024;
+const size_t upload_chunk_size = 256 * 1024;
+
+// pixel buffers: the upload thread stages texture bands through a ring of pixel_buffer_count unpack buffers
+// of upload_chunk_size bytes, the textures then read them from there while the thread goes on
+const bool use_pixel_buffers = true;
+const int pixel_buffer_count = 8;
+
+// mip streaming: streamed uploads start with the levels of at most stream_start_size texels a side, and
+// finer levels follow as objects come close enough to show them. Levels no longer needed are evicted
+// when others would not fit texture_memory_budget. Needs the mip chains on the CPU, from use_cpu_mipmaps
+// or cooked textures
+const bool use_mip_streaming = true;
+const int stream_start_size = 64;
+const size_t texture_memory_budget = 32 * 1024 * 1024;
+
+// virtual texturing: the garden samples a virtual texture, its own texture at virtual_tile_size texels a
+// side tiled virtual_texture_repeat times each way, which --cook-textures cuts into pages of
+// virtual_page_size texels. The page file takes about 6 MB per tile, --cook-textures N tiles it N times.
+// Only the pages a feedback pass drawn at 1 / virtual_feedback_divisor of the window size finds on
+// screen are read from disk, into a cache of virtual_cache_pages x virtual_cache_pages pages, at most
+// virtual_pages_per_frame a frame. Without the page file the garden keeps its own texture
+const bool use_virtual_texturing = true;
+const int virtual_texture_object = 0;
+const int virtual_tile_size = 1024;
+const int virtual_texture_repeat = 2;
+const int virtual_page_size = 128;
+const int virtual_page_border = 4;
+const int virtual_cache_pages = 16;
+const int virtual_feedback_divisor = 8;
+const int virtual_pages_per_frame = 8;
+
+// texture atlases: with single textures, the ones of at most atlas_max_texture_size texels a side are
+// packed by --cook-textures into atlases of texture_atlas_size texels a side, and their objects share the
+// atlas, texture coordinates moved to where each texture went, so they are drawn with one binding.
+// atlas_gutter texels of padding around every texture keep the mip levels from bleeding into each other.
+// Texture arrays share their bindings already and leave the atlases out
+const bool use_texture_atlases = true;
+const int texture_atlas_size = 1024;
+const int atlas_max_texture_size = 640;
+const int atlas_gutter = 16;
+const char* const atlas_layout_file = "src/textures/atlas.txt";
+
+// stream buffer: per-frame uniforms and instance data, one region per frame in flight
+const GLsizeiptr stream_region_size = 8 * 1024 * 1024;
+const unsigned int frame_data_binding = 0;
+const unsigned int object_data_binding = 1;
+
 // camera
 Camera camera(glm::vec3(0.0f, 0.0f, 6.0f));
 float last_x = scr_width / 2.0f;
 float last_y = scr_height / 2.0f;
 bool first_mouse = true;
 
+// framebuffer size, forwarded to the thread that draws through the frame packet
+int framebuffer_width = scr_width;
+int framebuffer_height = scr_height;
+
 // timing
 float delta_time = 0.0f;
 float last_frame = 0.0f;
+float last_report = 0.0f;
 
 // lighting
 glm::vec3 light_pos(1.2f, 1.0f, 2.0f);
@@ -48,8 +329,38 @@ glm::vec3 light_pos(1.2f, 1.0f, 2.0f);
 // specular reflex
 float specular_strength = 0.5;
 
-int main()
+int main(const int argc, char** argv)
 {
+	std::pair<std::string, std::string> modelsAndTextures[] =
+	{
+		{"src/resources/garden.csv", "src/textures/grass.jpg"},
+		{"src/resources/walls.csv", "src/textures/wall.jpg"},
+		{"src/resources/door.csv", "src/textures/door.jpg"},
+		{"src/resources/window.csv", "src/textures/window.jpg"},
+		{"src/resources/ceiling.csv", "src/textures/ceiling.jpg"},
+		{"src/resources/rooftop.csv", "src/textures/rooftop.jpg"}
+	};
+
+	const int models_and_textures_count = sizeof(modelsAndTextures) / sizeof(modelsAndTextures[0]);
+
+	// the benchmarks and --check-kernels run without a window and exit, see Bench.cpp
+	const auto bench_status = run_bench_mode(argc, argv, modelsAndTextures, models_and_textures_count);
+	if (bench_status >= 0)
+		return bench_status;
+
+	job_system jobs;
+	jobs.start(job_workers > 0 ? job_workers : std::max(1u, std::thread::hardware_concurrency()) - 1);
+
+	// --cook-textures compresses every texture into KTX2 files next to it and exits, no window either. A
+	// number after it is how many times the virtual texture repeats its tile each way
+	if (argc > 1 && std::string(argv[1]) == "--cook-textures")
+	{
+		const auto virtual_repeat = argc > 2 ? std::max(1, std::atoi(argv[2])) : virtual_texture_repeat;
+		cook_textures(jobs, modelsAndTextures, models_and_textures_count, virtual_repeat);
+		jobs.stop();
+		return 0;
+	}
+
 	// glfw: initialize and configure
 	glfwInit();
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
@@ -70,7 +381,8 @@ int main()
 	glfwSetCursorPosCallback(window, mouse_callback);
 	glfwSetScrollCallback(window, scroll_callback);
 
-	// glew: load all OpenGL function pointers
+	// glew: load all OpenGL function pointers, including extensions the core profile does not advertise the old way
+	glewExperimental = GL_TRUE;
 	if (glewInit() != GLEW_OK) {
 		std::cout << "An error occurred while starting GLEW!" << std::endl;
 	}
@@ -81,28 +393,243 @@ int main()
 
 	// configure global opengl state
 	glEnable(GL_DEPTH_TEST);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
 	// build and compile our shader zprogram
 	Shader lighting_shader("src/shaders/phong_lighting.vs", "src/shaders/phong_lighting.fs");
 
 	Shader light_cube_shader("src/shaders/light_cube.vs", "src/shaders/light_cube.fs");
 
-	std::pair<std::string, std::string> modelsAndTextures[] =
+	Shader feedback_shader("src/shaders/phong_lighting.vs", "src/shaders/virtual_feedback.fs");
+
+	// texture units: single textures on 0, texture arrays on 1, the virtual texture's page cache on 2
+	// and its page table on 3
+	lighting_shader.use();
+	lighting_shader.setInt("ourTexture", 0);
+	lighting_shader.setInt("ourTextureArray", 1);
+	lighting_shader.setInt("virtualPages", 2);
+	lighting_shader.setInt("virtualTable", 3);
+
+	bind_uniform_blocks(lighting_shader);
+	bind_uniform_blocks(light_cube_shader);
+	bind_uniform_blocks(feedback_shader);
+
+	// with a page file the virtual texture stands in for the object's own texture, which is not loaded at all
+	virtual_texture virtual_pages;
+	const auto virtual_texturing = use_virtual_texturing && virtual_pages.create(virtual_page_file_name(modelsAndTextures[virtual_texture_object].second),
+		virtual_cache_pages, scr_width / virtual_feedback_divisor, scr_height / virtual_feedback_divisor, virtual_pages_per_frame);
+	if (virtual_texturing)
 	{
-		{"src/resources/garden.csv", "src/textures/grass.jpg"},
-		{"src/resources/walls.csv", "src/textures/wall.jpg"},
-		{"src/resources/door.csv", "src/textures/door.jpg"},
-		{"src/resources/window.csv", "src/textures/window.jpg"},
-		{"src/resources/ceiling.csv", "src/textures/ceiling.jpg"},
-		{"src/resources/rooftop.csv", "src/textures/rooftop.jpg"}
-	};
+		const auto& header = virtual_pages.header;
+		const glm::vec4 virtual_info(page_file_pages(header, 0), header.page_size, header.levels, page_file_stored_size(header));
+		lighting_shader.setVec4("virtualInfo", virtual_info);
+		feedback_shader.use();
+		feedback_shader.setVec4("virtualInfo", virtual_info);
+		modelsAndTextures[virtual_texture_object].second = "";
+		std::cout << "Virtual texture = " << header.size << "x" << header.size << ", " << header.levels << " levels, " << virtual_cache_pages * virtual_cache_pages << " pages cached" << std::endl;
+	}
+
+	stream_buffer stream;
+	stream.create(stream_region_size);
+
+	GLint uniform_alignment;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniform_alignment);
+
+	upload_thread uploads;
+	uploads.pixel_buffer_count = use_pixel_buffers ? pixel_buffer_count : 0;
+	uploads.pixel_buffer_size = upload_chunk_size;
+	const auto streaming = use_upload_thread && uploads.start(window);
+	upload_scheduler scheduler;
+	scheduler.frame_budget = upload_frame_budget;
+
+	texture_streamer streamer;
+	streamer.budget = texture_memory_budget;
+	auto* const mip_streamer = streaming && use_mip_streaming ? &streamer : nullptr;
+	std::vector<texture_level_change> texture_changes;
+
+	// textures streamed in are decoded on a pool of their own, so waiting for the culling jobs of a frame
+	// never ends up running a decode. Nothing else runs its jobs, so it has a worker even on a single core
+	job_system decoders;
+	if (streaming)
+		decoders.start(std::max(1u, jobs.worker_count()));
+	auto residency_reported = false;
 
-	const int models_and_textures_count = sizeof(modelsAndTextures) / sizeof(modelsAndTextures[0]);
 	auto* custom_objects = new custom_object[models_and_textures_count];
-	for (auto i = 0; i < models_and_textures_count; i++)
-		custom_objects[i] = load_custom_object(modelsAndTextures[i]);
 
-	auto sun = load_custom_object({ "src/resources/sun.csv", "" });
+	// objects naming the same mesh or texture content share a single copy of it, freed along with the last of them
+	resource_cache<cached_resource> meshes([](cached_resource& mesh) { glDeleteBuffers(1, &mesh.object); });
+	resource_cache<cached_resource> textures([](cached_resource& texture) { glDeleteTextures(1, &texture.object); });
+
+	// the CSV files are parsed by jobs, the GL objects are then created by the upload thread or here on the context's thread
+	std::vector<std::vector<float>> model_vertices(models_and_textures_count + 1);
+	jobs.parallel_for(model_vertices.size(), 1, [&](const size_t begin, const size_t end)
+	{
+		for (auto i = begin; i < end; i++)
+			model_vertices[i] = read_csv_file(i < models_and_textures_count ? modelsAndTextures[i].first : "src/resources/sun.csv");
+	});
+
+	// textures cooked into an atlas are drawn from it
+	if (use_texture_atlases && use_cooked_textures && !use_texture_arrays)
+		apply_texture_atlases(read_atlas_layout(atlas_layout_file), modelsAndTextures, models_and_textures_count, model_vertices);
+
+	std::vector<texture_pool> texture_pools;
+	custom_object sun;
+	if (streaming)
+	{
+		// nothing waits for the uploads, the objects show up as they land
+		for (auto i = 0; i < models_and_textures_count; i++)
+			queue_custom_object(custom_objects[i], modelsAndTextures[i].first, std::move(model_vertices[i]), use_texture_arrays ? "" : modelsAndTextures[i].second, meshes, textures, scheduler, decoders, mip_streamer);
+
+		if (use_texture_arrays)
+			queue_texture_pools(custom_objects, modelsAndTextures, models_and_textures_count, scheduler, decoders, mip_streamer, texture_pools);
+
+		queue_custom_object(sun, "src/resources/sun.csv", std::move(model_vertices[models_and_textures_count]), "", meshes, textures, scheduler, decoders, mip_streamer);
+	}
+	else
+	{
+		if (use_texture_arrays)
+		{
+			// load the meshes alone and put every texture in a pool afterwards
+			for (auto i = 0; i < models_and_textures_count; i++)
+				custom_objects[i] = load_custom_object(modelsAndTextures[i].first, model_vertices[i], "", meshes, textures);
+
+			texture_pools = load_texture_pools(custom_objects, modelsAndTextures, models_and_textures_count, jobs);
+		}
+		else
+		{
+			// every texture is decoded by jobs first, once for the same content, only the uploads are left for this thread
+			std::vector<std::string> texture_file_names;
+			std::vector<uint64_t> hashes;
+			for (auto i = 0; i < models_and_textures_count; i++)
+			{
+				const auto& texture_file_name = modelsAndTextures[i].second;
+				const auto hash = texture_file_name.empty() ? 0 : texture_content_hash(textures, texture_file_name);
+				const auto decoded = std::find(hashes.begin(), hashes.end(), hash) != hashes.end();
+				hashes.push_back(hash);
+				texture_file_names.push_back(decoded ? "" : texture_file_name);
+			}
+			auto images = decode_images(jobs, texture_file_names, std::vector<int>(models_and_textures_count, 0));
+			if (use_cpu_mipmaps)
+			{
+				for (auto& image : images)
+					build_image_mip_chain(jobs, image, image.width, image.height);
+			}
+
+			for (auto i = 0; i < models_and_textures_count; i++)
+			{
+				custom_objects[i] = load_custom_object(modelsAndTextures[i].first, model_vertices[i], "", meshes, textures);
+				if (!modelsAndTextures[i].second.empty())
+				{
+					acquire_object_texture(custom_objects[i], textures, modelsAndTextures[i].second, [&](cached_resource& texture)
+					{
+						texture.object = create_object_texture(images[i]);
+						texture.resource = -1;
+						texture.stream = -1;
+					});
+				}
+				stbi_image_free(images[i].pixels);
+			}
+		}
+
+		sun = load_custom_object("src/resources/sun.csv", model_vertices[models_and_textures_count], "", meshes, textures);
+	}
+
+	std::cout << "Resource cache = " << meshes.size() << " meshes, " << textures.size() << " textures, " << meshes.hits + textures.hits << " shared" << std::endl;
+
+	// the house prefab: the garden is the root, the walls sit on it and the rest hangs from the walls
+	prefab house;
+	house.parts =
+	{
+		{0, -1, glm::mat4(1.0f), glm::mat4(1.0f)},
+		{1, 0, glm::mat4(1.0f), glm::mat4(1.0f)},
+		{2, 1, glm::mat4(1.0f), glm::mat4(1.0f)},
+		{3, 1, glm::mat4(1.0f), glm::mat4(1.0f)},
+		{4, 1, glm::mat4(1.0f), glm::mat4(1.0f)},
+		{5, 1, glm::mat4(1.0f), glm::mat4(1.0f)}
+	};
+	resolve_prefab_hierarchy(house);
+
+	std::vector<object_bounds> part_bounds;
+	for (const auto& part : house.parts)
+		part_bounds.push_back(custom_objects[part.object].bounds);
+	compute_prefab_bounds(house, part_bounds);
+
+	// every instance owns its slot, so the grid is placed by jobs, each bounding its range in one batch
+	const float grid_offset = (house_grid_size - 1) * house_spacing * 0.5f;
+	resize_prefab_instances(house, house_grid_size * house_grid_size);
+	jobs.parallel_for(house.instances.size(), 1024, [&](const size_t begin, const size_t end)
+	{
+		for (auto i = begin; i < end; i++)
+		{
+			const auto x = static_cast<int>(i) / house_grid_size;
+			const auto z = static_cast<int>(i) % house_grid_size;
+			house.instances[i] = glm::translate(glm::mat4(1.0f), glm::vec3(x * house_spacing - grid_offset, 0.0f, -z * house_spacing));
+		}
+		place_prefab_instances(house, begin, end);
+	});
+
+	if (use_bvh_culling)
+	{
+		build_bvh(house.instance_bvh, house.instance_bounds);
+		house.cull_roots = bvh_subtrees(house.instance_bvh, cull_subtree_depth);
+	}
+
+	// rooms of the house and the openings between them, in prefab space
+	const auto house_cells = load_cell_graph("src/resources/cells.csv", "src/resources/portals.csv");
+	std::vector<frustum> portal_frusta;
+
+	const auto occluder_triangles = load_occluder_triangles("src/resources/walls.csv");
+	std::vector<glm::mat4> occluders;
+	std::vector<glm::mat4> rasterized_occluders; // what the occlusion buffer holds, seen from camera version rasterized_version
+	unsigned int rasterized_version = 0;
+	occlusion_culler occlusion;
+	if (use_occlusion_culling)
+		occlusion.start(occlusion_width, occlusion_height);
+	uint32_t visible_houses = 0;
+
+	// the houses the frustum and the portals leave, from camera version culled_version
+	std::vector<uint32_t> camera_visible;
+	unsigned int culled_version = 0;
+	auto reused_frames = 0;
+	camera.SetPerspective(static_cast<float>(scr_width) / static_cast<float>(scr_height), 0.1f, 100.0f);
+
+	occlusion_queries queries;
+	if (use_occlusion_queries)
+		queries.create(house.instances.size());
+
+	// from here on the context belongs to whoever draws: the render thread, one frame behind this one,
+	// or this thread right after every frame is built
+	render_state renderer;
+	renderer.lighting_shader = &lighting_shader;
+	renderer.light_cube_shader = &light_cube_shader;
+	renderer.feedback_shader = &feedback_shader;
+	renderer.objects = custom_objects;
+	renderer.sun = &sun;
+	renderer.texture_pools = &texture_pools;
+	renderer.house = &house;
+	renderer.stream = &stream;
+	renderer.uniform_alignment = uniform_alignment;
+	renderer.queries = &queries;
+	renderer.virtual_pages = &virtual_pages;
+	renderer.virtual_object = virtual_texturing ? virtual_texture_object : -1;
+	renderer.viewport_width = scr_width;
+	renderer.viewport_height = scr_height;
+	for (size_t i = 0; i < house.parts.size(); i++)
+		renderer.part_order.push_back(i);
+	std::stable_sort(renderer.part_order.begin(), renderer.part_order.end(), [&](const size_t a, const size_t b)
+	{
+		return modelsAndTextures[house.parts[a].object].second < modelsAndTextures[house.parts[b].object].second;
+	});
+
+	frame_pipeline<frame_packet> pipeline;
+	frame_packet inline_packet;
+	std::thread render_thread;
+	if (use_render_thread)
+	{
+		glfwMakeContextCurrent(nullptr);
+		render_thread = std::thread(render_loop, window, std::ref(renderer), std::ref(pipeline));
+	}
 
 	// render loop
 	while (!glfwWindowShouldClose(window))
@@ -112,70 +639,215 @@ int main()
 		delta_time = current_frame - last_frame;
 		last_frame = current_frame;
 
-		// input
+		// input, the mouse moves since the last frame first so the keys move along the new direction
+		camera.Update();
 		process_input(window);
 
-		// render
-		glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
 		// change the light's position values over time (can be done anywhere in the render loop actually, but try to do it at least before using the light source positions)
 		light_pos.x = sin(glfwGetTime()) * 2.0f;
 		light_pos.y = sin(glfwGetTime()) * 2.0f;
 		light_pos.z = cos(glfwGetTime()) * 2.0f;
 
-		// be sure to activate shader when setting uniforms/drawing objects
-		lighting_shader.use();
-		lighting_shader.setVec3("lightColor", 1.0f, 1.0f, 1.0f);
-		lighting_shader.setVec3("lightPos", light_pos);
-		lighting_shader.setVec3("viewPos", camera.Position);
-		lighting_shader.setFloat("specularStrength", specular_strength);
+		// view/projection transformations, kept by the camera until it changes
+		const auto& projection = camera.GetProjectionMatrix();
+		const auto& view = camera.GetViewMatrix();
+		const auto& view_projection = camera.GetViewProjectionMatrix();
+		const auto& view_frustum = camera.GetFrustum();
+
+		// the houses drawn last frame that are nearest the camera hide the rest, their walls are rasterized
+		// while this thread goes on with the frustum culling. The buffer already holds them when neither
+		// they nor the camera changed
+		auto rasterize_occluders = false;
+		if (use_occlusion_culling)
+		{
+			select_occluders(house, visible_houses, camera.Position, occluders);
+			rasterize_occluders = camera.GetVersion() != rasterized_version || occluders != rasterized_occluders;
+			if (rasterize_occluders)
+			{
+				occlusion.begin_frame(view_projection, &occluder_triangles, occluders);
+				rasterized_occluders = occluders;
+				rasterized_version = camera.GetVersion();
+			}
+		}
 
-		// view/projection transformations
-		auto projection = glm::perspective(glm::radians(camera.Zoom), static_cast<float>(scr_width) / static_cast<float>(scr_height), 0.1f, 100.0f);
-		auto view = camera.GetViewMatrix();
-		lighting_shader.setMat4("projection", projection);
-		lighting_shader.setMat4("view", view);
+		// keep only the house instances inside the view frustum and not hidden behind the occluders. The
+		// houses never move, so the frustum and the portals leave the same ones for as long as the camera
+		// does not; the occlusion test narrows house.visible in place, so they are copied back from there
+		if (camera.GetVersion() != culled_version)
+		{
+			visible_houses = cull_prefab_instances(house, view_frustum, jobs);
+			if (use_portals)
+				visible_houses = cull_prefab_portals(house_cells, house, visible_houses, view_projection, view_frustum, camera.Position, portal_frusta);
+			camera_visible.assign(house.visible.begin(), house.visible.begin() + visible_houses);
+			culled_version = camera.GetVersion();
+		}
+		else
+		{
+			std::copy(camera_visible.begin(), camera_visible.end(), house.visible.begin());
+			visible_houses = static_cast<uint32_t>(camera_visible.size());
+			reused_frames++;
+		}
+		const auto occlusion_candidates = visible_houses;
+		auto occlusion_test_milliseconds = 0.0f;
+		if (use_occlusion_culling)
+		{
+			if (rasterize_occluders)
+				occlusion.wait();
+			const auto test_start = std::chrono::steady_clock::now();
+			visible_houses = occlusion.filter_visible(house.instance_bounds, house.visible.data(), visible_houses);
+			occlusion_test_milliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - test_start).count();
+		}
 
-		// world transformation
+		// the lamp is a smaller cube at the light position
 		auto model = glm::mat4(1.0f);
-		lighting_shader.setMat4("model", model);
+		model = translate(model, light_pos);
+		model = scale(model, glm::vec3(0.2f));
+		const auto sun_bounds = transform_bounds(sun.bounds, model);
+		auto draw_sun = sphere_in_frustum(view_frustum, sun_bounds.center, sun_bounds.radius);
+		if (draw_sun && use_occlusion_culling)
+			draw_sun = occlusion.buffer.is_box_visible(view_projection, (sun_bounds.min + sun_bounds.max) * 0.5f, (sun_bounds.max - sun_bounds.min) * 0.5f);
 
-		// render objects
-		for (auto i = 0; i < models_and_textures_count; i++)
+		// the nearest visible house decides how much the objects matter this frame
+		auto nearest_house = FLT_MAX;
+		if (streaming)
 		{
-			glBindTexture(GL_TEXTURE_2D, custom_objects[i].texture);
-			lighting_shader.setBool("drawTexture", custom_objects[i].draw_texture);
-			glBindVertexArray(custom_objects[i].vao);
-			glDrawArrays(GL_TRIANGLES, 0, custom_objects[i].points);
+			for (uint32_t i = 0; i < visible_houses; i++)
+			{
+				const auto index = house.visible[i];
+				const glm::vec3 center(house.instance_bounds.center_x[index], house.instance_bounds.center_y[index], house.instance_bounds.center_z[index]);
+				nearest_house = std::min(nearest_house, glm::length(center - camera.Position));
+			}
 		}
 
-		// also draw the lamp object
-		light_cube_shader.use();
-		light_cube_shader.setMat4("projection", projection);
-		light_cube_shader.setMat4("view", view);
-		model = glm::mat4(1.0f);
-		model = translate(model, light_pos);
-		model = scale(model, glm::vec3(0.2f)); // a smaller cube
-		light_cube_shader.setMat4("model", model);
+		// every streamed texture asks for the level its objects would show at the nearest house, from the
+		// nearest point of their bounding spheres
+		if (mip_streamer != nullptr)
+		{
+			const auto pixel_scale = projection[1][1] * framebuffer_height * 0.5f;
+			mip_streamer->begin_frame();
+			for (auto i = 0; i < models_and_textures_count && visible_houses > 0; i++)
+			{
+				const auto& object = custom_objects[i];
+				if (object.texture_stream < 0)
+					continue;
 
-		glBindVertexArray(sun.vao);
-		glDrawArrays(GL_TRIANGLES, 0, sun.points);
+				const auto& texture = mip_streamer->get(object.texture_stream);
+				const auto distance = std::max(0.1f, nearest_house - object.bounds.radius);
+				mip_streamer->want(object.texture_stream, required_mip_level(std::max(texture.width, texture.height), texture.levels, object.uv_density, distance, pixel_scale));
+			}
+			mip_streamer->update(scheduler, decoders, upload_chunk_size, texture_changes);
+		}
 
-		// glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
-		glfwSwapBuffers(window);
+		// uploads still held back go out in order of how much their objects matter this frame
+		if (streaming && !scheduler.idle())
+		{
+			for (auto i = 0; i < models_and_textures_count; i++)
+				prioritize_uploads(scheduler, custom_objects[i], screen_importance(custom_objects[i].bounds.radius, nearest_house, projection[1][1], visible_houses > 0));
+			prioritize_uploads(scheduler, sun, screen_importance(sun_bounds.radius, glm::length(sun_bounds.center - camera.Position), projection[1][1], draw_sun));
+		}
+		scheduler.issue(uploads);
+
+		const auto report = current_frame - last_report >= 1.0f;
+
+		// everything the frame needs is copied into the packet, so this thread can move on to the next one
+		auto& packet = use_render_thread ? pipeline.begin_write() : inline_packet;
+		packet.projection = projection;
+		packet.view = view;
+		packet.view_pos = camera.Position;
+		packet.light_pos = light_pos;
+		packet.specular_strength = specular_strength;
+		packet.house_indices.assign(house.visible.begin(), house.visible.begin() + visible_houses);
+		packet.house_instances.resize(visible_houses);
+		write_prefab_instances(house, visible_houses, packet.house_instances.data());
+		packet.draw_sun = draw_sun;
+		packet.sun_model = model;
+		packet.framebuffer_width = framebuffer_width;
+		packet.framebuffer_height = framebuffer_height;
+		packet.report = report;
+		packet.texture_changes.swap(texture_changes);
+		texture_changes.clear();
+
+		if (use_render_thread)
+		{
+			pipeline.submit();
+		}
+		else
+		{
+			render_frame(renderer, packet);
+			glfwSwapBuffers(window);
+		}
+
+		// report how much of the scene survived culling, once a second
+		if (report)
+		{
+			std::cout << "Visible objects = " << visible_houses + (draw_sun ? 1 : 0) << "/" << house.instances.size() + 1 << std::endl;
+			if (reused_frames > 0)
+				std::cout << "Culling reused = " << reused_frames << " frames, camera still" << std::endl;
+			reused_frames = 0;
+			if (use_occlusion_culling)
+			{
+				const auto culled = occlusion_candidates > 0 ? 100.0f * (occlusion_candidates - visible_houses) / occlusion_candidates : 0.0f;
+				std::cout << "Occlusion culled = " << culled << "% of " << occlusion_candidates << " (raster " << occlusion.raster_milliseconds << " ms, test " << occlusion_test_milliseconds << " ms)" << std::endl;
+			}
+			if (!scheduler.idle())
+			{
+				std::cout << "Uploads = " << scheduler.queue_depth << " queued, " << scheduler.issued_bytes / 1024 << " KB this frame, " << scheduler.peak_bytes / 1024 << " KB peak, "
+					<< scheduler.capacity() << " slots" << std::endl;
+				scheduler.reset_peak();
+				residency_reported = false;
+			}
+			else if (streaming && !residency_reported && scheduler.residency_milliseconds >= 0.0f)
+			{
+				std::cout << "Uploads resident after " << scheduler.residency_milliseconds << " ms" << std::endl;
+				residency_reported = true;
+			}
+			if (mip_streamer != nullptr)
+			{
+				std::cout << "Texture memory = " << mip_streamer->resident_bytes / 1024 << " KB of " << mip_streamer->budget / 1024 << " KB budget, "
+					<< mip_streamer->deferred_levels << " levels deferred" << std::endl;
+			}
+			last_report = current_frame;
+		}
+
+		// glfw: poll IO events (keys pressed/released, mouse moved etc.)
 		glfwPollEvents();
 	}
 
+	// let the render thread finish the frames already handed over, then take the context back for the cleanup
+	if (use_render_thread)
+	{
+		pipeline.close();
+		render_thread.join();
+		glfwMakeContextCurrent(window);
+	}
+
+	// uploads still queued are finished before anything is deleted
+	uploads.stop();
+	decoders.stop();
+	if (streaming && use_pixel_buffers)
+	{
+		const auto& pixel_buffers = uploads.pixel_buffers;
+		std::cout << "Pixel buffers = " << pixel_buffers.staged << " bands, " << pixel_buffers.staged_bytes / 1024 << " KB staged, " << pixel_buffers.direct << " direct, "
+			<< pixel_buffers.busy << " busy, " << pixel_buffers.written << " written by jobs" << std::endl;
+	}
+
 	// optional: de-allocate all resources once they've outlived their purpose:
 	for (auto i = 0; i < models_and_textures_count; i++)
 	{
 		glDeleteVertexArrays(1, &custom_objects[i].vao);
-		glDeleteBuffers(1, &custom_objects[i].vbo);
+		release_object_resources(custom_objects[i], meshes, textures);
 	}
 
 	glDeleteVertexArrays(1, &sun.vao);
-	glDeleteBuffers(1, &sun.vbo);
+	release_object_resources(sun, meshes, textures);
+	stream.destroy();
+	occlusion.stop();
+	queries.destroy();
+	virtual_pages.destroy();
+	jobs.stop();
+
+	for (const auto& pool : texture_pools)
+		glDeleteTextures(1, &pool.texture);
 
 	// glfw: terminate, clearing all previously allocated GLFW resources.
 	glfwTerminate();
@@ -212,12 +884,25 @@ void process_input(GLFWwindow* window)
 	}
 }
 
+// points the shader's uniform blocks at the binding points the stream buffer ranges are bound to
+void bind_uniform_blocks(const Shader& shader)
+{
+	const auto frame_block = glGetUniformBlockIndex(shader.ID, "FrameData");
+	if (frame_block != GL_INVALID_INDEX)
+		glUniformBlockBinding(shader.ID, frame_block, frame_data_binding);
+
+	const auto object_block = glGetUniformBlockIndex(shader.ID, "ObjectData");
+	if (object_block != GL_INVALID_INDEX)
+		glUniformBlockBinding(shader.ID, object_block, object_data_binding);
+}
+
 // glfw: whenever the window size changed (by OS or user resize) this callback function executes
 void framebuffer_size_callback(GLFWwindow* window, const int width, const int height)
 {
-	// make sure the viewport matches the new window dimensions; note that width and
+	// the viewport is set by the thread that draws once the size reaches it; note that width and
 	// height will be significantly larger than specified on retina displays.
-	glViewport(0, 0, width, height);
+	framebuffer_width = width;
+	framebuffer_height = height;
 }
 
 // glfw: whenever the mouse moves, this callback is called
@@ -245,88 +930,1507 @@ void scroll_callback(GLFWwindow*, double, const double yoffset)
 	camera.ProcessMouseScroll(yoffset);
 }
 
-custom_object load_custom_object(const std::pair<std::string, std::string>& file_name_and_texture)
+custom_object load_custom_object(const std::pair<std::string, std::string>& file_name_and_texture, resource_cache<cached_resource>& meshes, resource_cache<cached_resource>& textures)
 {
-	custom_object custom_object;
+	return load_custom_object(file_name_and_texture.first, read_csv_file(file_name_and_texture.first), file_name_and_texture.second, meshes, textures);
+}
 
-	auto vector = read_csv_file(file_name_and_texture.first);
-	const auto texture_file_name = file_name_and_texture.second;
+// same as above from vertices already read
+custom_object load_custom_object(const std::string& mesh_file_name, const std::vector<float>& vector, const std::string& texture_file_name, resource_cache<cached_resource>& meshes, resource_cache<cached_resource>& textures)
+{
+	custom_object custom_object;
+	custom_object.texture = 0;
+	custom_object.texture_pool = -1;
+	custom_object.texture_layer = -1;
 
 	const int vector_size = vector.size();
-	auto* const vertices = new float[vector_size];
-	for (size_t i = 0; i < vector_size; i++)
-		vertices[i] = vector[i];
 
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	// bounding box and sphere of the positions, used to place and cull the object
+	custom_object.bounds = compute_bounds(vector.data(), vector_size / vertice_definition, vertice_definition);
+	custom_object.uv_density = texture_coordinate_density(vector.data(), vector_size / vertice_definition, vertice_definition, 9);
+	custom_object.texture_stream = -1;
+	custom_object.shared_texture = nullptr;
 
-	unsigned int vbo, obj_vao;
-	glGenVertexArrays(1, &obj_vao);
-	glGenBuffers(1, &vbo);
+	// the vertices are hashed as they are, texture coordinates moved into an atlas included
+	custom_object.mesh_hash = fnv1a_hash(vector.data(), sizeof(float) * vector_size);
+	const auto& mesh = meshes.acquire(mesh_file_name, custom_object.mesh_hash, [&](cached_resource& mesh)
+	{
+		glGenBuffers(1, &mesh.object);
+		glBindBuffer(GL_ARRAY_BUFFER, mesh.object);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(float) * vector_size, vector.data(), GL_STATIC_DRAW);
+		mesh.resource = -1;
+		mesh.stream = -1;
+	});
+	custom_object.shared_buffer = &mesh.object;
+	custom_object.vbo = mesh.object;
+	create_object_vao(custom_object);
 
-	glBindVertexArray(obj_vao);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(float) * vector_size, vertices, GL_STATIC_DRAW);
+	custom_object.draw_texture = false;
+	custom_object.texture_upload = nullptr;
+	if (!texture_file_name.empty())
+	{
+		acquire_object_texture(custom_object, textures, texture_file_name, [&](cached_resource& texture)
+		{
+			texture.object = load_object_texture(texture_file_name);
+			texture.resource = -1;
+			texture.stream = -1;
+		});
+	}
 
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, vertice_definition * sizeof(float), static_cast<void*>(0));
-	glEnableVertexAttribArray(0);
+	custom_object.points = vector_size / vertice_definition;
+	custom_object.buffer_resource = -1;
+	custom_object.texture_resource = -1;
+	custom_object.resident = true;
 
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, vertice_definition * sizeof(float), reinterpret_cast<void*>(3 * sizeof(float)));
-	glEnableVertexAttribArray(1);
+	return custom_object;
+}
 
-	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, vertice_definition * sizeof(float), reinterpret_cast<void*>(6 * sizeof(float)));
-	glEnableVertexAttribArray(2);
+// same as above with the buffer and the texture uploaded by the scheduler, the vertex array is made by
+// make_resident on the drawing thread. The object must stay where it is until its uploads have finished.
+// With a streamer the texture only starts with its coarse levels
+void queue_custom_object(custom_object& object, const std::string& mesh_file_name, std::vector<float> vertices, const std::string& texture_file_name, resource_cache<cached_resource>& meshes, resource_cache<cached_resource>& textures, upload_scheduler& scheduler, job_system& decoders, texture_streamer* streamer)
+{
+	object.vao = 0;
+	object.vbo = 0;
+	object.texture = 0;
+	object.texture_pool = -1;
+	object.texture_layer = -1;
+	object.points = static_cast<int>(vertices.size() / vertice_definition);
+	object.draw_texture = false;
+	object.bounds = compute_bounds(vertices.data(), object.points, vertice_definition);
+	object.uv_density = texture_coordinate_density(vertices.data(), object.points, vertice_definition, 9);
+	object.texture_upload = nullptr;
+	object.texture_resource = -1;
+	object.texture_stream = -1;
+	object.shared_texture = nullptr;
+	object.resident = false;
 
-	glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, vertice_definition * sizeof(float), reinterpret_cast<void*>(9 * sizeof(float)));
-	glEnableVertexAttribArray(3);
+	// the storage first, then the data range by range
+	object.mesh_hash = fnv1a_hash(vertices.data(), sizeof(float) * vertices.size());
+	const auto& mesh = meshes.acquire(mesh_file_name, object.mesh_hash, [&](cached_resource& mesh)
+	{
+		auto* const target = &mesh.object;
+		const auto data = std::make_shared<std::vector<float>>(std::move(vertices));
+		const auto size = data->size() * sizeof(float);
+
+		std::vector<upload_item> items;
+		items.push_back({ [target, size]
+		{
+			glGenBuffers(1, target);
+			glBindBuffer(GL_ARRAY_BUFFER, *target);
+			glBufferData(GL_ARRAY_BUFFER, size, nullptr, GL_STATIC_DRAW);
+		}, 0 });
+
+		for (size_t offset = 0; offset < size; offset += upload_chunk_size)
+		{
+			const auto bytes = std::min(upload_chunk_size, size - offset);
+			items.push_back({ [target, data, offset, bytes]
+			{
+				glBindBuffer(GL_ARRAY_BUFFER, *target);
+				glBufferSubData(GL_ARRAY_BUFFER, offset, bytes, reinterpret_cast<const char*>(data->data()) + offset);
+			}, bytes });
+		}
+
+		mesh.upload = std::make_shared<upload_ticket>();
+		mesh.resource = scheduler.add(std::move(items), mesh.upload);
+		mesh.stream = -1;
+	});
+	object.shared_buffer = &mesh.object;
+	object.buffer_upload = mesh.upload;
+	object.buffer_resource = mesh.resource;
 
 	if (!texture_file_name.empty())
 	{
-		custom_object.texture = load_object_texture(texture_file_name);
-		custom_object.draw_texture = true;
+		acquire_object_texture(object, textures, texture_file_name, [&](cached_resource& texture)
+		{
+			std::shared_ptr<job_counter> decoded;
+			upload_staging staging;
+			auto items = object_texture_items(&texture.object, texture_file_name, decoders, streamer, texture.stream, decoded, staging);
+			texture.upload = std::make_shared<upload_ticket>();
+			texture.resource = add_staged_resource(scheduler, decoders, std::move(items), std::move(staging), texture.upload, decoded);
+		});
 	}
-	else
-		custom_object.draw_texture = false;
+}
 
-	custom_object.points = vector_size / vertice_definition;
-	custom_object.vao = obj_vao;
-	custom_object.vbo = vbo;
+// the object samples the texture the cache keeps for the content of texture_file_name, made by load when
+// nothing holds it yet. A texture still uploading is picked up by make_resident once it has finished
+void acquire_object_texture(custom_object& object, resource_cache<cached_resource>& textures, const std::string& texture_file_name, const resource_cache<cached_resource>::load_function& load)
+{
+	object.texture_hash = texture_content_hash(textures, texture_file_name);
+	const auto& texture = textures.acquire(texture_file_name, object.texture_hash, load);
+	object.shared_texture = &texture.object;
+	object.texture = texture.object;
+	object.draw_texture = true;
+	object.texture_upload = texture.upload;
+	object.texture_resource = texture.resource;
+	object.texture_stream = texture.stream;
+}
 
-	return custom_object;
+// the file is only read for its hash the first time its name comes up
+uint64_t texture_content_hash(const resource_cache<cached_resource>& textures, const std::string& texture_file_name)
+{
+	uint64_t hash;
+	if (!textures.find_hash(texture_file_name, hash))
+		hash = file_content_hash(texture_file_name);
+	return hash;
 }
 
-unsigned int load_object_texture(const std::string& texture_file_name)
+// the object's references to its cached buffer and texture, the last ones delete them
+void release_object_resources(custom_object& object, resource_cache<cached_resource>& meshes, resource_cache<cached_resource>& textures)
 {
-	unsigned int texture;
-	glGenTextures(1, &texture);
-	glBindTexture(GL_TEXTURE_2D, texture);
+	if (object.shared_buffer != nullptr)
+		meshes.release(object.mesh_hash);
+	if (object.shared_texture != nullptr)
+		textures.release(object.texture_hash);
+	object.shared_buffer = nullptr;
+	object.shared_texture = nullptr;
+}
 
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+// the steps of load_object_texture: the file is read here and decoded by a decoder job right away, which
+// also builds the mip chain. decoded is that job's counter. The first item makes the storage, then every
+// level goes in bands of rows, read from staging once its write has put the levels there. Without CPU
+// mipmaps only level 0 is uploaded and the others are generated from it. With a streamer and a chain the
+// levels finer than the streamer's first one are left out, stream is then the texture's handle and -1
+// otherwise
+std::vector<upload_item> object_texture_items(unsigned int* texture, const std::string& texture_file_name, job_system& decoders, texture_streamer* streamer, int& stream, std::shared_ptr<job_counter>& decoded, upload_staging& staging)
+{
+	stream = -1;
+	decoded = nullptr;
+	staging = upload_staging{ nullptr, 0, nullptr };
+	const auto cooked = std::make_shared<decoded_image>(decoded_image{});
+	if (load_cooked_texture(texture_file_name, *cooked))
+		return cooked_texture_items(texture, cooked, streamer, stream, staging);
+
+	std::vector<upload_item> items;
 
+	const auto file = std::make_shared<std::vector<unsigned char>>(read_file(texture_file_name));
 	int width, height, nr_channels;
-	stbi_set_flip_vertically_on_load(1);
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	if (!texture_file_info(*file, width, height, nr_channels))
+	{
+		std::cout << "Failed to load texture" << std::endl;
+		return items;
+	}
+
+	const auto format = choose_texture_format(nr_channels, srgb_textures);
+	const auto channels = format.channels;
+	const auto levels = use_cpu_mipmaps ? mip_level_count(width, height) : 1;
+	const auto image = std::make_shared<decoded_image>(decoded_image{});
+	decoded = std::make_shared<job_counter>();
+
+	// a streamed texture keeps its chain for the finer levels
+	streamed_texture* streamed = nullptr;
+	auto first_level = 0;
+	if (streamer != nullptr && levels > 1)
+	{
+		stream = streamer->add(texture, GL_TEXTURE_2D, width, height, channels, 1, levels, 0, srgb_textures, stream_start_size);
+		streamed = &streamer->get(stream);
+		streamed->chains[0] = std::shared_ptr<std::vector<std::vector<unsigned char>>>(image, &image->levels);
+		first_level = streamed->first_level;
+	}
+
+	decoders.run(*decoded, [file, image, channels, &decoders]
+	{
+		image->pixels = decode_texture(*file, image->width, image->height, image->channels, channels);
+		std::vector<unsigned char>().swap(*file);
+		if (image->pixels == nullptr)
+			std::cout << "Failed to load texture" << std::endl;
+		else if (use_cpu_mipmaps)
+			build_image_mip_chain(decoders, *image, image->width, image->height);
+	});
+
+	// the levels uploaded now one after another, level 0 is the decoded image itself without a chain
+	std::vector<size_t> offsets(levels, 0);
+	staging.buffer = std::make_shared<staging_buffer>();
+	for (auto level = first_level; level < levels; level++)
+	{
+		const auto bands = plan_level_bands(0, width, height, channels, level);
+		offsets[level] = staging.bytes;
+		staging.bytes += bands.rows * bands.row_bytes;
+	}
+	staging.write = [image, offsets, width, height, channels, first_level, levels](unsigned char* memory)
+	{
+		for (auto level = first_level; level < levels; level++)
+		{
+			const auto* const pixels = image->levels.empty() ? image->pixels : image->levels[level].data();
+			if (pixels == nullptr)
+				return;
+
+			const auto bands = plan_level_bands(0, width, height, channels, level);
+			std::copy(pixels, pixels + bands.rows * bands.row_bytes, memory + offsets[level]);
+		}
+	};
+
+	items.push_back({ [texture, image, format, width, height, levels, first_level]
+	{
+		glGenTextures(1, texture);
+		glBindTexture(GL_TEXTURE_2D, *texture);
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		set_texture_swizzle(GL_TEXTURE_2D, format.channels);
 
-	auto* const data = stbi_load(texture_file_name.c_str(), &width, &height, &nr_channels, 0);
-	if (data)
+		// rows of gray textures are not 4 byte aligned
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		for (auto level = first_level; level < levels; level++)
+			glTexImage2D(GL_TEXTURE_2D, level, format.internal_format, std::max(1, width >> level), std::max(1, height >> level), 0, format.format, GL_UNSIGNED_BYTE, nullptr);
+		if (levels > 1)
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+		if (first_level > 0)
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, first_level);
+	}, 0 });
+
+	for (auto level = first_level; level < levels; level++)
+	{
+		const auto bands = plan_level_bands(0, width, height, channels, level);
+		for (auto first_row = 0; first_row < bands.rows; first_row += bands.band)
+		{
+			const auto rows = std::min(bands.band, bands.rows - first_row);
+			items.push_back({ [texture, image, format, level, bands, first_row, rows, buffer = staging.buffer, offset = offsets[level]]
+			{
+				const auto* pixels = image->levels.empty() ? image->pixels : image->levels[level].data();
+				if (pixels == nullptr)
+					return;
+				if (buffer->staged())
+					pixels = buffer_offset(offset);
+
+				glBindTexture(GL_TEXTURE_2D, *texture);
+				upload_pixels(pixels + first_row * bands.row_bytes, rows * bands.row_bytes, [&](const void* data)
+				{
+					glTexSubImage2D(GL_TEXTURE_2D, level, 0, first_row, bands.width, rows, format.format, GL_UNSIGNED_BYTE, data);
+				}, buffer.get());
+			}, rows * bands.row_bytes });
+		}
+	}
+
+	items.push_back({ [texture, image, streamed, buffer = staging.buffer]
 	{
-		// PNG with transparent background
-		const auto is_png = texture_file_name.find(".png");
-		if (is_png != std::string::npos)
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+		buffer->destroy();
+		glBindTexture(GL_TEXTURE_2D, *texture);
+		if (image->pixels != nullptr && image->levels.empty())
+			glGenerateMipmap(GL_TEXTURE_2D);
+		stbi_image_free(image->pixels);
+		image->pixels = nullptr;
+
+		if (streamed != nullptr)
+			streamed->ready = !image->levels.empty();
 		else
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
+			std::vector<std::vector<unsigned char>>().swap(image->levels);
+	}, 0 });
 
-		glGenerateMipmap(GL_TEXTURE_2D);
+	return items;
+}
+
+// a cooked texture has nothing to decode: the storage of every level first, then the levels in bands of
+// rows, of blocks when it is compressed. Staged and streamed as in object_texture_items
+std::vector<upload_item> cooked_texture_items(unsigned int* texture, std::shared_ptr<decoded_image> image, texture_streamer* streamer, int& stream, upload_staging& staging)
+{
+	const auto levels = static_cast<int>(image->levels.size());
+	const auto format = choose_texture_format(image->channels, srgb_textures);
+
+	streamed_texture* streamed = nullptr;
+	auto first_level = 0;
+	if (streamer != nullptr && levels > 1)
+	{
+		stream = streamer->add(texture, GL_TEXTURE_2D, image->width, image->height, image->channels, 1, levels, image->compressed, srgb_textures, stream_start_size);
+		streamed = &streamer->get(stream);
+		streamed->chains[0] = std::shared_ptr<std::vector<std::vector<unsigned char>>>(image, &image->levels);
+		first_level = streamed->first_level;
 	}
-	else
+
+	std::vector<size_t> offsets(levels, 0);
+	staging.buffer = std::make_shared<staging_buffer>();
+	staging.bytes = 0;
+	for (auto level = first_level; level < levels; level++)
 	{
-		std::cout << "Failed to load texture" << std::endl;
+		offsets[level] = staging.bytes;
+		staging.bytes += image->levels[level].size();
 	}
-	stbi_image_free(data);
+	staging.write = [image, offsets, first_level, levels](unsigned char* memory)
+	{
+		for (auto level = first_level; level < levels; level++)
+			std::copy(image->levels[level].begin(), image->levels[level].end(), memory + offsets[level]);
+	};
 
-	return texture;
-}
\ No newline at end of file
+	std::vector<upload_item> items;
+	items.push_back({ [texture, image, levels, format, first_level]
+	{
+		glGenTextures(1, texture);
+		glBindTexture(GL_TEXTURE_2D, *texture);
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, first_level);
+		if (image->compressed == 0)
+			set_texture_swizzle(GL_TEXTURE_2D, format.channels);
+
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		for (auto level = first_level; level < levels; level++)
+		{
+			const auto width = std::max(1, image->width >> level);
+			const auto height = std::max(1, image->height >> level);
+			if (image->compressed != 0)
+				glCompressedTexImage2D(GL_TEXTURE_2D, level, image->compressed, width, height, 0, static_cast<GLsizei>(image->levels[level].size()), nullptr);
+			else
+				glTexImage2D(GL_TEXTURE_2D, level, format.internal_format, width, height, 0, format.format, GL_UNSIGNED_BYTE, nullptr);
+		}
+	}, 0 });
+
+	for (auto level = first_level; level < levels; level++)
+	{
+		const auto bands = plan_level_bands(image->compressed, image->width, image->height, image->channels, level);
+		for (auto first_row = 0; first_row < bands.rows; first_row += bands.band)
+		{
+			const auto rows = std::min(bands.band, bands.rows - first_row);
+			items.push_back({ [texture, image, format, level, bands, first_row, rows, buffer = staging.buffer, offset = offsets[level]]
+			{
+				const auto* const data = (buffer->staged() ? buffer_offset(offset) : image->levels[level].data()) + first_row * bands.row_bytes;
+				glBindTexture(GL_TEXTURE_2D, *texture);
+				upload_pixels(data, rows * bands.row_bytes, [&](const void* pixels)
+				{
+					if (image->compressed != 0)
+						glCompressedTexSubImage2D(GL_TEXTURE_2D, level, 0, first_row * 4, bands.width, std::min(rows * 4, bands.height - first_row * 4), image->compressed,
+							static_cast<GLsizei>(rows * bands.row_bytes), pixels);
+					else
+						glTexSubImage2D(GL_TEXTURE_2D, level, 0, first_row, bands.width, rows, format.format, GL_UNSIGNED_BYTE, pixels);
+				}, buffer.get());
+			}, rows * bands.row_bytes });
+		}
+	}
+
+	items.push_back({ [streamed, buffer = staging.buffer]
+	{
+		buffer->destroy();
+		if (streamed != nullptr)
+			streamed->ready = true;
+	}, 0 });
+
+	return items;
+}
+
+level_bands plan_level_bands(const GLenum compressed, const int width, const int height, const int channels, const int level)
+{
+	level_bands bands;
+	bands.width = std::max(1, width >> level);
+	bands.height = std::max(1, height >> level);
+	bands.row_bytes = compressed != 0 ? compressed_level_size(compressed, bands.width, 1) : static_cast<size_t>(bands.width) * channels;
+	bands.rows = compressed != 0 ? (bands.height + 3) / 4 : bands.height;
+	bands.band = static_cast<int>(std::max<size_t>(1, upload_chunk_size / bands.row_bytes));
+	return bands;
+}
+
+// load_texture_pools through the scheduler: the files are read here and the layout comes from their
+// headers, so the objects know their pool and layer right away. Every layer is decoded, scaled to its
+// pool and given its mip chain by a decoder job started here; every pool is a resource whose layers go
+// level by level in bands of rows, staged as in object_texture_items once the jobs of all its layers are
+// done. Cooked layers are read whole here and go the same way, in bands of block rows when compressed.
+// With a streamer a pool with a chain only starts with its coarse levels and keeps the chains of its
+// layers. pools must not be resized afterwards
+void queue_texture_pools(custom_object* objects, const std::pair<std::string, std::string>* file_names_and_textures, const int count, upload_scheduler& scheduler, job_system& decoders, texture_streamer* streamer, std::vector<texture_pool>& pools)
+{
+	std::vector<std::shared_ptr<std::vector<unsigned char>>> files(count);
+	std::vector<decoded_image> images(count, decoded_image{});
+	for (auto i = 0; i < count; i++)
+	{
+		const auto& texture_file_name = file_names_and_textures[i].second;
+		if (texture_file_name.empty())
+			continue;
+
+		auto& image = images[i];
+		if (load_cooked_texture(texture_file_name, image))
+			continue;
+
+		files[i] = std::make_shared<std::vector<unsigned char>>(read_file(texture_file_name));
+		if (!texture_file_info(*files[i], image.width, image.height, image.channels))
+		{
+			std::cout << "Failed to load texture" << std::endl;
+			image = decoded_image{};
+		}
+		image.channels = upload_channels(image.channels);
+	}
+
+	std::vector<texture_slot> slots;
+	pools = plan_texture_pools(images, texture_array_resize, texture_array_size, srgb_textures, slots);
+
+	for (size_t p = 0; p < pools.size(); p++)
+	{
+		auto* const pool = &pools[p];
+
+		// layers decoded here get their chain along with them, cooked ones brought theirs
+		if (use_cpu_mipmaps && pool->compressed == 0 && pool->levels == 1)
+			pool->levels = mip_level_count(pool->width, pool->height);
+
+		streamed_texture* streamed = nullptr;
+		auto stream = -1, first_level = 0;
+		if (streamer != nullptr && pool->levels > 1)
+		{
+			stream = streamer->add(&pool->texture, GL_TEXTURE_2D_ARRAY, pool->width, pool->height, pool->channels, pool->layers, pool->levels, pool->compressed, pool->srgb, stream_start_size);
+			streamed = &streamer->get(stream);
+			first_level = streamed->first_level;
+		}
+
+		std::vector<upload_item> items;
+		items.push_back({ [pool, first_level] { create_texture_pool(*pool, first_level); }, 0 });
+		std::shared_ptr<job_counter> decoded;
+		upload_staging staging{ std::make_shared<staging_buffer>(), 0, nullptr };
+		const auto staged_levels = std::make_shared<std::vector<staged_level>>();
+
+		for (auto i = 0; i < count; i++)
+		{
+			if (slots[i].pool != static_cast<int>(p))
+				continue;
+
+			const auto levels = std::make_shared<std::vector<std::vector<unsigned char>>>(std::move(images[i].levels));
+			if (streamed != nullptr)
+				streamed->chains[slots[i].layer] = levels;
+			if (files[i])
+			{
+				// the decoded layer, scaled to the pool's size when it differs
+				if (!decoded)
+					decoded = std::make_shared<job_counter>();
+				const auto file = files[i];
+				decoders.run(*decoded, [pool, levels, file, &decoders]
+				{
+					decoded_image image{};
+					image.pixels = decode_texture(*file, image.width, image.height, image.channels, pool->channels);
+					std::vector<unsigned char>().swap(*file);
+					if (image.pixels == nullptr)
+					{
+						std::cout << "Failed to load texture" << std::endl;
+						return;
+					}
+
+					if (pool->levels > 1)
+					{
+						build_image_mip_chain(decoders, image, pool->width, pool->height);
+						*levels = std::move(image.levels);
+						return;
+					}
+
+					if (image.width == pool->width && image.height == pool->height)
+						levels->emplace_back(image.pixels, image.pixels + static_cast<size_t>(image.width) * image.height * image.channels);
+					else
+						levels->push_back(resize_image(image, pool->width, pool->height));
+					stbi_image_free(image.pixels);
+				});
+			}
+
+			const auto layer = slots[i].layer;
+			for (auto level = first_level; level < pool->levels; level++)
+			{
+				const auto bands = plan_level_bands(pool->compressed, pool->width, pool->height, pool->channels, level);
+				const auto offset = staging.bytes;
+				staged_levels->push_back(staged_level{ levels, level, offset });
+				staging.bytes += bands.rows * bands.row_bytes;
+
+				for (auto first_row = 0; first_row < bands.rows; first_row += bands.band)
+				{
+					const auto rows = std::min(bands.band, bands.rows - first_row);
+					const auto last = streamed == nullptr && level == pool->levels - 1 && first_row + rows == bands.rows;
+					items.push_back({ [pool, levels, layer, level, first_row, rows, last, buffer = staging.buffer, offset]
+					{
+						if (levels->empty())
+							return;
+
+						const auto* const pixels = buffer->staged() ? buffer_offset(offset) : (*levels)[level].data();
+						if (pool->compressed != 0)
+							upload_texture_pool_blocks(*pool, layer, level, first_row, rows, pixels, buffer.get());
+						else
+							upload_texture_pool_rows(*pool, layer, level, first_row, rows, pixels, buffer.get());
+						if (last)
+							std::vector<std::vector<unsigned char>>().swap(*levels);
+					}, rows * bands.row_bytes });
+				}
+			}
+		}
+
+		items.push_back({ [pool, streamed, buffer = staging.buffer]
+		{
+			buffer->destroy();
+			finish_texture_pool(*pool);
+			if (streamed != nullptr)
+				streamed->ready = true;
+		}, 0 });
+
+		// layers that failed to decode have no levels and leave their place empty
+		staging.write = [staged_levels](unsigned char* memory)
+		{
+			for (const auto& staged : *staged_levels)
+			{
+				if (!staged.levels->empty())
+					std::copy((*staged.levels)[staged.level].begin(), (*staged.levels)[staged.level].end(), memory + staged.offset);
+			}
+		};
+
+		const auto ticket = std::make_shared<upload_ticket>();
+		const auto resource = add_staged_resource(scheduler, decoders, std::move(items), std::move(staging), ticket, decoded);
+		for (auto i = 0; i < count; i++)
+		{
+			if (slots[i].pool != static_cast<int>(p))
+				continue;
+
+			objects[i].texture_upload = ticket;
+			objects[i].texture_resource = resource;
+			objects[i].texture_stream = stream;
+		}
+	}
+
+	for (auto i = 0; i < count; i++)
+	{
+		objects[i].texture_pool = slots[i].pool;
+		objects[i].texture_layer = slots[i].layer;
+		objects[i].draw_texture = slots[i].pool >= 0;
+	}
+}
+
+// a resource shared by several objects goes out with the priority of the most important of them
+void prioritize_uploads(upload_scheduler& scheduler, const custom_object& object, const float priority)
+{
+	if (object.buffer_resource >= 0)
+		scheduler.raise_priority(object.buffer_resource, priority);
+	if (object.texture_resource >= 0)
+		scheduler.raise_priority(object.texture_resource, priority);
+}
+
+// moves the texture coordinates of the objects whose textures went into an atlas to their place in it, and
+// names the atlas as their texture instead
+void apply_texture_atlases(const std::vector<atlas_entry>& entries, std::pair<std::string, std::string>* file_names_and_textures, const int count, std::vector<std::vector<float>>& vertices)
+{
+	for (auto i = 0; i < count; i++)
+	{
+		for (const auto& entry : entries)
+		{
+			if (entry.texture_file_name != file_names_and_textures[i].second)
+				continue;
+
+			remap_texture_coordinates(vertices[i].data(), static_cast<int>(vertices[i].size() / vertice_definition), vertice_definition, 9, entry);
+			file_names_and_textures[i].second = entry.atlas_file_name;
+			break;
+		}
+	}
+}
+
+// vertex arrays belong to the context they were made in, so this runs on the thread that draws
+void create_object_vao(custom_object& object)
+{
+	glGenVertexArrays(1, &object.vao);
+	glBindVertexArray(object.vao);
+	glBindBuffer(GL_ARRAY_BUFFER, object.vbo);
+
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, vertice_definition * sizeof(float), static_cast<void*>(0));
+	glEnableVertexAttribArray(0);
+
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, vertice_definition * sizeof(float), reinterpret_cast<void*>(3 * sizeof(float)));
+	glEnableVertexAttribArray(1);
+
+	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, vertice_definition * sizeof(float), reinterpret_cast<void*>(6 * sizeof(float)));
+	glEnableVertexAttribArray(2);
+
+	glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, vertice_definition * sizeof(float), reinterpret_cast<void*>(9 * sizeof(float)));
+	glEnableVertexAttribArray(3);
+}
+
+// true once the object can be drawn, its vertex array is made the first time the uploads are found finished
+bool make_resident(custom_object& object)
+{
+	if (object.resident)
+		return true;
+	if (!upload_finished(object.buffer_upload.get()) || !upload_finished(object.texture_upload.get()))
+		return false;
+
+	if (object.shared_buffer != nullptr)
+		object.vbo = *object.shared_buffer;
+	if (object.shared_texture != nullptr)
+		object.texture = *object.shared_texture;
+	create_object_vao(object);
+	object.resident = true;
+	return true;
+}
+
+// only the positions of a mesh, three per triangle, for the occlusion rasterizer
+std::vector<glm::vec3> load_occluder_triangles(const std::string& file_name)
+{
+	const auto vector = read_csv_file(file_name);
+
+	std::vector<glm::vec3> triangles;
+	for (size_t i = 0; i + vertice_definition <= vector.size(); i += vertice_definition)
+		triangles.emplace_back(vector[i], vector[i + 1], vector[i + 2]);
+
+	return triangles;
+}
+
+// places the occluder part of the drawn instances closest to the eye
+void select_occluders(const prefab& prefab, const uint32_t drawn, const glm::vec3& eye, std::vector<glm::mat4>& occluders)
+{
+	std::vector<std::pair<float, uint32_t>> candidates;
+	for (uint32_t i = 0; i < drawn; i++)
+	{
+		const auto index = prefab.visible[i];
+		const glm::vec3 center(prefab.instance_bounds.center_x[index], prefab.instance_bounds.center_y[index], prefab.instance_bounds.center_z[index]);
+		candidates.emplace_back(glm::dot(center - eye, center - eye), index);
+	}
+
+	const auto count = std::min(candidates.size(), occluder_count);
+	std::partial_sort(candidates.begin(), candidates.begin() + count, candidates.end());
+
+	occluders.clear();
+	for (size_t i = 0; i < count; i++)
+		occluders.push_back(prefab.instances[candidates[i].second] * prefab.parts[occluder_part].world);
+}
+
+// draws a frame packet, on whichever thread currently owns the context
+void render_frame(render_state& state, const frame_packet& packet)
+{
+	auto& stream = *state.stream;
+	auto& queries = *state.queries;
+	const auto& house = *state.house;
+	auto& sun = *state.sun;
+	auto* custom_objects = state.objects;
+	const auto& texture_pools = *state.texture_pools;
+	const auto uniform_alignment = state.uniform_alignment;
+
+	// make sure the viewport matches the window dimensions
+	if (packet.framebuffer_width != state.viewport_width || packet.framebuffer_height != state.viewport_height)
+	{
+		glViewport(0, 0, packet.framebuffer_width, packet.framebuffer_height);
+		state.viewport_width = packet.framebuffer_width;
+		state.viewport_height = packet.framebuffer_height;
+	}
+
+	// streamed mip levels become the base level once their uploads have finished, evictions go right away
+	auto& texture_changes = state.texture_changes;
+	texture_changes.insert(texture_changes.end(), packet.texture_changes.begin(), packet.texture_changes.end());
+	texture_changes.erase(std::remove_if(texture_changes.begin(), texture_changes.end(), apply_texture_level_change), texture_changes.end());
+
+	// pages the feedback asked for go into the cache before anything samples it
+	auto& virtual_pages = *state.virtual_pages;
+	if (state.virtual_object >= 0)
+	{
+		virtual_pages.begin_frame();
+		virtual_pages.bind(GL_TEXTURE2, GL_TEXTURE3);
+	}
+
+	// render
+	glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	// everything that changes per frame is written straight into this frame's region of the stream buffer
+	stream.begin_frame();
+
+	// the blocks every draw needs come first, so a full region only ever costs houses and parts. Nothing is
+	// drawn when not even they fit, which only happens when the region could not be mapped
+	const auto frame_data = stream.allocate(sizeof(frame_uniforms), uniform_alignment);
+	const auto sun_data = stream.allocate(sizeof(object_uniforms), uniform_alignment);
+	if (frame_data.cpu == nullptr || sun_data.cpu == nullptr)
+	{
+		stream.flush();
+		stream.end_frame();
+		return;
+	}
+
+	*static_cast<object_uniforms*>(sun_data.cpu) = { packet.sun_model, false, false, 0, false, false, { 0, 0, 0 } };
+	auto* frame = static_cast<frame_uniforms*>(frame_data.cpu);
+	frame->projection = packet.projection;
+	frame->view = packet.view;
+	frame->light_pos = glm::vec4(packet.light_pos, 1.0f);
+	frame->view_pos = glm::vec4(packet.view_pos, 1.0f);
+	frame->light_color = glm::vec4(1.0f, 1.0f, 1.0f, 1.0f);
+	frame->specular_strength = packet.specular_strength;
+
+	// houses found hidden last frame are skipped, the ones whose query is still in flight are left to the GPU
+	auto& drawn_houses = state.drawn_houses;
+	auto& conditional_houses = state.conditional_houses;
+	auto& queried_houses = state.queried_houses;
+	drawn_houses.clear();
+	conditional_houses.clear();
+	queried_houses.clear();
+	if (use_occlusion_queries)
+		queries.begin_frame();
+	for (uint32_t k = 0; k < packet.house_indices.size(); k++)
+	{
+		if (!use_occlusion_queries)
+		{
+			drawn_houses.push_back(k);
+			continue;
+		}
+
+		const auto index = packet.house_indices[k];
+		const glm::vec3 center(house.instance_bounds.center_x[index], house.instance_bounds.center_y[index], house.instance_bounds.center_z[index]);
+		const glm::vec3 extent(house.instance_bounds.extent_x[index], house.instance_bounds.extent_y[index], house.instance_bounds.extent_z[index]);
+
+		// with the eye inside the box only its far faces would be tested and the house would hide itself
+		if (glm::all(glm::lessThanEqual(glm::abs(packet.view_pos - center), extent + query_eye_margin)))
+		{
+			drawn_houses.push_back(k);
+			continue;
+		}
+
+		if (queries.needs_query(index))
+			queried_houses.push_back(k);
+
+		const auto decision = queries.decide(index);
+		if (decision == query_draw)
+			drawn_houses.push_back(k);
+		else if (decision == query_conditional)
+			conditional_houses.push_back(k);
+	}
+
+	auto visible_houses = static_cast<GLsizei>(drawn_houses.size());
+	auto instance_data = stream.allocate(sizeof(glm::mat4) * visible_houses, sizeof(glm::vec4));
+	if (instance_data.cpu != nullptr)
+	{
+		auto* instances = static_cast<glm::mat4*>(instance_data.cpu);
+		for (const auto k : drawn_houses)
+			*instances++ = packet.house_instances[k];
+	}
+	else
+		visible_houses = 0;
+
+	// parts whose uploads are still in flight get no data and are left out
+	auto& part_data = state.part_data;
+	part_data.resize(house.parts.size());
+	for (size_t i = 0; i < house.parts.size(); i++)
+	{
+		auto& object = custom_objects[house.parts[i].object];
+		part_data[i] = make_resident(object) ? stream.allocate(sizeof(object_uniforms), uniform_alignment) : stream_allocation{ nullptr, 0, 0 };
+		if (part_data[i].cpu != nullptr)
+			*static_cast<object_uniforms*>(part_data[i].cpu) = { house.parts[i].world, object.draw_texture, object.texture_pool >= 0, object.texture_layer, true, house.parts[i].object == state.virtual_object, { 0, 0, 0 } };
+	}
+
+	// conditionally drawn houses go one by one, so each part gets its full model matrix
+	auto& conditional_data = state.conditional_data;
+	conditional_data.resize(conditional_houses.size() * house.parts.size());
+	for (size_t h = 0; h < conditional_houses.size(); h++)
+	{
+		for (size_t i = 0; i < house.parts.size(); i++)
+		{
+			const auto& object = custom_objects[house.parts[i].object];
+			auto& data = conditional_data[h * house.parts.size() + i];
+			data = object.resident ? stream.allocate(sizeof(object_uniforms), uniform_alignment) : stream_allocation{ nullptr, 0, 0 };
+			if (data.cpu != nullptr)
+				*static_cast<object_uniforms*>(data.cpu) = { packet.house_instances[conditional_houses[h]] * house.parts[i].world, object.draw_texture, object.texture_pool >= 0, object.texture_layer, false,
+					house.parts[i].object == state.virtual_object, { 0, 0, 0 } };
+		}
+	}
+
+	// the query proxies are the lamp cube stretched over each house's box, so they wait for its upload too
+	const auto sun_resident = make_resident(sun);
+	if (!sun_resident)
+		queried_houses.clear();
+	const auto sun_center = (sun.bounds.min + sun.bounds.max) * 0.5f;
+	const auto sun_size = sun.bounds.max - sun.bounds.min;
+	auto& query_data = state.query_data;
+	query_data.resize(queried_houses.size());
+	for (size_t h = 0; h < queried_houses.size(); h++)
+	{
+		const auto index = packet.house_indices[queried_houses[h]];
+		const glm::vec3 center(house.instance_bounds.center_x[index], house.instance_bounds.center_y[index], house.instance_bounds.center_z[index]);
+		const glm::vec3 extent(house.instance_bounds.extent_x[index], house.instance_bounds.extent_y[index], house.instance_bounds.extent_z[index]);
+		const auto box = glm::scale(glm::translate(glm::mat4(1.0f), center), extent * 2.0f / sun_size) * glm::translate(glm::mat4(1.0f), -sun_center);
+
+		query_data[h] = stream.allocate(sizeof(object_uniforms), uniform_alignment);
+		if (query_data[h].cpu != nullptr)
+			*static_cast<object_uniforms*>(query_data[h].cpu) = { box, false, false, 0, false, false, { 0, 0, 0 } };
+	}
+
+	stream.flush();
+	glBindBufferRange(GL_UNIFORM_BUFFER, frame_data_binding, stream.buffer, frame_data.offset, frame_data.size);
+
+	// render the house parts once for every visible instance, the ones sharing a texture one after another, only binding a texture when it differs from the one already bound
+	state.lighting_shader->use();
+	unsigned int bound_texture = 0;
+	for (const auto i : state.part_order)
+	{
+		const auto& object = custom_objects[house.parts[i].object];
+		if (part_data[i].cpu == nullptr)
+			continue;
+
+		bind_object_texture(object, texture_pools, bound_texture);
+		glBindBufferRange(GL_UNIFORM_BUFFER, object_data_binding, stream.buffer, part_data[i].offset, part_data[i].size);
+		attach_instance_buffer(object.vao, stream.buffer, instance_data.offset);
+		glBindVertexArray(object.vao);
+		glDrawArraysInstanced(GL_TRIANGLES, 0, object.points, visible_houses);
+	}
+
+	for (size_t h = 0; h < conditional_houses.size(); h++)
+	{
+		glBeginConditionalRender(queries.pending_query(packet.house_indices[conditional_houses[h]]), GL_QUERY_NO_WAIT);
+		for (const auto i : state.part_order)
+		{
+			const auto& object = custom_objects[house.parts[i].object];
+			const auto& data = conditional_data[h * house.parts.size() + i];
+			if (data.cpu == nullptr)
+				continue;
+
+			bind_object_texture(object, texture_pools, bound_texture);
+			glBindBufferRange(GL_UNIFORM_BUFFER, object_data_binding, stream.buffer, data.offset, data.size);
+			glBindVertexArray(object.vao);
+			glDrawArrays(GL_TRIANGLES, 0, object.points);
+		}
+		glEndConditionalRender();
+	}
+
+	// also draw the lamp object
+	if (packet.draw_sun && sun_resident)
+	{
+		state.light_cube_shader->use();
+		glBindBufferRange(GL_UNIFORM_BUFFER, object_data_binding, stream.buffer, sun_data.offset, sun_data.size);
+		glBindVertexArray(sun.vao);
+		glDrawArrays(GL_TRIANGLES, 0, sun.points);
+	}
+
+	// test the boxes against the finished depth buffer without touching it or the colors
+	if (!queried_houses.empty())
+	{
+		state.light_cube_shader->use();
+		glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+		glDepthMask(GL_FALSE);
+		glDepthFunc(GL_LEQUAL);
+		glBindVertexArray(sun.vao);
+		for (size_t h = 0; h < queried_houses.size(); h++)
+		{
+			if (query_data[h].cpu == nullptr)
+				continue;
+
+			glBindBufferRange(GL_UNIFORM_BUFFER, object_data_binding, stream.buffer, query_data[h].offset, query_data[h].size);
+			queries.begin_query(packet.house_indices[queried_houses[h]]);
+			glDrawArrays(GL_TRIANGLES, 0, sun.points);
+			queries.end_query();
+		}
+		glDepthFunc(GL_LESS);
+		glDepthMask(GL_TRUE);
+		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	}
+
+	// the instanced parts once more into the feedback target, every pixel naming the virtual texture page
+	// it samples. Blending would mix the page numbers, so it is off meanwhile
+	if (state.virtual_object >= 0 && visible_houses > 0)
+	{
+		virtual_pages.begin_feedback();
+		glDisable(GL_BLEND);
+		state.feedback_shader->use();
+		state.feedback_shader->setFloat("feedbackBias", std::log2(static_cast<float>(state.viewport_width) / virtual_pages.feedback_width));
+		for (size_t i = 0; i < house.parts.size(); i++)
+		{
+			const auto& object = custom_objects[house.parts[i].object];
+			if (part_data[i].cpu == nullptr)
+				continue;
+
+			glBindBufferRange(GL_UNIFORM_BUFFER, object_data_binding, stream.buffer, part_data[i].offset, part_data[i].size);
+			glBindVertexArray(object.vao);
+			glDrawArraysInstanced(GL_TRIANGLES, 0, object.points, visible_houses);
+		}
+		glEnable(GL_BLEND);
+		virtual_pages.end_feedback(state.viewport_width, state.viewport_height);
+	}
+
+	stream.end_frame();
+
+	if (packet.report && use_occlusion_queries)
+		std::cout << "Occlusion queries = " << queries.issued << " issued, " << queries.skipped << " skipped, " << queries.conditional << " conditional" << std::endl;
+
+	if (packet.report && state.virtual_object >= 0)
+	{
+		std::cout << "Virtual texture pages = " << virtual_pages.resident() << "/" << virtual_pages.cache_pages * virtual_pages.cache_pages << " resident, " << virtual_pages.requested
+			<< " requested, " << virtual_pages.loaded << " loaded, " << virtual_pages.evicted << " evicted" << std::endl;
+		virtual_pages.reset_counters();
+	}
+}
+
+// the render thread: takes the context over and draws every packet it is handed until the pipeline closes.
+// The packet goes back before the swap, which may block on vsync, so the next one can already be built
+void render_loop(GLFWwindow* window, render_state& state, frame_pipeline<frame_packet>& pipeline)
+{
+	glfwMakeContextCurrent(window);
+	while (auto* packet = pipeline.begin_read())
+	{
+		render_frame(state, *packet);
+		pipeline.end_read();
+		glfwSwapBuffers(window);
+	}
+	glfwMakeContextCurrent(nullptr);
+}
+
+// binds the texture or texture array an object samples, unless it is the one already bound
+void bind_object_texture(const custom_object& object, const std::vector<texture_pool>& texture_pools, unsigned int& bound_texture)
+{
+	if (object.texture_pool >= 0)
+	{
+		const auto pool_texture = texture_pools[object.texture_pool].texture;
+		if (pool_texture != bound_texture)
+		{
+			glActiveTexture(GL_TEXTURE1);
+			glBindTexture(GL_TEXTURE_2D_ARRAY, pool_texture);
+			bound_texture = pool_texture;
+		}
+	}
+	else if (object.draw_texture && object.texture != bound_texture)
+	{
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, object.texture);
+		bound_texture = object.texture;
+	}
+}
+
+unsigned int load_object_texture(const std::string& texture_file_name)
+{
+	decoded_image image{};
+	if (load_cooked_texture(texture_file_name, image))
+		return create_object_texture(image);
+
+	const auto file = read_file(texture_file_name);
+	image.pixels = decode_texture(file, image.width, image.height, image.channels, 0);
+
+	if (use_cpu_mipmaps)
+	{
+		// nothing else is loading, the chain is built on this thread alone
+		job_system jobs;
+		jobs.start(0);
+		build_image_mip_chain(jobs, image, image.width, image.height);
+		jobs.stop();
+	}
+
+	const auto texture = create_object_texture(image);
+	stbi_image_free(image.pixels);
+
+	return texture;
+}
+
+// uploads pixels decoded by decode_texture, or a whole mip chain, cooked or built on the CPU
+unsigned int create_object_texture(const decoded_image& image)
+{
+	const auto format = choose_texture_format(image.channels, srgb_textures);
+
+	unsigned int texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	if (image.compressed == 0)
+		set_texture_swizzle(GL_TEXTURE_2D, format.channels);
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+	if (!image.levels.empty())
+	{
+		for (size_t level = 0; level < image.levels.size(); level++)
+		{
+			const auto width = std::max(1, image.width >> level);
+			const auto height = std::max(1, image.height >> level);
+			if (image.compressed != 0)
+				glCompressedTexImage2D(GL_TEXTURE_2D, static_cast<int>(level), image.compressed, width, height, 0, static_cast<GLsizei>(image.levels[level].size()), image.levels[level].data());
+			else
+				glTexImage2D(GL_TEXTURE_2D, static_cast<int>(level), format.internal_format, width, height, 0, format.format, GL_UNSIGNED_BYTE, image.levels[level].data());
+		}
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, static_cast<int>(image.levels.size()) - 1);
+	}
+	else if (image.pixels)
+	{
+		glTexImage2D(GL_TEXTURE_2D, 0, format.internal_format, image.width, image.height, 0, format.format, GL_UNSIGNED_BYTE, image.pixels);
+		glGenerateMipmap(GL_TEXTURE_2D);
+	}
+	else
+	{
+		std::cout << "Failed to load texture" << std::endl;
+	}
+
+	return texture;
+}
+
+// the size a texture file is decoded at by decode_texture and its own channel count, false when it is
+// no image
+bool texture_file_info(const std::vector<unsigned char>& file, int& width, int& height, int& channels)
+{
+	image_info info;
+	if (!read_image_info(file.data(), file.size(), texture_skip_levels, info))
+		return false;
+
+	width = info.width;
+	height = info.height;
+	channels = info.channels;
+	return true;
+}
+
+// decodes an image file into the channels it is uploaded with, which are its own but for RGB, expanded
+// to RGBA, at 1 / 2^texture_skip_levels of its size. wanted asks for a channel count of its own instead,
+// 0 takes the file's. Null when the file cannot be decoded; the pixels go back with stbi_image_free
+unsigned char* decode_texture(const std::vector<unsigned char>& file, int& width, int& height, int& channels, const int wanted)
+{
+	image_info info;
+	if (!read_image_info(file.data(), file.size(), 0, info))
+		return nullptr;
+
+	auto* const pixels = decode_image(file.data(), file.size(), texture_skip_levels, wanted != 0 ? wanted : upload_channels(info.channels), info);
+	width = info.width;
+	height = info.height;
+	channels = info.channels;
+	return pixels;
+}
+
+// plain RGB levels, such as the cooked chains of textures without alpha, to RGBA
+void expand_image_channels(decoded_image& image)
+{
+	if (image.compressed != 0 || image.channels != 3)
+		return;
+
+	for (size_t level = 0; level < image.levels.size(); level++)
+	{
+		auto& texels = image.levels[level];
+		std::vector<unsigned char> rgba(texels.size() / 3 * 4);
+		expand_rgb_to_rgba(texels.data(), rgba.data(), texels.size() / 3);
+		texels.swap(rgba);
+	}
+	image.channels = 4;
+}
+
+// src/textures/grass.jpg cooked to bc7 is src/textures/grass.bc7.ktx2, its plain mip chain
+// src/textures/grass.mips.ktx2
+std::string cooked_file_name(const std::string& texture_file_name, const std::string& format_name)
+{
+	return texture_file_stem(texture_file_name) + "." + format_name + ".ktx2";
+}
+
+// src/textures/grass.jpg has its virtual texture pages in src/textures/grass.pages
+std::string virtual_page_file_name(const std::string& texture_file_name)
+{
+	return texture_file_stem(texture_file_name) + ".pages";
+}
+
+// the file name without its extension
+std::string texture_file_stem(const std::string& texture_file_name)
+{
+	const auto dot = texture_file_name.find_last_of('.');
+	const auto slash = texture_file_name.find_last_of("/\\");
+	return dot != std::string::npos && (slash == std::string::npos || dot > slash) ? texture_file_name.substr(0, dot) : texture_file_name;
+}
+
+// the best cooked version of the texture the context can sample, in the order bc7, bc3, bc1, etc2, then
+// the plain mip chain when the chains come from the CPU. false when there is none and the image itself
+// has to be decoded
+bool load_cooked_texture(const std::string& texture_file_name, decoded_image& image)
+{
+	if (!use_cooked_textures)
+		return false;
+
+	const texture_codec preference[] = { codec_bc7, codec_bc3, codec_bc1, codec_etc2 };
+	for (const auto codec : preference)
+	{
+		if (!codec_supported(codec))
+			continue;
+
+		const auto file = read_file(cooked_file_name(texture_file_name, codec_name(codec)));
+		if (!file.empty() && read_ktx2(file, image))
+		{
+			if (srgb_textures)
+				image.compressed = srgb_compressed_format(image.compressed);
+			return true;
+		}
+	}
+
+	if (!use_cpu_mipmaps)
+		return false;
+
+	const auto file = read_file(cooked_file_name(texture_file_name, "mips"));
+	if (file.empty() || !read_ktx2(file, image))
+		return false;
+
+	expand_image_channels(image);
+	return true;
+}
+
+// every texture gets its mip chain down to 1x1, built as with use_cpu_mipmaps, which is written as it is
+// and compressed with each codec that suits it: BC3 and BC7 when it has alpha and BC1, BC7 and ETC2
+// when it has not. The block rows of a level are compressed by jobs. Textures for the pools are cooked
+// at the pools' size, as blocks cannot be scaled once loaded. Prints the PSNR of level 0 against the
+// source for every codec. The texture atlases and the virtual texture's page file, its tile repeated
+// virtual_repeat times each way, are cooked after them
+void cook_textures(job_system& jobs, const std::pair<std::string, std::string>* file_names_and_textures, const int count, const int virtual_repeat)
+{
+	stbi_set_flip_vertically_on_load(1);
+	for (auto i = 0; i < count; i++)
+	{
+		const auto& texture_file_name = file_names_and_textures[i].second;
+		if (texture_file_name.empty())
+			continue;
+
+		const auto file = read_file(texture_file_name);
+		decoded_image image{};
+		image.pixels = stbi_load_from_memory(file.data(), static_cast<int>(file.size()), &image.width, &image.height, &image.channels, 4);
+		if (image.pixels == nullptr)
+		{
+			std::cout << "Failed to load texture" << std::endl;
+			continue;
+		}
+		const auto has_alpha = image.channels == 2 || image.channels == 4;
+		image.channels = 4;
+
+		const auto mips_start = std::chrono::steady_clock::now();
+		if (use_texture_arrays && texture_array_resize)
+			build_image_mip_chain(jobs, image, texture_array_size, texture_array_size);
+		else
+			build_image_mip_chain(jobs, image, image.width, image.height);
+		const auto mips_milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - mips_start).count();
+
+		cook_mip_chain(jobs, texture_file_name, image.levels, image.width, image.height, has_alpha, mips_milliseconds);
+	}
+
+	if (use_texture_atlases)
+		cook_texture_atlases(jobs, file_names_and_textures, count);
+
+	if (use_virtual_texturing && virtual_texture_object < count)
+		cook_virtual_texture(jobs, file_names_and_textures[virtual_texture_object].second, virtual_repeat);
+}
+
+// writes a mip chain of four channel texels, level 0 first, as it is and compressed with each codec that
+// suits it, has_alpha deciding which. The block rows of a level are compressed by jobs
+void cook_mip_chain(job_system& jobs, const std::string& texture_file_name, const std::vector<std::vector<unsigned char>>& mips, const int width, const int height, const bool has_alpha, const double mips_milliseconds)
+{
+	std::vector<glm::ivec2> sizes;
+	for (auto level = 0; level < static_cast<int>(mips.size()); level++)
+		sizes.push_back(glm::ivec2(std::max(1, width >> level), std::max(1, height >> level)));
+
+	// the plain chain leaves alpha out when there is none
+	std::vector<std::vector<unsigned char>> plain(mips.size());
+	size_t plain_bytes = 0;
+	for (size_t level = 0; level < mips.size(); level++)
+	{
+		if (has_alpha)
+		{
+			plain[level] = mips[level];
+		}
+		else
+		{
+			plain[level].resize(mips[level].size() / 4 * 3);
+			for (size_t texel = 0; texel < mips[level].size() / 4; texel++)
+				std::copy(&mips[level][texel * 4], &mips[level][texel * 4] + 3, &plain[level][texel * 3]);
+		}
+		plain_bytes += plain[level].size();
+	}
+
+	const auto plain_cooked = cooked_file_name(texture_file_name, "mips");
+	if (write_ktx2(plain_cooked, has_alpha ? GL_RGBA8 : GL_RGB8, sizes[0].x, sizes[0].y, plain))
+		std::cout << plain_cooked << " = " << sizes[0].x << "x" << sizes[0].y << ", " << plain.size() << " levels, " << plain_bytes / 1024 << " KB, "
+			<< mips_milliseconds << " ms" << std::endl;
+	else
+		std::cout << "Failed to write " << plain_cooked << std::endl;
+
+	for (const auto codec : texture_codecs)
+	{
+		if (has_alpha ? !codec_has_alpha(codec) : codec == codec_bc3)
+			continue;
+
+		const auto start = std::chrono::steady_clock::now();
+		std::vector<std::vector<unsigned char>> levels(mips.size());
+		size_t bytes = 0;
+		for (size_t level = 0; level < mips.size(); level++)
+		{
+			const auto size = sizes[level];
+			levels[level].resize(compressed_level_size(codec_gl_format(codec), size.x, size.y));
+			bytes += levels[level].size();
+			jobs.parallel_for((size.y + 3) / 4, 4, [&](const size_t begin, const size_t end)
+			{
+				compress_block_rows(codec, mips[level].data(), size.x, size.y, static_cast<int>(begin), static_cast<int>(end), levels[level].data());
+			});
+		}
+		const auto milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		const auto decoded = decompress_level(codec, levels[0].data(), sizes[0].x, sizes[0].y);
+		const auto psnr = rgba_psnr(mips[0].data(), decoded.data(), static_cast<size_t>(sizes[0].x) * sizes[0].y, has_alpha ? 4 : 3);
+
+		const auto cooked = cooked_file_name(texture_file_name, codec_name(codec));
+		if (!write_ktx2(cooked, codec_gl_format(codec), sizes[0].x, sizes[0].y, levels))
+		{
+			std::cout << "Failed to write " << cooked << std::endl;
+			continue;
+		}
+
+		std::cout << cooked << " = " << sizes[0].x << "x" << sizes[0].y << ", " << levels.size() << " levels, " << bytes / 1024 << " KB, PSNR "
+			<< psnr << " dB, " << milliseconds << " ms" << std::endl;
+	}
+}
+
+// the textures of at most atlas_max_texture_size texels a side, packed tallest first into atlases of
+// texture_atlas_size texels a side, the ones with alpha apart from the others. Every texture sits at a
+// multiple of the coarsest level's texel, surrounded by atlas_gutter texels of its own edges, and the
+// atlases keep only the levels atlas_mip_levels allows. They are cooked like the textures, under the
+// names atlas_layout_file gives them
+void cook_texture_atlases(job_system& jobs, const std::pair<std::string, std::string>* file_names_and_textures, const int count)
+{
+	const auto levels = atlas_mip_levels(atlas_gutter);
+	const auto alignment = 1 << (levels - 1);
+	const std::string layout_file_name(atlas_layout_file);
+	const auto folder = layout_file_name.substr(0, layout_file_name.find_last_of("/\\") + 1);
+
+	std::vector<atlas_entry> entries;
+	auto atlas_count = 0;
+	for (auto alpha = 0; alpha < 2; alpha++)
+	{
+		// the small textures of this kind, each once
+		std::vector<std::string> names;
+		std::vector<decoded_image> images;
+		for (auto i = 0; i < count; i++)
+		{
+			const auto& texture_file_name = file_names_and_textures[i].second;
+			if (texture_file_name.empty() || std::find(names.begin(), names.end(), texture_file_name) != names.end())
+				continue;
+
+			const auto file = read_file(texture_file_name);
+			decoded_image image{};
+			if (!stbi_info_from_memory(file.data(), static_cast<int>(file.size()), &image.width, &image.height, &image.channels)
+				|| (image.channels == 2 || image.channels == 4) != (alpha == 1) || image.width > atlas_max_texture_size || image.height > atlas_max_texture_size)
+				continue;
+
+			image.pixels = stbi_load_from_memory(file.data(), static_cast<int>(file.size()), &image.width, &image.height, &image.channels, 4);
+			if (image.pixels == nullptr)
+				continue;
+
+			image.channels = 4;
+			names.push_back(texture_file_name);
+			images.push_back(image);
+		}
+
+		std::vector<size_t> order(images.size());
+		for (size_t i = 0; i < order.size(); i++)
+			order[i] = i;
+		std::sort(order.begin(), order.end(), [&](const size_t a, const size_t b) { return images[a].height > images[b].height; });
+
+		// a texture that fits no atlas so far starts the next one, one too large for an empty atlas is left out
+		std::vector<skyline_packer> packers;
+		std::vector<std::vector<atlas_rect>> rects;
+		std::vector<std::vector<size_t>> contents;
+		for (const auto i : order)
+		{
+			const auto width = (images[i].width + 2 * atlas_gutter + alignment - 1) / alignment * alignment;
+			const auto height = (images[i].height + 2 * atlas_gutter + alignment - 1) / alignment * alignment;
+			atlas_rect rect;
+			auto atlas = 0;
+			while (atlas < static_cast<int>(packers.size()) && !packers[atlas].insert(width, height, rect))
+				atlas++;
+
+			if (atlas == static_cast<int>(packers.size()))
+			{
+				packers.emplace_back();
+				packers.back().reset(texture_atlas_size, texture_atlas_size);
+				rects.emplace_back();
+				contents.emplace_back();
+				if (!packers.back().insert(width, height, rect))
+				{
+					packers.pop_back();
+					rects.pop_back();
+					contents.pop_back();
+					continue;
+				}
+			}
+
+			rects[atlas].push_back(rect);
+			contents[atlas].push_back(i);
+		}
+
+		for (size_t atlas = 0; atlas < packers.size(); atlas++)
+		{
+			const auto atlas_file_name = folder + "atlas" + std::to_string(atlas_count++) + (alpha == 1 ? ".png" : ".jpg");
+			const auto mips_start = std::chrono::steady_clock::now();
+			std::vector<unsigned char> pixels(static_cast<size_t>(texture_atlas_size) * texture_atlas_size * 4, 0);
+			for (size_t k = 0; k < contents[atlas].size(); k++)
+			{
+				const auto& image = images[contents[atlas][k]];
+				const auto rect = atlas_rect{ rects[atlas][k].x + atlas_gutter, rects[atlas][k].y + atlas_gutter, image.width, image.height };
+				copy_into_atlas(pixels.data(), texture_atlas_size, 4, rect, image.pixels, image.width, image.height, atlas_gutter);
+
+				const auto size = static_cast<float>(texture_atlas_size);
+				entries.push_back(atlas_entry{ names[contents[atlas][k]], atlas_file_name, rect.x / size, rect.y / size, (rect.x + rect.width) / size, (rect.y + rect.height) / size });
+			}
+
+			auto mips = build_mip_chain(jobs, pixels.data(), texture_atlas_size, texture_atlas_size, 4, mipmap_srgb, mipmap_filter);
+			mips.resize(std::min(mips.size(), static_cast<size_t>(levels)));
+			const auto mips_milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - mips_start).count();
+			cook_mip_chain(jobs, atlas_file_name, mips, texture_atlas_size, texture_atlas_size, alpha == 1, mips_milliseconds);
+		}
+
+		for (auto& image : images)
+			stbi_image_free(image.pixels);
+	}
+
+	if (write_atlas_layout(atlas_layout_file, entries))
+		std::cout << atlas_layout_file << " = " << entries.size() << " textures in " << atlas_count << " atlases" << std::endl;
+	else
+		std::cout << "Failed to write " << atlas_layout_file << std::endl;
+}
+
+// the page file of the virtual texture: the texture scaled to virtual_tile_size and tiled repeat times
+// each way, every level of the virtual texture being the same level of the tile's mip chain, built as
+// with use_cpu_mipmaps, repeated. The pages of a row of pages are cut by jobs and written together
+void cook_virtual_texture(job_system& jobs, const std::string& texture_file_name, const int repeat)
+{
+	const auto file = read_file(texture_file_name);
+	decoded_image image{};
+	image.pixels = stbi_load_from_memory(file.data(), static_cast<int>(file.size()), &image.width, &image.height, &image.channels, 4);
+	if (image.pixels == nullptr)
+	{
+		std::cout << "Failed to load texture" << std::endl;
+		return;
+	}
+	image.channels = 4;
+
+	const auto start = std::chrono::steady_clock::now();
+	const auto tile_size = virtual_tile_size;
+	const auto virtual_texture_size = tile_size * repeat;
+	build_image_mip_chain(jobs, image, tile_size, tile_size);
+
+	const page_file_header header{ virtual_texture_size, virtual_page_size, virtual_page_border, page_file_levels(virtual_texture_size, virtual_page_size) };
+	const auto page_file = virtual_page_file_name(texture_file_name);
+	std::ofstream out(page_file, std::ios::binary);
+	write_page_file_header(out, header);
+
+	const auto stored = page_file_stored_size(header);
+	const auto page_bytes = page_file_page_bytes(header);
+	size_t page_count = 0;
+	std::vector<unsigned char> row;
+	for (auto level = 0; level < header.levels; level++)
+	{
+		const auto& tile = image.levels[std::min(level, static_cast<int>(image.levels.size()) - 1)];
+		const auto tile_level_size = std::max(1, tile_size >> level);
+		const auto pages = page_file_pages(header, level);
+		row.resize(pages * page_bytes);
+		for (auto y = 0; y < pages; y++)
+		{
+			jobs.parallel_for(pages, 1, [&](const size_t begin, const size_t end)
+			{
+				for (auto x = static_cast<int>(begin); x < static_cast<int>(end); x++)
+				{
+					// the border texels come from the neighbouring pages, wrapping around the edges
+					auto* const page = &row[x * page_bytes];
+					for (auto page_y = 0; page_y < stored; page_y++)
+					{
+						const auto tile_y = ((y * header.page_size - header.border + page_y) % tile_level_size + tile_level_size) % tile_level_size;
+						for (auto page_x = 0; page_x < stored; page_x++)
+						{
+							const auto tile_x = ((x * header.page_size - header.border + page_x) % tile_level_size + tile_level_size) % tile_level_size;
+							std::copy_n(&tile[(static_cast<size_t>(tile_y) * tile_level_size + tile_x) * 4], 4, &page[(static_cast<size_t>(page_y) * stored + page_x) * 4]);
+						}
+					}
+				}
+			});
+			out.write(reinterpret_cast<const char*>(row.data()), row.size());
+		}
+		page_count += static_cast<size_t>(pages) * pages;
+	}
+
+	const auto milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	if (out)
+		std::cout << page_file << " = " << header.size << "x" << header.size << ", " << header.levels << " levels, " << page_count << " pages, "
+			<< page_count * page_bytes / 1024 << " KB, " << milliseconds << " ms" << std::endl;
+	else
+		std::cout << "Failed to write " << page_file << std::endl;
+}
+
+std::vector<texture_pool> load_texture_pools(custom_object* objects, const std::pair<std::string, std::string>* file_names_and_textures, const int count, job_system& jobs)
+{
+	std::vector<std::string> texture_file_names;
+	for (auto i = 0; i < count; i++)
+		texture_file_names.push_back(file_names_and_textures[i].second);
+
+	// channel counts as uploaded, they decide the pools
+	auto images = decode_images(jobs, texture_file_names, std::vector<int>(count, 0));
+
+	// chains are built at the pools' size, so the images are scaled first
+	if (use_cpu_mipmaps)
+	{
+		for (auto& image : images)
+		{
+			if (texture_array_resize)
+				build_image_mip_chain(jobs, image, texture_array_size, texture_array_size);
+			else
+				build_image_mip_chain(jobs, image, image.width, image.height);
+		}
+	}
+
+	std::vector<texture_slot> slots;
+	auto pools = build_texture_pools(images, texture_array_resize, texture_array_size, srgb_textures, slots);
+
+	for (auto i = 0; i < count; i++)
+	{
+		objects[i].texture_pool = slots[i].pool;
+		objects[i].texture_layer = slots[i].layer;
+		objects[i].draw_texture = slots[i].pool >= 0;
+		stbi_image_free(images[i].pixels);
+	}
+
+	return pools;
+}
+
+// replaces the pixels of a decoded image with its mip chain, scaled to width x height first when its size
+// differs. Images without pixels, or with a chain already, are left as they are
+void build_image_mip_chain(job_system& jobs, decoded_image& image, const int width, const int height)
+{
+	if (image.pixels == nullptr || !image.levels.empty())
+		return;
+
+	if (image.width != width || image.height != height)
+	{
+		const auto resized = resize_image(image, width, height);
+		image.levels = build_mip_chain(jobs, resized.data(), width, height, image.channels, mipmap_srgb, mipmap_filter);
+	}
+	else
+	{
+		image.levels = build_mip_chain(jobs, image.pixels, width, height, image.channels, mipmap_srgb, mipmap_filter);
+	}
+
+	stbi_image_free(image.pixels);
+	image.pixels = nullptr;
+	image.width = width;
+	image.height = height;
+}
+
+// the whole file, empty when it cannot be read
+std::vector<unsigned char> read_file(const std::string& file_name)
+{
+	std::ifstream file(file_name, std::ios::binary | std::ios::ate);
+	if (!file)
+		return std::vector<unsigned char>();
+
+	std::vector<unsigned char> data(static_cast<size_t>(file.tellg()));
+	file.seekg(0);
+	file.read(reinterpret_cast<char*>(data.data()), data.size());
+	return data;
+}
+
+// every file is read first, one after the other, then the decodes run as jobs. Empty names and files
+// that fail to decode give an image without pixels or size. channels is what to decode to, 0 keeping
+// the file's own count. Cooked textures come back with their mip chain, with nothing to decode
+std::vector<decoded_image> decode_images(job_system& jobs, const std::vector<std::string>& file_names, const std::vector<int>& channels)
+{
+	std::vector<decoded_image> images(file_names.size(), decoded_image{});
+	std::vector<std::vector<unsigned char>> files(file_names.size());
+	for (size_t i = 0; i < file_names.size(); i++)
+	{
+		if (!file_names[i].empty() && !load_cooked_texture(file_names[i], images[i]))
+			files[i] = read_file(file_names[i]);
+	}
+
+	jobs.parallel_for(files.size(), 1, [&](const size_t begin, const size_t end)
+	{
+		for (auto i = begin; i < end; i++)
+		{
+			if (file_names[i].empty() || !images[i].levels.empty())
+				continue;
+
+			auto& image = images[i];
+			image.pixels = decode_texture(files[i], image.width, image.height, image.channels, channels[i]);
+			if (image.pixels == nullptr)
+			{
+				std::cout << "Failed to load texture" << std::endl;
+				image = decoded_image{};
+			}
+		}
+	});
+
+	return images;
+}
@@ -0,0 +1,554 @@
+﻿#include <GL/glew.h>
+#include <glm.hpp>
+#include <gtc/matrix_transform.hpp>
+#include <CpuFeatures.h>
+#include <CSVReader.h>
+#include <TextureFormats.h>
+#include <ImageDecoder.h>
+#include <Mipmaps.h>
+#include <Frustum.h>
+#include <Culling.h>
+#include <SimdMath.h>
+#include <Bvh.h>
+#include <Prefab.h>
+#include <JobSystem.h>
+#include <OcclusionCulling.h>
+#include "Bench.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+void run_job_benchmark();
+void run_decode_benchmark(const std::pair<std::string, std::string>* file_names_and_textures, int count);
+void run_math_benchmark();
+void run_cull_benchmark();
+bool run_kernel_check(const std::pair<std::string, std::string>* file_names_and_textures, int count);
+float max_difference(const float* a, const float* b, size_t count);
+std::vector<unsigned char> read_file(const std::string& file_name); // Application.cpp
+
+int run_bench_mode(const int argc, char** argv, const std::pair<std::string, std::string>* file_names_and_textures, const int count)
+{
+	if (argc < 2)
+		return -1;
+	const std::string mode = argv[1];
+
+	// --bench-jobs measures the job system
+	if (mode == "--bench-jobs")
+	{
+		run_job_benchmark();
+		return 0;
+	}
+
+	// --bench-math times the SIMD math kernels at every level the CPU runs, against glm
+	if (mode == "--bench-math")
+	{
+		run_math_benchmark();
+		return 0;
+	}
+
+	// --bench-cull times the frustum culling of a million boxes at every level the CPU runs
+	if (mode == "--bench-cull")
+	{
+		run_cull_benchmark();
+		return 0;
+	}
+
+	// --bench-decode times the image decoders on the textures
+	if (mode == "--bench-decode")
+	{
+		run_decode_benchmark(file_names_and_textures, count);
+		return 0;
+	}
+
+	// --check-kernels runs every SIMD variant of the hot kernels the CPU has against the scalar one, 1
+	// when any of them differs
+	if (mode == "--check-kernels")
+		return run_kernel_check(file_names_and_textures, count) ? 0 : 1;
+
+	return -1;
+}
+
+// scheduling cost of a single job, and how a fixed amount of work scales with the number of workers
+void run_job_benchmark()
+{
+	const auto cores = std::max(1u, std::thread::hardware_concurrency());
+	std::cout << "Cores = " << cores << std::endl;
+
+	{
+		job_system jobs;
+		jobs.start(cores - 1);
+
+		const auto job_count = 200000;
+		std::atomic<int> done(0);
+		job_counter counter;
+		const auto start = std::chrono::steady_clock::now();
+		for (auto i = 0; i < job_count; i++)
+			jobs.run(counter, [&done] { done++; });
+		jobs.wait(counter);
+		const auto nanoseconds = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+		std::cout << "Overhead per job = " << nanoseconds / job_count << " ns" << std::endl;
+
+		jobs.stop();
+	}
+
+	// the same sum of square roots split over more and more workers
+	const size_t items = 1 << 24;
+	auto single_thread = 0.0;
+	for (auto workers = 0u; workers < cores; workers++)
+	{
+		job_system jobs;
+		jobs.start(workers);
+
+		std::atomic<long long> total(0);
+		const auto start = std::chrono::steady_clock::now();
+		jobs.parallel_for(items, 4096, [&total](const size_t begin, const size_t end)
+		{
+			auto sum = 0.0f;
+			for (auto i = begin; i < end; i++)
+				sum += std::sqrt(static_cast<float>(i));
+			total += static_cast<long long>(sum);
+		});
+		const auto milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		if (workers == 0)
+			single_thread = milliseconds;
+
+		std::cout << "Threads = " << workers + 1 << ": " << milliseconds << " ms, speedup " << single_thread / milliseconds << std::endl;
+		jobs.stop();
+	}
+}
+
+// the largest difference between two runs of floats
+float max_difference(const float* a, const float* b, const size_t count)
+{
+	auto difference = 0.0f;
+	for (size_t i = 0; i < count; i++)
+		difference = std::max(difference, std::abs(a[i] - b[i]));
+	return difference;
+}
+
+// every math kernel at each level the CPU runs, over rotated, scaled and moved matrices: the best time of
+// a few runs per item, and the largest difference from the scalar kernels, which are glm
+void run_math_benchmark()
+{
+	std::cout << "SIMD level = " << simd_level_name(cpu_simd_level()) << std::endl;
+
+	const size_t count = 1 << 18;
+	const auto runs = 5;
+	aligned_vector<glm::mat4> matrices(count), results(count), reference(count);
+	point_set points;
+	resize_point_set(points, count);
+	for (size_t i = 0; i < count; i++)
+	{
+		const auto t = static_cast<float>(i);
+		const auto axis = glm::normalize(glm::vec3(std::sin(t * 0.7f), std::cos(t * 1.3f), 0.5f));
+		matrices[i] = glm::scale(glm::rotate(glm::translate(glm::mat4(1.0f), glm::vec3(std::sin(t) * 50.0f, t * 0.001f, std::cos(t) * 50.0f)), t * 0.37f, axis), glm::vec3(0.5f + std::fmod(t * 0.013f, 2.0f)));
+		points.x[i] = std::sin(t * 0.11f) * 10.0f;
+		points.y[i] = std::cos(t * 0.17f) * 10.0f;
+		points.z[i] = std::sin(t * 0.23f) * 10.0f;
+	}
+	const auto view_projection = glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 100.0f) * glm::lookAt(glm::vec3(0.0f, 5.0f, 10.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	object_bounds box{ glm::vec3(-1.0f, 0.0f, -2.0f), glm::vec3(3.0f, 2.0f, 1.0f), glm::vec3(1.0f, 1.0f, -0.5f), 2.7f };
+
+	point_set transformed, reference_points;
+	cull_set boxes, reference_boxes;
+	for (auto* set : { &boxes, &reference_boxes })
+	{
+		for (auto* axis : { &set->center_x, &set->center_y, &set->center_z, &set->extent_x, &set->extent_y, &set->extent_z })
+			axis->resize(count);
+	}
+	resize_point_set(transformed, count);
+	resize_point_set(reference_points, count);
+
+	aligned_vector<glm::mat4> product_reference(count);
+	multiply_matrices_scalar(view_projection, matrices.data(), product_reference.data(), count);
+	inverse_transpose_scalar(matrices.data(), reference.data(), count);
+	transform_points_scalar(view_projection, points.x.data(), points.y.data(), points.z.data(), count, reference_points.x.data(), reference_points.y.data(), reference_points.z.data(), reference_points.w.data());
+	transform_boxes_scalar(box, matrices.data(), count, reference_boxes, 0);
+
+	const char* const names[] = { "multiply", "transform points", "inverse transpose", "transform boxes" };
+	for (auto level = 0; level <= cpu_simd_level(); level++)
+	{
+		force_simd_level(static_cast<simd_level>(level));
+		for (auto kernel = 0; kernel < 4; kernel++)
+		{
+			auto best = 0.0;
+			for (auto run = 0; run < runs; run++)
+			{
+				const auto start = std::chrono::steady_clock::now();
+				switch (kernel)
+				{
+				case 0:
+					multiply_matrices(view_projection, matrices.data(), results.data(), count);
+					break;
+				case 1:
+					transform_points(view_projection, points, transformed);
+					break;
+				case 2:
+					inverse_transpose_matrices(matrices.data(), results.data(), count);
+					break;
+				default:
+					transform_boxes(box, matrices.data(), count, boxes, 0);
+					break;
+				}
+				const auto nanoseconds = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / count;
+				if (run == 0 || nanoseconds < best)
+					best = nanoseconds;
+			}
+
+			auto error = 0.0f;
+			switch (kernel)
+			{
+			case 0:
+				error = max_difference(&results[0][0][0], &product_reference[0][0][0], count * 16);
+				break;
+			case 1:
+				error = std::max(std::max(max_difference(transformed.x.data(), reference_points.x.data(), count), max_difference(transformed.y.data(), reference_points.y.data(), count)),
+					std::max(max_difference(transformed.z.data(), reference_points.z.data(), count), max_difference(transformed.w.data(), reference_points.w.data(), count)));
+				break;
+			case 2:
+				error = max_difference(&results[0][0][0], &reference[0][0][0], count * 16);
+				break;
+			default:
+				error = std::max(std::max(max_difference(boxes.center_x.data(), reference_boxes.center_x.data(), count), max_difference(boxes.center_y.data(), reference_boxes.center_y.data(), count)),
+					std::max(max_difference(boxes.center_z.data(), reference_boxes.center_z.data(), count), max_difference(boxes.extent_x.data(), reference_boxes.extent_x.data(), count)));
+				error = std::max(error, std::max(max_difference(boxes.extent_y.data(), reference_boxes.extent_y.data(), count), max_difference(boxes.extent_z.data(), reference_boxes.extent_z.data(), count)));
+				break;
+			}
+
+			std::cout << names[kernel] << " " << simd_level_name(static_cast<simd_level>(level)) << " = " << best << " ns, error " << error << std::endl;
+		}
+	}
+	force_simd_level(environment_simd_level());
+}
+
+// a million boxes scattered around the camera culled at each level the CPU runs: the best time of a few
+// runs per box, and how many are visible next to what the scalar variant finds
+void run_cull_benchmark()
+{
+	std::cout << "SIMD level = " << simd_level_name(cpu_simd_level()) << std::endl;
+
+	const uint32_t count = 1 << 20;
+	const auto runs = 5;
+	cull_set boxes;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		const auto t = static_cast<float>(i);
+		const glm::vec3 center(std::sin(t * 0.7f) * 100.0f, std::cos(t * 1.3f) * 20.0f, std::sin(t * 0.11f) * 100.0f);
+		const auto extent = glm::vec3(1.0f + std::fmod(t * 0.013f, 3.0f));
+		add_cull_bounds(boxes, object_bounds{ center - extent, center + extent, center, glm::length(extent) });
+	}
+	const auto view_frustum = extract_frustum(glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 100.0f) * glm::lookAt(glm::vec3(0.0f, 5.0f, 10.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f)));
+
+	std::vector<uint32_t> reference(count), visible(count);
+	const auto reference_count = cull_boxes_scalar(view_frustum, boxes, 0, count, reference.data());
+	for (auto level = 0; level <= cpu_simd_level(); level++)
+	{
+		force_simd_level(static_cast<simd_level>(level));
+		auto best = 0.0;
+		uint32_t visible_count = 0;
+		for (auto run = 0; run < runs; run++)
+		{
+			const auto start = std::chrono::steady_clock::now();
+			visible_count = cull_boxes(view_frustum, boxes, 0, count, visible.data());
+			const auto nanoseconds = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / count;
+			if (run == 0 || nanoseconds < best)
+				best = nanoseconds;
+		}
+
+		const auto same = visible_count == reference_count && std::equal(visible.begin(), visible.begin() + visible_count, reference.begin());
+		std::cout << "cull boxes " << simd_level_name(static_cast<simd_level>(level)) << " = " << best << " ns per box, " << visible_count << " visible, scalar " << reference_count
+			<< (same ? "" : ", FAILED") << std::endl;
+	}
+	force_simd_level(environment_simd_level());
+}
+
+// forces every level the CPU runs in turn and compares what the dispatched kernels give with the scalar
+// variants: culled boxes, expanded texels, rasterized rows, tile depths, mip filtering and CSV separators
+// and numbers exactly, the math kernels within 1e-3, since their sums are ordered differently and fused.
+// Then moves prefab instances and checks the refitted hierarchy against a rebuilt one. false when
+// anything differs
+bool run_kernel_check(const std::pair<std::string, std::string>* file_names_and_textures, const int count)
+{
+	std::cout << "SIMD level = " << simd_level_name(cpu_simd_level()) << std::endl;
+
+	unsigned int state = 12345;
+	const auto next = [&state]
+	{
+		state = state * 1664525u + 1013904223u;
+		return state >> 8;
+	};
+	const auto next_float = [&next](const float range) { return (static_cast<float>(next() % 20001) / 10000.0f - 1.0f) * range; };
+
+	const uint32_t box_count = 10007;
+	const auto view_projection = glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 100.0f) * glm::lookAt(glm::vec3(0.0f, 5.0f, 10.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	const auto view_frustum = extract_frustum(view_projection);
+	cull_set boxes;
+	for (uint32_t i = 0; i < box_count; i++)
+	{
+		const glm::vec3 center(next_float(60.0f), next_float(60.0f), next_float(60.0f));
+		const auto extent = glm::vec3(next_float(3.0f), next_float(3.0f), next_float(3.0f)) + 3.0f;
+		add_cull_bounds(boxes, object_bounds{ center - extent, center + extent, center, glm::length(extent) });
+	}
+	std::vector<uint32_t> reference_visible(box_count), visible(box_count);
+	const auto reference_visible_count = cull_boxes_scalar(view_frustum, boxes, 3, box_count, reference_visible.data());
+
+	const size_t texels = 1031;
+	std::vector<unsigned char> rgb(texels * 3), reference_rgba(texels * 4), rgba(texels * 4);
+	for (auto& byte : rgb)
+		byte = static_cast<unsigned char>(next());
+	expand_rgb_to_rgba_scalar(rgb.data(), reference_rgba.data(), texels);
+
+	const auto row_width = 256;
+	const auto rows = 64;
+	std::vector<float> reference_depth(row_width * rows), depth(row_width * rows);
+	std::vector<glm::vec3> row_steps(rows), row_edges(rows);
+	std::vector<float> reference_tiles(row_width / 8), tiles(row_width / 8);
+	for (auto row = 0; row < rows; row++)
+	{
+		row_steps[row] = glm::vec3(next_float(1.0f), next_float(1.0f), next_float(1.0f));
+		row_edges[row] = glm::vec3(next_float(100.0f), next_float(100.0f), next_float(100.0f));
+	}
+	const auto fill_rows = [&](std::vector<float>& target, const bool scalar)
+	{
+		std::fill(target.begin(), target.end(), 1.0f);
+		for (auto row = 0; row < rows; row++)
+		{
+			const auto x0 = row * 3 % 200;
+			const auto x1 = std::min(row_width - 1, x0 + row * 7 % 50);
+			if (scalar)
+				rasterize_row_scalar(&target[row * row_width], x0, x1, row_steps[row], row_edges[row], 0.001f * row, 0.25f);
+			else
+				rasterize_row(&target[row * row_width], x0, x1, row_steps[row], row_edges[row], 0.001f * row, 0.25f);
+		}
+	};
+	fill_rows(reference_depth, true);
+	tile_row_farthest_scalar(reference_depth.data(), row_width, row_width / 8, reference_tiles.data());
+
+	// an odd sized level, so the wide mip variants end in a partial register
+	const auto mip_width = 37, mip_height = 29;
+	const auto mip_horizontal_taps = make_mip_taps(mip_width, mip_width / 2, mip_kaiser);
+	const auto mip_vertical_taps = make_mip_taps(mip_height, mip_height / 2, mip_kaiser);
+	std::vector<float> mip_source(mip_width * mip_height * 4);
+	for (auto& value : mip_source)
+		value = next_float(1.0f);
+	std::vector<float> reference_narrowed(mip_width / 2 * mip_height * 4), narrowed(reference_narrowed.size());
+	std::vector<float> reference_mip(mip_width / 2 * (mip_height / 2) * 4), mip(reference_mip.size());
+	mip_horizontal_scalar(mip_source.data(), mip_width, mip_horizontal_taps, mip_width / 2, 0, mip_height, reference_narrowed.data());
+	mip_vertical_scalar(reference_narrowed.data(), mip_width / 2 * 4, mip_vertical_taps, 0, mip_height / 2, reference_mip.data());
+
+	std::string text(4099, ' ');
+	const char alphabet[] = "0123456789.-; \t\n\re";
+	for (auto& c : text)
+		c = alphabet[next() % (sizeof(alphabet) - 1)];
+	std::vector<uint64_t> reference_bits((text.size() + 63) / 64), bits(reference_bits.size());
+	csv_separators_scalar(text.data(), text.size(), reference_bits.data());
+	std::vector<std::vector<float>> reference_models;
+	for (auto i = 0; i < count; i++)
+	{
+		force_simd_level(simd_scalar);
+		reference_models.push_back(read_csv_file(file_names_and_textures[i].first));
+	}
+
+	const size_t matrix_count = 1001;
+	aligned_vector<glm::mat4> matrices(matrix_count), reference_products(matrix_count), products(matrix_count);
+	for (auto& matrix : matrices)
+		matrix = glm::scale(glm::rotate(glm::translate(glm::mat4(1.0f), glm::vec3(next_float(50.0f), next_float(50.0f), next_float(50.0f))), next_float(3.0f), glm::vec3(0.6f, 0.8f, 0.0f)), glm::vec3(1.0f + next_float(0.5f)));
+	multiply_matrices_scalar(view_projection, matrices.data(), reference_products.data(), matrix_count);
+	aligned_vector<glm::mat4> reference_normals(matrix_count), normals(matrix_count);
+	inverse_transpose_scalar(matrices.data(), reference_normals.data(), matrix_count);
+
+	point_set points, reference_points, transformed;
+	resize_point_set(points, matrix_count);
+	resize_point_set(reference_points, matrix_count);
+	for (size_t i = 0; i < matrix_count; i++)
+	{
+		points.x[i] = next_float(10.0f);
+		points.y[i] = next_float(10.0f);
+		points.z[i] = next_float(10.0f);
+	}
+	transform_points_scalar(view_projection, points.x.data(), points.y.data(), points.z.data(), matrix_count, reference_points.x.data(), reference_points.y.data(), reference_points.z.data(), reference_points.w.data());
+
+	const object_bounds local_box{ glm::vec3(-1.0f, 0.0f, -2.0f), glm::vec3(3.0f, 2.0f, 1.0f), glm::vec3(1.0f, 1.0f, -0.5f), 2.7f };
+	cull_set placed_boxes, reference_placed_boxes;
+	for (auto* set : { &placed_boxes, &reference_placed_boxes })
+	{
+		for (auto* axis : { &set->center_x, &set->center_y, &set->center_z, &set->extent_x, &set->extent_y, &set->extent_z })
+			axis->resize(matrix_count);
+	}
+	transform_boxes_scalar(local_box, matrices.data(), matrix_count, reference_placed_boxes, 0);
+
+	auto failed = false;
+	for (auto level = 0; level <= cpu_simd_level(); level++)
+	{
+		force_simd_level(static_cast<simd_level>(level));
+		const auto report = [&failed, level](const char* kernel, const bool ok)
+		{
+			std::cout << kernel << " " << simd_level_name(static_cast<simd_level>(level)) << " = " << (ok ? "ok" : "FAILED") << std::endl;
+			failed = failed || !ok;
+		};
+
+		const auto visible_count = cull_boxes(view_frustum, boxes, 3, box_count, visible.data());
+		report("cull boxes", visible_count == reference_visible_count && std::equal(visible.begin(), visible.begin() + visible_count, reference_visible.begin()));
+
+		expand_rgb_to_rgba(rgb.data(), rgba.data(), texels);
+		report("expand rgb to rgba", rgba == reference_rgba);
+
+		fill_rows(depth, false);
+		report("rasterize row", depth == reference_depth);
+		tile_row_farthest(depth.data(), row_width, row_width / 8, tiles.data());
+		report("tile row farthest", tiles == reference_tiles);
+
+		mip_horizontal(mip_source.data(), mip_width, mip_horizontal_taps, mip_width / 2, 0, mip_height, narrowed.data());
+		report("mip horizontal", narrowed == reference_narrowed);
+		mip_vertical(reference_narrowed.data(), mip_width / 2 * 4, mip_vertical_taps, 0, mip_height / 2, mip.data());
+		report("mip vertical", mip == reference_mip);
+
+		csv_separators(text.data(), text.size(), bits.data());
+		auto models_equal = bits == reference_bits;
+		for (auto i = 0; i < count; i++)
+			models_equal = models_equal && read_csv_file(file_names_and_textures[i].first) == reference_models[i];
+		report("csv", models_equal);
+
+		multiply_matrices(view_projection, matrices.data(), products.data(), matrix_count);
+		report("multiply", max_difference(&products[0][0][0], &reference_products[0][0][0], matrix_count * 16) < 1e-3f);
+
+		transform_points(view_projection, points, transformed);
+		report("transform points", std::max(std::max(max_difference(transformed.x.data(), reference_points.x.data(), matrix_count), max_difference(transformed.y.data(), reference_points.y.data(), matrix_count)),
+			std::max(max_difference(transformed.z.data(), reference_points.z.data(), matrix_count), max_difference(transformed.w.data(), reference_points.w.data(), matrix_count))) < 1e-3f);
+
+		inverse_transpose_matrices(matrices.data(), normals.data(), matrix_count);
+		report("inverse transpose", max_difference(&normals[0][0][0], &reference_normals[0][0][0], matrix_count * 16) < 1e-3f);
+
+		transform_boxes(local_box, matrices.data(), matrix_count, placed_boxes, 0);
+		auto box_error = 0.0f;
+		const std::pair<const std::vector<float>*, const std::vector<float>*> box_axes[] =
+		{
+			{ &placed_boxes.center_x, &reference_placed_boxes.center_x }, { &placed_boxes.center_y, &reference_placed_boxes.center_y }, { &placed_boxes.center_z, &reference_placed_boxes.center_z },
+			{ &placed_boxes.extent_x, &reference_placed_boxes.extent_x }, { &placed_boxes.extent_y, &reference_placed_boxes.extent_y }, { &placed_boxes.extent_z, &reference_placed_boxes.extent_z }
+		};
+		for (const auto& axis : box_axes)
+			box_error = std::max(box_error, max_difference(axis.first->data(), axis.second->data(), matrix_count));
+		report("transform boxes", box_error < 1e-3f);
+	}
+
+	// every seventh instance moved on its own: each node of the refitted hierarchy still bounds exactly its
+	// instances, the root matches a rebuilt hierarchy's and the hierarchy culls what the flat list does
+	force_simd_level(environment_simd_level());
+	prefab moved{};
+	moved.bounds = object_bounds{ glm::vec3(-1.0f), glm::vec3(1.0f), glm::vec3(0.0f), std::sqrt(3.0f) };
+	resize_prefab_instances(moved, box_count);
+	for (auto& instance : moved.instances)
+		instance = glm::translate(glm::mat4(1.0f), glm::vec3(next_float(60.0f), next_float(60.0f), next_float(60.0f)));
+	place_prefab_instances(moved, 0, box_count);
+	build_bvh(moved.instance_bvh, moved.instance_bounds);
+	for (uint32_t i = 0; i < box_count; i += 7)
+		move_prefab_instance(moved, i, glm::translate(moved.instances[i], glm::vec3(next_float(20.0f), next_float(20.0f), next_float(20.0f))));
+
+	auto refit_ok = true;
+	for (auto node : moved.instance_bvh.nodes)
+	{
+		const auto refitted = node;
+		bvh_fit_node(moved.instance_bvh, moved.instance_bounds, node);
+		refit_ok = refit_ok && node.min == refitted.min && node.max == refitted.max;
+	}
+	bvh rebuilt;
+	build_bvh(rebuilt, moved.instance_bounds);
+	refit_ok = refit_ok && rebuilt.nodes[0].min == moved.instance_bvh.nodes[0].min && rebuilt.nodes[0].max == moved.instance_bvh.nodes[0].max;
+
+	std::vector<uint32_t> tree_visible(box_count), flat_visible(box_count);
+	const auto tree_visible_count = cull_bvh(moved.instance_bvh, moved.instance_bounds, view_frustum, 0, tree_visible.data());
+	const auto flat_visible_count = cull_boxes_scalar(view_frustum, moved.instance_bounds, 0, box_count, flat_visible.data());
+	std::sort(tree_visible.begin(), tree_visible.begin() + tree_visible_count);
+	refit_ok = refit_ok && tree_visible_count == flat_visible_count && std::equal(tree_visible.begin(), tree_visible.begin() + tree_visible_count, flat_visible.begin());
+	std::cout << "bvh refit = " << (refit_ok ? "ok" : "FAILED") << std::endl;
+	failed = failed || !refit_ok;
+
+	return !failed;
+}
+
+// decodes every texture with each decoder built in that takes it, whole and at 1/2, 1/4 and 1/8 of its
+// size, and prints the best time of a few runs of each. Larger synthetic images follow, the texture with
+// the most texels tiled over 2048 and 4096 texels a side, when libjpeg-turbo is there to encode them
+void run_decode_benchmark(const std::pair<std::string, std::string>* file_names_and_textures, const int count)
+{
+	std::vector<std::pair<std::string, std::vector<unsigned char>>> files;
+	for (auto i = 0; i < count; i++)
+	{
+		if (!file_names_and_textures[i].second.empty())
+			files.emplace_back(file_names_and_textures[i].second, read_file(file_names_and_textures[i].second));
+	}
+
+#ifdef USE_LIBJPEG_TURBO
+	image_info largest{ 0, 0, 0 };
+	unsigned char* source = nullptr;
+	for (const auto& file : files)
+	{
+		image_info info;
+		if (read_image_info(file.second.data(), file.second.size(), 0, info) && info.width * info.height > largest.width * largest.height)
+		{
+			stbi_image_free(source);
+			source = decode_image(file.second.data(), file.second.size(), 0, 3, largest);
+		}
+	}
+
+	const int synthetic_sizes[] = { 2048, 4096 };
+	for (const auto size : synthetic_sizes)
+	{
+		if (source == nullptr)
+			break;
+
+		std::vector<unsigned char> tiled(static_cast<size_t>(size) * size * 3);
+		for (auto y = 0; y < size; y++)
+		{
+			for (auto x = 0; x < size; x++)
+				std::copy_n(source + (static_cast<size_t>(y % largest.height) * largest.width + x % largest.width) * 3, 3, &tiled[(static_cast<size_t>(y) * size + x) * 3]);
+		}
+		files.emplace_back("synthetic " + std::to_string(size), encode_jpeg(tiled.data(), size, size, 3, 90));
+	}
+	stbi_image_free(source);
+#else
+	std::cout << "Synthetic images need USE_LIBJPEG_TURBO to encode them" << std::endl;
+#endif
+
+	const auto runs = 5;
+	for (const auto& file : files)
+	{
+		const auto* const data = file.second.data();
+		const auto size = file.second.size();
+		image_info info;
+		if (!read_image_info(data, size, 0, info))
+		{
+			std::cout << "Failed to load texture" << std::endl;
+			continue;
+		}
+
+		std::cout << file.first << " = " << info.width << "x" << info.height << std::endl;
+		for (const auto* decoder : image_decoders())
+		{
+			if (!decoder->accepts(data, size))
+				continue;
+
+			std::cout << "  " << decoder->name << ":";
+			for (auto scale = 0; scale <= 3; scale++)
+			{
+				auto best = 0.0;
+				for (auto run = 0; run < runs; run++)
+				{
+					image_info decoded;
+					const auto start = std::chrono::steady_clock::now();
+					auto* const pixels = decoder->decode(data, size, scale, upload_channels(info.channels), decoded);
+					const auto milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+					stbi_image_free(pixels);
+					if (run == 0 || milliseconds < best)
+						best = milliseconds;
+				}
+				std::cout << " 1/" << (1 << scale) << " = " << best << " ms";
+			}
+			std::cout << std::endl;
+		}
+	}
+}
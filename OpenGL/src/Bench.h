@@ -0,0 +1,12 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <string>
+#include <utility>
+
+// the modes that measure or check parts of the renderer and exit without opening a window, chosen by
+// argv[1]: --bench-jobs, --bench-math, --bench-cull, --bench-decode and --check-kernels. Returns the
+// exit status of the mode, -1 when argv names none of them and the renderer runs
+int run_bench_mode(int argc, char** argv, const std::pair<std::string, std::string>* file_names_and_textures, int count);
+
+#endif
@@ -1,11 +1,28 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// per-frame and per-object data, both bound from the stream buffer
+layout (std140) uniform FrameData
+{
+	mat4 projection;
+	mat4 view;
+	vec4 lightPos;
+	vec4 viewPos;
+	vec4 lightColor;
+	float specularStrength;
+} frame;
+
+layout (std140) uniform ObjectData
+{
+	mat4 model;
+	bool drawTexture;
+	bool useTextureArray;
+	int textureLayer;
+	bool instanced;
+	bool virtualTexture;
+} object;
 
 void main()
 {
-	gl_Position = projection * view * model * vec4(aPos, 1.0);
+	gl_Position = frame.projection * frame.view * object.model * vec4(aPos, 1.0);
 }
@@ -6,37 +6,79 @@ in vec3 FragPos;
 in vec3 ObjColor;  
 in vec2 TextCoord;
 
-uniform vec3 lightPos; 
-uniform vec3 viewPos; 
-uniform vec3 lightColor;
-uniform float specularStrength;
+// per-frame and per-object data, both bound from the stream buffer
+layout (std140) uniform FrameData
+{
+    mat4 projection;
+    mat4 view;
+    vec4 lightPos;
+    vec4 viewPos;
+    vec4 lightColor;
+    float specularStrength;
+} frame;
+
+layout (std140) uniform ObjectData
+{
+    mat4 model;
+    bool drawTexture;
+    bool useTextureArray;
+    int textureLayer;
+    bool instanced;
+    bool virtualTexture;
+} object;
 
-uniform bool drawTexture;
 uniform sampler2D ourTexture;
+uniform sampler2DArray ourTextureArray;
+
+// the virtual texture: its page cache, its page table with a level per page level, and
+// (pages a side at level 0, texels a side of a page, levels, texels a side of a cached page)
+uniform sampler2D virtualPages;
+uniform sampler2D virtualTable;
+uniform vec4 virtualInfo;
+
+vec4 virtualTexture(vec2 uv)
+{
+    // the level texture() would pick, whole levels only since a page holds a single one
+    vec2 texels = uv * virtualInfo.x * virtualInfo.y;
+    vec2 dx = dFdx(texels), dy = dFdy(texels);
+    float level = clamp(floor(0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1.0))), 0.0, virtualInfo.z - 1.0);
+
+    // the table names the slot of the page or of the coarser page standing in for it
+    vec2 wrapped = fract(uv);
+    vec2 pages = vec2(max(virtualInfo.x / exp2(level), 1.0));
+    vec4 entry = floor(texelFetch(virtualTable, ivec2(min(floor(wrapped * pages), pages - 1.0)), int(level)) * 255.0 + 0.5);
+    vec2 inPage = fract(wrapped * max(virtualInfo.x / exp2(entry.z), 1.0));
+    vec2 texel = entry.xy * virtualInfo.w + 0.5 * (virtualInfo.w - virtualInfo.y) + inPage * virtualInfo.y;
+    return textureLod(virtualPages, texel / vec2(textureSize(virtualPages, 0)), 0.0);
+}
 
 void main()
 {
     // ambient
     float ambientStrength = 0.1;
-    vec3 ambient = ambientStrength * lightColor;
+    vec3 ambient = ambientStrength * frame.lightColor.rgb;
     vec3 objectColor = ObjColor;
 
     // diffuse 
     vec3 norm = normalize(Normal);
-    vec3 lightDir = normalize(lightPos - FragPos);
+    vec3 lightDir = normalize(frame.lightPos.xyz - FragPos);
     float diff = max(dot(norm, lightDir), 0.0);
-    vec3 diffuse = diff * lightColor;
+    vec3 diffuse = diff * frame.lightColor.rgb;
 
     // specular
     // float specularStrength = 0.5;
-    vec3 viewDir = normalize(viewPos - FragPos);
+    vec3 viewDir = normalize(frame.viewPos.xyz - FragPos);
     vec3 reflectDir = reflect(-lightDir, norm);  
     float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32);
-    vec3 specular = specularStrength * spec * lightColor;  
+    vec3 specular = frame.specularStrength * spec * frame.lightColor.rgb;  
         
     vec3 result = (ambient + diffuse + specular) * objectColor;
 
-    if(drawTexture)
+    if(object.virtualTexture)
+        FragColor = virtualTexture(TextCoord) * vec4(result, 1.0);
+    else if(object.drawTexture && object.useTextureArray)
+        FragColor = texture(ourTextureArray, vec3(TextCoord, object.textureLayer)) * vec4(result, 1.0);
+    else if(object.drawTexture)
         FragColor = texture(ourTexture, TextCoord) * vec4(result, 1.0);
     else
         FragColor = vec4(result, 1.0);
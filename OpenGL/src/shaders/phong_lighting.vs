@@ -3,21 +3,40 @@ layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec3 aColor;
 layout (location = 3) in vec2 aTextureCoord;
+layout (location = 4) in mat4 aInstanceModel;
 
 out vec3 FragPos;
 out vec3 Normal;
 out vec3 ObjColor;
 out vec2 TextCoord;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// per-frame and per-object data, both bound from the stream buffer
+layout (std140) uniform FrameData
+{
+    mat4 projection;
+    mat4 view;
+    vec4 lightPos;
+    vec4 viewPos;
+    vec4 lightColor;
+    float specularStrength;
+} frame;
+
+layout (std140) uniform ObjectData
+{
+    mat4 model;
+    bool drawTexture;
+    bool useTextureArray;
+    int textureLayer;
+    bool instanced;
+    bool virtualTexture;
+} object;
 
 void main()
 {
-    FragPos = vec3(model * vec4(aPos, 1.0));
-    Normal = mat3(transpose(inverse(model))) * aNormal;  
+    mat4 world = object.instanced ? aInstanceModel * object.model : object.model;
+    FragPos = vec3(world * vec4(aPos, 1.0));
+    Normal = mat3(transpose(inverse(world))) * aNormal;  
     ObjColor = aColor;
     TextCoord = aTextureCoord;
-    gl_Position = projection * view * vec4(FragPos, 1.0);
+    gl_Position = frame.projection * frame.view * vec4(FragPos, 1.0);
 }
\ No newline at end of file
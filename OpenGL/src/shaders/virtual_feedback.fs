@@ -0,0 +1,37 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 TextCoord;
+
+layout (std140) uniform ObjectData
+{
+    mat4 model;
+    bool drawTexture;
+    bool useTextureArray;
+    int textureLayer;
+    bool instanced;
+    bool virtualTexture;
+} object;
+
+// same as in phong_lighting.fs
+uniform vec4 virtualInfo;
+// log2 of how many times smaller than the window the feedback target is a side
+uniform float feedbackBias;
+
+// the virtual texture page each pixel samples as (x, y, level), alpha 0 where none is
+void main()
+{
+    if(!object.virtualTexture)
+    {
+        FragColor = vec4(0.0);
+        return;
+    }
+
+    vec2 texels = TextCoord * virtualInfo.x * virtualInfo.y;
+    vec2 dx = dFdx(texels), dy = dFdy(texels);
+    float level = clamp(floor(0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1.0)) - feedbackBias), 0.0, virtualInfo.z - 1.0);
+
+    vec2 pages = vec2(max(virtualInfo.x / exp2(level), 1.0));
+    vec2 page = min(floor(fract(TextCoord) * pages), pages - 1.0);
+    FragColor = vec4(page, level, 255.0) / 255.0;
+}